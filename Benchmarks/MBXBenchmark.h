@@ -0,0 +1,146 @@
+//
+//  MBXBenchmark.h
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#ifndef MBXBenchmark_h
+#define MBXBenchmark_h
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark - Stand-ins for the Apple headers used by the extracted C code
+
+// The C parts of the library only need a few things from Foundation and CoreLocation, which are defined here the same
+// way so that the code copied out of the .m files compiles unchanged on any platform
+//
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef double CLLocationDegrees;
+
+typedef long NSInteger;
+typedef unsigned long NSUInteger;
+typedef double NSTimeInterval;
+#define NS_ENUM(_type, _name) enum _name _name; enum _name
+
+typedef unsigned char Boolean;
+typedef unsigned long CFHashCode;
+typedef const void *CFTypeRef;
+
+#if defined(__APPLE__)
+#include <libkern/OSByteOrder.h>
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define OSSwapLittleToHostInt64(x) ((uint64_t)(x))
+#define OSSwapLittleToHostInt32(x) ((uint32_t)(x))
+#define OSSwapHostToLittleInt64(x) ((uint64_t)(x))
+#define OSSwapHostToLittleInt32(x) ((uint32_t)(x))
+#else
+#define OSSwapLittleToHostInt64(x) __builtin_bswap64(x)
+#define OSSwapLittleToHostInt32(x) __builtin_bswap32(x)
+#define OSSwapHostToLittleInt64(x) __builtin_bswap64(x)
+#define OSSwapHostToLittleInt32(x) __builtin_bswap32(x)
+#endif
+
+#pragma mark - Options
+
+typedef struct {
+    uint64_t tileCount;
+    uint64_t lookupCount;
+    long maximumZ;
+    uint64_t urlCount;
+    uint64_t seed;
+    uint64_t packTileCount;
+    uint64_t packCount;
+    uint64_t requestCount;
+    uint64_t latencyMilliseconds;
+    uint64_t errorPercent;
+    const char *traceFile;
+} MBXBenchmarkOptions;
+
+#pragma mark - Timing and statistics
+
+// Nanoseconds from a monotonic clock
+//
+uint64_t MBXBenchmarkNow(void);
+
+// A small deterministic random number generator, so that runs with the same seed do the same work
+//
+uint64_t MBXBenchmarkRandom(uint64_t *state);
+
+// Sorts the samples in place and returns the given percentile (0-100) of them
+//
+uint64_t MBXBenchmarkPercentile(uint64_t *samples, size_t count, double percentile);
+
+// Makes a directory for the benchmark's files, which is removed with everything in it when the benchmark exits
+//
+const char *MBXBenchmarkTemporaryDirectory(void);
+
+#pragma mark - Synthetic offline maps
+
+// Tile number index of a synthetic pack, which fills each zoom level in row order before going on to the next one, like
+// a pack for a region which covers the whole world
+//
+void MBXBenchmarkTileAtIndex(uint64_t index, long *z, uint64_t *x, uint64_t *y);
+
+// Writes the contents of a synthetic tile to buffer, which has to hold MBXBenchmarkMaximumTileSize bytes, and returns
+// its length. Some of the tiles are identical, like the tiles of open ocean in a real pack.
+//
+#define MBXBenchmarkMaximumTileSize 1024
+size_t MBXBenchmarkTileData(uint64_t index, uint8_t *buffer);
+
+// Writes synthetic tiles into a new offline map database, with the schema and statements of the downloader, in batches
+// which are committed the same way as a download job's
+//
+typedef struct MBXBenchmarkPackWriter MBXBenchmarkPackWriter;
+
+MBXBenchmarkPackWriter *MBXBenchmarkPackWriterCreate(const char *path, uint64_t batchCount, uint64_t batchBytes);
+bool MBXBenchmarkPackWriterAddTile(MBXBenchmarkPackWriter *writer, long z, uint64_t x, uint64_t y, const uint8_t *data, size_t length);
+uint64_t MBXBenchmarkPackWriterCommitCount(const MBXBenchmarkPackWriter *writer);
+bool MBXBenchmarkPackWriterFinish(MBXBenchmarkPackWriter *writer, long maximumZ);
+
+// Writes a pack with the first tileCount synthetic tiles
+//
+bool MBXBenchmarkCreatePack(const char *path, uint64_t tileCount);
+
+// Writes one tile into an existing pack over a connection and transaction of its own, the way the downloader saved
+// each file before it batched its commits
+//
+bool MBXBenchmarkPackWriteTile(const char *path, long z, uint64_t x, uint64_t y, const uint8_t *data, size_t length);
+
+#pragma mark - JSON output
+
+// Results are printed as one JSON object, with an object for each benchmark holding its measurements
+//
+void MBXBenchmarkBeginObject(const char *name);
+void MBXBenchmarkEndObject(void);
+void MBXBenchmarkWriteInteger(const char *name, uint64_t value);
+void MBXBenchmarkWriteDouble(const char *name, double value);
+void MBXBenchmarkWriteBool(const char *name, bool value);
+
+#pragma mark - Benchmarks
+
+// Each benchmark checks its results as it goes, and returns false if any of them were wrong
+//
+bool MBXBenchmarkCoverage(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkArchive(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkURLTemplate(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkDatabase(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkJobCreation(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkCatalog(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkTileCache(const MBXBenchmarkOptions *options);
+bool MBXBenchmarkServer(const MBXBenchmarkOptions *options);
+
+#endif
@@ -0,0 +1,160 @@
+//
+//  MBXBenchmarkArchive.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include "MBXOfflineMapArchiveCore.inc"
+
+#pragma mark - Synthetic archives
+
+// A synthetic archive has the tiles of a synthetic pack, and each tile's offset is its number, so lookups can be checked
+//
+static uint8_t *MBXBenchmarkArchiveCreateDirectory(uint64_t tileCount, bool *keysValid)
+{
+    MBXOfflineMapArchiveEntry *entries = malloc(tileCount * sizeof(MBXOfflineMapArchiveEntry));
+    uint8_t *directory = malloc(tileCount * MBXOfflineMapArchiveEntrySize);
+    if (!entries || !directory)
+    {
+        free(entries);
+        free(directory);
+        return NULL;
+    }
+
+    // Every key has to fall within its zoom level's part of the key space, since the levels are stored one after another
+    //
+    *keysValid = true;
+    for (uint64_t i = 0; i < tileCount; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkTileAtIndex(i, &z, &x, &y);
+        uint64_t key = MBXOfflineMapArchiveTileKey(z, x, y);
+        uint64_t first = (((uint64_t)1 << (2 * z)) - 1) / 3;
+        if (key < first || key >= first + ((uint64_t)1 << (2 * z))) *keysValid = false;
+
+        entries[i] = (MBXOfflineMapArchiveEntry){ key, i, 1, (int64_t)i };
+    }
+    qsort(entries, tileCount, sizeof(MBXOfflineMapArchiveEntry), MBXOfflineMapArchiveCompareEntries);
+
+    // The Hilbert curve visits each tile of a zoom level exactly once, so no two tiles can have the same key
+    //
+    for (uint64_t i = 0; i < tileCount; i++)
+    {
+        if (i > 0 && entries[i].key == entries[i - 1].key) *keysValid = false;
+
+        uint8_t *entry = directory + i * MBXOfflineMapArchiveEntrySize;
+        MBXOfflineMapArchiveWriteUInt64(entry, entries[i].key);
+        MBXOfflineMapArchiveWriteUInt64(entry + 8, entries[i].offset);
+        MBXOfflineMapArchiveWriteUInt32(entry + 16, entries[i].length);
+        MBXOfflineMapArchiveWriteUInt32(entry + 20, 0);
+    }
+    free(entries);
+
+    return directory;
+}
+
+
+// Lookups for UINT64_MAX are for tiles from the zoom level above the archive, which aren't in it
+//
+static void MBXBenchmarkArchiveLookupTile(uint64_t index, uint64_t lookup, long lastZ, long *z, uint64_t *x, uint64_t *y)
+{
+    if (index != UINT64_MAX)
+    {
+        MBXBenchmarkTileAtIndex(index, z, x, y);
+        return;
+    }
+    *z = lastZ + 1;
+    *x = lookup % ((uint64_t)1 << *z);
+    *y = (lookup / 7) % ((uint64_t)1 << *z);
+}
+
+
+static volatile uintptr_t MBXBenchmarkArchiveSink;
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkArchive(const MBXBenchmarkOptions *options)
+{
+    uint64_t tileCount = options->tileCount;
+    MBXBenchmarkBeginObject("archive_index");
+    MBXBenchmarkWriteInteger("tiles", tileCount);
+
+    bool keysValid = false;
+    uint64_t buildStart = MBXBenchmarkNow();
+    uint8_t *directory = MBXBenchmarkArchiveCreateDirectory(tileCount, &keysValid);
+    uint64_t buildNanoseconds = MBXBenchmarkNow() - buildStart;
+    if (!directory)
+    {
+        MBXBenchmarkWriteBool("passed", false);
+        MBXBenchmarkEndObject();
+        return false;
+    }
+
+    long lastZ;
+    uint64_t lastX, lastY;
+    MBXBenchmarkTileAtIndex(tileCount - 1, &lastZ, &lastX, &lastY);
+
+    MBXBenchmarkWriteInteger("maximum_zoom", (uint64_t)lastZ);
+    MBXBenchmarkWriteDouble("build_ms", (double)buildNanoseconds / 1e6);
+    MBXBenchmarkWriteDouble("build_tiles_per_second", (double)tileCount / ((double)buildNanoseconds / 1e9));
+    MBXBenchmarkWriteBool("keys_valid", keysValid);
+
+    // One lookup in ten is for a tile which isn't in the archive. Each lookup is timed on its own for the percentiles,
+    // and all of them together for the throughput, which leaves out the clock's overhead.
+    //
+    uint64_t lookupCount = options->lookupCount;
+    uint64_t *samples = malloc(MAX(lookupCount, (uint64_t)1) * sizeof(uint64_t));
+    uint64_t *indexes = malloc(MAX(lookupCount, (uint64_t)1) * sizeof(uint64_t));
+    uint64_t state = options->seed;
+    for (uint64_t i = 0; i < lookupCount; i++)
+    {
+        indexes[i] = (i % 10 == 9 ? UINT64_MAX : MBXBenchmarkRandom(&state) % tileCount);
+    }
+
+    uint64_t wrongResults = 0;
+    for (uint64_t i = 0; i < lookupCount; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkArchiveLookupTile(indexes[i], i, lastZ, &z, &x, &y);
+
+        uint64_t start = MBXBenchmarkNow();
+        const uint8_t *entry = MBXOfflineMapArchiveFindEntry(directory, tileCount, MBXOfflineMapArchiveTileKey(z, x, y));
+        samples[i] = MBXBenchmarkNow() - start;
+
+        bool found = (entry != NULL);
+        if (found != (indexes[i] != UINT64_MAX) || (found && MBXOfflineMapArchiveReadUInt64(entry + 8) != indexes[i])) wrongResults++;
+    }
+
+    uint64_t batchStart = MBXBenchmarkNow();
+    for (uint64_t i = 0; i < lookupCount; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkArchiveLookupTile(indexes[i], i, lastZ, &z, &x, &y);
+        MBXBenchmarkArchiveSink = (uintptr_t)MBXOfflineMapArchiveFindEntry(directory, tileCount, MBXOfflineMapArchiveTileKey(z, x, y));
+    }
+    uint64_t batchNanoseconds = MBXBenchmarkNow() - batchStart;
+
+    MBXBenchmarkBeginObject("lookups");
+    MBXBenchmarkWriteInteger("count", lookupCount);
+    MBXBenchmarkWriteInteger("p50_ns", MBXBenchmarkPercentile(samples, lookupCount, 50.0));
+    MBXBenchmarkWriteInteger("p99_ns", MBXBenchmarkPercentile(samples, lookupCount, 99.0));
+    MBXBenchmarkWriteDouble("lookups_per_second", (double)lookupCount / ((double)batchNanoseconds / 1e9));
+    MBXBenchmarkWriteInteger("wrong_results", wrongResults);
+    MBXBenchmarkEndObject();
+
+    free(samples);
+    free(indexes);
+    free(directory);
+
+    bool success = keysValid && wrongResults == 0;
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
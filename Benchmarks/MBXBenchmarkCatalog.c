@@ -0,0 +1,408 @@
+//
+//  MBXBenchmarkCatalog.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#define _XOPEN_SOURCE 700
+
+#include "MBXBenchmark.h"
+
+#include <dirent.h>
+#include <sqlite3.h>
+#include <sys/stat.h>
+
+#include "MBXOfflineMapDownloaderCore.inc"
+
+#pragma mark - Catalog entries
+
+// What MBXOfflineMapDownloader keeps in the catalog for each completed offline map. The library writes the catalog as a
+// binary property list with NSPropertyListSerialization, which is only on Apple platforms, so the benchmark's catalog is
+// the same entries as tab separated text, one line per offline map.
+//
+#define MBXBenchmarkCatalogMaximumMetadata 16
+
+typedef struct {
+    char name[32];
+    char value[64];
+} MBXBenchmarkCatalogMetadata;
+
+typedef struct {
+    char file[64];
+    uint64_t fileSize;
+    int64_t modificationTime;
+    uint64_t tileCount;
+    size_t metadataCount;
+    MBXBenchmarkCatalogMetadata metadata[MBXBenchmarkCatalogMaximumMetadata];
+    bool loadedFromCatalog;
+} MBXBenchmarkCatalogEntry;
+
+// The metadata which -[MBXOfflineMapDatabase initWithContentsOfFile:catalogEntry:] reads, in the order it reads them
+//
+static const char *const MBXBenchmarkCatalogMetadataNames[] = {
+    "uniqueID", "mapID", "includesMetadata", "includesMarkers", "imageQuality", "region_latitude", "region_longitude",
+    "region_latitude_delta", "region_longitude_delta", "minimumZ", "maximumZ", "schemaVersion"
+};
+
+static size_t const MBXBenchmarkCatalogMetadataNameCount = sizeof(MBXBenchmarkCatalogMetadataNames) / sizeof(MBXBenchmarkCatalogMetadataNames[0]);
+
+static uint64_t const MBXBenchmarkCatalogTilesPerMap = 100;
+
+
+static const char *MBXBenchmarkCatalogMetadataValue(const MBXBenchmarkCatalogEntry *entry, const char *name)
+{
+    for (size_t i = 0; i < entry->metadataCount; i++)
+    {
+        if (strcmp(entry->metadata[i].name, name) == 0) return entry->metadata[i].value;
+    }
+
+    return NULL;
+}
+
+
+static bool MBXBenchmarkCatalogAddMetadata(MBXBenchmarkCatalogEntry *entry, const char *name, const char *value)
+{
+    if (!name || !value || entry->metadataCount >= MBXBenchmarkCatalogMaximumMetadata) return false;
+
+    MBXBenchmarkCatalogMetadata *metadata = &entry->metadata[entry->metadataCount++];
+    snprintf(metadata->name, sizeof(metadata->name), "%s", name);
+    snprintf(metadata->value, sizeof(metadata->value), "%s", value);
+    return true;
+}
+
+
+// The same test as -[MBXOfflineMapDatabase initWithContentsOfFile:catalogEntry:] uses for a valid offline map
+//
+static bool MBXBenchmarkCatalogEntryIsValid(const MBXBenchmarkCatalogEntry *entry)
+{
+    for (size_t i = 1; i < MBXBenchmarkCatalogMetadataNameCount - 1; i++)
+    {
+        if (!MBXBenchmarkCatalogMetadataValue(entry, MBXBenchmarkCatalogMetadataNames[i])) return false;
+    }
+
+    return true;
+}
+
+
+static int MBXBenchmarkCatalogCompareEntries(const void *a, const void *b)
+{
+    return strcmp(((const MBXBenchmarkCatalogEntry *)a)->file, ((const MBXBenchmarkCatalogEntry *)b)->file);
+}
+
+
+#pragma mark - Reading databases
+
+typedef enum {
+    MBXBenchmarkCatalogModeQueryPerName,
+    MBXBenchmarkCatalogModeMetadataQuery,
+    MBXBenchmarkCatalogModeCatalog
+} MBXBenchmarkCatalogMode;
+
+
+// Opens a connection the same way as -[MBXOfflineMapDatabase sqliteOpenConnection]
+//
+static sqlite3 *MBXBenchmarkCatalogOpenDatabase(const char *path)
+{
+    sqlite3 *db;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL))
+    {
+        fprintf(stderr, "Can't open database %s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_exec(db, "PRAGMA mmap_size=0; PRAGMA cache_size=-2048;", NULL, NULL, NULL);
+
+    return db;
+}
+
+
+// Reads an offline map's metadata from its database. Before the catalog, MBXOfflineMapDatabase opened the database and
+// ran a query for every name; now it reads the whole metadata table over one connection when there's no catalog entry.
+//
+static bool MBXBenchmarkCatalogReadDatabase(const char *path, MBXBenchmarkCatalogMode mode, MBXBenchmarkCatalogEntry *entry)
+{
+    bool success = true;
+    if (mode == MBXBenchmarkCatalogModeQueryPerName)
+    {
+        for (size_t i = 0; i < MBXBenchmarkCatalogMetadataNameCount && success; i++)
+        {
+            sqlite3 *db = MBXBenchmarkCatalogOpenDatabase(path);
+            sqlite3_stmt *ppStmt = NULL;
+            char query[128];
+            snprintf(query, sizeof(query), "SELECT value FROM metadata WHERE name='%s';", MBXBenchmarkCatalogMetadataNames[i]);
+            success = (db && sqlite3_prepare_v2(db, query, -1, &ppStmt, NULL) == SQLITE_OK);
+            if (success && sqlite3_step(ppStmt) == SQLITE_ROW)
+            {
+                success = MBXBenchmarkCatalogAddMetadata(entry, MBXBenchmarkCatalogMetadataNames[i], (const char *)sqlite3_column_text(ppStmt, 0));
+            }
+            sqlite3_finalize(ppStmt);
+            sqlite3_close(db);
+        }
+    }
+    else
+    {
+        sqlite3 *db = MBXBenchmarkCatalogOpenDatabase(path);
+        sqlite3_stmt *ppStmt = NULL;
+        success = (db && sqlite3_prepare_v2(db, "SELECT name, value FROM metadata;", -1, &ppStmt, NULL) == SQLITE_OK);
+        int rc = SQLITE_DONE;
+        while (success && (rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+        {
+            success = MBXBenchmarkCatalogAddMetadata(entry, (const char *)sqlite3_column_text(ppStmt, 0), (const char *)sqlite3_column_text(ppStmt, 1));
+        }
+        success = success && rc == SQLITE_DONE;
+        sqlite3_finalize(ppStmt);
+        sqlite3_close(db);
+    }
+
+    return success && MBXBenchmarkCatalogEntryIsValid(entry);
+}
+
+
+// Counts the tiles of an offline map like -[MBXOfflineMapDatabase sqliteTileCount], which the downloader does for each
+// offline map it adds to the catalog
+//
+static bool MBXBenchmarkCatalogCountTiles(const char *path, MBXBenchmarkCatalogEntry *entry)
+{
+    sqlite3 *db = MBXBenchmarkCatalogOpenDatabase(path);
+    sqlite3_stmt *ppStmt = NULL;
+    bool success = (db
+                    && sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM tiles;", -1, &ppStmt, NULL) == SQLITE_OK
+                    && sqlite3_step(ppStmt) == SQLITE_ROW);
+    if (success) entry->tileCount = (uint64_t)sqlite3_column_int64(ppStmt, 0);
+    sqlite3_finalize(ppStmt);
+    sqlite3_close(db);
+
+    return success;
+}
+
+
+#pragma mark - Catalog files
+
+static bool MBXBenchmarkCatalogWrite(const char *directory, const MBXBenchmarkCatalogEntry *entries, size_t count)
+{
+    // Write to a temporary file and rename it over the old catalog, like -[MBXOfflineMapDownloader writeCatalog]
+    //
+    char path[320];
+    char temporaryPath[336];
+    snprintf(path, sizeof(path), "%s/%s", directory, MBXOfflineMapDownloaderCatalogFilename);
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+
+    FILE *file = fopen(temporaryPath, "w");
+    if (!file) return false;
+
+    bool success = (fprintf(file, "version\t%ld\n", (long)MBXOfflineMapDownloaderCatalogVersion) > 0);
+    for (size_t i = 0; i < count && success; i++)
+    {
+        const MBXBenchmarkCatalogEntry *entry = &entries[i];
+        success = (fprintf(file, "%s\t%llu\t%lld\t%llu", entry->file, (unsigned long long)entry->fileSize,
+                           (long long)entry->modificationTime, (unsigned long long)entry->tileCount) > 0);
+        for (size_t m = 0; m < entry->metadataCount && success; m++)
+        {
+            success = (fprintf(file, "\t%s=%s", entry->metadata[m].name, entry->metadata[m].value) > 0);
+        }
+        success = success && fputc('\n', file) != EOF;
+    }
+    success = (fclose(file) == 0) && success;
+
+    return success && rename(temporaryPath, path) == 0;
+}
+
+
+// Reads the catalog's entries, sorted by file name so that they can be looked up like the keys of the catalog's
+// dictionary. A catalog which is missing or from another version has no entries.
+//
+static size_t MBXBenchmarkCatalogRead(const char *directory, MBXBenchmarkCatalogEntry *entries, size_t capacity)
+{
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", directory, MBXOfflineMapDownloaderCatalogFilename);
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+
+    size_t count = 0;
+    char line[4096];
+    long version = 0;
+    if (fgets(line, sizeof(line), file) && sscanf(line, "version\t%ld", &version) == 1 && version == MBXOfflineMapDownloaderCatalogVersion)
+    {
+        while (count < capacity && fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\n")] = '\0';
+            MBXBenchmarkCatalogEntry *entry = &entries[count];
+            memset(entry, 0, sizeof(MBXBenchmarkCatalogEntry));
+
+            char *fields;
+            char *field = strtok_r(line, "\t", &fields);
+            char *fileSize = strtok_r(NULL, "\t", &fields);
+            char *modificationTime = strtok_r(NULL, "\t", &fields);
+            char *tileCount = strtok_r(NULL, "\t", &fields);
+            if (!field || !fileSize || !modificationTime || !tileCount) continue;
+
+            snprintf(entry->file, sizeof(entry->file), "%s", field);
+            entry->fileSize = strtoull(fileSize, NULL, 10);
+            entry->modificationTime = strtoll(modificationTime, NULL, 10);
+            entry->tileCount = strtoull(tileCount, NULL, 10);
+            while ((field = strtok_r(NULL, "\t", &fields)))
+            {
+                char *separator = strchr(field, '=');
+                if (!separator) continue;
+                *separator = '\0';
+                MBXBenchmarkCatalogAddMetadata(entry, field, separator + 1);
+            }
+            count++;
+        }
+    }
+    fclose(file);
+
+    qsort(entries, count, sizeof(MBXBenchmarkCatalogEntry), MBXBenchmarkCatalogCompareEntries);
+    return count;
+}
+
+
+#pragma mark - Startup
+
+// Finds the completed offline maps in the directory and loads each one the way -[MBXOfflineMapDownloader init] does:
+// from its catalog entry when it has one which matches the file's size and modification date, and otherwise from its
+// database. This returns the number of valid offline maps, which are written to maps.
+//
+static size_t MBXBenchmarkCatalogStartup(const char *directory, MBXBenchmarkCatalogMode mode, bool countTiles, MBXBenchmarkCatalogEntry *maps, size_t capacity, size_t *loadedFromCatalog)
+{
+    MBXBenchmarkCatalogEntry *catalogEntries = NULL;
+    size_t catalogCount = 0;
+    if (mode == MBXBenchmarkCatalogModeCatalog)
+    {
+        catalogEntries = malloc(MAX(capacity, (size_t)1) * sizeof(MBXBenchmarkCatalogEntry));
+        if (catalogEntries) catalogCount = MBXBenchmarkCatalogRead(directory, catalogEntries, capacity);
+    }
+
+    size_t count = 0;
+    *loadedFromCatalog = 0;
+    DIR *files = opendir(directory);
+    struct dirent *file;
+    while (files && count < capacity && (file = readdir(files)))
+    {
+        size_t length = strlen(file->d_name);
+        if (length < 9 || strcmp(file->d_name + length - 9, ".complete") != 0) continue;
+
+        char path[320];
+        struct stat attributes;
+        snprintf(path, sizeof(path), "%s/%s", directory, file->d_name);
+        if (stat(path, &attributes) != 0) continue;
+
+        MBXBenchmarkCatalogEntry *map = &maps[count];
+        memset(map, 0, sizeof(MBXBenchmarkCatalogEntry));
+        snprintf(map->file, sizeof(map->file), "%s", file->d_name);
+        map->fileSize = (uint64_t)attributes.st_size;
+        map->modificationTime = (int64_t)attributes.st_mtim.tv_sec * 1000000000LL + attributes.st_mtim.tv_nsec;
+
+        const MBXBenchmarkCatalogEntry *catalogEntry = (catalogCount ? bsearch(map, catalogEntries, catalogCount, sizeof(MBXBenchmarkCatalogEntry), MBXBenchmarkCatalogCompareEntries) : NULL);
+        bool valid;
+        if (catalogEntry && catalogEntry->fileSize == map->fileSize && catalogEntry->modificationTime == map->modificationTime)
+        {
+            *map = *catalogEntry;
+            map->loadedFromCatalog = true;
+            valid = MBXBenchmarkCatalogEntryIsValid(map);
+            (*loadedFromCatalog)++;
+        }
+        else
+        {
+            valid = MBXBenchmarkCatalogReadDatabase(path, mode, map) && (!countTiles || MBXBenchmarkCatalogCountTiles(path, map));
+        }
+        if (valid) count++;
+    }
+    if (files) closedir(files);
+    free(catalogEntries);
+
+    return count;
+}
+
+
+#pragma mark - Benchmark
+
+static bool MBXBenchmarkCatalogCheckMaps(const MBXBenchmarkCatalogEntry *maps, const MBXBenchmarkCatalogEntry *expected, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const MBXBenchmarkCatalogEntry *match = bsearch(&maps[i], expected, count, sizeof(MBXBenchmarkCatalogEntry), MBXBenchmarkCatalogCompareEntries);
+        if (!match) return false;
+        for (size_t n = 0; n < MBXBenchmarkCatalogMetadataNameCount; n++)
+        {
+            const char *value = MBXBenchmarkCatalogMetadataValue(&maps[i], MBXBenchmarkCatalogMetadataNames[n]);
+            const char *expectedValue = MBXBenchmarkCatalogMetadataValue(match, MBXBenchmarkCatalogMetadataNames[n]);
+            if (!value || !expectedValue || strcmp(value, expectedValue) != 0) return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool MBXBenchmarkCatalog(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("offline_map_catalog");
+    MBXBenchmarkWriteInteger("offline_maps", options->packCount);
+    MBXBenchmarkWriteInteger("tiles_per_map", MBXBenchmarkCatalogTilesPerMap);
+
+    char directory[256];
+    bool success = (MBXBenchmarkTemporaryDirectory() != NULL);
+    if (success)
+    {
+        snprintf(directory, sizeof(directory), "%s/catalog", MBXBenchmarkTemporaryDirectory());
+        success = (mkdir(directory, 0700) == 0);
+    }
+    for (uint64_t i = 0; i < options->packCount && success; i++)
+    {
+        char path[320];
+        snprintf(path, sizeof(path), "%s/map-%06llu.complete", directory, (unsigned long long)i);
+        success = MBXBenchmarkCreatePack(path, MBXBenchmarkCatalogTilesPerMap);
+    }
+
+    size_t capacity = (size_t)options->packCount;
+    MBXBenchmarkCatalogEntry *expected = malloc(MAX(capacity, (size_t)1) * sizeof(MBXBenchmarkCatalogEntry));
+    MBXBenchmarkCatalogEntry *maps = malloc(MAX(capacity, (size_t)1) * sizeof(MBXBenchmarkCatalogEntry));
+    success = success && expected && maps;
+
+    // Writing the catalog reads every database and counts its tiles, which the downloader does in the background
+    //
+    size_t loadedFromCatalog = 0;
+    uint64_t start = MBXBenchmarkNow();
+    size_t count = (success ? MBXBenchmarkCatalogStartup(directory, MBXBenchmarkCatalogModeMetadataQuery, true, expected, capacity, &loadedFromCatalog) : 0);
+    success = success && count == capacity && MBXBenchmarkCatalogWrite(directory, expected, count);
+    uint64_t writeNanoseconds = MBXBenchmarkNow() - start;
+    qsort(expected, count, sizeof(MBXBenchmarkCatalogEntry), MBXBenchmarkCatalogCompareEntries);
+    for (size_t i = 0; i < count; i++)
+    {
+        success = success && expected[i].tileCount == MBXBenchmarkCatalogTilesPerMap;
+    }
+    MBXBenchmarkWriteDouble("write_catalog_ms", (double)writeNanoseconds / 1e6);
+
+    // Then time startup with a query for each metadata name like MBXOfflineMapDatabase used to, with one metadata query
+    // for each database like it does without a catalog, and from the catalog
+    //
+    MBXBenchmarkCatalogMode modes[3] = { MBXBenchmarkCatalogModeQueryPerName, MBXBenchmarkCatalogModeMetadataQuery, MBXBenchmarkCatalogModeCatalog };
+    const char *names[3] = { "query_per_name", "metadata_query", "catalog" };
+    uint64_t nanoseconds[3] = { 0, 0, 0 };
+    for (size_t m = 0; m < 3 && success; m++)
+    {
+        start = MBXBenchmarkNow();
+        count = MBXBenchmarkCatalogStartup(directory, modes[m], false, maps, capacity, &loadedFromCatalog);
+        nanoseconds[m] = MBXBenchmarkNow() - start;
+
+        bool startupSuccess = (count == capacity
+                               && loadedFromCatalog == (modes[m] == MBXBenchmarkCatalogModeCatalog ? count : 0)
+                               && MBXBenchmarkCatalogCheckMaps(maps, expected, count));
+        MBXBenchmarkBeginObject(names[m]);
+        MBXBenchmarkWriteDouble("startup_ms", (double)nanoseconds[m] / 1e6);
+        MBXBenchmarkWriteDouble("per_map_us", (double)nanoseconds[m] / 1e3 / (double)MAX(count, (size_t)1));
+        MBXBenchmarkWriteInteger("loaded_from_catalog", loadedFromCatalog);
+        MBXBenchmarkWriteBool("passed", startupSuccess);
+        MBXBenchmarkEndObject();
+        success = success && startupSuccess;
+    }
+    MBXBenchmarkWriteDouble("catalog_speedup", (double)nanoseconds[1] / (double)MAX(nanoseconds[2], (uint64_t)1));
+    free(expected);
+    free(maps);
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
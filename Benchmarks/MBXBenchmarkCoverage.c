@@ -0,0 +1,162 @@
+//
+//  MBXBenchmarkCoverage.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include "MBXTileCoverageCore.inc"
+
+#pragma mark - Rasterizing shapes
+
+// Counts the tiles covered by one ring at a zoom level, the same way as -[MBXTileCoverage enumerateRowsAtZoom:usingBlock:]
+//
+static bool MBXBenchmarkCoverageCountTiles(const MBXTileCoveragePoint *ring, size_t count, long z, uint64_t *tileCount)
+{
+    double minY = INFINITY;
+    double maxY = -INFINITY;
+    for (size_t i = 0; i < count; i++)
+    {
+        minY = MIN(minY, ring[i].y);
+        maxY = MAX(maxY, ring[i].y);
+    }
+
+    long tilesPerSide = 1L << z;
+    long firstRow = MIN(MAX((long)floor(minY * tilesPerSide), 0), tilesPerSide - 1);
+    long lastRow = MAX(MIN((long)ceil(maxY * tilesPerSide) - 1, tilesPerSide - 1), firstRow);
+    MBXTileCoverageRow *rows = calloc((size_t)(lastRow - firstRow + 1), sizeof(MBXTileCoverageRow));
+    if (!rows) return false;
+
+    const MBXTileCoveragePoint *rings[1] = { ring };
+    size_t ringCounts[1] = { count };
+    bool success = MBXTileCoverageRasterizeShape(rings, ringCounts, 1, tilesPerSide, rows, firstRow, lastRow);
+
+    *tileCount = 0;
+    for (long y = firstRow; y <= lastRow; y++)
+    {
+        MBXTileCoverageRow *row = &rows[y - firstRow];
+        if (success) success = MBXTileCoverageNormalizeRow(row, tilesPerSide);
+        for (size_t i = 0; success && i < row->count; i++)
+        {
+            *tileCount += (uint64_t)(row->spans[i].maxX - row->spans[i].minX + 1);
+        }
+        free(row->spans);
+    }
+    free(rows);
+
+    return success;
+}
+
+
+// Counts the tiles of a region directly, the same way as -[MBXTileCoverage enumerateRectangularTileRangesAtZoom:usingBlock:],
+// which the rasterizer has to agree with
+//
+static uint64_t MBXBenchmarkCoverageCountRegionTiles(double minX, double maxX, double minY, double maxY, long z)
+{
+    long tilesPerSide = 1L << z;
+    double scale = (double)tilesPerSide;
+    long firstRow = MIN(MAX((long)floor(minY * scale), 0), tilesPerSide - 1);
+    long lastRow = MAX(MIN((long)ceil(maxY * scale) - 1, tilesPerSide - 1), firstRow);
+    long firstColumn = (long)floor(minX * scale);
+    long width = MIN(MAX(firstColumn, (long)ceil(maxX * scale) - 1) - firstColumn + 1, tilesPerSide);
+    return (uint64_t)width * (uint64_t)(lastRow - firstRow + 1);
+}
+
+
+static void MBXBenchmarkCoverageRegion(double west, double east, double south, double north, MBXTileCoveragePoint ring[4])
+{
+    double minX = (west + 180.0) / 360.0;
+    double maxX = (east + 180.0) / 360.0;
+    double minY = MBXTileCoverageYForLatitude(north);
+    double maxY = MBXTileCoverageYForLatitude(south);
+    ring[0] = (MBXTileCoveragePoint){ minX, minY };
+    ring[1] = (MBXTileCoveragePoint){ maxX, minY };
+    ring[2] = (MBXTileCoveragePoint){ maxX, maxY };
+    ring[3] = (MBXTileCoveragePoint){ minX, maxY };
+}
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkCoverage(const MBXBenchmarkOptions *options)
+{
+    bool success = true;
+    MBXBenchmarkBeginObject("tile_coverage");
+    MBXBenchmarkWriteInteger("maximum_zoom", (uint64_t)options->maximumZ);
+
+    // The time to count the tiles of a large irregular shape is what creating an offline map job for it costs. A star
+    // with many points has lots of edges active in each row, and crosses the antimeridian.
+    //
+    size_t pointCount = 1024;
+    MBXTileCoveragePoint *star = malloc(pointCount * sizeof(MBXTileCoveragePoint));
+    for (size_t i = 0; i < pointCount; i++)
+    {
+        double angle = 2.0 * M_PI * (double)i / (double)pointCount;
+        double radius = (i % 2 ? 30.0 : 12.0);
+        double longitude = 180.0 + radius * 1.5 * cos(angle);
+        double latitude = 20.0 + radius * sin(angle);
+        star[i] = (MBXTileCoveragePoint){ (longitude + 180.0) / 360.0, MBXTileCoverageYForLatitude(latitude) };
+    }
+
+    uint64_t shapeTiles = 0;
+    uint64_t shapeStart = MBXBenchmarkNow();
+    uint64_t maximumZoomNanoseconds = 0;
+    for (long z = 0; z <= options->maximumZ && success; z++)
+    {
+        uint64_t tiles = 0;
+        uint64_t start = MBXBenchmarkNow();
+        success = MBXBenchmarkCoverageCountTiles(star, pointCount, z, &tiles);
+        maximumZoomNanoseconds = MBXBenchmarkNow() - start;
+        shapeTiles += tiles;
+    }
+    free(star);
+
+    MBXBenchmarkBeginObject("irregular_shape");
+    MBXBenchmarkWriteInteger("points", pointCount);
+    MBXBenchmarkWriteInteger("tiles", shapeTiles);
+    MBXBenchmarkWriteDouble("total_ms", (double)(MBXBenchmarkNow() - shapeStart) / 1e6);
+    MBXBenchmarkWriteDouble("maximum_zoom_ms", (double)maximumZoomNanoseconds / 1e6);
+    MBXBenchmarkEndObject();
+
+    // Random regions, some of which cross the antimeridian, have to come out of the rasterizer with exactly the tiles
+    // which the closed form for regions gives
+    //
+    uint64_t state = options->seed;
+    uint64_t regionCount = 2000;
+    uint64_t mismatches = 0;
+    uint64_t regionTiles = 0;
+    uint64_t regionStart = MBXBenchmarkNow();
+    long regionMaximumZ = MIN(options->maximumZ, 12);
+    for (uint64_t i = 0; i < regionCount && success; i++)
+    {
+        double west = (double)(MBXBenchmarkRandom(&state) % 360000) / 1000.0 - 180.0;
+        double width = (double)(MBXBenchmarkRandom(&state) % 60000) / 1000.0 + 0.001;
+        double south = (double)(MBXBenchmarkRandom(&state) % 160000) / 1000.0 - 80.0;
+        double height = (double)(MBXBenchmarkRandom(&state) % 40000) / 1000.0 + 0.001;
+
+        MBXTileCoveragePoint ring[4];
+        MBXBenchmarkCoverageRegion(west, west + width, south, MIN(south + height, 85.0), ring);
+        for (long z = 0; z <= regionMaximumZ && success; z++)
+        {
+            uint64_t tiles = 0;
+            success = MBXBenchmarkCoverageCountTiles(ring, 4, z, &tiles);
+            if (tiles != MBXBenchmarkCoverageCountRegionTiles(ring[0].x, ring[1].x, ring[0].y, ring[2].y, z)) mismatches++;
+            regionTiles += tiles;
+        }
+    }
+
+    MBXBenchmarkBeginObject("random_regions");
+    MBXBenchmarkWriteInteger("regions", regionCount);
+    MBXBenchmarkWriteInteger("maximum_zoom", (uint64_t)regionMaximumZ);
+    MBXBenchmarkWriteInteger("tiles", regionTiles);
+    MBXBenchmarkWriteDouble("total_ms", (double)(MBXBenchmarkNow() - regionStart) / 1e6);
+    MBXBenchmarkWriteInteger("mismatches", mismatches);
+    MBXBenchmarkEndObject();
+
+    success = success && mismatches == 0;
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
@@ -0,0 +1,522 @@
+//
+//  MBXBenchmarkDatabase.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "MBXOfflineMapDatabaseCore.inc"
+#include "MBXOfflineMapDownloaderCore.inc"
+
+#pragma mark - Connection pool
+
+// The read engine of MBXOfflineMapDatabase, from -sqliteCheckOutConnection to -sqliteDataForPath:usingConnection:, with
+// a mutex in place of @synchronized and an array in place of the NSPointerArray of idle connections. The memory map and
+// page cache sizes are the defaults from -initWithContentsOfFile:catalogEntry:.
+//
+typedef struct {
+    const char *path;
+    pthread_mutex_t lock;
+    MBXOfflineMapDatabaseConnection **idleConnections;
+    NSUInteger idleCount;
+    NSUInteger connectionGeneration;
+    NSUInteger memoryMapSize;
+    NSUInteger pageCacheSize;
+    _Atomic uint64_t openedConnections;
+} MBXBenchmarkDatabasePool;
+
+
+static void MBXBenchmarkDatabasePoolInit(MBXBenchmarkDatabasePool *pool, const char *path)
+{
+    memset(pool, 0, sizeof(MBXBenchmarkDatabasePool));
+    pool->path = path;
+    pool->idleConnections = calloc(MBXOfflineMapDatabaseMaximumIdleConnections, sizeof(MBXOfflineMapDatabaseConnection *));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->memoryMapSize = 0;
+    pool->pageCacheSize = 2 * 1024 * 1024;
+}
+
+
+static MBXOfflineMapDatabaseConnection *MBXBenchmarkDatabaseOpenConnection(MBXBenchmarkDatabasePool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    NSUInteger generation = pool->connectionGeneration;
+    pthread_mutex_unlock(&pool->lock);
+
+    sqlite3 *db;
+    if (sqlite3_open_v2(pool->path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL))
+    {
+        fprintf(stderr, "Can't open database %s: %s\n", pool->path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    char pragmas[128];
+    snprintf(pragmas, sizeof(pragmas), "PRAGMA mmap_size=%lu; PRAGMA cache_size=-%lu;", pool->memoryMapSize, pool->pageCacheSize / 1024);
+    sqlite3_exec(db, pragmas, NULL, NULL, NULL);
+
+    MBXOfflineMapDatabaseConnection *connection = calloc(1, sizeof(MBXOfflineMapDatabaseConnection));
+    connection->db = db;
+    connection->generation = generation;
+    atomic_fetch_add(&pool->openedConnections, 1);
+
+    return connection;
+}
+
+
+static void MBXBenchmarkDatabaseCloseConnection(MBXOfflineMapDatabaseConnection *connection)
+{
+    if (!connection) return;
+
+    for (NSUInteger i = 0; i < MBXOfflineMapDatabaseStatementCount; i++)
+    {
+        sqlite3_finalize(connection->statements[i]);
+    }
+    sqlite3_close(connection->db);
+    free(connection);
+}
+
+
+static MBXOfflineMapDatabaseConnection *MBXBenchmarkDatabaseCheckOutConnection(MBXBenchmarkDatabasePool *pool)
+{
+    MBXOfflineMapDatabaseConnection *connection = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->idleCount > 0) connection = pool->idleConnections[--pool->idleCount];
+    pthread_mutex_unlock(&pool->lock);
+
+    return connection ? connection : MBXBenchmarkDatabaseOpenConnection(pool);
+}
+
+
+static void MBXBenchmarkDatabaseCheckInConnection(MBXBenchmarkDatabasePool *pool, MBXOfflineMapDatabaseConnection *connection)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (connection->generation == pool->connectionGeneration && pool->idleCount < MBXOfflineMapDatabaseMaximumIdleConnections)
+    {
+        pool->idleConnections[pool->idleCount++] = connection;
+        connection = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    MBXBenchmarkDatabaseCloseConnection(connection);
+}
+
+
+static void MBXBenchmarkDatabasePoolDestroy(MBXBenchmarkDatabasePool *pool)
+{
+    for (NSUInteger i = 0; i < pool->idleCount; i++)
+    {
+        MBXBenchmarkDatabaseCloseConnection(pool->idleConnections[i]);
+    }
+    pool->idleCount = 0;
+    free(pool->idleConnections);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+static sqlite3_stmt *MBXBenchmarkDatabaseStatement(MBXOfflineMapDatabaseConnection *connection, MBXOfflineMapDatabaseStatement statement)
+{
+    if (!connection->statements[statement]
+        && sqlite3_prepare_v2(connection->db, MBXOfflineMapDatabaseStatementSQL[statement], -1, &connection->statements[statement], NULL))
+    {
+        fprintf(stderr, "Problem preparing sql statement: %s\n", sqlite3_errmsg(connection->db));
+        sqlite3_finalize(connection->statements[statement]);
+        connection->statements[statement] = NULL;
+    }
+
+    return connection->statements[statement];
+}
+
+
+// Copies the tile's blob into buffer the way -sqliteDataForSingleColumnStatement:connection: copies it into an NSData,
+// and returns its length, or -1 if the database doesn't have the tile
+//
+static long MBXBenchmarkDatabaseDataForTile(MBXOfflineMapDatabaseConnection *connection, long z, uint64_t x, uint64_t y, uint8_t *buffer)
+{
+    sqlite3_stmt *ppStmt = MBXBenchmarkDatabaseStatement(connection, MBXOfflineMapDatabaseStatementDataForDeduplicatedTile);
+    if (!ppStmt) return -1;
+
+    sqlite3_bind_int64(ppStmt, 1, z);
+    sqlite3_bind_int64(ppStmt, 2, (sqlite3_int64)x);
+    sqlite3_bind_int64(ppStmt, 3, (sqlite3_int64)((((uint64_t)1 << z) - 1) - y));
+
+    long length = -1;
+    if (sqlite3_step(ppStmt) == SQLITE_ROW && sqlite3_column_type(ppStmt, 0) != SQLITE_NULL)
+    {
+        length = MIN(sqlite3_column_bytes(ppStmt, 0), MBXBenchmarkMaximumTileSize);
+        memcpy(buffer, sqlite3_column_blob(ppStmt, 0), (size_t)length);
+    }
+    sqlite3_reset(ppStmt);
+
+    return length;
+}
+
+
+// One lookup the way -[MBXOfflineMapDatabase dataForPath:withError:] does it, with its own connection check out
+//
+static long MBXBenchmarkDatabaseLookUpTile(MBXBenchmarkDatabasePool *pool, long z, uint64_t x, uint64_t y, uint8_t *buffer)
+{
+    MBXOfflineMapDatabaseConnection *connection = MBXBenchmarkDatabaseCheckOutConnection(pool);
+    if (!connection) return -1;
+
+    long length = MBXBenchmarkDatabaseDataForTile(connection, z, x, y, buffer);
+    MBXBenchmarkDatabaseCheckInConnection(pool, connection);
+
+    return length;
+}
+
+
+// One lookup the way MBXOfflineMapDatabase did it before the pool: open the database, prepare the query, step it, and
+// close everything again. It's here as the baseline for the pooled lookups.
+//
+static long MBXBenchmarkDatabaseLookUpTileUnpooled(const char *path, long z, uint64_t x, uint64_t y, uint8_t *buffer)
+{
+    sqlite3 *db;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL))
+    {
+        fprintf(stderr, "Can't open database %s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+
+    sqlite3_stmt *ppStmt;
+    if (sqlite3_prepare_v2(db, MBXOfflineMapDatabaseStatementSQL[MBXOfflineMapDatabaseStatementDataForDeduplicatedTile], -1, &ppStmt, NULL))
+    {
+        fprintf(stderr, "Problem preparing sql statement: %s\n", sqlite3_errmsg(db));
+        sqlite3_finalize(ppStmt);
+        sqlite3_close(db);
+        return -1;
+    }
+
+    sqlite3_bind_int64(ppStmt, 1, z);
+    sqlite3_bind_int64(ppStmt, 2, (sqlite3_int64)x);
+    sqlite3_bind_int64(ppStmt, 3, (sqlite3_int64)((((uint64_t)1 << z) - 1) - y));
+
+    long length = -1;
+    if (sqlite3_step(ppStmt) == SQLITE_ROW && sqlite3_column_type(ppStmt, 0) != SQLITE_NULL)
+    {
+        length = MIN(sqlite3_column_bytes(ppStmt, 0), MBXBenchmarkMaximumTileSize);
+        memcpy(buffer, sqlite3_column_blob(ppStmt, 0), (size_t)length);
+    }
+
+    sqlite3_finalize(ppStmt);
+    sqlite3_close(db);
+    return length;
+}
+
+
+#pragma mark - Lookups
+
+// Lookups for UINT64_MAX are for tiles from the zoom level above the pack, which aren't in it
+//
+static void MBXBenchmarkDatabaseTileForLookup(uint64_t index, uint64_t lookup, long lastZ, long *z, uint64_t *x, uint64_t *y)
+{
+    if (index != UINT64_MAX)
+    {
+        MBXBenchmarkTileAtIndex(index, z, x, y);
+        return;
+    }
+    *z = lastZ + 1;
+    *x = lookup % ((uint64_t)1 << *z);
+    *y = (lookup / 7) % ((uint64_t)1 << *z);
+}
+
+
+static bool MBXBenchmarkDatabaseCheckTile(uint64_t index, const uint8_t *data, long length)
+{
+    if (index == UINT64_MAX) return (length < 0);
+
+    uint8_t expected[MBXBenchmarkMaximumTileSize];
+    size_t expectedLength = MBXBenchmarkTileData(index, expected);
+    return (length == (long)expectedLength && memcmp(data, expected, expectedLength) == 0);
+}
+
+
+typedef struct {
+    MBXBenchmarkDatabasePool *pool;
+    const uint64_t *indexes;
+    uint64_t first;
+    uint64_t count;
+    long lastZ;
+    uint64_t wrongResults;
+} MBXBenchmarkDatabaseThread;
+
+
+static void *MBXBenchmarkDatabaseRunThread(void *context)
+{
+    MBXBenchmarkDatabaseThread *thread = context;
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    for (uint64_t i = thread->first; i < thread->first + thread->count; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkDatabaseTileForLookup(thread->indexes[i], i, thread->lastZ, &z, &x, &y);
+        long length = MBXBenchmarkDatabaseLookUpTile(thread->pool, z, x, y, data);
+        if (!MBXBenchmarkDatabaseCheckTile(thread->indexes[i], data, length)) thread->wrongResults++;
+    }
+
+    return NULL;
+}
+
+
+static bool MBXBenchmarkDatabasePack(const MBXBenchmarkOptions *options, uint64_t tileCount)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "pack_%llu", (unsigned long long)tileCount);
+    MBXBenchmarkBeginObject(name);
+
+    // Writing the pack goes through the download job's batched commits, so its speed is the speed of the save path
+    //
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.sqlite", MBXBenchmarkTemporaryDirectory(), name);
+    uint64_t writeStart = MBXBenchmarkNow();
+    bool success = MBXBenchmarkCreatePack(path, tileCount);
+    uint64_t writeNanoseconds = MBXBenchmarkNow() - writeStart;
+
+    MBXBenchmarkBeginObject("batched_writes");
+    MBXBenchmarkWriteDouble("total_ms", (double)writeNanoseconds / 1e6);
+    MBXBenchmarkWriteDouble("tiles_per_second", (double)tileCount / ((double)writeNanoseconds / 1e9));
+    MBXBenchmarkEndObject();
+
+    if (!success)
+    {
+        MBXBenchmarkWriteBool("passed", false);
+        MBXBenchmarkEndObject();
+        return false;
+    }
+
+    long lastZ;
+    uint64_t lastX, lastY;
+    MBXBenchmarkTileAtIndex(tileCount - 1, &lastZ, &lastX, &lastY);
+
+    // One lookup in ten is for a tile which isn't in the pack. Each lookup is timed on its own for the percentiles, and
+    // then the same lookups are spread over as many threads as the pool keeps connections for.
+    //
+    uint64_t lookupCount = options->lookupCount;
+    uint64_t *samples = malloc(MAX(lookupCount, (uint64_t)1) * sizeof(uint64_t));
+    uint64_t *indexes = malloc(MAX(lookupCount, (uint64_t)1) * sizeof(uint64_t));
+    uint64_t state = options->seed;
+    for (uint64_t i = 0; i < lookupCount; i++)
+    {
+        indexes[i] = (i % 10 == 9 ? UINT64_MAX : MBXBenchmarkRandom(&state) % tileCount);
+    }
+
+    MBXBenchmarkDatabasePool pool;
+    MBXBenchmarkDatabasePoolInit(&pool, path);
+    uint64_t wrongResults = 0;
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    for (uint64_t i = 0; i < lookupCount; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkDatabaseTileForLookup(indexes[i], i, lastZ, &z, &x, &y);
+
+        uint64_t start = MBXBenchmarkNow();
+        long length = MBXBenchmarkDatabaseLookUpTile(&pool, z, x, y, data);
+        samples[i] = MBXBenchmarkNow() - start;
+
+        if (!MBXBenchmarkDatabaseCheckTile(indexes[i], data, length)) wrongResults++;
+    }
+
+    MBXBenchmarkBeginObject("pooled_lookups");
+    MBXBenchmarkWriteInteger("count", lookupCount);
+    MBXBenchmarkWriteInteger("p50_ns", MBXBenchmarkPercentile(samples, lookupCount, 50.0));
+    MBXBenchmarkWriteInteger("p99_ns", MBXBenchmarkPercentile(samples, lookupCount, 99.0));
+    MBXBenchmarkWriteInteger("connections_opened", atomic_load(&pool.openedConnections));
+    MBXBenchmarkWriteInteger("wrong_results", wrongResults);
+    MBXBenchmarkEndObject();
+
+    // The unpooled baseline runs the first of the same lookups. Opening the database each time costs far more than the
+    // lookup itself, so it gets at most a tenth as many to keep the run short.
+    //
+    uint64_t unpooledCount = MIN(lookupCount, MAX(lookupCount / 10, (uint64_t)1000));
+    uint64_t *unpooledSamples = malloc(MAX(unpooledCount, (uint64_t)1) * sizeof(uint64_t));
+    uint64_t unpooledWrongResults = 0;
+    for (uint64_t i = 0; i < unpooledCount; i++)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkDatabaseTileForLookup(indexes[i], i, lastZ, &z, &x, &y);
+
+        uint64_t start = MBXBenchmarkNow();
+        long length = MBXBenchmarkDatabaseLookUpTileUnpooled(path, z, x, y, data);
+        unpooledSamples[i] = MBXBenchmarkNow() - start;
+
+        if (!MBXBenchmarkDatabaseCheckTile(indexes[i], data, length)) unpooledWrongResults++;
+    }
+
+    uint64_t pooledP50 = MBXBenchmarkPercentile(samples, lookupCount, 50.0);
+    uint64_t unpooledP50 = MBXBenchmarkPercentile(unpooledSamples, unpooledCount, 50.0);
+    MBXBenchmarkBeginObject("unpooled_lookups");
+    MBXBenchmarkWriteInteger("count", unpooledCount);
+    MBXBenchmarkWriteInteger("p50_ns", unpooledP50);
+    MBXBenchmarkWriteInteger("p99_ns", MBXBenchmarkPercentile(unpooledSamples, unpooledCount, 99.0));
+    MBXBenchmarkWriteInteger("connections_opened", unpooledCount);
+    MBXBenchmarkWriteDouble("pooled_speedup", (double)unpooledP50 / (double)MAX(pooledP50, (uint64_t)1));
+    MBXBenchmarkWriteInteger("wrong_results", unpooledWrongResults);
+    MBXBenchmarkEndObject();
+    free(unpooledSamples);
+
+    MBXBenchmarkDatabaseThread threads[MBXOfflineMapDatabaseMaximumIdleConnections];
+    pthread_t threadIDs[MBXOfflineMapDatabaseMaximumIdleConnections];
+    uint64_t concurrentStart = MBXBenchmarkNow();
+    for (NSUInteger t = 0; t < MBXOfflineMapDatabaseMaximumIdleConnections; t++)
+    {
+        uint64_t first = lookupCount * t / MBXOfflineMapDatabaseMaximumIdleConnections;
+        uint64_t last = lookupCount * (t + 1) / MBXOfflineMapDatabaseMaximumIdleConnections;
+        threads[t] = (MBXBenchmarkDatabaseThread){ &pool, indexes, first, last - first, lastZ, 0 };
+        pthread_create(&threadIDs[t], NULL, MBXBenchmarkDatabaseRunThread, &threads[t]);
+    }
+    uint64_t concurrentWrongResults = 0;
+    for (NSUInteger t = 0; t < MBXOfflineMapDatabaseMaximumIdleConnections; t++)
+    {
+        pthread_join(threadIDs[t], NULL);
+        concurrentWrongResults += threads[t].wrongResults;
+    }
+    uint64_t concurrentNanoseconds = MBXBenchmarkNow() - concurrentStart;
+
+    // The pool never needs more connections than there are threads using it at once
+    //
+    uint64_t openedConnections = atomic_load(&pool.openedConnections);
+    MBXBenchmarkBeginObject("concurrent_lookups");
+    MBXBenchmarkWriteInteger("threads", MBXOfflineMapDatabaseMaximumIdleConnections);
+    MBXBenchmarkWriteDouble("lookups_per_second", (double)lookupCount / ((double)concurrentNanoseconds / 1e9));
+    MBXBenchmarkWriteInteger("connections_opened", openedConnections);
+    MBXBenchmarkWriteInteger("wrong_results", concurrentWrongResults);
+    MBXBenchmarkEndObject();
+
+    MBXBenchmarkDatabasePoolDestroy(&pool);
+    free(samples);
+    free(indexes);
+    remove(path);
+
+    success = (wrongResults == 0 && unpooledWrongResults == 0 && concurrentWrongResults == 0 && openedConnections <= MBXOfflineMapDatabaseMaximumIdleConnections);
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
+
+
+#pragma mark - Saves
+
+static uint64_t MBXBenchmarkDatabaseTileCount(const char *path)
+{
+    sqlite3 *db;
+    sqlite3_stmt *ppStmt = NULL;
+    uint64_t count = 0;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+        && sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM tiles;", -1, &ppStmt, NULL) == SQLITE_OK
+        && sqlite3_step(ppStmt) == SQLITE_ROW)
+    {
+        count = (uint64_t)sqlite3_column_int64(ppStmt, 0);
+    }
+    sqlite3_finalize(ppStmt);
+    sqlite3_close(db);
+
+    return count;
+}
+
+
+static void MBXBenchmarkDatabaseWriteSaves(const char *name, uint64_t tileCount, uint64_t commitCount, uint64_t nanoseconds, bool success)
+{
+    MBXBenchmarkBeginObject(name);
+    MBXBenchmarkWriteInteger("commits", commitCount);
+    MBXBenchmarkWriteDouble("total_ms", (double)nanoseconds / 1e6);
+    MBXBenchmarkWriteDouble("tiles_per_second", (double)tileCount / ((double)nanoseconds / 1e9));
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+}
+
+
+static bool MBXBenchmarkDatabaseSaves(const MBXBenchmarkOptions *options)
+{
+    // The same tiles are saved three ways: with a connection and transaction for each file, like the downloader used
+    // to; with one commit for each file over the job's WAL connection; and in the job's batches of up to
+    // MBXOfflineMapDownloaderCommitBatchCount files. Every commit is a real fsync, so this uses fewer tiles than the
+    // packs do.
+    //
+    uint64_t tileCount = MIN(options->packTileCount, (uint64_t)2000);
+    MBXBenchmarkBeginObject("saves");
+    MBXBenchmarkWriteInteger("tiles", tileCount);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/saves.sqlite", MBXBenchmarkTemporaryDirectory());
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    long z = 0;
+    uint64_t x, y;
+
+    bool connectionsSuccess = MBXBenchmarkCreatePack(path, 0);
+    uint64_t start = MBXBenchmarkNow();
+    for (uint64_t i = 0; i < tileCount && connectionsSuccess; i++)
+    {
+        MBXBenchmarkTileAtIndex(i, &z, &x, &y);
+        connectionsSuccess = MBXBenchmarkPackWriteTile(path, z, x, y, data, MBXBenchmarkTileData(i, data));
+    }
+    uint64_t connectionsNanoseconds = MBXBenchmarkNow() - start;
+    connectionsSuccess = connectionsSuccess && MBXBenchmarkDatabaseTileCount(path) == tileCount;
+    MBXBenchmarkDatabaseWriteSaves("per_file_connections", tileCount, tileCount, connectionsNanoseconds, connectionsSuccess);
+
+    uint64_t batchCounts[] = { 1, MBXOfflineMapDownloaderCommitBatchCount };
+    const char *names[] = { "per_file_commits", "group_commits" };
+    uint64_t nanoseconds[2];
+    bool success = connectionsSuccess;
+    for (size_t b = 0; b < 2; b++)
+    {
+        start = MBXBenchmarkNow();
+        MBXBenchmarkPackWriter *writer = MBXBenchmarkPackWriterCreate(path, batchCounts[b], MBXOfflineMapDownloaderCommitBatchBytes);
+        bool writerSuccess = (writer != NULL);
+        for (uint64_t i = 0; i < tileCount && writerSuccess; i++)
+        {
+            MBXBenchmarkTileAtIndex(i, &z, &x, &y);
+            writerSuccess = MBXBenchmarkPackWriterAddTile(writer, z, x, y, data, MBXBenchmarkTileData(i, data));
+        }
+        uint64_t commitCount = 0;
+        if (writer)
+        {
+            writerSuccess = MBXBenchmarkPackWriterFinish(writer, z) && writerSuccess;
+            commitCount = MBXBenchmarkPackWriterCommitCount(writer);
+        }
+        nanoseconds[b] = MBXBenchmarkNow() - start;
+
+        writerSuccess = writerSuccess && MBXBenchmarkDatabaseTileCount(path) == tileCount;
+        MBXBenchmarkDatabaseWriteSaves(names[b], tileCount, commitCount, nanoseconds[b], writerSuccess);
+        success = success && writerSuccess;
+    }
+    remove(path);
+
+    MBXBenchmarkWriteDouble("group_commit_speedup", (double)nanoseconds[0] / (double)MAX(nanoseconds[1], (uint64_t)1));
+    MBXBenchmarkWriteDouble("speedup_over_per_file_connections", (double)connectionsNanoseconds / (double)MAX(nanoseconds[1], (uint64_t)1));
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkDatabase(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("offline_database");
+    MBXBenchmarkWriteInteger("schema_version", (uint64_t)MBXOfflineMapDatabaseSchemaVersionDeduplicated);
+
+    // Packs grow tenfold from a thousand tiles up to the largest size asked for, so that the results show how lookups
+    // scale with the size of the tiles table
+    //
+    bool success = (MBXBenchmarkTemporaryDirectory() != NULL) && MBXBenchmarkDatabaseSaves(options);
+    uint64_t tileCount = MIN(options->packTileCount, (uint64_t)1000);
+    while (success)
+    {
+        success = MBXBenchmarkDatabasePack(options, tileCount);
+        if (tileCount >= options->packTileCount) break;
+        tileCount = MIN(tileCount * 10, options->packTileCount);
+    }
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
@@ -0,0 +1,541 @@
+//
+//  MBXBenchmarkJobCreation.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include <sqlite3.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include "MBXTileCoverageCore.inc"
+#include "MBXOfflineMapDownloaderCore.inc"
+
+#pragma mark - Queries
+
+typedef struct {
+    char *bytes;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} MBXBenchmarkJobQuery;
+
+
+static void MBXBenchmarkJobQueryAppend(MBXBenchmarkJobQuery *query, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+
+    if (query->failed || length < 0) return;
+    if (query->length + (size_t)length + 1 > query->capacity)
+    {
+        size_t capacity = MAX(query->capacity * 2, query->length + (size_t)length + 1);
+        char *bytes = realloc(query->bytes, capacity);
+        if (!bytes)
+        {
+            query->failed = true;
+            return;
+        }
+        query->bytes = bytes;
+        query->capacity = capacity;
+    }
+
+    va_start(arguments, format);
+    vsnprintf(query->bytes + query->length, query->capacity - query->length, format, arguments);
+    va_end(arguments);
+    query->length += (size_t)length;
+}
+
+
+#pragma mark - Tile ranges
+
+typedef struct {
+    bool rectangular;
+    double minX;
+    double maxX;
+    double minY;
+    double maxY;
+    const MBXTileCoveragePoint *ring;
+    size_t count;
+} MBXBenchmarkJobRegion;
+
+typedef void (*MBXBenchmarkJobRangeFunction)(void *context, long z, long minX, long maxX, long minY, long maxY);
+
+
+// The same as -[MBXTileCoverage enumerateRectangularTileRangesAtZoom:usingBlock:]
+//
+static void MBXBenchmarkJobRectangularRanges(const MBXBenchmarkJobRegion *region, long z, MBXBenchmarkJobRangeFunction function, void *context)
+{
+    long tilesPerSide = 1L << z;
+    double scale = (double)tilesPerSide;
+    long minY = MIN(MAX((long)floor(region->minY * scale), 0), tilesPerSide - 1);
+    long maxY = MAX(MIN((long)ceil(region->maxY * scale) - 1, tilesPerSide - 1), minY);
+    long minX = (long)floor(region->minX * scale);
+    long width = MAX(minX, (long)ceil(region->maxX * scale) - 1) - minX + 1;
+    if (width >= tilesPerSide)
+    {
+        function(context, z, 0, tilesPerSide - 1, minY, maxY);
+        return;
+    }
+    minX = ((minX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+    long maxX = minX + width - 1;
+    if (maxX < tilesPerSide)
+    {
+        function(context, z, minX, maxX, minY, maxY);
+    }
+    else
+    {
+        function(context, z, 0, maxX - tilesPerSide, minY, maxY);
+        function(context, z, minX, tilesPerSide - 1, minY, maxY);
+    }
+}
+
+
+// The same as -[MBXTileCoverage enumerateTileRangesForMinimumZ:maximumZ:withError:usingBlock:], which merges rows with
+// the same spans as the row above them into rectangular ranges. The tiles of an irregular shape's rows are also counted
+// one row at a time, to check the ranges against.
+//
+static bool MBXBenchmarkJobTileRanges(const MBXBenchmarkJobRegion *region, long minimumZ, long maximumZ, MBXBenchmarkJobRangeFunction function, void *context, uint64_t *rowTileCount)
+{
+    for (long z = minimumZ; z <= maximumZ; z++)
+    {
+        if (region->rectangular)
+        {
+            MBXBenchmarkJobRectangularRanges(region, z, function, context);
+            continue;
+        }
+
+        long tilesPerSide = 1L << z;
+        long firstRow = MIN(MAX((long)floor(region->minY * tilesPerSide), 0), tilesPerSide - 1);
+        long lastRow = MAX(MIN((long)ceil(region->maxY * tilesPerSide) - 1, tilesPerSide - 1), firstRow);
+        MBXTileCoverageRow *rows = calloc((size_t)(lastRow - firstRow + 1), sizeof(MBXTileCoverageRow));
+        if (!rows) return false;
+
+        const MBXTileCoveragePoint *rings[1] = { region->ring };
+        size_t ringCounts[1] = { region->count };
+        bool success = MBXTileCoverageRasterizeShape(rings, ringCounts, 1, tilesPerSide, rows, firstRow, lastRow);
+
+        MBXTileCoverageRow open = { NULL, 0, 0 };
+        long openMinY = 0;
+        long openMaxY = -1;
+        for (long y = firstRow; y <= lastRow; y++)
+        {
+            MBXTileCoverageRow *row = &rows[y - firstRow];
+            if (success) success = MBXTileCoverageNormalizeRow(row, tilesPerSide);
+            for (size_t i = 0; success && i < row->count; i++)
+            {
+                *rowTileCount += (uint64_t)(row->spans[i].maxX - row->spans[i].minX + 1);
+            }
+            if (success && !(row->count == open.count && y == openMaxY + 1 && (row->count == 0 || memcmp(row->spans, open.spans, row->count * sizeof(MBXTileCoverageSpan)) == 0)))
+            {
+                for (size_t i = 0; i < open.count; i++)
+                {
+                    function(context, z, open.spans[i].minX, open.spans[i].maxX, openMinY, openMaxY);
+                }
+                open.count = 0;
+                for (size_t i = 0; i < row->count && success; i++)
+                {
+                    success = MBXTileCoverageRowAddSpan(&open, row->spans[i].minX, row->spans[i].maxX);
+                }
+                openMinY = y;
+            }
+            openMaxY = y;
+            free(row->spans);
+        }
+        for (size_t i = 0; i < open.count && success; i++)
+        {
+            function(context, z, open.spans[i].minX, open.spans[i].maxX, openMinY, openMaxY);
+        }
+        free(open.spans);
+        free(rows);
+
+        if (!success) return false;
+    }
+
+    return true;
+}
+
+
+#pragma mark - Creating jobs
+
+typedef struct {
+    MBXBenchmarkJobQuery *query;
+    uint64_t rangeCount;
+    uint64_t tileCount;
+} MBXBenchmarkJobRangeContext;
+
+
+static void MBXBenchmarkJobAppendRange(void *context, long z, long minX, long maxX, long minY, long maxY)
+{
+    MBXBenchmarkJobRangeContext *ranges = context;
+    MBXBenchmarkJobQueryAppend(ranges->query, "INSERT INTO \"tile_ranges\" VALUES(NULL,%ld,%ld,%ld,%ld,%ld,0);\n", z, minX, maxX, minY, maxY);
+    ranges->rangeCount++;
+    ranges->tileCount += (uint64_t)(maxX - minX + 1) * (uint64_t)(maxY - minY + 1);
+}
+
+
+// Starts the transaction which creates a partial database, with its tables, its metadata, and its non-tile resources in
+// the queue
+//
+static void MBXBenchmarkJobAppendTables(MBXBenchmarkJobQuery *query, long maximumZ)
+{
+    char tileSchema[512];
+    snprintf(tileSchema, sizeof(tileSchema),
+#include "MBXOfflineMapDatabaseTileSchema.inc"
+             , "tile_id INTEGER REFERENCES data", (sqlite3_libversion_number() >= 3008002 ? " WITHOUT ROWID" : ""));
+    static const char *const tableSchema =
+#include "MBXOfflineMapDownloaderSchema.inc"
+        ;
+
+    MBXBenchmarkJobQueryAppend(query, "PRAGMA foreign_keys=ON;\nBEGIN TRANSACTION;\n%s%s%s%s", tableSchema, tileSchema, MBXOfflineMapDownloaderQueueSchema, MBXOfflineMapDownloaderTileRangeSchema);
+    MBXBenchmarkJobQueryAppend(query, "INSERT INTO \"metadata\" VALUES('minimumZ','0');\nINSERT INTO \"metadata\" VALUES('maximumZ','%ld');\n", maximumZ);
+    MBXBenchmarkJobQueryAppend(query, "INSERT INTO \"metadata\" VALUES('jobPriority','1');\n");
+    MBXBenchmarkJobQueryAppend(query, "INSERT INTO queue (url, zoom_level) SELECT url, -1 FROM resources;\n");
+}
+
+
+// Creates the partial database for a job the way -[MBXOfflineMapDownloader sqliteCreateDatabaseForJob:...] does, and
+// checks that its tile ranges add up to the tiles which the coverage has. The time this takes is how long the user waits
+// between starting a download and seeing it start.
+//
+static bool MBXBenchmarkJobCreate(const char *path, const MBXBenchmarkJobRegion *region, long maximumZ, MBXBenchmarkJobRangeContext *ranges)
+{
+    MBXBenchmarkJobQuery query = { NULL, 0, 0, false };
+    MBXBenchmarkJobAppendTables(&query, maximumZ);
+
+    *ranges = (MBXBenchmarkJobRangeContext){ &query, 0, 0 };
+    uint64_t rowTileCount = 0;
+    bool success = MBXBenchmarkJobTileRanges(region, 0, maximumZ, MBXBenchmarkJobAppendRange, ranges, &rowTileCount);
+    success = success && (region->rectangular || rowTileCount == ranges->tileCount);
+    MBXBenchmarkJobQueryAppend(&query, "COMMIT;");
+    success = success && !query.failed;
+
+    sqlite3 *db = NULL;
+    remove(path);
+    success = (success
+               && sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) == SQLITE_OK
+               && sqlite3_exec(db, query.bytes, NULL, NULL, NULL) == SQLITE_OK);
+    if (!success && db) fprintf(stderr, "Can't create %s: %s\n", path, sqlite3_errmsg(db));
+    free(query.bytes);
+
+    sqlite3_stmt *ppStmt = NULL;
+    success = (success
+               && sqlite3_prepare_v2(db, "SELECT SUM((max_x - min_x + 1) * (max_y - min_y + 1)) FROM tile_ranges;", -1, &ppStmt, NULL) == SQLITE_OK
+               && sqlite3_step(ppStmt) == SQLITE_ROW
+               && (uint64_t)sqlite3_column_int64(ppStmt, 0) == ranges->tileCount);
+    sqlite3_finalize(ppStmt);
+    sqlite3_close(db);
+
+    return success;
+}
+
+
+// Moves the first chunk of tiles from the tile ranges into the queue, like -[MBXOfflineMapDownloader
+// sqliteEnqueueTileChunkForJob:withError:] does when a job starts, and returns the number of tiles queued or -1
+//
+static long MBXBenchmarkJobEnqueueTileChunk(const char *path)
+{
+    sqlite3 *db = NULL;
+    sqlite3_stmt *statements[MBXOfflineMapDownloaderStatementCount] = { NULL };
+    MBXOfflineMapDownloaderStatement used[3] = {
+        MBXOfflineMapDownloaderStatementSelectTileRange,
+        MBXOfflineMapDownloaderStatementUpdateTileRange,
+        MBXOfflineMapDownloaderStatementInsertQueuedTile
+    };
+    bool failed = (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK);
+    for (size_t i = 0; i < 3 && !failed; i++)
+    {
+        failed = (sqlite3_prepare_v2(db, MBXOfflineMapDownloaderStatementSQL[used[i]], -1, &statements[used[i]], NULL) != SQLITE_OK);
+    }
+    failed = failed || (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK);
+
+    sqlite3_stmt *selectRange = statements[MBXOfflineMapDownloaderStatementSelectTileRange];
+    sqlite3_stmt *updateRange = statements[MBXOfflineMapDownloaderStatementUpdateTileRange];
+    sqlite3_stmt *insertTile = statements[MBXOfflineMapDownloaderStatementInsertQueuedTile];
+    long queued = 0;
+    while (!failed && queued < MBXOfflineMapDownloaderEnumerationChunkSize)
+    {
+        int rc = sqlite3_step(selectRange);
+        if (rc != SQLITE_ROW)
+        {
+            failed = (rc != SQLITE_DONE);
+            sqlite3_reset(selectRange);
+            break;
+        }
+        sqlite3_int64 rangeID = sqlite3_column_int64(selectRange, 0);
+        sqlite3_int64 z = sqlite3_column_int64(selectRange, 1);
+        sqlite3_int64 minX = sqlite3_column_int64(selectRange, 2);
+        sqlite3_int64 maxX = sqlite3_column_int64(selectRange, 3);
+        sqlite3_int64 minY = sqlite3_column_int64(selectRange, 4);
+        sqlite3_int64 maxY = sqlite3_column_int64(selectRange, 5);
+        sqlite3_int64 enumerated = sqlite3_column_int64(selectRange, 6);
+        sqlite3_reset(selectRange);
+
+        sqlite3_int64 height = maxY - minY + 1;
+        sqlite3_int64 end = MIN((maxX - minX + 1) * height, enumerated + (MBXOfflineMapDownloaderEnumerationChunkSize - queued));
+        for (sqlite3_int64 i = enumerated; i < end && !failed; i++)
+        {
+            sqlite3_bind_int64(insertTile, 1, z);
+            sqlite3_bind_int64(insertTile, 2, minX + i / height);
+            sqlite3_bind_int64(insertTile, 3, ((1LL << z) - 1) - (minY + i % height));
+            failed = (sqlite3_step(insertTile) != SQLITE_DONE);
+            sqlite3_reset(insertTile);
+        }
+
+        if (!failed)
+        {
+            sqlite3_bind_int64(updateRange, 1, rangeID);
+            sqlite3_bind_int64(updateRange, 2, end);
+            failed = (sqlite3_step(updateRange) != SQLITE_DONE);
+            sqlite3_reset(updateRange);
+            queued += (long)(end - enumerated);
+        }
+    }
+    if (db) failed = (sqlite3_exec(db, (failed ? "ROLLBACK;" : "COMMIT;"), NULL, NULL, NULL) != SQLITE_OK) || failed;
+    if (failed && db) fprintf(stderr, "Can't queue tiles in %s: %s\n", path, sqlite3_errmsg(db));
+
+    for (size_t i = 0; i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        sqlite3_finalize(statements[i]);
+    }
+    sqlite3_close(db);
+
+    return failed ? -1 : queued;
+}
+
+
+#pragma mark - Materialized jobs
+
+// Above this many tiles, materializing a job's tiles takes too long and too much memory to be worth measuring
+//
+static uint64_t const MBXBenchmarkJobMaterializedTileLimit = 1000000;
+
+typedef struct {
+    char **paths;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t bytes;
+    bool failed;
+} MBXBenchmarkJobTilePaths;
+
+
+static void MBXBenchmarkJobAppendTilePaths(void *context, long z, long minX, long maxX, long minY, long maxY)
+{
+    MBXBenchmarkJobTilePaths *tilePaths = context;
+    for (long x = minX; x <= maxX && !tilePaths->failed; x++)
+    {
+        for (long y = minY; y <= maxY && !tilePaths->failed; y++)
+        {
+            if (tilePaths->count == tilePaths->capacity)
+            {
+                uint64_t capacity = MAX(tilePaths->capacity * 2, (uint64_t)1024);
+                char **paths = realloc(tilePaths->paths, capacity * sizeof(char *));
+                if (!paths)
+                {
+                    tilePaths->failed = true;
+                    break;
+                }
+                tilePaths->paths = paths;
+                tilePaths->capacity = capacity;
+            }
+
+            char path[64];
+            int length = snprintf(path, sizeof(path), "%ld/%ld/%ld.png", z, x, y);
+            tilePaths->paths[tilePaths->count] = strdup(path);
+            tilePaths->failed = (tilePaths->paths[tilePaths->count] == NULL);
+            tilePaths->count += !tilePaths->failed;
+            tilePaths->bytes += (uint64_t)length + 1;
+        }
+    }
+}
+
+
+static void MBXBenchmarkJobCountTiles(void *context, long z, long minX, long maxX, long minY, long maxY)
+{
+    *(uint64_t *)context += (uint64_t)(maxX - minX + 1) * (uint64_t)(maxY - minY + 1);
+}
+
+
+// Creates the partial database the way the downloader did before tile ranges: every tile's path is built up front, and
+// then every tile is queued in the same transaction which creates the tables
+//
+static bool MBXBenchmarkJobCreateMaterialized(const char *path, const MBXBenchmarkJobRegion *region, long maximumZ, MBXBenchmarkJobTilePaths *tilePaths)
+{
+    *tilePaths = (MBXBenchmarkJobTilePaths){ NULL, 0, 0, 0, false };
+    uint64_t rowTileCount = 0;
+    bool success = MBXBenchmarkJobTileRanges(region, 0, maximumZ, MBXBenchmarkJobAppendTilePaths, tilePaths, &rowTileCount) && !tilePaths->failed;
+
+    MBXBenchmarkJobQuery query = { NULL, 0, 0, false };
+    MBXBenchmarkJobAppendTables(&query, maximumZ);
+    success = success && !query.failed;
+
+    sqlite3 *db = NULL;
+    sqlite3_stmt *insertTile = NULL;
+    remove(path);
+    success = (success
+               && sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) == SQLITE_OK
+               && sqlite3_exec(db, query.bytes, NULL, NULL, NULL) == SQLITE_OK
+               && sqlite3_prepare_v2(db, MBXOfflineMapDownloaderStatementSQL[MBXOfflineMapDownloaderStatementInsertQueuedTile], -1, &insertTile, NULL) == SQLITE_OK);
+    free(query.bytes);
+    for (uint64_t i = 0; i < tilePaths->count && success; i++)
+    {
+        long z, x, y;
+        success = (sscanf(tilePaths->paths[i], "%ld/%ld/%ld", &z, &x, &y) == 3);
+        sqlite3_bind_int64(insertTile, 1, z);
+        sqlite3_bind_int64(insertTile, 2, x);
+        sqlite3_bind_int64(insertTile, 3, ((1LL << z) - 1) - y);
+        success = success && (sqlite3_step(insertTile) == SQLITE_DONE);
+        sqlite3_reset(insertTile);
+    }
+    sqlite3_finalize(insertTile);
+    if (db) success = (sqlite3_exec(db, (success ? "COMMIT;" : "ROLLBACK;"), NULL, NULL, NULL) == SQLITE_OK) && success;
+    if (!success && db) fprintf(stderr, "Can't create %s: %s\n", path, sqlite3_errmsg(db));
+
+    sqlite3_stmt *ppStmt = NULL;
+    success = (success
+               && sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM queue WHERE zoom_level >= 0;", -1, &ppStmt, NULL) == SQLITE_OK
+               && sqlite3_step(ppStmt) == SQLITE_ROW
+               && (uint64_t)sqlite3_column_int64(ppStmt, 0) == tilePaths->count);
+    sqlite3_finalize(ppStmt);
+    sqlite3_close(db);
+
+    for (uint64_t i = 0; i < tilePaths->count; i++)
+    {
+        free(tilePaths->paths[i]);
+    }
+    free(tilePaths->paths);
+    tilePaths->paths = NULL;
+
+    return success;
+}
+
+
+static uint64_t MBXBenchmarkJobFileSize(const char *path)
+{
+    struct stat info;
+    return (stat(path, &info) == 0 ? (uint64_t)info.st_size : 0);
+}
+
+
+// Compares the two ways of creating a job at the highest zoom level whose tiles can still be materialized
+//
+static bool MBXBenchmarkJobCompareMaterialized(const MBXBenchmarkJobRegion *region, const char *name, long maximumZ)
+{
+    long z = 0;
+    uint64_t tileCount = 0;
+    uint64_t rowTileCount = 0;
+    while (z <= maximumZ)
+    {
+        uint64_t zoomTileCount = 0;
+        if (!MBXBenchmarkJobTileRanges(region, z, z, MBXBenchmarkJobCountTiles, &zoomTileCount, &rowTileCount)) return false;
+        if (tileCount + zoomTileCount > MBXBenchmarkJobMaterializedTileLimit) break;
+        tileCount += zoomTileCount;
+        z++;
+    }
+    long comparisonZ = MAX(z - 1, 0L);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/job_%s_compared.sqlite", MBXBenchmarkTemporaryDirectory(), name);
+
+    MBXBenchmarkJobRangeContext ranges;
+    uint64_t start = MBXBenchmarkNow();
+    bool success = MBXBenchmarkJobCreate(path, region, comparisonZ, &ranges);
+    uint64_t rangeNanoseconds = MBXBenchmarkNow() - start;
+    uint64_t rangeFileSize = MBXBenchmarkJobFileSize(path);
+
+    MBXBenchmarkJobTilePaths tilePaths;
+    start = MBXBenchmarkNow();
+    success = MBXBenchmarkJobCreateMaterialized(path, region, comparisonZ, &tilePaths) && success;
+    uint64_t materializedNanoseconds = MBXBenchmarkNow() - start;
+    uint64_t materializedFileSize = MBXBenchmarkJobFileSize(path);
+    remove(path);
+    success = success && tilePaths.count == ranges.tileCount;
+
+    MBXBenchmarkBeginObject("compared_with_materialized");
+    MBXBenchmarkWriteInteger("maximum_zoom", (uint64_t)comparisonZ);
+    MBXBenchmarkWriteInteger("tiles", tilePaths.count);
+    MBXBenchmarkWriteDouble("tile_ranges_create_ms", (double)rangeNanoseconds / 1e6);
+    MBXBenchmarkWriteInteger("tile_ranges_database_bytes", rangeFileSize);
+    MBXBenchmarkWriteDouble("materialized_create_ms", (double)materializedNanoseconds / 1e6);
+    MBXBenchmarkWriteInteger("materialized_database_bytes", materializedFileSize);
+    MBXBenchmarkWriteInteger("materialized_path_bytes", tilePaths.bytes);
+    MBXBenchmarkWriteDouble("speedup", (double)materializedNanoseconds / (double)MAX(rangeNanoseconds, (uint64_t)1));
+    MBXBenchmarkWriteBool("tiles_match", success);
+    MBXBenchmarkEndObject();
+
+    return success;
+}
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkJobCreation(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("job_creation");
+    MBXBenchmarkWriteInteger("maximum_zoom", (uint64_t)options->maximumZ);
+
+    // A star shaped like a coastline around a country the size of France, and a region about the size of the contiguous
+    // United States
+    //
+    size_t pointCount = 256;
+    MBXTileCoveragePoint *star = malloc(pointCount * sizeof(MBXTileCoveragePoint));
+    for (size_t i = 0; i < pointCount; i++)
+    {
+        double angle = 2.0 * M_PI * (double)i / (double)pointCount;
+        double radius = (i % 2 ? 5.0 : 3.5);
+        double longitude = 2.5 + radius * 1.5 * cos(angle);
+        double latitude = 46.5 + radius * sin(angle);
+        star[i] = (MBXTileCoveragePoint){ (longitude + 180.0) / 360.0, MBXTileCoverageYForLatitude(latitude) };
+    }
+
+    MBXBenchmarkJobRegion regions[2] = {
+        { false, 0.0, 0.0, INFINITY, -INFINITY, star, pointCount },
+        { true, (-125.0 + 180.0) / 360.0, (-66.0 + 180.0) / 360.0, MBXTileCoverageYForLatitude(50.0), MBXTileCoverageYForLatitude(24.0), NULL, 0 }
+    };
+    for (size_t i = 0; i < pointCount; i++)
+    {
+        regions[0].minY = MIN(regions[0].minY, star[i].y);
+        regions[0].maxY = MAX(regions[0].maxY, star[i].y);
+    }
+    const char *names[2] = { "irregular_shape", "region" };
+
+    bool success = (MBXBenchmarkTemporaryDirectory() != NULL);
+    for (int r = 0; r < 2 && success; r++)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/job_%s.sqlite", MBXBenchmarkTemporaryDirectory(), names[r]);
+
+        MBXBenchmarkJobRangeContext ranges;
+        uint64_t start = MBXBenchmarkNow();
+        success = MBXBenchmarkJobCreate(path, &regions[r], options->maximumZ, &ranges);
+        uint64_t nanoseconds = MBXBenchmarkNow() - start;
+
+        // The first download can start once the first chunk of tiles is in the queue
+        //
+        start = MBXBenchmarkNow();
+        long queued = (success ? MBXBenchmarkJobEnqueueTileChunk(path) : -1);
+        uint64_t chunkNanoseconds = MBXBenchmarkNow() - start;
+        bool queuedChunk = (queued == (long)MIN(ranges.tileCount, (uint64_t)MBXOfflineMapDownloaderEnumerationChunkSize));
+        remove(path);
+
+        MBXBenchmarkBeginObject(names[r]);
+        MBXBenchmarkWriteInteger("tiles", ranges.tileCount);
+        MBXBenchmarkWriteInteger("tile_ranges", ranges.rangeCount);
+        MBXBenchmarkWriteDouble("create_ms", (double)nanoseconds / 1e6);
+        MBXBenchmarkWriteDouble("first_chunk_ms", (double)chunkNanoseconds / 1e6);
+        MBXBenchmarkWriteBool("ranges_match_tiles", success);
+        MBXBenchmarkWriteBool("queued_first_chunk", queuedChunk);
+        success = success && queuedChunk && MBXBenchmarkJobCompareMaterialized(&regions[r], names[r], options->maximumZ);
+        MBXBenchmarkEndObject();
+    }
+    free(star);
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
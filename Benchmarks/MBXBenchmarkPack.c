@@ -0,0 +1,334 @@
+//
+//  MBXBenchmarkPack.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include <sqlite3.h>
+
+#include "MBXOfflineMapDownloaderCore.inc"
+
+// Defined along with the rest of the schema versions, in MBXBenchmarkDatabase.c
+//
+extern NSInteger const MBXOfflineMapDatabaseSchemaVersionDeduplicated;
+
+#pragma mark - Synthetic tiles
+
+void MBXBenchmarkTileAtIndex(uint64_t index, long *z, uint64_t *x, uint64_t *y)
+{
+    long zoom = 0;
+    while (index >= ((uint64_t)1 << (2 * zoom)))
+    {
+        index -= (uint64_t)1 << (2 * zoom);
+        zoom++;
+    }
+    *z = zoom;
+    *x = index & (((uint64_t)1 << zoom) - 1);
+    *y = index >> zoom;
+}
+
+
+size_t MBXBenchmarkTileData(uint64_t index, uint8_t *buffer)
+{
+    // Every fourth tile is open ocean, which is the same everywhere. The rest are all different, and between 64 bytes
+    // and 1 KB long. Real tiles are bigger, but that makes little difference to finding them, and this way a pack of a
+    // million tiles fits in a few hundred MB.
+    //
+    bool ocean = (index % 4 == 3);
+    uint64_t state = (ocean ? 0 : index + 1);
+    size_t length = (ocean ? 384 : 64 + (size_t)(MBXBenchmarkRandom(&state) % (MBXBenchmarkMaximumTileSize - 63)));
+    for (size_t i = 0; i < length; i += sizeof(uint64_t))
+    {
+        uint64_t value = MBXBenchmarkRandom(&state);
+        memcpy(buffer + i, &value, MIN(sizeof(uint64_t), length - i));
+    }
+
+    return length;
+}
+
+
+// The downloader hashes blobs with CC_SHA256, which is only on Apple platforms. All the hash is used for is matching up
+// identical blobs, so the synthetic packs use a 32 byte digest of the same size made with FNV-1a and splitmix64.
+//
+static void MBXBenchmarkContentHash(const uint8_t *data, size_t length, uint8_t digest[32])
+{
+    uint64_t state = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        state = (state ^ data[i]) * 0x100000001b3ULL;
+    }
+    for (size_t i = 0; i < 32; i += sizeof(uint64_t))
+    {
+        uint64_t value = MBXBenchmarkRandom(&state);
+        memcpy(digest + i, &value, sizeof(uint64_t));
+    }
+}
+
+
+#pragma mark - Writing packs
+
+typedef struct {
+    long z;
+    uint64_t x;
+    uint64_t y;
+    uint8_t *data;
+    size_t length;
+} MBXBenchmarkPackWrite;
+
+struct MBXBenchmarkPackWriter {
+    sqlite3 *db;
+    sqlite3_stmt *statements[MBXOfflineMapDownloaderStatementCount];
+    uint64_t batchCount;
+    uint64_t batchBytes;
+    MBXBenchmarkPackWrite *pendingWrites;
+    uint64_t pendingCount;
+    uint64_t pendingBytes;
+    uint64_t pendingStartTime;
+    uint64_t commitCount;
+    bool failed;
+};
+
+
+static void MBXBenchmarkPackWriterClose(MBXBenchmarkPackWriter *writer)
+{
+    for (size_t i = 0; i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        sqlite3_finalize(writer->statements[i]);
+    }
+    for (uint64_t i = 0; i < writer->pendingCount; i++)
+    {
+        free(writer->pendingWrites[i].data);
+    }
+    if (writer->db)
+    {
+        // Like -[MBXOfflineMapDownloadJob sqliteCloseDatabase], which checkpoints the write-ahead log into the file
+        //
+        sqlite3_exec(writer->db, "PRAGMA journal_mode=DELETE;", NULL, NULL, NULL);
+        sqlite3_close(writer->db);
+    }
+    free(writer->pendingWrites);
+    free(writer);
+}
+
+
+MBXBenchmarkPackWriter *MBXBenchmarkPackWriterCreate(const char *path, uint64_t batchCount, uint64_t batchBytes)
+{
+    MBXBenchmarkPackWriter *writer = calloc(1, sizeof(MBXBenchmarkPackWriter));
+    if (!writer) return NULL;
+    writer->batchCount = MAX(batchCount, (uint64_t)1);
+    writer->batchBytes = batchBytes;
+    writer->pendingWrites = calloc(writer->batchCount, sizeof(MBXBenchmarkPackWrite));
+
+    // The tables are the ones -[MBXOfflineMapDownloader sqliteCreateDatabaseForJob:...] creates, and the connection is
+    // set up the same way as -[MBXOfflineMapDownloadJob sqliteOpenDatabaseWithError:] sets up the job's connection
+    //
+    char tileSchema[512];
+    snprintf(tileSchema, sizeof(tileSchema),
+#include "MBXOfflineMapDatabaseTileSchema.inc"
+             , "tile_id INTEGER REFERENCES data", (sqlite3_libversion_number() >= 3008002 ? " WITHOUT ROWID" : ""));
+    static const char *const tableSchema =
+#include "MBXOfflineMapDownloaderSchema.inc"
+        ;
+
+    remove(path);
+    bool success = (writer->pendingWrites
+                    && sqlite3_open_v2(path, &writer->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, "BEGIN TRANSACTION;", NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, tableSchema, NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, tileSchema, NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, MBXOfflineMapDownloaderQueueSchema, NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, MBXOfflineMapDownloaderTileRangeSchema, NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, "PRAGMA foreign_keys=ON; PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer->db, MBXOfflineMapDownloaderValidatorSchema, NULL, NULL, NULL) == SQLITE_OK);
+    for (size_t i = 0; success && i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        success = (sqlite3_prepare_v2(writer->db, MBXOfflineMapDownloaderStatementSQL[i], -1, &writer->statements[i], NULL) == SQLITE_OK);
+    }
+    if (!success)
+    {
+        if (writer->db) fprintf(stderr, "Can't create %s: %s\n", path, sqlite3_errmsg(writer->db));
+        MBXBenchmarkPackWriterClose(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+static bool MBXBenchmarkPackWriterWriteTile(MBXBenchmarkPackWriter *writer, const MBXBenchmarkPackWrite *write)
+{
+    // The same statements as -[MBXOfflineMapDownloader sqliteWriteData:response:forItem:job:] uses for a map tile. The
+    // synthetic tiles weren't queued, so there's no queue row to delete, and they don't have validators.
+    //
+    uint8_t hash[32];
+    MBXBenchmarkContentHash(write->data, write->length, hash);
+
+    sqlite3_stmt *insertData = writer->statements[MBXOfflineMapDownloaderStatementInsertData];
+    sqlite3_bind_blob(insertData, 1, write->data, (int)write->length, SQLITE_STATIC);
+    sqlite3_bind_blob(insertData, 2, hash, sizeof(hash), SQLITE_STATIC);
+    bool success = (sqlite3_step(insertData) == SQLITE_DONE);
+    sqlite3_reset(insertData);
+    sqlite3_clear_bindings(insertData);
+
+    if (success)
+    {
+        sqlite3_stmt *insertTile = writer->statements[MBXOfflineMapDownloaderStatementInsertTile];
+        sqlite3_bind_int64(insertTile, 1, write->z);
+        sqlite3_bind_int64(insertTile, 2, (sqlite3_int64)write->x);
+        sqlite3_bind_int64(insertTile, 3, (sqlite3_int64)((((uint64_t)1 << write->z) - 1) - write->y));
+        sqlite3_bind_blob(insertTile, 4, hash, sizeof(hash), SQLITE_STATIC);
+        success = (sqlite3_step(insertTile) == SQLITE_DONE);
+        sqlite3_reset(insertTile);
+        sqlite3_clear_bindings(insertTile);
+    }
+
+    return success;
+}
+
+
+static bool MBXBenchmarkPackWriterCommit(MBXBenchmarkPackWriter *writer)
+{
+    // Write the whole batch in one transaction, like -[MBXOfflineMapDownloader sqliteCommitPendingWritesForJob:]
+    //
+    if (writer->pendingCount == 0) return !writer->failed;
+
+    bool success = (sqlite3_exec(writer->db, "BEGIN TRANSACTION;", NULL, NULL, NULL) == SQLITE_OK);
+    if (success)
+    {
+        for (uint64_t i = 0; i < writer->pendingCount && success; i++)
+        {
+            success = MBXBenchmarkPackWriterWriteTile(writer, &writer->pendingWrites[i]);
+        }
+        success = (sqlite3_exec(writer->db, (success ? "COMMIT;" : "ROLLBACK;"), NULL, NULL, NULL) == SQLITE_OK) && success;
+    }
+    if (!success) fprintf(stderr, "Can't commit a batch: %s\n", sqlite3_errmsg(writer->db));
+
+    for (uint64_t i = 0; i < writer->pendingCount; i++)
+    {
+        free(writer->pendingWrites[i].data);
+    }
+    writer->pendingCount = 0;
+    writer->pendingBytes = 0;
+    writer->commitCount++;
+    writer->failed = writer->failed || !success;
+
+    return !writer->failed;
+}
+
+
+bool MBXBenchmarkPackWriterAddTile(MBXBenchmarkPackWriter *writer, long z, uint64_t x, uint64_t y, const uint8_t *data, size_t length)
+{
+    // Buffer the tile the way -[MBXOfflineMapDownloader sqliteSaveDownloadedData:response:forItem:job:] does. There's no
+    // timer here, so a batch which has been open for longer than the commit interval is committed when the next tile
+    // comes in instead.
+    //
+    if (writer->pendingCount > 0 && MBXBenchmarkNow() - writer->pendingStartTime >= (uint64_t)(MBXOfflineMapDownloaderCommitInterval * 1e9))
+    {
+        MBXBenchmarkPackWriterCommit(writer);
+    }
+
+    uint8_t *copy = malloc(MAX(length, (size_t)1));
+    if (!copy) return false;
+    memcpy(copy, data, length);
+
+    if (writer->pendingCount == 0) writer->pendingStartTime = MBXBenchmarkNow();
+    writer->pendingWrites[writer->pendingCount++] = (MBXBenchmarkPackWrite){ z, x, y, copy, length };
+    writer->pendingBytes += length;
+
+    if (writer->pendingCount >= writer->batchCount || writer->pendingBytes >= writer->batchBytes)
+    {
+        return MBXBenchmarkPackWriterCommit(writer);
+    }
+
+    return !writer->failed;
+}
+
+
+uint64_t MBXBenchmarkPackWriterCommitCount(const MBXBenchmarkPackWriter *writer)
+{
+    return writer->commitCount;
+}
+
+
+bool MBXBenchmarkPackWriterFinish(MBXBenchmarkPackWriter *writer, long maximumZ)
+{
+    // Finish the pack the way -[MBXOfflineMapDownloader sqliteFinishJobIfComplete:] does, with the metadata which
+    // MBXOfflineMapDatabase needs to open it
+    //
+    bool success = MBXBenchmarkPackWriterCommit(writer);
+
+    char metadata[1024];
+    snprintf(metadata, sizeof(metadata),
+             "BEGIN TRANSACTION;\n"
+             "INSERT INTO \"metadata\" VALUES('uniqueID','benchmark');\n"
+             "INSERT INTO \"metadata\" VALUES('mapID','examples.map-benchmark');\n"
+             "INSERT INTO \"metadata\" VALUES('includesMetadata','NO');\n"
+             "INSERT INTO \"metadata\" VALUES('includesMarkers','NO');\n"
+             "INSERT INTO \"metadata\" VALUES('imageQuality','0');\n"
+             "INSERT INTO \"metadata\" VALUES('region_latitude','0');\n"
+             "INSERT INTO \"metadata\" VALUES('region_longitude','0');\n"
+             "INSERT INTO \"metadata\" VALUES('region_latitude_delta','170');\n"
+             "INSERT INTO \"metadata\" VALUES('region_longitude_delta','360');\n"
+             "INSERT INTO \"metadata\" VALUES('minimumZ','0');\n"
+             "INSERT INTO \"metadata\" VALUES('maximumZ','%ld');\n"
+             "INSERT INTO \"metadata\" VALUES('schemaVersion','%ld');\n"
+             "DROP TABLE IF EXISTS queue;\n"
+             "COMMIT;",
+             maximumZ, (long)MBXOfflineMapDatabaseSchemaVersionDeduplicated);
+    success = success && sqlite3_exec(writer->db, metadata, NULL, NULL, NULL) == SQLITE_OK;
+
+    MBXBenchmarkPackWriterClose(writer);
+    return success;
+}
+
+
+bool MBXBenchmarkCreatePack(const char *path, uint64_t tileCount)
+{
+    MBXBenchmarkPackWriter *writer = MBXBenchmarkPackWriterCreate(path, MBXOfflineMapDownloaderCommitBatchCount, MBXOfflineMapDownloaderCommitBatchBytes);
+    if (!writer) return false;
+
+    bool success = true;
+    long z = 0;
+    uint64_t x, y;
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    for (uint64_t i = 0; i < tileCount && success; i++)
+    {
+        MBXBenchmarkTileAtIndex(i, &z, &x, &y);
+        success = MBXBenchmarkPackWriterAddTile(writer, z, x, y, data, MBXBenchmarkTileData(i, data));
+    }
+
+    return MBXBenchmarkPackWriterFinish(writer, z) && success;
+}
+
+
+bool MBXBenchmarkPackWriteTile(const char *path, long z, uint64_t x, uint64_t y, const uint8_t *data, size_t length)
+{
+    // Open the database, start a transaction, write the tile, and commit, with a fresh connection and statements every
+    // time and the default rollback journal, like -[MBXOfflineMapDownloader sqliteSaveDownloadedData:forURL:] did
+    //
+    MBXBenchmarkPackWriter writer = { 0 };
+    bool success = (sqlite3_open_v2(path, &writer.db, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK
+                    && sqlite3_exec(writer.db, "PRAGMA foreign_keys=ON; BEGIN TRANSACTION;", NULL, NULL, NULL) == SQLITE_OK);
+    for (size_t i = 0; success && i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        if (i != MBXOfflineMapDownloaderStatementInsertData && i != MBXOfflineMapDownloaderStatementInsertTile) continue;
+        success = (sqlite3_prepare_v2(writer.db, MBXOfflineMapDownloaderStatementSQL[i], -1, &writer.statements[i], NULL) == SQLITE_OK);
+    }
+    if (success)
+    {
+        success = MBXBenchmarkPackWriterWriteTile(&writer, &(MBXBenchmarkPackWrite){ z, x, y, (uint8_t *)data, length });
+        success = (sqlite3_exec(writer.db, (success ? "COMMIT;" : "ROLLBACK;"), NULL, NULL, NULL) == SQLITE_OK) && success;
+    }
+    if (!success) fprintf(stderr, "Can't write a tile to %s: %s\n", path, sqlite3_errmsg(writer.db));
+
+    for (size_t i = 0; i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        sqlite3_finalize(writer.statements[i]);
+    }
+    sqlite3_close(writer.db);
+    return success;
+}
@@ -0,0 +1,555 @@
+//
+//  MBXBenchmarkServer.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#define _XOPEN_SOURCE 700
+
+#include "MBXBenchmark.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MBXOfflineMapDownloaderCore.inc"
+
+#pragma mark - Local tile server
+
+// A stand-in for the tile API on the loopback interface. It serves the synthetic tiles at /v4/{z}/{x}/{y}.png, one
+// request per connection, after a delay which varies between half and one and a half times the configured latency.
+// A configurable share of the requests fail: half of them with a 503 response, and half by closing the connection
+// without one, which the downloader treats as a connectivity error.
+//
+// Every tile has an ETag, and requests with a matching If-None-Match get a 304 response without the tile, like the tile
+// API's. Bumping the revision changes a share of the tiles, so that updating an offline map can be measured.
+//
+#define MBXBenchmarkServerETagSize 48
+
+typedef struct {
+    int listener;
+    uint16_t port;
+    uint64_t latencyMilliseconds;
+    uint64_t errorPercent;
+    uint64_t seed;
+    _Atomic uint64_t revision;
+    uint64_t changedPercent;
+    pthread_t thread;
+    _Atomic uint64_t requests;
+    _Atomic uint64_t serverErrors;
+    _Atomic uint64_t droppedConnections;
+    _Atomic uint64_t notModified;
+    _Atomic uint64_t bytesSent;
+    _Atomic uint64_t responseBytesSent;
+} MBXBenchmarkServerState;
+
+typedef struct {
+    MBXBenchmarkServerState *server;
+    int connection;
+} MBXBenchmarkServerConnection;
+
+
+static bool MBXBenchmarkServerWriteAll(int connection, const void *bytes, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = send(connection, bytes, length, MSG_NOSIGNAL);
+        if (written <= 0) return false;
+        bytes = (const uint8_t *)bytes + written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+
+// Reads one request up to the end of its headers, which is all that a GET has
+//
+static ssize_t MBXBenchmarkServerReadRequest(int connection, char *buffer, size_t size)
+{
+    size_t length = 0;
+    while (length + 1 < size)
+    {
+        ssize_t count = recv(connection, buffer + length, size - length - 1, 0);
+        if (count <= 0) return -1;
+        length += (size_t)count;
+        buffer[length] = '\0';
+        if (strstr(buffer, "\r\n\r\n")) return (ssize_t)length;
+    }
+
+    return -1;
+}
+
+
+static uint64_t MBXBenchmarkServerTileIndex(long z, uint64_t x, uint64_t y)
+{
+    return (((uint64_t)1 << (2 * z)) - 1) / 3 + (y << z) + x;
+}
+
+
+// Writes the tile's current contents to buffer and its ETag to etag, and returns its length. Tiles which changed in the
+// current revision have different contents from the synthetic tile at the same index, and a different ETag.
+//
+static uint64_t MBXBenchmarkServerTileVersion(MBXBenchmarkServerState *server, uint64_t index)
+{
+    uint64_t revision = atomic_load(&server->revision);
+    uint64_t state = server->seed ^ (index * 0xbf58476d1ce4e5b9ULL);
+    return (revision > 0 && MBXBenchmarkRandom(&state) % 100 < server->changedPercent ? revision : 0);
+}
+
+
+static size_t MBXBenchmarkServerTileContents(MBXBenchmarkServerState *server, uint64_t index, uint8_t *buffer, char *etag)
+{
+    uint64_t version = MBXBenchmarkServerTileVersion(server, index);
+    size_t length = MBXBenchmarkTileData(index, buffer);
+    if (version > 0)
+    {
+        uint64_t state = version;
+        uint64_t change = MBXBenchmarkRandom(&state);
+        for (size_t i = 0; i < MIN(length, sizeof(uint64_t)); i++)
+        {
+            buffer[i] ^= (uint8_t)(change >> (8 * i));
+        }
+    }
+    snprintf(etag, MBXBenchmarkServerETagSize, "\"%llx-%llu\"", (unsigned long long)index, (unsigned long long)version);
+
+    return length;
+}
+
+
+// Copies the value of a header, up to the end of its line, or returns false if there's no such header
+//
+static bool MBXBenchmarkServerHeader(const char *headers, const char *name, char *value, size_t size)
+{
+    char field[64];
+    snprintf(field, sizeof(field), "\r\n%s: ", name);
+    const char *start = strstr(headers, field);
+    const char *end = (start ? strstr(start + strlen(field), "\r\n") : NULL);
+    if (!end) return false;
+
+    start += strlen(field);
+    size_t length = MIN((size_t)(end - start), size - 1);
+    memcpy(value, start, length);
+    value[length] = '\0';
+    return true;
+}
+
+
+static void *MBXBenchmarkServerHandleConnection(void *context)
+{
+    MBXBenchmarkServerConnection *handler = context;
+    MBXBenchmarkServerState *server = handler->server;
+    int connection = handler->connection;
+    free(handler);
+
+    char request[2048];
+    if (MBXBenchmarkServerReadRequest(connection, request, sizeof(request)) < 0)
+    {
+        close(connection);
+        return NULL;
+    }
+
+    uint64_t number = atomic_fetch_add(&server->requests, 1);
+    uint64_t state = server->seed ^ (number * 0x9e3779b97f4a7c15ULL);
+    uint64_t latency = server->latencyMilliseconds * 1000000ULL;
+    latency = latency / 2 + (latency > 0 ? MBXBenchmarkRandom(&state) % (latency + 1) : 0);
+    struct timespec delay = { (time_t)(latency / 1000000000ULL), (long)(latency % 1000000000ULL) };
+    nanosleep(&delay, NULL);
+
+    long z;
+    unsigned long long x, y;
+    char response[256];
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    char etag[MBXBenchmarkServerETagSize];
+    char ifNoneMatch[MBXBenchmarkServerETagSize];
+    bool failing = (MBXBenchmarkRandom(&state) % 100 < server->errorPercent);
+    if (failing && MBXBenchmarkRandom(&state) % 2)
+    {
+        atomic_fetch_add(&server->droppedConnections, 1);
+    }
+    else if (failing)
+    {
+        atomic_fetch_add(&server->serverErrors, 1);
+        int length = snprintf(response, sizeof(response), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        if (MBXBenchmarkServerWriteAll(connection, response, (size_t)length)) atomic_fetch_add(&server->responseBytesSent, (uint64_t)length);
+    }
+    else if (sscanf(request, "GET /v4/%ld/%llu/%llu.png HTTP/1.1", &z, &x, &y) == 3 && z >= 0 && z <= 12 && x < (1ULL << z) && y < (1ULL << z))
+    {
+        size_t dataLength = MBXBenchmarkServerTileContents(server, MBXBenchmarkServerTileIndex(z, x, y), data, etag);
+        if (MBXBenchmarkServerHeader(request, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) && strcmp(ifNoneMatch, etag) == 0)
+        {
+            atomic_fetch_add(&server->notModified, 1);
+            int length = snprintf(response, sizeof(response), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nConnection: close\r\n\r\n", etag);
+            if (MBXBenchmarkServerWriteAll(connection, response, (size_t)length)) atomic_fetch_add(&server->responseBytesSent, (uint64_t)length);
+        }
+        else
+        {
+            int length = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: %zu\r\nETag: %s\r\nConnection: close\r\n\r\n", dataLength, etag);
+            if (MBXBenchmarkServerWriteAll(connection, response, (size_t)length) && MBXBenchmarkServerWriteAll(connection, data, dataLength))
+            {
+                atomic_fetch_add(&server->bytesSent, dataLength);
+                atomic_fetch_add(&server->responseBytesSent, (uint64_t)length + dataLength);
+            }
+        }
+    }
+    else
+    {
+        int length = snprintf(response, sizeof(response), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        if (MBXBenchmarkServerWriteAll(connection, response, (size_t)length)) atomic_fetch_add(&server->responseBytesSent, (uint64_t)length);
+    }
+    close(connection);
+
+    return NULL;
+}
+
+
+static void *MBXBenchmarkServerRun(void *context)
+{
+    MBXBenchmarkServerState *server = context;
+    while (true)
+    {
+        int connection = accept(server->listener, NULL, NULL);
+        if (connection < 0) break;
+
+        // Each connection gets its own thread, so that the injected latency overlaps like a real server's would
+        //
+        MBXBenchmarkServerConnection *handler = malloc(sizeof(MBXBenchmarkServerConnection));
+        pthread_t thread;
+        *handler = (MBXBenchmarkServerConnection){ server, connection };
+        if (pthread_create(&thread, NULL, MBXBenchmarkServerHandleConnection, handler) == 0)
+        {
+            pthread_detach(thread);
+        }
+        else
+        {
+            close(connection);
+            free(handler);
+        }
+    }
+
+    return NULL;
+}
+
+
+static bool MBXBenchmarkServerStart(MBXBenchmarkServerState *server, const MBXBenchmarkOptions *options)
+{
+    memset(server, 0, sizeof(MBXBenchmarkServerState));
+    server->latencyMilliseconds = options->latencyMilliseconds;
+    server->errorPercent = options->errorPercent;
+    server->seed = options->seed;
+
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addressLength = sizeof(address);
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener < 0
+        || bind(server->listener, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(server->listener, 128) != 0
+        || getsockname(server->listener, (struct sockaddr *)&address, &addressLength) != 0
+        || pthread_create(&server->thread, NULL, MBXBenchmarkServerRun, server) != 0)
+    {
+        if (server->listener >= 0) close(server->listener);
+        return false;
+    }
+    server->port = ntohs(address.sin_port);
+
+    return true;
+}
+
+
+static void MBXBenchmarkServerStop(MBXBenchmarkServerState *server)
+{
+    // Shutting the listening socket down wakes up the accept() in the server thread. Handlers which are still running
+    // are detached, and they finish on their own.
+    //
+    shutdown(server->listener, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listener);
+}
+
+
+#pragma mark - Downloading tiles
+
+// Fetches a tile, and returns its HTTP status, or 0 for a connectivity error. With an ETag, the request is conditional,
+// like the downloader's requests when it updates an offline map. The response's ETag is copied to responseETag.
+//
+static int MBXBenchmarkServerFetchTile(uint16_t port, long z, uint64_t x, uint64_t y, const char *etag, uint8_t *data, size_t *dataLength, char *responseETag)
+{
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int connection = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection < 0) return 0;
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(connection);
+        return 0;
+    }
+
+    char request[256];
+    char conditional[MBXBenchmarkServerETagSize + 32] = "";
+    if (etag) snprintf(conditional, sizeof(conditional), "If-None-Match: %s\r\n", etag);
+    int requestLength = snprintf(request, sizeof(request), "GET /v4/%ld/%llu/%llu.png HTTP/1.1\r\nHost: 127.0.0.1\r\n%sConnection: close\r\n\r\n",
+                                 z, (unsigned long long)x, (unsigned long long)y, conditional);
+    char response[MBXBenchmarkMaximumTileSize + 512];
+    size_t length = 0;
+    if (MBXBenchmarkServerWriteAll(connection, request, (size_t)requestLength))
+    {
+        ssize_t count;
+        while (length < sizeof(response) - 1 && (count = recv(connection, response + length, sizeof(response) - 1 - length, 0)) > 0)
+        {
+            length += (size_t)count;
+        }
+    }
+    close(connection);
+    response[length] = '\0';
+
+    int status = 0;
+    char *body = strstr(response, "\r\n\r\n");
+    if (!body || sscanf(response, "HTTP/1.1 %d", &status) != 1) return 0;
+
+    *body = '\0';
+    if (!MBXBenchmarkServerHeader(response, "ETag", responseETag, MBXBenchmarkServerETagSize)) responseETag[0] = '\0';
+    body += 4;
+    *dataLength = MIN(length - (size_t)(body - response), (size_t)MBXBenchmarkMaximumTileSize);
+    memcpy(data, body, *dataLength);
+
+    return status;
+}
+
+
+typedef struct {
+    uint16_t port;
+    uint64_t tileCount;
+    _Atomic uint64_t *nextTile;
+    uint64_t *samples;
+    _Atomic uint64_t *sampleCount;
+    uint64_t serverErrors;
+    uint64_t connectivityErrors;
+    uint64_t failedTiles;
+    uint64_t wrongTiles;
+    MBXBenchmarkServerState *server;
+    char (*etags)[MBXBenchmarkServerETagSize];
+    uint64_t notModified;
+} MBXBenchmarkServerWorker;
+
+
+static void *MBXBenchmarkServerRunWorker(void *context)
+{
+    // Each worker is one slot of the download window. Failed requests are retried right away rather than after the
+    // downloader's backoff delay, up to the same number of attempts. Workers with ETags make conditional requests with
+    // them, and keep the new ETags of the tiles which changed, like the downloader's validators table.
+    //
+    MBXBenchmarkServerWorker *worker = context;
+    uint8_t data[MBXBenchmarkMaximumTileSize];
+    uint8_t expected[MBXBenchmarkMaximumTileSize];
+    char responseETag[MBXBenchmarkServerETagSize];
+    char expectedETag[MBXBenchmarkServerETagSize];
+    uint64_t index;
+    while ((index = atomic_fetch_add(worker->nextTile, 1)) < worker->tileCount)
+    {
+        long z;
+        uint64_t x, y;
+        MBXBenchmarkTileAtIndex(index, &z, &x, &y);
+
+        const char *etag = (worker->etags && worker->etags[index][0] ? worker->etags[index] : NULL);
+        int status = 0;
+        size_t dataLength = 0;
+        for (NSInteger attempt = 0; attempt < MBXOfflineMapDownloaderMaximumAttempts && status != 200 && status != 304; attempt++)
+        {
+            uint64_t start = MBXBenchmarkNow();
+            status = MBXBenchmarkServerFetchTile(worker->port, z, x, y, etag, data, &dataLength, responseETag);
+            worker->samples[atomic_fetch_add(worker->sampleCount, 1)] = MBXBenchmarkNow() - start;
+            if (status == 0) worker->connectivityErrors++;
+            else if (status != 200 && status != 304) worker->serverErrors++;
+        }
+
+        if (status != 200 && status != 304)
+        {
+            worker->failedTiles++;
+            continue;
+        }
+
+        // A tile which wasn't modified has to still have the ETag it was downloaded with, and a tile which was has to
+        // arrive with its new contents and ETag
+        //
+        size_t expectedLength = MBXBenchmarkServerTileContents(worker->server, index, expected, expectedETag);
+        if (status == 304)
+        {
+            worker->notModified++;
+            if (!etag || strcmp(etag, expectedETag) != 0) worker->wrongTiles++;
+            continue;
+        }
+        if (dataLength != expectedLength || memcmp(data, expected, expectedLength) != 0 || strcmp(responseETag, expectedETag) != 0)
+        {
+            worker->wrongTiles++;
+        }
+        if (worker->etags) memcpy(worker->etags[index], responseETag, MBXBenchmarkServerETagSize);
+    }
+
+    return NULL;
+}
+
+
+// Downloads the first tileCount tiles with a window of as many workers, and returns how long it took
+//
+static uint64_t MBXBenchmarkServerDownload(MBXBenchmarkServerState *server, uint64_t tileCount, NSUInteger window, uint64_t *samples,
+                                           char (*etags)[MBXBenchmarkServerETagSize], MBXBenchmarkServerWorker *total, uint64_t *requests)
+{
+    _Atomic uint64_t nextTile = 0;
+    _Atomic uint64_t sampleCount = 0;
+    MBXBenchmarkServerWorker workers[MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads];
+    pthread_t threads[MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads];
+    uint64_t start = MBXBenchmarkNow();
+    for (NSUInteger i = 0; i < window; i++)
+    {
+        workers[i] = (MBXBenchmarkServerWorker){ server->port, tileCount, &nextTile, samples, &sampleCount, 0, 0, 0, 0, server, etags, 0 };
+        pthread_create(&threads[i], NULL, MBXBenchmarkServerRunWorker, &workers[i]);
+    }
+    memset(total, 0, sizeof(MBXBenchmarkServerWorker));
+    for (NSUInteger i = 0; i < window; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total->serverErrors += workers[i].serverErrors;
+        total->connectivityErrors += workers[i].connectivityErrors;
+        total->failedTiles += workers[i].failedTiles;
+        total->wrongTiles += workers[i].wrongTiles;
+        total->notModified += workers[i].notModified;
+    }
+    *requests = atomic_load(&sampleCount);
+
+    return MBXBenchmarkNow() - start;
+}
+
+
+#pragma mark - Updates
+
+// Share of the tiles which change between the first download of the updated offline map and its update
+//
+static uint64_t const MBXBenchmarkServerChangedPercent = 10;
+
+
+// Downloads a pack's tiles, and then updates it with conditional requests twice: once when none of its tiles have
+// changed, and once when some of them have. The bytes the server sent each time are what an update costs the user.
+// Failures are turned off for this, so that retries don't count towards the bytes.
+//
+static bool MBXBenchmarkServerUpdates(MBXBenchmarkServerState *server, uint64_t tileCount, uint64_t *samples)
+{
+    MBXBenchmarkBeginObject("conditional_updates");
+    MBXBenchmarkWriteInteger("tiles", tileCount);
+    MBXBenchmarkWriteInteger("changed_percent", MBXBenchmarkServerChangedPercent);
+
+    char (*etags)[MBXBenchmarkServerETagSize] = calloc(MAX(tileCount, (uint64_t)1), MBXBenchmarkServerETagSize);
+    server->errorPercent = 0;
+    server->changedPercent = MBXBenchmarkServerChangedPercent;
+
+    const char *names[3] = { "initial_download", "unchanged", "partially_changed" };
+    uint64_t initialResponseBytes = 0;
+    bool success = (etags != NULL);
+    for (int phase = 0; phase < 3 && success; phase++)
+    {
+        if (phase == 2) atomic_fetch_add(&server->revision, 1);
+        uint64_t changedTiles = 0;
+        for (uint64_t i = 0; i < tileCount && phase == 2; i++)
+        {
+            changedTiles += (MBXBenchmarkServerTileVersion(server, i) > 0);
+        }
+
+        uint64_t bytesBefore = atomic_load(&server->bytesSent);
+        uint64_t responseBytesBefore = atomic_load(&server->responseBytesSent);
+        MBXBenchmarkServerWorker total;
+        uint64_t requests;
+        uint64_t nanoseconds = MBXBenchmarkServerDownload(server, tileCount, MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads, samples, etags, &total, &requests);
+        uint64_t bodyBytes = atomic_load(&server->bytesSent) - bytesBefore;
+        uint64_t responseBytes = atomic_load(&server->responseBytesSent) - responseBytesBefore;
+        if (phase == 0) initialResponseBytes = responseBytes;
+
+        // Only the tiles which changed since the last download come back with their contents
+        //
+        uint64_t downloaded = tileCount - total.notModified - total.failedTiles;
+        bool phaseSuccess = (total.failedTiles == 0 && total.wrongTiles == 0 && downloaded == (phase == 1 ? 0 : (phase == 2 ? changedTiles : tileCount)));
+
+        MBXBenchmarkBeginObject(names[phase]);
+        MBXBenchmarkWriteInteger("requests", requests);
+        MBXBenchmarkWriteInteger("not_modified", total.notModified);
+        MBXBenchmarkWriteInteger("downloaded", downloaded);
+        MBXBenchmarkWriteInteger("body_bytes", bodyBytes);
+        MBXBenchmarkWriteInteger("response_bytes", responseBytes);
+        MBXBenchmarkWriteDouble("share_of_full_download", (double)responseBytes / (double)MAX(initialResponseBytes, (uint64_t)1));
+        MBXBenchmarkWriteDouble("total_ms", (double)nanoseconds / 1e6);
+        MBXBenchmarkWriteBool("passed", phaseSuccess);
+        MBXBenchmarkEndObject();
+        success = success && phaseSuccess;
+    }
+    free(etags);
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkServer(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("tile_server");
+    MBXBenchmarkWriteInteger("latency_ms", options->latencyMilliseconds);
+    MBXBenchmarkWriteInteger("error_percent", options->errorPercent);
+
+    MBXBenchmarkServerState server;
+    bool success = MBXBenchmarkServerStart(&server, options);
+    if (!success) fprintf(stderr, "Can't start the local tile server\n");
+
+    // The same tiles are downloaded one at a time, with the downloader's initial window, and with its largest window.
+    // Tiles only go up to zoom level 12, which the server checks.
+    //
+    uint64_t tileCount = MIN(options->requestCount, (uint64_t)22369621);
+    NSUInteger windows[3] = { 1, MBXOfflineMapDownloaderInitialWindow, MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads };
+    uint64_t maximumRequests = tileCount * MBXOfflineMapDownloaderMaximumAttempts;
+    uint64_t *samples = malloc(MAX(maximumRequests, (uint64_t)1) * sizeof(uint64_t));
+    for (int w = 0; w < 3 && success; w++)
+    {
+        uint64_t requestsBefore = atomic_load(&server.requests);
+        uint64_t serverErrorsBefore = atomic_load(&server.serverErrors);
+        uint64_t droppedBefore = atomic_load(&server.droppedConnections);
+
+        MBXBenchmarkServerWorker total;
+        uint64_t requests;
+        uint64_t nanoseconds = MBXBenchmarkServerDownload(&server, tileCount, windows[w], samples, NULL, &total, &requests);
+
+        // Every error the server injected has to come back as the same kind of error, and every tile has to arrive
+        // intact, unless all of its attempts happened to fail
+        //
+        uint64_t injectedServerErrors = atomic_load(&server.serverErrors) - serverErrorsBefore;
+        uint64_t injectedDrops = atomic_load(&server.droppedConnections) - droppedBefore;
+        bool errorsMatch = (total.serverErrors == injectedServerErrors && total.connectivityErrors == injectedDrops
+                            && atomic_load(&server.requests) - requestsBefore == requests);
+
+        char name[32];
+        snprintf(name, sizeof(name), "window_%lu", windows[w]);
+        MBXBenchmarkBeginObject(name);
+        MBXBenchmarkWriteInteger("tiles", tileCount);
+        MBXBenchmarkWriteInteger("requests", requests);
+        MBXBenchmarkWriteInteger("p50_us", MBXBenchmarkPercentile(samples, requests, 50.0) / 1000);
+        MBXBenchmarkWriteInteger("p99_us", MBXBenchmarkPercentile(samples, requests, 99.0) / 1000);
+        MBXBenchmarkWriteDouble("tiles_per_second", (double)tileCount / ((double)nanoseconds / 1e9));
+        MBXBenchmarkWriteInteger("server_errors", total.serverErrors);
+        MBXBenchmarkWriteInteger("connectivity_errors", total.connectivityErrors);
+        MBXBenchmarkWriteBool("errors_match", errorsMatch);
+        MBXBenchmarkWriteInteger("failed_tiles", total.failedTiles);
+        MBXBenchmarkWriteInteger("wrong_tiles", total.wrongTiles);
+        MBXBenchmarkEndObject();
+
+        success = errorsMatch && total.wrongTiles == 0 && (options->errorPercent > 0 || total.failedTiles == 0);
+    }
+    success = success && MBXBenchmarkServerUpdates(&server, tileCount, samples);
+    free(samples);
+
+    if (server.port) MBXBenchmarkServerStop(&server);
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
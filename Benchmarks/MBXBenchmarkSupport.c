@@ -0,0 +1,134 @@
+//
+//  MBXBenchmarkSupport.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#define _XOPEN_SOURCE 700
+
+#include "MBXBenchmark.h"
+
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma mark - Timing and statistics
+
+uint64_t MBXBenchmarkNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+
+uint64_t MBXBenchmarkRandom(uint64_t *state)
+{
+    // splitmix64
+    //
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+static int MBXBenchmarkCompareSamples(const void *a, const void *b)
+{
+    uint64_t sa = *(const uint64_t *)a;
+    uint64_t sb = *(const uint64_t *)b;
+    return (sa < sb ? -1 : (sa > sb ? 1 : 0));
+}
+
+
+uint64_t MBXBenchmarkPercentile(uint64_t *samples, size_t count, double percentile)
+{
+    if (count == 0) return 0;
+
+    qsort(samples, count, sizeof(uint64_t), MBXBenchmarkCompareSamples);
+    size_t index = (size_t)ceil(percentile / 100.0 * (double)count);
+    return samples[MIN(MAX(index, (size_t)1), count) - 1];
+}
+
+
+static char MBXBenchmarkTemporaryPath[] = "/tmp/mbx-benchmarks-XXXXXX";
+static bool MBXBenchmarkTemporaryPathCreated = false;
+
+
+static int MBXBenchmarkRemoveFile(const char *path, const struct stat *info, int type, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+
+static void MBXBenchmarkRemoveTemporaryDirectory(void)
+{
+    nftw(MBXBenchmarkTemporaryPath, MBXBenchmarkRemoveFile, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+
+const char *MBXBenchmarkTemporaryDirectory(void)
+{
+    if (!MBXBenchmarkTemporaryPathCreated)
+    {
+        if (!mkdtemp(MBXBenchmarkTemporaryPath)) return NULL;
+        MBXBenchmarkTemporaryPathCreated = true;
+        atexit(MBXBenchmarkRemoveTemporaryDirectory);
+    }
+
+    return MBXBenchmarkTemporaryPath;
+}
+
+
+#pragma mark - JSON output
+
+static int MBXBenchmarkDepth = 0;
+static bool MBXBenchmarkNeedsComma = false;
+
+
+static void MBXBenchmarkWriteName(const char *name)
+{
+    printf("%s\n%*s", (MBXBenchmarkNeedsComma ? "," : ""), 2 * MBXBenchmarkDepth, "");
+    if (name) printf("\"%s\": ", name);
+    MBXBenchmarkNeedsComma = true;
+}
+
+
+void MBXBenchmarkBeginObject(const char *name)
+{
+    if (MBXBenchmarkDepth > 0) MBXBenchmarkWriteName(name);
+    printf("{");
+    MBXBenchmarkDepth++;
+    MBXBenchmarkNeedsComma = false;
+}
+
+
+void MBXBenchmarkEndObject(void)
+{
+    MBXBenchmarkDepth--;
+    printf("\n%*s}", 2 * MBXBenchmarkDepth, "");
+    if (MBXBenchmarkDepth == 0) printf("\n");
+    MBXBenchmarkNeedsComma = true;
+}
+
+
+void MBXBenchmarkWriteInteger(const char *name, uint64_t value)
+{
+    MBXBenchmarkWriteName(name);
+    printf("%llu", (unsigned long long)value);
+}
+
+
+void MBXBenchmarkWriteDouble(const char *name, double value)
+{
+    MBXBenchmarkWriteName(name);
+    printf("%.6g", (isfinite(value) ? value : 0.0));
+}
+
+
+void MBXBenchmarkWriteBool(const char *name, bool value)
+{
+    MBXBenchmarkWriteName(name);
+    printf("%s", (value ? "true" : "false"));
+}
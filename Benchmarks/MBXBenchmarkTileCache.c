@@ -0,0 +1,507 @@
+//
+//  MBXBenchmarkRasterTileCache.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include <pthread.h>
+
+#include "MBXRasterTileCacheCore.inc"
+
+#pragma mark - Tile cache
+
+// MBXRasterTileCache from MBXRasterTileRenderer.m, with an open addressing hash table in place of the CFSet, using the
+// same hash and equality callbacks. Objects are just non-NULL markers, since there are no bitmaps to keep.
+//
+typedef struct {
+    pthread_rwlock_t lock;
+    MBXRasterTileCacheEntry **slots;
+    size_t slotCount;
+    size_t usedSlots;
+    size_t count;
+    MBXRasterTileCacheEntry *oldest;
+    MBXRasterTileCacheEntry *newest;
+    NSUInteger totalCost;
+    NSUInteger totalCostLimit;
+    _Atomic uint64_t clock;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t evictions;
+} MBXBenchmarkRasterTileCache;
+
+static MBXRasterTileCacheEntry MBXBenchmarkTileCacheRemovedEntry;
+
+
+static size_t MBXBenchmarkTileCacheSlot(const MBXBenchmarkRasterTileCache *cache, const MBXRasterTileCacheEntry *probe, bool forInsert)
+{
+    size_t mask = cache->slotCount - 1;
+    size_t slot = (size_t)MBXRasterTileCacheEntryHash(probe) & mask;
+    size_t firstRemoved = SIZE_MAX;
+    while (cache->slots[slot])
+    {
+        if (cache->slots[slot] == &MBXBenchmarkTileCacheRemovedEntry)
+        {
+            if (firstRemoved == SIZE_MAX) firstRemoved = slot;
+        }
+        else if (MBXRasterTileCacheEntryEqual(cache->slots[slot], probe))
+        {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return (forInsert && firstRemoved != SIZE_MAX ? firstRemoved : slot);
+}
+
+
+static MBXRasterTileCacheEntry *MBXBenchmarkTileCacheGetValue(const MBXBenchmarkRasterTileCache *cache, const MBXRasterTileCacheEntry *probe)
+{
+    MBXRasterTileCacheEntry *entry = cache->slots[MBXBenchmarkTileCacheSlot(cache, probe, false)];
+    return (entry == &MBXBenchmarkTileCacheRemovedEntry ? NULL : entry);
+}
+
+
+static void MBXBenchmarkTileCacheAddValue(MBXBenchmarkRasterTileCache *cache, MBXRasterTileCacheEntry *entry)
+{
+    // Keep the table at most half full, counting removed slots, so that probes stay short
+    //
+    if (2 * (cache->usedSlots + 1) > cache->slotCount)
+    {
+        MBXRasterTileCacheEntry **slots = cache->slots;
+        size_t slotCount = cache->slotCount;
+        cache->slotCount = 64;
+        while (cache->slotCount < 4 * (cache->count + 1)) cache->slotCount *= 2;
+        cache->slots = calloc(cache->slotCount, sizeof(MBXRasterTileCacheEntry *));
+        cache->usedSlots = cache->count;
+        for (size_t i = 0; i < slotCount; i++)
+        {
+            if (slots[i] && slots[i] != &MBXBenchmarkTileCacheRemovedEntry) cache->slots[MBXBenchmarkTileCacheSlot(cache, slots[i], true)] = slots[i];
+        }
+        free(slots);
+    }
+
+    size_t slot = MBXBenchmarkTileCacheSlot(cache, entry, true);
+    if (!cache->slots[slot]) cache->usedSlots++;
+    cache->slots[slot] = entry;
+    cache->count++;
+}
+
+
+static void MBXBenchmarkTileCacheRemoveValue(MBXBenchmarkRasterTileCache *cache, MBXRasterTileCacheEntry *entry)
+{
+    cache->slots[MBXBenchmarkTileCacheSlot(cache, entry, false)] = &MBXBenchmarkTileCacheRemovedEntry;
+    cache->count--;
+}
+
+
+static void MBXBenchmarkTileCacheLinkNewestEntry(MBXBenchmarkRasterTileCache *cache, MBXRasterTileCacheEntry *entry)
+{
+    entry->linkedAccess = atomic_load(&entry->lastAccess);
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest)
+    {
+        cache->newest->newer = entry;
+    }
+    else
+    {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+
+static void MBXBenchmarkTileCacheUnlinkEntry(MBXBenchmarkRasterTileCache *cache, MBXRasterTileCacheEntry *entry)
+{
+    if (entry->older)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+    if (entry->newer)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    entry->older = NULL;
+    entry->newer = NULL;
+}
+
+
+static void MBXBenchmarkTileCacheEvictEntries(MBXBenchmarkRasterTileCache *cache, MBXRasterTileCacheEntry *keep)
+{
+    while (cache->totalCost > cache->totalCostLimit && cache->oldest && cache->oldest != keep)
+    {
+        MBXRasterTileCacheEntry *entry = cache->oldest;
+        MBXBenchmarkTileCacheUnlinkEntry(cache, entry);
+
+        if (atomic_load(&entry->lastAccess) != entry->linkedAccess)
+        {
+            // This entry has been used since it was linked, so give it another trip through the list
+            MBXBenchmarkTileCacheLinkNewestEntry(cache, entry);
+            continue;
+        }
+
+        MBXBenchmarkTileCacheRemoveValue(cache, entry);
+        cache->totalCost -= entry->cost;
+        free(entry);
+        atomic_fetch_add(&cache->evictions, 1);
+    }
+}
+
+
+static void MBXBenchmarkTileCacheInit(MBXBenchmarkRasterTileCache *cache, NSUInteger totalCostLimit)
+{
+    memset(cache, 0, sizeof(MBXBenchmarkRasterTileCache));
+    pthread_rwlock_init(&cache->lock, NULL);
+    cache->totalCostLimit = totalCostLimit;
+}
+
+
+static void MBXBenchmarkTileCacheDestroy(MBXBenchmarkRasterTileCache *cache)
+{
+    MBXRasterTileCacheEntry *entry = cache->oldest;
+    while (entry)
+    {
+        MBXRasterTileCacheEntry *newer = entry->newer;
+        free(entry);
+        entry = newer;
+    }
+    free(cache->slots);
+    pthread_rwlock_destroy(&cache->lock);
+}
+
+
+static bool MBXBenchmarkTileCacheObjectForKey(MBXBenchmarkRasterTileCache *cache, uint64_t key, bool countingLookup)
+{
+    CFTypeRef object = NULL;
+    MBXRasterTileCacheEntry probe = { .key = key };
+
+    pthread_rwlock_rdlock(&cache->lock);
+    MBXRasterTileCacheEntry *entry = (cache->slots ? MBXBenchmarkTileCacheGetValue(cache, &probe) : NULL);
+    if (entry)
+    {
+        atomic_store(&entry->lastAccess, atomic_fetch_add(&cache->clock, 1) + 1);
+        object = entry->object;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (countingLookup)
+    {
+        atomic_fetch_add((object ? &cache->hits : &cache->misses), 1);
+    }
+
+    return (object != NULL);
+}
+
+
+static void MBXBenchmarkTileCacheSetObject(MBXBenchmarkRasterTileCache *cache, uint64_t key, NSUInteger cost)
+{
+    MBXRasterTileCacheEntry probe = { .key = key };
+
+    pthread_rwlock_wrlock(&cache->lock);
+    MBXRasterTileCacheEntry *entry = (cache->slots ? MBXBenchmarkTileCacheGetValue(cache, &probe) : NULL);
+    if (entry)
+    {
+        cache->totalCost -= entry->cost;
+        MBXBenchmarkTileCacheUnlinkEntry(cache, entry);
+    }
+    else
+    {
+        entry = calloc(1, sizeof(MBXRasterTileCacheEntry));
+        entry->key = key;
+        MBXBenchmarkTileCacheAddValue(cache, entry);
+    }
+    entry->object = (CFTypeRef)entry;
+    entry->cost = cost;
+    cache->totalCost += cost;
+    MBXBenchmarkTileCacheLinkNewestEntry(cache, entry);
+
+    MBXBenchmarkTileCacheEvictEntries(cache, entry);
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+
+// Walks the list and checks it against the hash table and the total cost, which a bug in the relinking would throw off
+//
+static bool MBXBenchmarkTileCacheIsConsistent(const MBXBenchmarkRasterTileCache *cache)
+{
+    size_t count = 0;
+    NSUInteger totalCost = 0;
+    for (MBXRasterTileCacheEntry *entry = cache->oldest; entry; entry = entry->newer)
+    {
+        if (MBXBenchmarkTileCacheGetValue(cache, entry) != entry || (entry->newer && entry->newer->older != entry)) return false;
+        count++;
+        totalCost += entry->cost;
+    }
+
+    return (count == cache->count && totalCost == cache->totalCost);
+}
+
+
+#pragma mark - Pan and zoom traces
+
+// A trace is the map's visible region in each frame, as a zoom level (which MapKit changes continuously while pinching)
+// and the center of the view in normalized map coordinates. Recorded traces are text files with one frame per line.
+//
+typedef struct {
+    double zoom;
+    double x;
+    double y;
+} MBXBenchmarkTraceFrame;
+
+typedef struct {
+    MBXBenchmarkTraceFrame *frames;
+    size_t count;
+    size_t capacity;
+} MBXBenchmarkTrace;
+
+// A phone screen in points, showing 512px tiles at 2x, which take 1 MB each once they're decoded
+//
+static double const MBXBenchmarkTraceViewWidth = 375.0;
+static double const MBXBenchmarkTraceViewHeight = 667.0;
+static NSUInteger const MBXBenchmarkTraceTileCost = 1024 * 1024;
+
+
+static void MBXBenchmarkTraceAddFrame(MBXBenchmarkTrace *trace, double zoom, double x, double y)
+{
+    if (trace->count == trace->capacity)
+    {
+        trace->capacity = MAX(trace->capacity * 2, (size_t)256);
+        trace->frames = realloc(trace->frames, trace->capacity * sizeof(MBXBenchmarkTraceFrame));
+    }
+    x -= floor(x);
+    y = MIN(MAX(y, 0.0), 1.0);
+    trace->frames[trace->count++] = (MBXBenchmarkTraceFrame){ zoom, x, y };
+}
+
+
+static bool MBXBenchmarkTraceRead(const char *path, MBXBenchmarkTrace *trace)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+
+    double zoom, x, y;
+    while (fscanf(file, "%lf %lf %lf", &zoom, &x, &y) == 3)
+    {
+        MBXBenchmarkTraceAddFrame(trace, MIN(MAX(zoom, 0.0), 22.0), x, y);
+    }
+    fclose(file);
+
+    return (trace->count > 0);
+}
+
+
+// Panning around a city at street level, with flicks which coast to a stop, like looking for a place
+//
+static void MBXBenchmarkTracePan(MBXBenchmarkTrace *trace, uint64_t seed)
+{
+    uint64_t state = seed;
+    double zoom = 15.5;
+    double worldPoints = 256.0 * pow(2.0, zoom);
+    double x = 0.2, y = 0.38, vx = 0.0, vy = 0.0;
+    for (int frame = 0; frame < 1800; frame++)
+    {
+        if (frame % 90 == 0)
+        {
+            vx = ((double)(MBXBenchmarkRandom(&state) % 4001) - 2000.0) / 50.0;
+            vy = ((double)(MBXBenchmarkRandom(&state) % 4001) - 2000.0) / 50.0;
+        }
+        vx *= 0.95;
+        vy *= 0.95;
+        x += vx / worldPoints;
+        y += vy / worldPoints;
+        MBXBenchmarkTraceAddFrame(trace, zoom, x, y);
+    }
+}
+
+
+// Pinching in from a country to a street and back out again, drifting a little, several times over
+//
+static void MBXBenchmarkTraceZoom(MBXBenchmarkTrace *trace, uint64_t seed)
+{
+    uint64_t state = seed;
+    double x = 0.3, y = 0.37;
+    for (int cycle = 0; cycle < 6; cycle++)
+    {
+        for (int frame = 0; frame < 300; frame++)
+        {
+            double zoom = 8.0 + 8.0 * (0.5 - 0.5 * cos(2.0 * M_PI * frame / 300.0));
+            double worldPoints = 256.0 * pow(2.0, zoom);
+            x += ((double)(MBXBenchmarkRandom(&state) % 41) - 20.0) / worldPoints;
+            y += ((double)(MBXBenchmarkRandom(&state) % 41) - 20.0) / worldPoints;
+            MBXBenchmarkTraceAddFrame(trace, zoom, x, y);
+        }
+    }
+}
+
+
+// Going back and forth between a few places, zooming out to get from one to the next, which is where keeping tiles
+// around pays off
+//
+static void MBXBenchmarkTraceBrowse(MBXBenchmarkTrace *trace, uint64_t seed)
+{
+    uint64_t state = seed;
+    double places[4][2] = { { 0.20, 0.38 }, { 0.21, 0.385 }, { 0.205, 0.37 }, { 0.22, 0.39 } };
+    double x = places[0][0], y = places[0][1];
+    for (int trip = 0; trip < 12; trip++)
+    {
+        int place = (int)(MBXBenchmarkRandom(&state) % 4);
+        double startX = x, startY = y;
+        for (int frame = 0; frame < 150; frame++)
+        {
+            double t = frame / 149.0;
+            double zoom = 14.0 - 4.0 * sin(M_PI * t);
+            x = startX + (places[place][0] - startX) * t;
+            y = startY + (places[place][1] - startY) * t;
+            MBXBenchmarkTraceAddFrame(trace, zoom, x, y);
+        }
+        for (int frame = 0; frame < 60; frame++)
+        {
+            MBXBenchmarkTraceAddFrame(trace, 14.0, x + sin(frame / 10.0) * 200.0 / (256.0 * pow(2.0, 14.0)), y);
+        }
+    }
+}
+
+
+#pragma mark - Replaying traces
+
+typedef struct {
+    uint64_t lookups;
+    uint64_t fallbacks;
+    uint64_t nanoseconds;
+    NSUInteger peakCost;
+    bool consistent;
+} MBXBenchmarkTraceResult;
+
+
+// Replays a trace the way the renderer uses its cache: each visible tile is looked up, and a tile which isn't cached is
+// stood in for by a cached ancestor while it loads. Loads finish before the next frame. Eviction stops at the newest
+// entry once everything older than it has been promoted, so the cache can go over its limit until the next insert, and
+// the peak shows by how much.
+//
+static MBXBenchmarkTraceResult MBXBenchmarkTraceReplay(const MBXBenchmarkTrace *trace, MBXBenchmarkRasterTileCache *cache)
+{
+    MBXBenchmarkTraceResult result = { 0, 0, 0, 0, true };
+    uint64_t start = MBXBenchmarkNow();
+    for (size_t f = 0; f < trace->count; f++)
+    {
+        const MBXBenchmarkTraceFrame *frame = &trace->frames[f];
+        long z = (long)floor(frame->zoom);
+        long tilesPerSide = 1L << z;
+        double tilePoints = 256.0 * pow(2.0, frame->zoom - (double)z);
+        double centerX = frame->x * tilePoints * (double)tilesPerSide;
+        double centerY = frame->y * tilePoints * (double)tilesPerSide;
+        long minX = (long)floor((centerX - MBXBenchmarkTraceViewWidth / 2.0) / tilePoints);
+        long maxX = (long)floor((centerX + MBXBenchmarkTraceViewWidth / 2.0) / tilePoints);
+        long minY = MAX((long)floor((centerY - MBXBenchmarkTraceViewHeight / 2.0) / tilePoints), 0);
+        long maxY = MIN((long)floor((centerY + MBXBenchmarkTraceViewHeight / 2.0) / tilePoints), tilesPerSide - 1);
+
+        for (long ty = minY; ty <= maxY; ty++)
+        {
+            for (long tx = minX; tx <= maxX; tx++)
+            {
+                uint64_t x = (uint64_t)(((tx % tilesPerSide) + tilesPerSide) % tilesPerSide);
+                uint64_t y = (uint64_t)ty;
+                uint64_t key = ((uint64_t)z << 58) | ((x & 0x1fffffff) << 29) | (y & 0x1fffffff);
+                result.lookups++;
+                if (MBXBenchmarkTileCacheObjectForKey(cache, key, true)) continue;
+
+                for (long levels = 1; levels <= (long)MBXRasterTileRendererDefaultMaximumFallbackZoomLevels && z - levels >= 0; levels++)
+                {
+                    uint64_t ancestor = ((uint64_t)(z - levels) << 58) | (((x >> levels) & 0x1fffffff) << 29) | ((y >> levels) & 0x1fffffff);
+                    if (MBXBenchmarkTileCacheObjectForKey(cache, ancestor, false))
+                    {
+                        result.fallbacks++;
+                        break;
+                    }
+                }
+                MBXBenchmarkTileCacheSetObject(cache, key, MBXBenchmarkTraceTileCost);
+                result.peakCost = MAX(result.peakCost, cache->totalCost);
+            }
+        }
+    }
+    result.nanoseconds = MBXBenchmarkNow() - start;
+    result.consistent = result.consistent && MBXBenchmarkTileCacheIsConsistent(cache);
+
+    return result;
+}
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkTileCache(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("tile_cache");
+    MBXBenchmarkWriteInteger("default_size_limit", MBXRasterTileRendererDefaultCacheSizeLimit);
+
+    MBXBenchmarkTrace traces[3];
+    const char *names[3] = { "pan", "zoom", "browse" };
+    memset(traces, 0, sizeof(traces));
+    size_t traceCount = 3;
+    bool success = true;
+    if (options->traceFile)
+    {
+        names[0] = "recorded";
+        traceCount = 1;
+        success = MBXBenchmarkTraceRead(options->traceFile, &traces[0]);
+        if (!success) fprintf(stderr, "Can't read a trace from %s\n", options->traceFile);
+    }
+    else
+    {
+        MBXBenchmarkTracePan(&traces[0], options->seed);
+        MBXBenchmarkTraceZoom(&traces[1], options->seed);
+        MBXBenchmarkTraceBrowse(&traces[2], options->seed);
+    }
+
+    // Each trace is replayed with the default size limit, and with half and twice as much room
+    //
+    NSUInteger limits[3] = { MBXRasterTileRendererDefaultCacheSizeLimit / 2, MBXRasterTileRendererDefaultCacheSizeLimit, MBXRasterTileRendererDefaultCacheSizeLimit * 2 };
+    for (size_t t = 0; t < traceCount && success; t++)
+    {
+        MBXBenchmarkBeginObject(names[t]);
+        MBXBenchmarkWriteInteger("frames", traces[t].count);
+        for (size_t l = 0; l < 3; l++)
+        {
+            MBXBenchmarkRasterTileCache cache;
+            MBXBenchmarkTileCacheInit(&cache, limits[l]);
+            MBXBenchmarkTraceResult result = MBXBenchmarkTraceReplay(&traces[t], &cache);
+
+            uint64_t hits = atomic_load(&cache.hits);
+            uint64_t misses = atomic_load(&cache.misses);
+            char name[32];
+            snprintf(name, sizeof(name), "limit_%lu_mb", limits[l] / (1024 * 1024));
+            MBXBenchmarkBeginObject(name);
+            MBXBenchmarkWriteInteger("lookups", result.lookups);
+            MBXBenchmarkWriteDouble("hit_ratio", (double)hits / (double)MAX(hits + misses, (uint64_t)1));
+            MBXBenchmarkWriteDouble("fallback_ratio", (double)result.fallbacks / (double)MAX(misses, (uint64_t)1));
+            MBXBenchmarkWriteInteger("evictions", atomic_load(&cache.evictions));
+            MBXBenchmarkWriteDouble("peak_mb", (double)result.peakCost / (1024.0 * 1024.0));
+            MBXBenchmarkWriteDouble("ns_per_lookup", (double)result.nanoseconds / (double)MAX(result.lookups, (uint64_t)1));
+            MBXBenchmarkWriteBool("consistent", result.consistent);
+            MBXBenchmarkEndObject();
+
+            success = success && result.consistent && hits + misses == result.lookups;
+            MBXBenchmarkTileCacheDestroy(&cache);
+        }
+        MBXBenchmarkEndObject();
+    }
+
+    for (size_t t = 0; t < 3; t++)
+    {
+        free(traces[t].frames);
+    }
+
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
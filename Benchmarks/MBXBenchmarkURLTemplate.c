@@ -0,0 +1,214 @@
+//
+//  MBXBenchmarkURLTemplate.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+#include "MBXTileURLTemplateCore.inc"
+
+#pragma mark - Expanding templates
+
+// Templates are compiled by Objective-C code, so the benchmark's templates are written out as segments by hand, in the
+// form -[MBXTileURLTemplate initWithString:hosts:imageQuality:] gives them. The bytes hold the literals and the hosts.
+//
+static const char MBXBenchmarkURLTemplateBytes[] = "https://.tiles.example.com/v4//.pngabcdhttps://t.example.com/tiles/?key=";
+
+static const MBXTileURLTemplateSegment MBXBenchmarkURLTemplateXYZ[] = {
+    { MBXTileURLTemplateSegmentLiteral, 0, 8 },
+    { MBXTileURLTemplateSegmentHost, 0, 0 },
+    { MBXTileURLTemplateSegmentLiteral, 8, 22 },
+    { MBXTileURLTemplateSegmentZ, 0, 0 },
+    { MBXTileURLTemplateSegmentLiteral, 30, 1 },
+    { MBXTileURLTemplateSegmentX, 0, 0 },
+    { MBXTileURLTemplateSegmentLiteral, 30, 1 },
+    { MBXTileURLTemplateSegmentY, 0, 0 },
+    { MBXTileURLTemplateSegmentLiteral, 31, 4 },
+};
+
+static const MBXTileURLTemplateSegment MBXBenchmarkURLTemplateQuadkey[] = {
+    { MBXTileURLTemplateSegmentLiteral, 39, 28 },
+    { MBXTileURLTemplateSegmentQuadkey, 0, 0 },
+    { MBXTileURLTemplateSegmentLiteral, 67, 5 },
+    { MBXTileURLTemplateSegmentFlippedY, 0, 0 },
+};
+
+static const MBXTileURLTemplateSegment MBXBenchmarkURLTemplateHosts[] = {
+    { MBXTileURLTemplateSegmentLiteral, 35, 1 },
+    { MBXTileURLTemplateSegmentLiteral, 36, 1 },
+    { MBXTileURLTemplateSegmentLiteral, 37, 1 },
+    { MBXTileURLTemplateSegmentLiteral, 38, 1 },
+};
+
+#define MBXBenchmarkURLTemplateHostCount (sizeof(MBXBenchmarkURLTemplateHosts) / sizeof(MBXBenchmarkURLTemplateHosts[0]))
+
+
+// Writes a tile URL the same way as -[MBXTileURLTemplate URLForTilePath:], up to where it's turned into an NSURL
+//
+static size_t MBXBenchmarkURLTemplateExpand(const MBXTileURLTemplateSegment *segments, size_t segmentCount, uint64_t x, uint64_t y, uint64_t z, char *buffer)
+{
+    const char *bytes = MBXBenchmarkURLTemplateBytes;
+    size_t length = 0;
+
+    for (size_t s = 0; s < segmentCount; s++)
+    {
+        const MBXTileURLTemplateSegment *segment = &segments[s];
+        const MBXTileURLTemplateSegment *host;
+        switch (segment->kind)
+        {
+            case MBXTileURLTemplateSegmentLiteral:
+                memcpy(buffer + length, bytes + segment->offset, segment->length);
+                length += segment->length;
+                break;
+            case MBXTileURLTemplateSegmentZ:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, z);
+                break;
+            case MBXTileURLTemplateSegmentX:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, x);
+                break;
+            case MBXTileURLTemplateSegmentY:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, y);
+                break;
+            case MBXTileURLTemplateSegmentFlippedY:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, (((uint64_t)1 << z) - 1) - MIN(y, ((uint64_t)1 << z) - 1));
+                break;
+            case MBXTileURLTemplateSegmentQuadkey:
+                length += MBXTileURLTemplateWriteQuadkey(buffer + length, x, y, z);
+                break;
+            case MBXTileURLTemplateSegmentHost:
+                host = &MBXBenchmarkURLTemplateHosts[MBXTileURLTemplateHostIndex(x, y, z, MBXBenchmarkURLTemplateHostCount)];
+                memcpy(buffer + length, bytes + host->offset, host->length);
+                length += host->length;
+                break;
+            default:
+                break;
+        }
+    }
+    buffer[length] = '\0';
+
+    return length;
+}
+
+
+// The format string way of making the same URLs, which the templates replaced, both as a baseline and to check them
+//
+static void MBXBenchmarkURLTemplateFormat(bool quadkey, uint64_t x, uint64_t y, uint64_t z, char *buffer, size_t size)
+{
+    if (!quadkey)
+    {
+        char host = (char)('a' + MBXTileURLTemplateHostIndex(x, y, z, MBXBenchmarkURLTemplateHostCount));
+        snprintf(buffer, size, "https://%c.tiles.example.com/v4/%llu/%llu/%llu.png", host, (unsigned long long)z, (unsigned long long)x, (unsigned long long)y);
+        return;
+    }
+
+    char key[64];
+    for (uint64_t i = 0; i < z; i++)
+    {
+        uint64_t bit = z - 1 - i;
+        key[i] = (char)('0' + ((x >> bit) & 1) + 2 * ((y >> bit) & 1));
+    }
+    key[z] = '\0';
+    snprintf(buffer, size, "https://t.example.com/tiles/%s?key=%llu", key, (unsigned long long)((((uint64_t)1 << z) - 1) - y));
+}
+
+
+static volatile size_t MBXBenchmarkURLTemplateSink;
+
+
+#pragma mark - Benchmark
+
+bool MBXBenchmarkURLTemplate(const MBXBenchmarkOptions *options)
+{
+    MBXBenchmarkBeginObject("url_template");
+    MBXBenchmarkWriteInteger("urls", options->urlCount);
+
+    const char *names[2] = { "xyz", "quadkey" };
+    const MBXTileURLTemplateSegment *segments[2] = { MBXBenchmarkURLTemplateXYZ, MBXBenchmarkURLTemplateQuadkey };
+    size_t segmentCounts[2] = {
+        sizeof(MBXBenchmarkURLTemplateXYZ) / sizeof(MBXBenchmarkURLTemplateXYZ[0]),
+        sizeof(MBXBenchmarkURLTemplateQuadkey) / sizeof(MBXBenchmarkURLTemplateQuadkey[0])
+    };
+
+    bool success = true;
+    for (int t = 0; t < 2; t++)
+    {
+        // Tiles are picked at random from zoom levels 0 to 22, so the numbers have a realistic spread of lengths
+        //
+        uint64_t state = options->seed;
+        uint64_t mismatches = 0;
+        char buffer[MBXTileURLTemplateStackBufferSize];
+        char expected[MBXTileURLTemplateStackBufferSize];
+        for (uint64_t i = 0; i < MIN(options->urlCount, (uint64_t)100000); i++)
+        {
+            uint64_t z = MBXBenchmarkRandom(&state) % 23;
+            uint64_t x = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            uint64_t y = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            MBXBenchmarkURLTemplateExpand(segments[t], segmentCounts[t], x, y, z, buffer);
+            MBXBenchmarkURLTemplateFormat(t == 1, x, y, z, expected, sizeof(expected));
+            if (strcmp(buffer, expected) != 0) mismatches++;
+        }
+
+        state = options->seed;
+        uint64_t templateStart = MBXBenchmarkNow();
+        for (uint64_t i = 0; i < options->urlCount; i++)
+        {
+            uint64_t z = MBXBenchmarkRandom(&state) % 23;
+            uint64_t x = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            uint64_t y = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            MBXBenchmarkURLTemplateSink = MBXBenchmarkURLTemplateExpand(segments[t], segmentCounts[t], x, y, z, buffer);
+        }
+        uint64_t templateNanoseconds = MBXBenchmarkNow() - templateStart;
+
+        state = options->seed;
+        uint64_t formatStart = MBXBenchmarkNow();
+        for (uint64_t i = 0; i < options->urlCount; i++)
+        {
+            uint64_t z = MBXBenchmarkRandom(&state) % 23;
+            uint64_t x = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            uint64_t y = MBXBenchmarkRandom(&state) & (((uint64_t)1 << z) - 1);
+            MBXBenchmarkURLTemplateFormat(t == 1, x, y, z, expected, sizeof(expected));
+            MBXBenchmarkURLTemplateSink = (size_t)expected[0];
+        }
+        uint64_t formatNanoseconds = MBXBenchmarkNow() - formatStart;
+
+        double urlCount = (double)MAX(options->urlCount, (uint64_t)1);
+        MBXBenchmarkBeginObject(names[t]);
+        MBXBenchmarkWriteDouble("template_ns_per_url", (double)templateNanoseconds / urlCount);
+        MBXBenchmarkWriteDouble("format_ns_per_url", (double)formatNanoseconds / urlCount);
+        MBXBenchmarkWriteInteger("mismatches", mismatches);
+        MBXBenchmarkEndObject();
+
+        success = success && mismatches == 0;
+    }
+
+    // The tiles in view should be spread evenly across the hosts, so that they can all be loading at once
+    //
+    uint64_t hostCounts[MBXBenchmarkURLTemplateHostCount] = { 0 };
+    for (uint64_t y = 24000; y < 24064; y++)
+    {
+        for (uint64_t x = 19000; x < 19064; x++)
+        {
+            hostCounts[MBXTileURLTemplateHostIndex(x, y, 16, MBXBenchmarkURLTemplateHostCount)]++;
+        }
+    }
+    uint64_t minimumCount = UINT64_MAX;
+    uint64_t maximumCount = 0;
+    for (size_t i = 0; i < MBXBenchmarkURLTemplateHostCount; i++)
+    {
+        minimumCount = MIN(minimumCount, hostCounts[i]);
+        maximumCount = MAX(maximumCount, hostCounts[i]);
+    }
+
+    MBXBenchmarkBeginObject("host_spread");
+    MBXBenchmarkWriteInteger("hosts", MBXBenchmarkURLTemplateHostCount);
+    MBXBenchmarkWriteInteger("fewest_tiles", minimumCount);
+    MBXBenchmarkWriteInteger("most_tiles", maximumCount);
+    MBXBenchmarkEndObject();
+
+    success = success && minimumCount > 0;
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+    return success;
+}
@@ -0,0 +1,85 @@
+//
+//  MBXBenchmarks.c
+//  MBXMapKit Benchmarks
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#include "MBXBenchmark.h"
+
+static void MBXBenchmarkPrintUsage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--tiles N] [--lookups N] [--max-zoom Z] [--urls N] [--seed N] [--pack-tiles N]\n"
+            "       [--packs N] [--requests N] [--latency MS] [--error-rate PERCENT] [--trace FILE]\n"
+            "  --tiles N          tiles in the synthetic packed archive (default 100000)\n"
+            "  --lookups N        archive and database lookups to time (default 100000)\n"
+            "  --max-zoom Z       highest zoom level for tile coverages and jobs (default 16)\n"
+            "  --urls N           tile URLs to make for each template (default 1000000)\n"
+            "  --seed N           seed for the random tiles, regions, and traces (default 1)\n"
+            "  --pack-tiles N     tiles in the largest synthetic offline map database (default 100000)\n"
+            "  --packs N          offline maps to start up with, from their databases or a catalog (default 100)\n"
+            "  --requests N       tiles to download from the local tile server (default 1000)\n"
+            "  --latency MS       the local tile server's average latency (default 2)\n"
+            "  --error-rate PCT   share of the local tile server's responses which fail (default 5)\n"
+            "  --trace FILE       replay a recorded trace of \"zoom x y\" lines through the tile cache\n",
+            program);
+}
+
+
+int main(int argc, char *argv[])
+{
+    MBXBenchmarkOptions options = { 100000, 100000, 16, 1000000, 1, 100000, 100, 1000, 2, 5, NULL };
+
+    for (int i = 1; i < argc; i++)
+    {
+        uint64_t *option = NULL;
+        if (strcmp(argv[i], "--tiles") == 0) option = &options.tileCount;
+        else if (strcmp(argv[i], "--lookups") == 0) option = &options.lookupCount;
+        else if (strcmp(argv[i], "--urls") == 0) option = &options.urlCount;
+        else if (strcmp(argv[i], "--seed") == 0) option = &options.seed;
+        else if (strcmp(argv[i], "--pack-tiles") == 0) option = &options.packTileCount;
+        else if (strcmp(argv[i], "--packs") == 0) option = &options.packCount;
+        else if (strcmp(argv[i], "--requests") == 0) option = &options.requestCount;
+        else if (strcmp(argv[i], "--latency") == 0) option = &options.latencyMilliseconds;
+        else if (strcmp(argv[i], "--error-rate") == 0) option = &options.errorPercent;
+
+        if (i + 1 < argc && option)
+        {
+            *option = strtoull(argv[++i], NULL, 10);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--max-zoom") == 0)
+        {
+            options.maximumZ = strtol(argv[++i], NULL, 10);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--trace") == 0)
+        {
+            options.traceFile = argv[++i];
+        }
+        else
+        {
+            MBXBenchmarkPrintUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (options.tileCount == 0 || options.packTileCount == 0 || options.maximumZ < 0 || options.maximumZ > 24 || options.errorPercent > 100)
+    {
+        MBXBenchmarkPrintUsage(argv[0]);
+        return 2;
+    }
+
+    MBXBenchmarkBeginObject(NULL);
+    bool success = MBXBenchmarkCoverage(&options);
+    success = MBXBenchmarkArchive(&options) && success;
+    success = MBXBenchmarkURLTemplate(&options) && success;
+    success = MBXBenchmarkDatabase(&options) && success;
+    success = MBXBenchmarkJobCreation(&options) && success;
+    success = MBXBenchmarkCatalog(&options) && success;
+    success = MBXBenchmarkTileCache(&options) && success;
+    success = MBXBenchmarkServer(&options) && success;
+    MBXBenchmarkWriteBool("passed", success);
+    MBXBenchmarkEndObject();
+
+    return (success ? 0 : 1);
+}
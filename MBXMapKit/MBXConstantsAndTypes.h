@@ -30,6 +30,8 @@ extern NSInteger const MBXMapKitErrorCodeOfflineMapHasNoDataForURL;
 extern NSInteger const MBXMapKitErrorCodeOfflineMapSqlite;
 /** There is a network connectivity problem such as airplane mode. */
 extern NSInteger const MBXMapKitErrorCodeURLSessionConnectivity;
+/** There isn't enough memory to work out which tiles cover an area at the requested zoom levels. */
+extern NSInteger const MBXMapKitErrorCodeTileCoverageOutOfMemory;
 
 #pragma mark - Image quality constants
 
@@ -53,4 +55,16 @@ typedef NS_ENUM(NSUInteger, MBXRasterImageQuality) {
     MBXRasterImageQualityJPEG90 = 7
 };
 
+#pragma mark - Tile source constants
+
+/** Where a map tile was loaded from. */
+typedef NS_ENUM(NSUInteger, MBXTileSource) {
+    /** An offline map database. */
+    MBXTileSourceOfflineMapDatabase = 0,
+    /** The shared tile cache. */
+    MBXTileSourceTileCache = 1,
+    /** A network request. */
+    MBXTileSourceNetwork = 2
+};
+
 #endif
@@ -9,11 +9,17 @@
 @import MapKit;
 
 #import "MBXConstantsAndTypes.h"
+#import "MBXMarkerIndex.h"
 #import "MBXOfflineMapDatabase.h"
 #import "MBXOfflineMapDownloader.h"
 #import "MBXPointAnnotation.h"
 #import "MBXRasterTileOverlay.h"
 #import "MBXRasterTileRenderer.h"
+#import "MBXTileCache.h"
+#import "MBXTileCoverage.h"
+#import "MBXTileFetcher.h"
+#import "MBXTileMetrics.h"
+#import "MBXTileURLTemplate.h"
 
 #pragma mark - MKMapView category
 
@@ -60,4 +66,15 @@
 /** Returns the global user agent for Mapbox API HTTP requests. */
 + (NSString *)userAgent;
 
+/** @name Spreading Tile Requests Across Hosts */
+
+/** Sets the hosts which Mapbox map tiles are requested from. Each tile is always requested from the same host, and spreading the tiles across several hosts lets more of them load at once.
+*
+*   This applies to raster tile overlays which are created after it is set, and to offline map downloads which are begun or resumed after it is set. If unset, defaults to `a.tiles.mapbox.com` through `d.tiles.mapbox.com`.
+*   @param tileHosts An array of host names. */
++ (void)setTileHosts:(NSArray *)tileHosts;
+
+/** Returns the hosts which Mapbox map tiles are requested from. */
++ (NSArray *)tileHosts;
+
 @end
@@ -52,6 +52,7 @@ NSInteger const MBXMapKitErrorCodeDownloadingCanceled = -3;
 NSInteger const MBXMapKitErrorCodeOfflineMapHasNoDataForURL = -4;
 NSInteger const MBXMapKitErrorCodeOfflineMapSqlite = -5;
 NSInteger const MBXMapKitErrorCodeURLSessionConnectivity = -6;
+NSInteger const MBXMapKitErrorCodeTileCoverageOutOfMemory = -7;
 
 #pragma mark - Global configuration
 
@@ -59,6 +60,7 @@ NSInteger const MBXMapKitErrorCodeURLSessionConnectivity = -6;
 
 @property (nonatomic) NSString *accessToken;
 @property (nonatomic) NSString *userAgent;
+@property (nonatomic) NSArray *tileHosts;
 
 @end
 
@@ -114,6 +116,18 @@ NSInteger const MBXMapKitErrorCodeURLSessionConnectivity = -6;
     return userAgent;
 }
 
++ (void)setTileHosts:(NSArray *)tileHosts
+{
+    [[MBXMapKit sharedInstance] setTileHosts:([tileHosts count] > 0 ? [tileHosts copy] : nil)];
+}
+
++ (NSArray *)tileHosts
+{
+    NSArray *tileHosts = [[MBXMapKit sharedInstance] tileHosts];
+
+    return (tileHosts ?: @[ @"a.tiles.mapbox.com", @"b.tiles.mapbox.com", @"c.tiles.mapbox.com", @"d.tiles.mapbox.com" ]);
+}
+
 @end
 
 #pragma mark - Helpers for creating verbose errors
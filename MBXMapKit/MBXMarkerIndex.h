@@ -0,0 +1,68 @@
+//
+//  MBXMarkerIndex.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+@import MapKit;
+
+
+#pragma mark - Marker clusters
+
+/** An `MBXMarkerCluster` stands in for several annotations which are too close together to be shown separately at a zoom level. Its coordinate is the center of the annotations it contains.
+*
+*   Clusters are returned by `-[MBXMarkerIndex annotationsInMapRect:clusteredAtZoomLevel:]`. The same cluster object is returned each time for the same group of annotations, so clusters which are already on a map view can be recognized and left in place. Clusters are kept in a cache which is limited in size and emptied when memory runs low, so a cluster which hasn't been returned for a while may be replaced by a new cluster object for the same annotations. */
+@interface MBXMarkerCluster : MKShape
+
+/** @name Accessing the Clustered Annotations */
+
+/** The annotations in the cluster. */
+@property (readonly, nonatomic) NSArray *annotations;
+
+/** The coordinate point of the cluster, which is the center of its annotations. */
+@property (readonly, nonatomic) CLLocationCoordinate2D coordinate;
+
+@end
+
+
+#pragma mark - Marker index
+
+/** An `MBXMarkerIndex` is a spatial index of annotations, such as the markers loaded by an `MBXRasterTileOverlay`. It is meant for maps with too many markers to add them all to an `MKMapView` at once. Instead, the annotations inside the visible map rect can be looked up each time the map moves, optionally grouped into clusters for the current zoom level.
+*
+*   Marker indexes are immutable and can be used from any thread. */
+@interface MBXMarkerIndex : NSObject
+
+
+#pragma mark -
+
+/** @name Creating a Marker Index */
+
+/** Creates a spatial index of annotations.
+*   @param annotations An array of objects which conform to the `MKAnnotation` protocol, such as `MBXPointAnnotation` objects.
+*   @return An initialized marker index. */
+- (instancetype)initWithAnnotations:(NSArray *)annotations;
+
+
+#pragma mark -
+
+/** @name Finding Annotations */
+
+/** The number of annotations in the index. */
+@property (readonly, nonatomic) NSUInteger count;
+
+/** Returns the annotations located inside a map rect.
+*   @param mapRect The map rect to search, such as the `visibleMapRect` of a map view. It may cross the antimeridian.
+*   @return An array of annotations. */
+- (NSArray *)annotationsInMapRect:(MKMapRect)mapRect;
+
+/** Returns the annotations located inside a map rect, with annotations which are close together at a zoom level grouped into clusters.
+*
+*   Annotations are grouped using a grid of cells which are about 64 screen points across at the given zoom level. Each cell which contains more than one annotation is returned as an `MBXMarkerCluster`, and each cell which contains a single annotation is returned as that annotation.
+*   @param mapRect The map rect to search, such as the `visibleMapRect` of a map view. It may cross the antimeridian.
+*   @param zoomLevel The zoom level to cluster annotations for, such as the result of `-[MKMapView mbx_zoomLevel]`.
+*   @return An array of annotations and `MBXMarkerCluster` objects. */
+- (NSArray *)annotationsInMapRect:(MKMapRect)mapRect clusteredAtZoomLevel:(NSInteger)zoomLevel;
+
+@end
@@ -0,0 +1,408 @@
+//
+//  MBXMarkerIndex.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMarkerIndex.h"
+
+
+#pragma mark - Quadtree
+
+// Annotations are indexed by a point quadtree written in plain C. Each node covers a quadrant of its parent, and the
+// points beneath a node are kept contiguous in a single array, so a node which lies entirely inside the search rect
+// can be added in one step without visiting its children. Points are in map point coordinates, with x wrapped into the
+// world and y clamped to it, so every point falls in exactly one quadrant of each node.
+//
+typedef struct {
+    double x;
+    double y;
+    size_t index;
+} MBXMarkerIndexPoint;
+
+typedef struct {
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+    size_t start;
+    size_t end;
+    long children[4];
+} MBXMarkerIndexNode;
+
+typedef struct {
+    MBXMarkerIndexPoint *points;
+    MBXMarkerIndexNode *nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+} MBXMarkerIndexTree;
+
+typedef struct {
+    size_t *indexes;
+    size_t count;
+    size_t capacity;
+} MBXMarkerIndexResults;
+
+static size_t const MBXMarkerIndexLeafCapacity = 32;
+static long const MBXMarkerIndexMaximumDepth = 24;
+static double const MBXMarkerIndexClusterCellSize = 64.0;
+static NSUInteger const MBXMarkerIndexClusterCacheCountLimit = 2048;
+
+
+static size_t MBXMarkerIndexPartition(MBXMarkerIndexPoint *points, size_t start, size_t end, bool byX, double split)
+{
+    // Move the points which are below the split to the front of the range, and return where the rest begin
+    //
+    size_t i = start;
+    for(size_t j = start; j < end; j++)
+    {
+        double value = (byX ? points[j].x : points[j].y);
+        if(value < split)
+        {
+            MBXMarkerIndexPoint swap = points[i];
+            points[i] = points[j];
+            points[j] = swap;
+            i++;
+        }
+    }
+    return i;
+}
+
+
+static long MBXMarkerIndexBuildNode(MBXMarkerIndexTree *tree, double minX, double minY, double maxX, double maxY, size_t start, size_t end, long depth)
+{
+    if(tree->nodeCount == tree->nodeCapacity)
+    {
+        size_t capacity = (tree->nodeCapacity ? tree->nodeCapacity * 2 : 64);
+        MBXMarkerIndexNode *nodes = realloc(tree->nodes, capacity * sizeof(MBXMarkerIndexNode));
+        if(!nodes) return -1;
+        tree->nodes = nodes;
+        tree->nodeCapacity = capacity;
+    }
+
+    long nodeIndex = (long)tree->nodeCount++;
+    MBXMarkerIndexNode node = { minX, minY, maxX, maxY, start, end, { -1, -1, -1, -1 } };
+    tree->nodes[nodeIndex] = node;
+
+    if(end - start > MBXMarkerIndexLeafCapacity && depth < MBXMarkerIndexMaximumDepth)
+    {
+        double midX = (minX + maxX) / 2.0;
+        double midY = (minY + maxY) / 2.0;
+
+        size_t south = MBXMarkerIndexPartition(tree->points, start, end, false, midY);
+        size_t northEast = MBXMarkerIndexPartition(tree->points, start, south, true, midX);
+        size_t southEast = MBXMarkerIndexPartition(tree->points, south, end, true, midX);
+
+        size_t bounds[5] = { start, northEast, south, southEast, end };
+        for(int quadrant = 0; quadrant < 4; quadrant++)
+        {
+            if(bounds[quadrant] == bounds[quadrant + 1]) continue;
+
+            bool east = (quadrant & 1);
+            bool southern = (quadrant & 2);
+            long child = MBXMarkerIndexBuildNode(tree,
+                                                 (east ? midX : minX), (southern ? midY : minY),
+                                                 (east ? maxX : midX), (southern ? maxY : midY),
+                                                 bounds[quadrant], bounds[quadrant + 1], depth + 1);
+            if(child < 0) return -1;
+
+            // The node array may have moved while building the child, so it's looked up again here
+            //
+            tree->nodes[nodeIndex].children[quadrant] = child;
+        }
+    }
+
+    return nodeIndex;
+}
+
+
+static bool MBXMarkerIndexResultsAdd(MBXMarkerIndexResults *results, size_t index)
+{
+    if(results->count == results->capacity)
+    {
+        size_t capacity = (results->capacity ? results->capacity * 2 : 64);
+        size_t *indexes = realloc(results->indexes, capacity * sizeof(size_t));
+        if(!indexes) return false;
+        results->indexes = indexes;
+        results->capacity = capacity;
+    }
+    results->indexes[results->count++] = index;
+    return true;
+}
+
+
+static bool MBXMarkerIndexQueryNode(const MBXMarkerIndexTree *tree, long nodeIndex, double minX, double minY, double maxX, double maxY, MBXMarkerIndexResults *results)
+{
+    // The search rect includes its minimum edges and excludes its maximum edges, like the nodes, so that neighboring
+    // rects never both contain the same point
+    //
+    const MBXMarkerIndexNode *node = &tree->nodes[nodeIndex];
+    if(node->maxX <= minX || node->minX >= maxX || node->maxY <= minY || node->minY >= maxY) return true;
+
+    bool contained = (node->minX >= minX && node->maxX <= maxX && node->minY >= minY && node->maxY <= maxY);
+    bool leaf = (node->children[0] < 0 && node->children[1] < 0 && node->children[2] < 0 && node->children[3] < 0);
+
+    if(contained || leaf)
+    {
+        for(size_t i = node->start; i < node->end; i++)
+        {
+            const MBXMarkerIndexPoint *point = &tree->points[i];
+            if(contained || (point->x >= minX && point->x < maxX && point->y >= minY && point->y < maxY))
+            {
+                if(!MBXMarkerIndexResultsAdd(results, point->index)) return false;
+            }
+        }
+        return true;
+    }
+
+    for(int quadrant = 0; quadrant < 4; quadrant++)
+    {
+        if(node->children[quadrant] < 0) continue;
+        if(!MBXMarkerIndexQueryNode(tree, node->children[quadrant], minX, minY, maxX, maxY, results)) return false;
+    }
+    return true;
+}
+
+
+#pragma mark - Marker clusters
+
+@interface MBXMarkerCluster ()
+
+@property (readwrite, nonatomic) NSArray *annotations;
+@property (readwrite, nonatomic) CLLocationCoordinate2D coordinate;
+
+@end
+
+
+@implementation MBXMarkerCluster
+
+@synthesize coordinate = _coordinate;
+
+@end
+
+
+#pragma mark - Marker index
+
+@interface MBXMarkerIndex ()
+
+@property (nonatomic) NSArray *annotations;
+@property (nonatomic) MBXMarkerIndexTree tree;
+@property (nonatomic) long rootNode;
+@property (nonatomic) NSCache *clusterCache;
+
+@end
+
+
+@implementation MBXMarkerIndex
+
+- (instancetype)initWithAnnotations:(NSArray *)annotations
+{
+    self = [super init];
+
+    if (self)
+    {
+        _annotations = [annotations copy];
+        _clusterCache = [NSCache new];
+        _clusterCache.countLimit = MBXMarkerIndexClusterCacheCountLimit;
+        _rootNode = -1;
+
+        size_t count = [_annotations count];
+        if (count > 0)
+        {
+            _tree.points = malloc(count * sizeof(MBXMarkerIndexPoint));
+            if (!_tree.points) return nil;
+
+            double worldWidth = MKMapSizeWorld.width;
+            double worldHeight = MKMapSizeWorld.height;
+            for (size_t i = 0; i < count; i++)
+            {
+                MKMapPoint mapPoint = MKMapPointForCoordinate([(id<MKAnnotation>)_annotations[i] coordinate]);
+                double x = fmod(mapPoint.x, worldWidth);
+                if (x < 0) x += worldWidth;
+                double y = fmin(fmax(mapPoint.y, 0.0), nextafter(worldHeight, 0.0));
+
+                _tree.points[i].x = x;
+                _tree.points[i].y = y;
+                _tree.points[i].index = i;
+            }
+
+            _rootNode = MBXMarkerIndexBuildNode(&_tree, 0.0, 0.0, worldWidth, worldHeight, 0, count, 0);
+            if (_rootNode < 0)
+            {
+                free(_tree.points);
+                free(_tree.nodes);
+                return nil;
+            }
+        }
+    }
+
+    return self;
+}
+
+
+- (void)dealloc
+{
+    free(_tree.points);
+    free(_tree.nodes);
+}
+
+
+- (NSUInteger)count
+{
+    return [_annotations count];
+}
+
+
+#pragma mark - Finding annotations
+
+- (void)enumerateWorldRectsForMapRect:(MKMapRect)mapRect usingBlock:(void (^)(MKMapRect worldRect))block
+{
+    // Map rects which cross the antimeridian extend past the east edge of the world, so the part beyond it is searched
+    // as a second rect at the west edge
+    //
+    if (MKMapRectIsNull(mapRect) || MKMapRectIsEmpty(mapRect)) return;
+
+    MKMapRect worldRect = MKMapRectIntersection(mapRect, MKMapRectWorld);
+    if ( ! MKMapRectIsNull(worldRect) && ! MKMapRectIsEmpty(worldRect)) block(worldRect);
+
+    if (MKMapRectSpans180thMeridian(mapRect))
+    {
+        MKMapRect remainder = MKMapRectRemainder(mapRect);
+        if ( ! MKMapRectIsNull(remainder) && ! MKMapRectIsEmpty(remainder)) block(remainder);
+    }
+}
+
+
+- (NSArray *)annotationIndexesInWorldRect:(MKMapRect)worldRect
+{
+    if (_rootNode < 0) return @[];
+
+    MBXMarkerIndexResults results = { NULL, 0, 0 };
+    bool success = MBXMarkerIndexQueryNode(&_tree, _rootNode, MKMapRectGetMinX(worldRect), MKMapRectGetMinY(worldRect), MKMapRectGetMaxX(worldRect), MKMapRectGetMaxY(worldRect), &results);
+
+    NSMutableArray *indexes = [NSMutableArray arrayWithCapacity:results.count];
+    if (success)
+    {
+        for (size_t i = 0; i < results.count; i++)
+        {
+            [indexes addObject:@(results.indexes[i])];
+        }
+    }
+    else
+    {
+        NSLog(@"Out of memory while searching the marker index");
+    }
+    free(results.indexes);
+
+    return indexes;
+}
+
+
+- (NSArray *)annotationsInMapRect:(MKMapRect)mapRect
+{
+    NSMutableArray *annotations = [NSMutableArray new];
+
+    [self enumerateWorldRectsForMapRect:mapRect usingBlock:^(MKMapRect worldRect) {
+        for (NSNumber *index in [self annotationIndexesInWorldRect:worldRect])
+        {
+            [annotations addObject:_annotations[[index unsignedIntegerValue]]];
+        }
+    }];
+
+    return annotations;
+}
+
+
+- (NSArray *)annotationsInMapRect:(MKMapRect)mapRect clusteredAtZoomLevel:(NSInteger)zoomLevel
+{
+    // Annotations are clustered on a fixed grid for each zoom level. The search rect is widened to whole grid cells, so
+    // that each cell is always clustered from all of its annotations and the same cluster can be returned for it every
+    // time, no matter which part of the cell is visible.
+    //
+    zoomLevel = MAX(0, MIN(zoomLevel, MBXMarkerIndexMaximumDepth));
+    double cellSize = MKMapSizeWorld.width / (256.0 * pow(2.0, zoomLevel)) * MBXMarkerIndexClusterCellSize;
+    long cellsAcross = (long)ceil(MKMapSizeWorld.width / cellSize);
+
+    NSMutableArray *results = [NSMutableArray new];
+
+    [self enumerateWorldRectsForMapRect:mapRect usingBlock:^(MKMapRect worldRect) {
+        double minX = floor(MKMapRectGetMinX(worldRect) / cellSize) * cellSize;
+        double minY = floor(MKMapRectGetMinY(worldRect) / cellSize) * cellSize;
+        double maxX = ceil(MKMapRectGetMaxX(worldRect) / cellSize) * cellSize;
+        double maxY = ceil(MKMapRectGetMaxY(worldRect) / cellSize) * cellSize;
+        MKMapRect cellRect = MKMapRectIntersection(MKMapRectMake(minX, minY, maxX - minX, maxY - minY), MKMapRectWorld);
+
+        // Sort the annotations into their grid cells
+        //
+        NSMutableDictionary *indexesForCell = [NSMutableDictionary new];
+        for (NSNumber *index in [self annotationIndexesInWorldRect:cellRect])
+        {
+            MKMapPoint point = MKMapPointForCoordinate([(id<MKAnnotation>)_annotations[[index unsignedIntegerValue]] coordinate]);
+            long cellX = (long)floor(point.x / cellSize) % cellsAcross;
+            long cellY = (long)floor(point.y / cellSize);
+            if (cellX < 0) cellX += cellsAcross;
+
+            NSNumber *cell = @(cellY * cellsAcross + cellX);
+            NSMutableArray *indexes = indexesForCell[cell];
+            if ( ! indexes)
+            {
+                indexes = [NSMutableArray new];
+                indexesForCell[cell] = indexes;
+            }
+            [indexes addObject:index];
+        }
+
+        [indexesForCell enumerateKeysAndObjectsUsingBlock:^(NSNumber *cell, NSArray *indexes, BOOL *stop) {
+            if ([indexes count] == 1)
+            {
+                [results addObject:_annotations[[indexes[0] unsignedIntegerValue]]];
+                return;
+            }
+
+            // Clusters are cached by zoom level and cell, in a cache which is limited in size and emptied when memory runs
+            // low, so panning across a large map doesn't keep every cluster ever made. The zoom level fits in the low 5
+            // bits, and the cell number in the rest.
+            //
+            NSNumber *key = @(([cell unsignedLongLongValue] << 5) | (unsigned long long)zoomLevel);
+            MBXMarkerCluster *cluster;
+            @synchronized(self)
+            {
+                cluster = [_clusterCache objectForKey:key];
+                if ( ! cluster)
+                {
+                    cluster = [self clusterWithAnnotationIndexes:indexes];
+                    [_clusterCache setObject:cluster forKey:key];
+                }
+            }
+            [results addObject:cluster];
+        }];
+    }];
+
+    return results;
+}
+
+
+- (MBXMarkerCluster *)clusterWithAnnotationIndexes:(NSArray *)indexes
+{
+    // The cluster is placed at the center of its annotations, taken in map points so it stays within the cell
+    //
+    NSMutableArray *annotations = [NSMutableArray arrayWithCapacity:[indexes count]];
+    double sumX = 0.0;
+    double sumY = 0.0;
+    for (NSNumber *index in indexes)
+    {
+        id<MKAnnotation> annotation = _annotations[[index unsignedIntegerValue]];
+        MKMapPoint point = MKMapPointForCoordinate([annotation coordinate]);
+        sumX += point.x;
+        sumY += point.y;
+        [annotations addObject:annotation];
+    }
+
+    MBXMarkerCluster *cluster = [MBXMarkerCluster new];
+    cluster.annotations = annotations;
+    cluster.coordinate = MKCoordinateForMapPoint(MKMapPointMake(sumX / [indexes count], sumY / [indexes count]));
+    return cluster;
+}
+
+@end
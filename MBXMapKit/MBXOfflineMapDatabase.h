@@ -52,6 +52,47 @@
 /** Initial creation date of the offline map database. */
 @property (readonly, nonatomic) NSDate *creationDate;
 
+/** The number of map tiles stored in the offline map database. */
+@property (readonly, nonatomic) NSUInteger tileCount;
+
+/** The size of the offline map database file, in bytes. */
+@property (readonly, nonatomic) unsigned long long fileSize;
+
+/** @name Tuning Read Performance */
+
+/** The number of bytes of the database file which sqlite may access using memory-mapped I/O. The default value of `0` disables memory mapping. Changes take effect for database connections opened after the value is set. */
+@property (nonatomic) NSUInteger memoryMapSize;
+
+/** The approximate number of bytes of sqlite page cache to use for each open database connection. The default value is 2 MB. Changes take effect for database connections opened after the value is set. */
+@property (nonatomic) NSUInteger pageCacheSize;
+
+/** @name Reclaiming Storage */
+
+/** Rewrites the database so that each distinct map tile or resource is stored only once, and removes any data which is no longer used.
+*
+*   Offline maps downloaded by this version of MBXMapKit are already stored this way as they download, so compacting them only removes unused data. Offline maps downloaded by older versions, which store identical tiles (like open ocean or empty land) once for each place they appear, can shrink considerably.
+*
+*   Compacting rewrites the whole database file, so it can take a while for a large offline map. Call this method from a background thread, preferably while the offline map isn't being displayed.
+*
+*   @param error If compacting the database fails, upon return contains an `NSError` object that describes the problem.
+*   @return Whether the database was compacted. If compacting fails, the database is left as it was. */
+- (BOOL)compactWithError:(NSError **)error;
+
+/** @name Reading Tiles From a Packed Archive */
+
+/** Whether map tiles and resources are read from a packed archive of the offline map rather than from its database. */
+@property (readonly, nonatomic, getter=isArchived) BOOL archived;
+
+/** Writes a packed archive of the offline map next to its database, and reads map tiles and resources from the archive from then on.
+*
+*   The archive is a single read-only file which is memory-mapped, with its map tiles sorted so that tiles which are near each other on the map are near each other in the file. Looking up a tile is a binary search of the archive's tile directory, and the returned data points into the mapped file rather than being copied. The database is kept alongside the archive, since updating the offline map needs it, so archiving an offline map roughly doubles the space it takes.
+*
+*   Writing the archive reads the whole database, so call this method from a background thread. The downloader writes archives for new offline maps by itself when `-[MBXOfflineMapDownloader writesArchivesForCompletedOfflineMaps]` is set. This method can be used to convert offline maps which were downloaded without it.
+*
+*   @param error If writing the archive fails, upon return contains an `NSError` object that describes the problem.
+*   @return Whether the archive was written. If writing fails, tiles continue to be read as they were before. */
+- (BOOL)writeArchiveWithError:(NSError **)error;
+
 - (instancetype)init UNAVAILABLE_ATTRIBUTE;
 
 @end
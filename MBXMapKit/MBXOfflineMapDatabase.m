@@ -8,6 +8,171 @@
 #import "MBXMapKit.h"
 
 #import <sqlite3.h>
+#import <CommonCrypto/CommonDigest.h>
+#import <libkern/OSByteOrder.h>
+
+#pragma mark - Read engine configuration
+
+// Idle read connections are kept open for reuse instead of opening the database file for every query. Connections are
+// checked out by whichever thread is doing a lookup and returned afterwards, so this only needs to be about as large as
+// the number of threads MapKit uses to load tiles concurrently.
+//
+static NSUInteger const MBXOfflineMapDatabaseMaximumIdleConnections = 4;
+
+// Statements are prepared once per connection (on first use, since legacy databases don't have all the tables) and
+// reused with bound parameters for every lookup
+//
+typedef NS_ENUM(NSUInteger, MBXOfflineMapDatabaseStatement) {
+    MBXOfflineMapDatabaseStatementDataForURL = 0,
+    MBXOfflineMapDatabaseStatementDataForTile = 1,
+    MBXOfflineMapDatabaseStatementDataForDeduplicatedTile = 2,
+    MBXOfflineMapDatabaseStatementCount
+};
+
+static const char *const MBXOfflineMapDatabaseStatementSQL[MBXOfflineMapDatabaseStatementCount] = {
+    "SELECT value FROM data WHERE id = (SELECT id FROM resources WHERE url = ?1);",
+    "SELECT tile_data FROM tiles WHERE zoom_level = ?1 AND tile_column = ?2 AND tile_row = ?3;",
+    "SELECT value FROM data WHERE id = (SELECT tile_id FROM tiles WHERE zoom_level = ?1 AND tile_column = ?2 AND tile_row = ?3);"
+};
+
+#pragma mark - Schema versions
+
+// Version 1 databases key every resource, including map tiles, by its full URL (access token and all) in the resources
+// table. Version 2 databases store map tiles in an MBTiles-style tiles table with an integer (zoom, column, row) primary
+// key, and keep only the handful of non-tile resources (TileJSON, features.json, and marker icons) in the resources table,
+// keyed by URL with the access token removed. Version 3 databases store each distinct blob (like the many identical tiles
+// of open ocean or empty land) only once, in the data table along with a hash of its contents, and both map tiles and
+// resources refer to their blob by id.
+//
+NSInteger const MBXOfflineMapDatabaseSchemaVersionLegacy = 1;
+NSInteger const MBXOfflineMapDatabaseSchemaVersionTiles = 2;
+NSInteger const MBXOfflineMapDatabaseSchemaVersionDeduplicated = 3;
+
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *statements[MBXOfflineMapDatabaseStatementCount];
+    NSUInteger generation;
+} MBXOfflineMapDatabaseConnection;
+
+#pragma mark - Packed archive format
+
+// A completed offline map can also be written out as a packed archive, which is a single read-only file that sits next
+// to the database and is memory-mapped to serve map tiles without going through sqlite. The file starts with a fixed
+// size header, followed by the tile directory, the tile data, and a metadata block. All the integers are little endian.
+//
+// The tile directory has one entry per tile, sorted by tile key. The key of a tile is its position along a Hilbert
+// curve over its zoom level, plus the number of tiles in all of the lower zoom levels, so a lookup is a binary search,
+// and tiles which are near each other on the map are near each other in the file. Tiles are written to the data section
+// in directory order, and identical tiles (which the deduplicated schema already stores only once) share their data.
+//
+// The metadata block is a binary property list with the database's metadata table and its non-tile resources, keyed
+// the same way as the resources table.
+//
+static char const MBXOfflineMapArchiveMagic[8] = { 'M', 'B', 'X', 'A', 'R', 'C', 'H', '1' };
+static uint32_t const MBXOfflineMapArchiveVersion = 1;
+static size_t const MBXOfflineMapArchiveHeaderSize = 64;
+static size_t const MBXOfflineMapArchiveEntrySize = 24;
+static long const MBXOfflineMapArchiveMaximumZ = 30;
+
+typedef struct {
+    uint64_t key;
+    uint64_t offset;
+    uint32_t length;
+    int64_t dataID;
+} MBXOfflineMapArchiveEntry;
+
+
+static uint64_t MBXOfflineMapArchiveTileKey(long z, uint64_t x, uint64_t y)
+{
+    uint64_t n = (uint64_t)1 << z;
+    uint64_t d = 0;
+    for (uint64_t s = n / 2; s > 0; s /= 2)
+    {
+        uint64_t rx = ((x & s) > 0);
+        uint64_t ry = ((y & s) > 0);
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve continues from where the previous quadrant left off
+        //
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            uint64_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return ((((uint64_t)1 << (2 * z)) - 1) / 3) + d;
+}
+
+
+static uint64_t MBXOfflineMapArchiveReadUInt64(const uint8_t *bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return OSSwapLittleToHostInt64(value);
+}
+
+
+static uint32_t MBXOfflineMapArchiveReadUInt32(const uint8_t *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return OSSwapLittleToHostInt32(value);
+}
+
+
+static void MBXOfflineMapArchiveWriteUInt64(uint8_t *bytes, uint64_t value)
+{
+    value = OSSwapHostToLittleInt64(value);
+    memcpy(bytes, &value, sizeof(value));
+}
+
+
+static void MBXOfflineMapArchiveWriteUInt32(uint8_t *bytes, uint32_t value)
+{
+    value = OSSwapHostToLittleInt32(value);
+    memcpy(bytes, &value, sizeof(value));
+}
+
+
+static int MBXOfflineMapArchiveCompareEntries(const void *a, const void *b)
+{
+    uint64_t ka = ((const MBXOfflineMapArchiveEntry *)a)->key;
+    uint64_t kb = ((const MBXOfflineMapArchiveEntry *)b)->key;
+    return (ka < kb ? -1 : (ka > kb ? 1 : 0));
+}
+
+
+static const uint8_t *MBXOfflineMapArchiveFindEntry(const uint8_t *directory, uint64_t count, uint64_t key)
+{
+    uint64_t low = 0;
+    uint64_t high = count;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        const uint8_t *entry = directory + middle * MBXOfflineMapArchiveEntrySize;
+        uint64_t entryKey = MBXOfflineMapArchiveReadUInt64(entry);
+        if (entryKey == key) return entry;
+        if (entryKey < key) low = middle + 1;
+        else high = middle;
+    }
+    return NULL;
+}
+
+
+#pragma mark - Private API for cooperating with MBXRasterTileOverlay
+
+@interface MBXRasterTileOverlay ()
+
++ (NSString *)qualityExtensionForImageQuality:(MBXRasterImageQuality)imageQuality;
+
+@end
+
 
 #pragma mark - Private API for creating verbose errors
 
@@ -22,6 +187,141 @@
 @end
 
 
+#pragma mark - Private API for cooperating with MBXTileMetrics
+
+@interface MBXTileMetrics ()
+
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+
+#pragma mark - Packed archive reader
+
+// Reads a packed archive through a memory mapping of the whole file. Map tiles are returned as NSData objects which
+// point into the mapping rather than copies, and which keep the mapping alive for as long as they are in use, so the
+// archive can be replaced or deleted while tiles from it are still being drawn.
+//
+@interface MBXOfflineMapArchive : NSObject
+
+- (instancetype)initWithContentsOfFile:(NSString *)path error:(NSError **)error;
+- (NSData *)dataForPath:(MKTileOverlayPath)path;
+- (NSData *)dataForResourceKey:(NSString *)key;
+
+@property (readonly, nonatomic) NSUInteger tileCount;
+
+@end
+
+
+@interface MBXOfflineMapArchive ()
+
+@property (nonatomic) NSData *mappedData;
+@property (nonatomic) const uint8_t *directory;
+@property (nonatomic) NSDictionary *resources;
+@property (readwrite, nonatomic) NSUInteger tileCount;
+
+@end
+
+
+@implementation MBXOfflineMapArchive
+
+- (instancetype)initWithContentsOfFile:(NSString *)path error:(NSError **)error
+{
+    self = [super init];
+
+    if (self)
+    {
+        _mappedData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:error];
+        if (!_mappedData) return nil;
+
+        // Check that the header, the directory, and the metadata block all fit in the file before trusting any of them
+        //
+        const uint8_t *bytes = [_mappedData bytes];
+        uint64_t length = [_mappedData length];
+        uint64_t tileCount = 0;
+        uint64_t directoryOffset = 0;
+        uint64_t metadataOffset = 0;
+        uint64_t metadataLength = 0;
+        BOOL valid = (length >= MBXOfflineMapArchiveHeaderSize
+                      && memcmp(bytes, MBXOfflineMapArchiveMagic, sizeof(MBXOfflineMapArchiveMagic)) == 0
+                      && MBXOfflineMapArchiveReadUInt32(bytes + 8) == MBXOfflineMapArchiveVersion);
+        if (valid)
+        {
+            tileCount = MBXOfflineMapArchiveReadUInt64(bytes + 16);
+            directoryOffset = MBXOfflineMapArchiveReadUInt64(bytes + 24);
+            metadataOffset = MBXOfflineMapArchiveReadUInt64(bytes + 48);
+            metadataLength = MBXOfflineMapArchiveReadUInt64(bytes + 56);
+            valid = (directoryOffset <= length
+                     && tileCount <= (length - directoryOffset) / MBXOfflineMapArchiveEntrySize
+                     && metadataOffset <= length
+                     && metadataLength <= length - metadataOffset);
+        }
+
+        NSDictionary *block = nil;
+        if (valid)
+        {
+            NSData *metadataData = [_mappedData subdataWithRange:NSMakeRange((NSUInteger)metadataOffset, (NSUInteger)metadataLength)];
+            block = [NSPropertyListSerialization propertyListWithData:metadataData options:NSPropertyListImmutable format:NULL error:NULL];
+            valid = ([block isKindOfClass:[NSDictionary class]]
+                     && [block[@"metadata"] isKindOfClass:[NSDictionary class]]
+                     && [block[@"resources"] isKindOfClass:[NSDictionary class]]);
+        }
+
+        if (!valid)
+        {
+            if (error)
+            {
+                NSString *reason = [NSString stringWithFormat:@"The file at %@ is not a valid offline map archive", path];
+                *error = [NSError mbx_errorWithCode:MBXMapKitErrorCodeOfflineMapSqlite reason:reason description:@"Invalid offline map archive"];
+            }
+            return nil;
+        }
+
+        _directory = bytes + directoryOffset;
+        _tileCount = (NSUInteger)tileCount;
+        _resources = block[@"resources"];
+    }
+
+    return self;
+}
+
+
+- (NSData *)dataForPath:(MKTileOverlayPath)path
+{
+    if (path.z < 0 || path.z > MBXOfflineMapArchiveMaximumZ || path.x < 0 || path.y < 0) return nil;
+
+    uint64_t key = MBXOfflineMapArchiveTileKey(path.z, (uint64_t)path.x, (uint64_t)path.y);
+    const uint8_t *entry = MBXOfflineMapArchiveFindEntry(_directory, _tileCount, key);
+    if (!entry) return nil;
+
+    // Tiles whose data was missing from the database are written with a length of zero
+    //
+    uint64_t offset = MBXOfflineMapArchiveReadUInt64(entry + 8);
+    uint32_t length = MBXOfflineMapArchiveReadUInt32(entry + 16);
+    if (length == 0 || offset > [_mappedData length] || length > [_mappedData length] - offset) return nil;
+
+    // The deallocator holds on to the mapping until the last tile which points into it is released
+    //
+    NSData *mappedData = _mappedData;
+    return [[NSData alloc] initWithBytesNoCopy:(void *)((const uint8_t *)[mappedData bytes] + offset)
+                                        length:length
+                                   deallocator:^(void *bytes, NSUInteger length) {
+                                       [mappedData length];
+                                   }];
+}
+
+
+- (NSData *)dataForResourceKey:(NSString *)key
+{
+    id data = _resources[key];
+    return ([data isKindOfClass:[NSData class]] ? data : nil);
+}
+
+@end
+
+
 #pragma mark -
 
 @interface MBXOfflineMapDatabase ()
@@ -36,8 +336,19 @@
 @property (readwrite, nonatomic) NSInteger maximumZ;
 @property (readwrite, nonatomic) NSString *path;
 @property (readwrite, nonatomic) BOOL invalid;
+@property (readwrite, nonatomic) NSInteger schemaVersion;
+@property (readwrite, nonatomic) NSUInteger tileCount;
+@property (readwrite, nonatomic) unsigned long long fileSize;
 
 @property (nonatomic) BOOL initializedProperly;
+@property (nonatomic) BOOL loadedFromCatalogEntry;
+@property (nonatomic) NSDictionary *metadata;
+@property (nonatomic) NSDate *cachedCreationDate;
+@property (nonatomic) NSPointerArray *idleConnections;
+@property (nonatomic) NSUInteger connectionGeneration;
+@property (nonatomic) NSUInteger contentsGeneration;
+@property (readwrite, nonatomic, getter=isArchived) BOOL archived;
+@property (nonatomic) MBXOfflineMapArchive *archive;
 
 @end
 
@@ -48,24 +359,57 @@
 
 
 - (instancetype)initWithContentsOfFile:(NSString *)path
+{
+    return [self initWithContentsOfFile:path catalogEntry:nil];
+}
+
+
+- (instancetype)initWithContentsOfFile:(NSString *)path catalogEntry:(NSDictionary *)catalogEntry
 {
     self = [super init];
 
     if(self)
     {
         _path = path;
+        _idleConnections = [NSPointerArray pointerArrayWithOptions:NSPointerFunctionsOpaqueMemory | NSPointerFunctionsOpaquePersonality];
+        _memoryMapSize = 0;
+        _pageCacheSize = 2 * 1024 * 1024;
+        _tileCount = NSNotFound;
+
+        // If MBXOfflineMapDownloader's catalog has an entry for the file, and the file hasn't been modified since the
+        // entry was made, take the metadata from the entry without opening the database. The database isn't opened until
+        // the first lookup. Otherwise, read all of the metadata rows at once rather than running a separate query for
+        // each name.
+        //
+        NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_path error:nil];
+        _fileSize = [attributes fileSize];
+        NSDictionary *metadata;
+        if(catalogEntry
+           && [catalogEntry[@"fileSize"] unsignedLongLongValue] == [attributes fileSize]
+           && [catalogEntry[@"modificationDate"] isEqual:[attributes fileModificationDate]])
+        {
+            metadata = catalogEntry[@"metadata"];
+            _tileCount = [catalogEntry[@"tileCount"] unsignedIntegerValue];
+            _cachedCreationDate = catalogEntry[@"creationDate"];
+            _loadedFromCatalogEntry = YES;
+        }
+        else
+        {
+            metadata = [self sqliteMetadata];
+        }
 
-        NSString *uniqueID = [self sqliteMetadataForName:@"uniqueID"];
-        NSString *mapID = [self sqliteMetadataForName:@"mapID"];
-        NSString *includesMetadata = [self sqliteMetadataForName:@"includesMetadata"];
-        NSString *includesMarkers = [self sqliteMetadataForName:@"includesMarkers"];
-        NSString *imageQuality = [self sqliteMetadataForName:@"imageQuality"];
-        NSString *region_latitude = [self sqliteMetadataForName:@"region_latitude"];
-        NSString *region_longitude = [self sqliteMetadataForName:@"region_longitude"];
-        NSString *region_latitude_delta = [self sqliteMetadataForName:@"region_latitude_delta"];
-        NSString *region_longitude_delta = [self sqliteMetadataForName:@"region_longitude_delta"];
-        NSString *minimumZ = [self sqliteMetadataForName:@"minimumZ"];
-        NSString *maximumZ = [self sqliteMetadataForName:@"maximumZ"];
+        NSString *uniqueID = metadata[@"uniqueID"];
+        NSString *mapID = metadata[@"mapID"];
+        NSString *includesMetadata = metadata[@"includesMetadata"];
+        NSString *includesMarkers = metadata[@"includesMarkers"];
+        NSString *imageQuality = metadata[@"imageQuality"];
+        NSString *region_latitude = metadata[@"region_latitude"];
+        NSString *region_longitude = metadata[@"region_longitude"];
+        NSString *region_latitude_delta = metadata[@"region_latitude_delta"];
+        NSString *region_longitude_delta = metadata[@"region_longitude_delta"];
+        NSString *minimumZ = metadata[@"minimumZ"];
+        NSString *maximumZ = metadata[@"maximumZ"];
+        NSString *schemaVersion = metadata[@"schemaVersion"];
 
         if ( ! uniqueID)
         {
@@ -104,6 +448,18 @@
             _minimumZ = [minimumZ integerValue];
             _maximumZ = [maximumZ integerValue];
 
+            _metadata = metadata;
+            _schemaVersion = schemaVersion ? [schemaVersion integerValue] : MBXOfflineMapDatabaseSchemaVersionLegacy;
+            if (_schemaVersion < MBXOfflineMapDatabaseSchemaVersionTiles)
+            {
+                [self migrateLegacyDatabaseInBackground];
+            }
+
+            // Map tiles are served from the packed archive instead of the database if one has been written. The archive isn't
+            // mapped until the first lookup.
+            //
+            _archived = [[NSFileManager defaultManager] fileExistsAtPath:[self archivePath]];
+
             _initializedProperly = YES;
         }
         else
@@ -118,6 +474,12 @@
 }
 
 
+- (void)dealloc
+{
+    [self sqliteCloseIdleConnections];
+}
+
+
 - (NSData *)dataForURL:(NSURL *)url withError:(NSError **)error
 {
     // If this assert fails, you may have tried to do something like [[MBXOfflineMapDatabase alloc] init]. Please don't do that!
@@ -127,7 +489,19 @@
     //
     assert(_initializedProperly);
 
-    NSData *data = [self sqliteDataForURL:url];
+    NSData *data = nil;
+    MBXOfflineMapArchive *archive = [self openArchive];
+    MBXOfflineMapDatabaseConnection *connection = (archive ? NULL : [self sqliteCheckOutConnection]);
+    if (archive)
+    {
+        data = [archive dataForResourceKey:[MBXOfflineMapDatabase resourceKeyForURL:url]];
+    }
+    else if (connection)
+    {
+        data = [self sqliteDataForURL:url usingConnection:connection];
+        [self sqliteCheckInConnection:connection];
+    }
+
     if (!data && error)
     {
         NSString *reason = [NSString stringWithFormat:@"The offline database has no data for %@",[url absoluteString]];
@@ -137,6 +511,77 @@
 }
 
 
+- (NSData *)dataForPath:(MKTileOverlayPath)path withError:(NSError **)error
+{
+    assert(_initializedProperly);
+
+    MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+    uint64_t lookupStartTime = [metrics startTime];
+
+    NSData *data = nil;
+    MBXOfflineMapArchive *archive = [self openArchive];
+    MBXOfflineMapDatabaseConnection *connection = (archive ? NULL : [self sqliteCheckOutConnection]);
+    if (archive)
+    {
+        data = [archive dataForPath:path];
+    }
+    else if (connection)
+    {
+        data = [self sqliteDataForPath:path usingConnection:connection];
+        [self sqliteCheckInConnection:connection];
+    }
+
+    [metrics recordStage:MBXTileMetricsStageDatabaseLookup startTime:lookupStartTime];
+    if (lookupStartTime) [metrics addValue:1 toCounter:(data ? MBXTileMetricsCounterDatabaseHits : MBXTileMetricsCounterDatabaseMisses)];
+
+    if (!data && error)
+    {
+        NSString *reason = [NSString stringWithFormat:@"The offline database has no data for tile %ld/%ld/%ld", (long)path.z, (long)path.x, (long)path.y];
+        *error = [NSError mbx_errorWithCode:MBXMapKitErrorCodeOfflineMapHasNoDataForURL reason:reason description:@"No offline data for key error"];
+    }
+    return data;
+}
+
+
+- (NSArray *)dataForPaths:(NSArray *)paths
+{
+    assert(_initializedProperly);
+
+    // Serve a batch of tiles, like the ones around a viewport, in one pass with one connection and its prepared statement
+    // rather than checking out a connection for every tile. Tiles which the database doesn't have come back as NSNull.
+    //
+    MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+    uint64_t lookupStartTime = [metrics startTime];
+
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:[paths count]];
+    NSUInteger hits = 0;
+    MBXOfflineMapArchive *archive = [self openArchive];
+    MBXOfflineMapDatabaseConnection *connection = (archive ? NULL : [self sqliteCheckOutConnection]);
+    for (NSValue *value in paths)
+    {
+        MKTileOverlayPath path;
+        [value getValue:&path];
+
+        NSData *data = nil;
+        if (archive) data = [archive dataForPath:path];
+        else if (connection) data = [self sqliteDataForPath:path usingConnection:connection];
+
+        if (data) hits++;
+        [results addObject:(data ?: [NSNull null])];
+    }
+    if (connection) [self sqliteCheckInConnection:connection];
+
+    [metrics recordStage:MBXTileMetricsStageDatabaseLookup startTime:lookupStartTime];
+    if (lookupStartTime)
+    {
+        [metrics addValue:hits toCounter:MBXTileMetricsCounterDatabaseHits];
+        [metrics addValue:[paths count] - hits toCounter:MBXTileMetricsCounterDatabaseMisses];
+    }
+
+    return results;
+}
+
+
 - (void)invalidate
 {
     // This is to let MBXOfflineMapDownloader mark an MBXOfflineMapDatabase object as invalid when it has been asked to delete
@@ -145,10 +590,49 @@
     // be a logic error, but it seems like a pretty easy error to make, so this helps to catch it (see assert in MBXRasterTileOverlay).
     //
     self.invalid = YES;
+
+    // Don't hold open file handles for a database that's about to be deleted. Any connections which are checked out right
+    // now get closed as they are checked back in, and tiles which were read from the archive keep its mapping alive on
+    // their own.
+    //
+    [self sqliteCloseIdleConnections];
+    @synchronized(self)
+    {
+        _archived = NO;
+        _archive = nil;
+    }
+}
+
+- (void)reloadContents
+{
+    // This is for MBXOfflineMapDownloader to call after it has replaced the database file with an updated copy. Lookups
+    // which are in progress finish reading the old file, and their connections are closed instead of being reused.
+    //
+    NSDictionary *metadata = [self sqliteMetadata];
+    NSString *schemaVersion = metadata[@"schemaVersion"];
+    unsigned long long fileSize = [[[NSFileManager defaultManager] attributesOfItemAtPath:_path error:nil] fileSize];
+    @synchronized(self)
+    {
+        _schemaVersion = schemaVersion ? [schemaVersion integerValue] : MBXOfflineMapDatabaseSchemaVersionLegacy;
+        _metadata = metadata;
+        _fileSize = fileSize;
+        _contentsGeneration += 1;
+        _tileCount = NSNotFound;
+        _archived = [[NSFileManager defaultManager] fileExistsAtPath:[self archivePath]];
+        _archive = nil;
+    }
+
+    @synchronized(_idleConnections)
+    {
+        _connectionGeneration += 1;
+    }
+    [self sqliteCloseIdleConnections];
 }
 
 - (NSDate *)creationDate
 {
+    if (_cachedCreationDate) return _cachedCreationDate;
+
     NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_path error:nil];
     
     if (attributes) return (NSDate *)[attributes objectForKey: NSFileCreationDate];
@@ -156,100 +640,1187 @@
     return nil;
 }
 
-#pragma mark - sqlite stuff
-
-- (NSString *)sqliteMetadataForName:(NSString *)name
+- (NSInteger)schemaVersion
 {
-    NSString *query = [NSString stringWithFormat:@"SELECT value FROM metadata WHERE name='%@';",name];
-    NSData *data = [self sqliteDataForSingleColumnQuery:query];
-    return data ? [[NSString alloc] initWithBytes:data.bytes length:data.length encoding:NSUTF8StringEncoding] : nil;
+    // The schema version and metadata change when the file is converted, compacted, or reloaded while lookups on other
+    // threads are using them, so they're read and written under the same lock as the archive
+    //
+    @synchronized(self)
+    {
+        return _schemaVersion;
+    }
 }
 
-
-- (NSData *)sqliteDataForURL:(NSURL *)url
+- (void)setSchemaVersion:(NSInteger)schemaVersion
 {
-    NSString *query = [NSString stringWithFormat:@"SELECT value FROM data WHERE id = (SELECT id from resources WHERE url='%@');", [url absoluteString]];
-    NSData *data = [self sqliteDataForSingleColumnQuery:query];
-    return data;
+    @synchronized(self)
+    {
+        _schemaVersion = schemaVersion;
+    }
 }
 
+- (NSDictionary *)metadata
+{
+    @synchronized(self)
+    {
+        return _metadata;
+    }
+}
 
-- (NSData *)sqliteDataForSingleColumnQuery:(NSString *)query
+- (NSUInteger)tileCount
 {
-    // MBXMapKit expects libsqlite to have been compiled with SQLITE_THREADSAFE=2 (multi-thread mode), which means
-    // that it can handle its own thread safety as long as you don't attempt to re-use database connections.
-    // Since the queries here are all SELECT's, locking for writes shouldn't be an issue.
-    // Some relevant sqlite documentation:
-    // - http://sqlite.org/faq.html#q5
-    // - http://www.sqlite.org/threadsafe.html
-    // - http://www.sqlite.org/c3ref/threadsafe.html
-    // - http://www.sqlite.org/c3ref/c_config_covering_index_scan.html#sqliteconfigmultithread
+    // Counting the tiles means reading the whole tiles table index, so it's done at most once per version of the file,
+    // and outside of the lock which every lookup takes. A count of a version of the file which has since been reloaded
+    // isn't kept.
     //
-    assert(sqlite3_threadsafe()==2);
-
-    // Open the database read-only and multi-threaded. The slightly obscure c-style variable names here and below are
-    // used to stay consistent with the sqlite documentaion. See http://sqlite.org/c3ref/open.html
-    sqlite3 *db;
-    int rc;
-    const char *filename = [_path cStringUsingEncoding:NSUTF8StringEncoding];
-    rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
-    if (rc)
+    NSUInteger contentsGeneration;
+    @synchronized(self)
     {
-        NSLog(@"Can't open database %@: %s", _path, sqlite3_errmsg(db));
-        sqlite3_close(db);
-        return nil;
+        if (_tileCount != NSNotFound) return _tileCount;
+        contentsGeneration = _contentsGeneration;
     }
 
-    // Prepare the query, see http://sqlite.org/c3ref/prepare.html
-    const char *zSql = [query cStringUsingEncoding:NSUTF8StringEncoding];
-    int nByte = (int)[query lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
-    sqlite3_stmt *ppStmt;
-    const char *pzTail;
-    rc = sqlite3_prepare_v2(db, zSql, nByte, &ppStmt, &pzTail);
-    if (rc)
+    NSUInteger tileCount = [self sqliteTileCount];
+    @synchronized(self)
     {
-        NSLog(@"Problem preparing sql statement: %s", sqlite3_errmsg(db));
-        sqlite3_finalize(ppStmt);
-        sqlite3_close(db);
-        return nil;
+        if (contentsGeneration == _contentsGeneration) _tileCount = tileCount;
     }
+    return tileCount;
+}
 
-    // Evaluate the query, see http://sqlite.org/c3ref/step.html and http://sqlite.org/c3ref/column_blob.html
-    NSData *data = nil;
-    rc = sqlite3_step(ppStmt);
-    if (rc == SQLITE_ROW)
-    {
-        // The query is supposed to be for exactly one column
-        assert(sqlite3_column_count(ppStmt)==1);
+- (NSDictionary *)catalogEntry
+{
+    // This is what MBXOfflineMapDownloader saves in its catalog so that the database can be recreated at the next launch
+    // without opening it. The file's size and modification date tell whether the entry is still current.
+    //
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_path error:nil];
+    NSDictionary *currentMetadata = self.metadata;
+    if (!attributes || !currentMetadata) return nil;
 
-        // Success!
-        data = [NSData dataWithBytes:sqlite3_column_blob(ppStmt, 0) length:sqlite3_column_bytes(ppStmt, 0)];
+    NSMutableDictionary *metadata = [currentMetadata mutableCopy];
+    metadata[@"uniqueID"] = _uniqueID;
+    metadata[@"schemaVersion"] = [NSString stringWithFormat:@"%ld", (long)self.schemaVersion];
 
-        // Check if any more rows match
-        if(sqlite3_step(ppStmt) != SQLITE_DONE)
-        {
-            // Oops, the query apparently matched more than one row (could also be an error)... not fatal, but not good.
-            NSLog(@"Warning, query may match more than one row: %@",query);
-        }
-    }
-    else if (rc == SQLITE_DONE)
-    {
-        // The query returned no results.
-    }
-    else if (rc == SQLITE_BUSY)
-    {
-        // This is bad, but theoretically it should never happen
-        NSLog(@"sqlite3_step() returned SQLITE_BUSY. You probably have a concurrency problem.");
-    }
-    else
-    {
-        NSLog(@"sqlite3_step() produced an error: %s", sqlite3_errmsg(db));
-    }
+    NSMutableDictionary *entry = [[NSMutableDictionary alloc] init];
+    entry[@"metadata"] = metadata;
+    entry[@"tileCount"] = @(self.tileCount);
+    entry[@"fileSize"] = @([attributes fileSize]);
+    entry[@"modificationDate"] = [attributes fileModificationDate];
+    NSDate *creationDate = [self creationDate];
+    if (creationDate) entry[@"creationDate"] = creationDate;
+    return entry;
+}
 
-    // Clean up
-    sqlite3_finalize(ppStmt);
-    sqlite3_close(db);
-    return data;
+- (void)setMemoryMapSize:(NSUInteger)memoryMapSize
+{
+    // Tuning values are applied when a connection is opened, so drop the idle connections to pick up the new value
+    //
+    _memoryMapSize = memoryMapSize;
+    [self sqliteCloseIdleConnections];
+}
+
+- (void)setPageCacheSize:(NSUInteger)pageCacheSize
+{
+    _pageCacheSize = pageCacheSize;
+    [self sqliteCloseIdleConnections];
+}
+
+#pragma mark - Resource keys
+
++ (NSString *)resourceKeyForURL:(NSURL *)url
+{
+    // Non-tile resources are keyed by their URL with the access token removed, so that changing the access token which
+    // is used for Mapbox API requests doesn't change which rows the URLs match.
+    //
+    NSString *urlString = [url absoluteString];
+    NSRange range = [urlString rangeOfString:@"access_token="];
+    if (range.location == NSNotFound || range.location == 0) return urlString;
+
+    NSRange end = [urlString rangeOfString:@"&" options:0 range:NSMakeRange(range.location, [urlString length] - range.location)];
+    NSString *before = [urlString substringToIndex:range.location - 1];
+    NSString *after = (end.location == NSNotFound ? @"" : [urlString substringFromIndex:end.location + 1]);
+    unichar separator = [urlString characterAtIndex:range.location - 1];
+
+    if ([after length] == 0) return before;
+
+    return [NSString stringWithFormat:@"%@%C%@", before, separator, after];
+}
+
+
++ (NSURL *)URLForResourceKey:(NSString *)key
+{
+    // This is the inverse of resourceKeyForURL:, adding the current access token back to a resource key
+    //
+    NSString *separator = ([key rangeOfString:@"?"].location == NSNotFound ? @"?" : @"&");
+    return [NSURL URLWithString:[NSString stringWithFormat:@"%@%@access_token=%@", key, separator, [MBXMapKit accessToken]]];
+}
+
+
++ (NSString *)tileTableSchemaForVersion:(NSInteger)schemaVersion
+{
+    // The tiles table follows the layout of the MBTiles tiles table, including its flipped (TMS) row numbering. Version 2
+    // databases keep the tile's blob in the table, while later versions keep the id of its row in the data table. Tiles
+    // which have not been downloaded yet have NULL tile_data (or tile_id). WITHOUT ROWID tables are only understood by
+    // sqlite 3.8.2 and later, so on older systems the table falls back to a normal rowid table with the same primary key.
+    //
+    return [NSString stringWithFormat:@"CREATE TABLE IF NOT EXISTS tiles (zoom_level INTEGER NOT NULL, tile_column INTEGER NOT NULL, tile_row INTEGER NOT NULL, %@, PRIMARY KEY (zoom_level, tile_column, tile_row))%@;\n",
+               (schemaVersion >= MBXOfflineMapDatabaseSchemaVersionDeduplicated ? @"tile_id INTEGER REFERENCES data" : @"tile_data BLOB"),
+               (sqlite3_libversion_number() >= 3008002 ? @" WITHOUT ROWID" : @"")];
+}
+
+
++ (NSData *)contentHashForData:(NSData *)data
+{
+    // Blobs are matched up by a SHA-256 digest of their contents, which is cheap next to downloading them, and long enough
+    // that two different tiles won't ever share one
+    //
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256([data bytes], (CC_LONG)[data length], digest);
+    return [NSData dataWithBytes:digest length:sizeof(digest)];
+}
+
+
++ (NSInteger)tileRowForPath:(MKTileOverlayPath)path
+{
+    // MBTiles numbers rows from the bottom of the map, while MapKit and the Mapbox API number them from the top
+    //
+    return ((NSInteger)1 << path.z) - 1 - path.y;
+}
+
+
+#pragma mark - Converting legacy databases
+
++ (NSInteger)schemaVersionOfDatabaseAtPath:(NSString *)path
+{
+    // Databases which were written before the schema had a version are version 1
+    //
+    NSInteger schemaVersion = MBXOfflineMapDatabaseSchemaVersionLegacy;
+    sqlite3 *db;
+    const char *filename = [path cStringUsingEncoding:NSUTF8StringEncoding];
+    if (sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+    {
+        sqlite3_stmt *versionStmt;
+        if (sqlite3_prepare_v2(db, "SELECT value FROM metadata WHERE name = 'schemaVersion';", -1, &versionStmt, NULL) == SQLITE_OK && sqlite3_step(versionStmt) == SQLITE_ROW)
+        {
+            schemaVersion = sqlite3_column_int(versionStmt, 0);
+        }
+        sqlite3_finalize(versionStmt);
+    }
+    sqlite3_close(db);
+    return schemaVersion;
+}
+
++ (BOOL)migrateLegacyDatabaseAtPath:(NSString *)path withError:(NSError **)error
+{
+    // Move the map tiles of a version 1 database (completed or partial) out of the URL keyed resources table and into the
+    // tiles table, then strip the access tokens from the remaining resource URLs. Everything happens in one transaction so
+    // that an interrupted conversion leaves the legacy database as it was.
+    //
+    sqlite3 *db;
+    const char *filename = [path cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc)
+    {
+        if (error) *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:path sqliteError:sqlite3_errmsg(db)];
+        sqlite3_close(db);
+        return NO;
+    }
+
+    // Pooled connections keep serving lookups from the legacy tables while this runs, so wait for them rather than
+    // failing the conversion with SQLITE_BUSY
+    //
+    sqlite3_busy_timeout(db, 5000);
+
+    // Databases which have already been converted don't need anything done
+    //
+    sqlite3_stmt *versionStmt;
+    BOOL alreadyConverted = NO;
+    if (sqlite3_prepare_v2(db, "SELECT value FROM metadata WHERE name = 'schemaVersion';", -1, &versionStmt, NULL) == SQLITE_OK)
+    {
+        alreadyConverted = (sqlite3_step(versionStmt) == SQLITE_ROW && sqlite3_column_int(versionStmt, 0) >= MBXOfflineMapDatabaseSchemaVersionTiles);
+    }
+    sqlite3_finalize(versionStmt);
+    if (alreadyConverted)
+    {
+        sqlite3_close(db);
+        return YES;
+    }
+
+    NSString *begin = [NSString stringWithFormat:@"BEGIN TRANSACTION;\n%@", [self tileTableSchemaForVersion:MBXOfflineMapDatabaseSchemaVersionTiles]];
+    char *errmsg = NULL;
+    sqlite3_exec(db, [begin UTF8String], NULL, NULL, &errmsg);
+
+    // Gather the resource rows before modifying the table
+    //
+    NSMutableArray *urls = [[NSMutableArray alloc] init];
+    NSMutableArray *ids = [[NSMutableArray alloc] init];
+    if (!errmsg)
+    {
+        sqlite3_stmt *ppStmt;
+        if (sqlite3_prepare_v2(db, "SELECT url, id FROM resources;", -1, &ppStmt, NULL) == SQLITE_OK)
+        {
+            while (sqlite3_step(ppStmt) == SQLITE_ROW)
+            {
+                const unsigned char *url = sqlite3_column_text(ppStmt, 0);
+                if (!url) continue;
+                [urls addObject:[NSString stringWithUTF8String:(const char *)url]];
+                [ids addObject:(sqlite3_column_type(ppStmt, 1) == SQLITE_NULL ? [NSNull null] : @(sqlite3_column_int64(ppStmt, 1)))];
+            }
+        }
+        sqlite3_finalize(ppStmt);
+    }
+
+    // Tile URLs look like https://a.tiles.mapbox.com/v4/{mapID}/{z}/{x}/{y}[@2x].{format}?access_token={token}
+    //
+    NSRegularExpression *tilePattern = [NSRegularExpression regularExpressionWithPattern:@"^/v4/[^/]+/(\\d+)/(\\d+)/(\\d+)(@2x)?\\.[a-z0-9]+$" options:0 error:nil];
+
+    sqlite3_stmt *insertTile = NULL;
+    sqlite3_stmt *deleteData = NULL;
+    sqlite3_stmt *deleteResource = NULL;
+    sqlite3_stmt *updateResource = NULL;
+    sqlite3_stmt *insertPendingTile = NULL;
+    if (!errmsg)
+    {
+        sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO tiles VALUES (?1, ?2, ?3, (SELECT value FROM data WHERE id = ?4));", -1, &insertTile, NULL);
+        sqlite3_prepare_v2(db, "DELETE FROM data WHERE id = ?1;", -1, &deleteData, NULL);
+        sqlite3_prepare_v2(db, "DELETE FROM resources WHERE url = ?1;", -1, &deleteResource, NULL);
+        sqlite3_prepare_v2(db, "UPDATE resources SET url = ?2 WHERE url = ?1;", -1, &updateResource, NULL);
+    }
+
+    BOOL success = (!errmsg && insertTile && deleteData && deleteResource && updateResource);
+    for (NSUInteger i = 0; success && i < [urls count]; i++)
+    {
+        NSString *urlString = urls[i];
+        NSURL *url = [NSURL URLWithString:urlString];
+        NSString *urlPath = [url path];
+        NSTextCheckingResult *match = (urlPath ? [tilePattern firstMatchInString:urlPath options:0 range:NSMakeRange(0, [urlPath length])] : nil);
+        const char *urlText = [urlString UTF8String];
+
+        if (match)
+        {
+            MKTileOverlayPath tilePath;
+            tilePath.z = [[urlPath substringWithRange:[match rangeAtIndex:1]] integerValue];
+            tilePath.x = [[urlPath substringWithRange:[match rangeAtIndex:2]] integerValue];
+            tilePath.y = [[urlPath substringWithRange:[match rangeAtIndex:3]] integerValue];
+
+            if (ids[i] == [NSNull null])
+            {
+                // Partial databases have rows for tiles which haven't been downloaded yet. Those don't go into the tiles
+                // table, which would need a NULL tile; they're listed in pending_tiles for MBXOfflineMapDownloader to
+                // queue instead.
+                //
+                if (!insertPendingTile)
+                {
+                    success = (sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS pending_tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER);", NULL, NULL, NULL) == SQLITE_OK
+                               && sqlite3_prepare_v2(db, "INSERT INTO pending_tiles VALUES (?1, ?2, ?3);", -1, &insertPendingTile, NULL) == SQLITE_OK);
+                }
+                if (success)
+                {
+                    sqlite3_bind_int64(insertPendingTile, 1, tilePath.z);
+                    sqlite3_bind_int64(insertPendingTile, 2, tilePath.x);
+                    sqlite3_bind_int64(insertPendingTile, 3, [self tileRowForPath:tilePath]);
+                    success = (sqlite3_step(insertPendingTile) == SQLITE_DONE);
+                    sqlite3_reset(insertPendingTile);
+                }
+            }
+            else
+            {
+                sqlite3_bind_int64(insertTile, 1, tilePath.z);
+                sqlite3_bind_int64(insertTile, 2, tilePath.x);
+                sqlite3_bind_int64(insertTile, 3, [self tileRowForPath:tilePath]);
+                sqlite3_bind_int64(insertTile, 4, [ids[i] longLongValue]);
+                success = (sqlite3_step(insertTile) == SQLITE_DONE);
+                sqlite3_reset(insertTile);
+
+                if (success)
+                {
+                    sqlite3_bind_int64(deleteData, 1, [ids[i] longLongValue]);
+                    success = (sqlite3_step(deleteData) == SQLITE_DONE);
+                    sqlite3_reset(deleteData);
+                }
+            }
+            if (success)
+            {
+                sqlite3_bind_text(deleteResource, 1, urlText, -1, SQLITE_TRANSIENT);
+                success = (sqlite3_step(deleteResource) == SQLITE_DONE);
+                sqlite3_reset(deleteResource);
+            }
+        }
+        else
+        {
+            NSString *key = [self resourceKeyForURL:url];
+            if (key && ! [key isEqualToString:urlString])
+            {
+                sqlite3_bind_text(updateResource, 1, urlText, -1, SQLITE_TRANSIENT);
+                sqlite3_bind_text(updateResource, 2, [key UTF8String], -1, SQLITE_TRANSIENT);
+                success = (sqlite3_step(updateResource) == SQLITE_DONE);
+                sqlite3_reset(updateResource);
+            }
+        }
+    }
+    sqlite3_finalize(insertTile);
+    sqlite3_finalize(deleteData);
+    sqlite3_finalize(deleteResource);
+    sqlite3_finalize(updateResource);
+    sqlite3_finalize(insertPendingTile);
+
+    if (success)
+    {
+        NSString *commit = [NSString stringWithFormat:@"INSERT OR REPLACE INTO metadata VALUES('schemaVersion','%ld');\nCOMMIT;",
+                               (long)MBXOfflineMapDatabaseSchemaVersionTiles];
+        sqlite3_exec(db, [commit UTF8String], NULL, NULL, &errmsg);
+        success = (errmsg == NULL);
+    }
+
+    if (success)
+    {
+        // Give the space which was used by the URL index back to the file system
+        //
+        sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL);
+    }
+    else
+    {
+        if (error) *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:path sqliteError:(errmsg ? errmsg : sqlite3_errmsg(db))];
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+    sqlite3_free(errmsg);
+    sqlite3_close(db);
+
+    return success;
+}
+
+
+#pragma mark - Deduplicating blobs
+
++ (BOOL)compactDatabaseAtPath:(NSString *)path withError:(NSError **)error
+{
+    // Bring a version 2 (or later) database up to the deduplicated schema: hash every blob which doesn't have a hash
+    // yet, store each distinct blob once and point the tiles and resources which used a copy of it at the one which is
+    // kept, and delete any blobs which nothing refers to anymore. Everything happens in one transaction, so an interrupted
+    // compaction leaves the database as it was.
+    //
+    sqlite3 *db;
+    const char *filename = [path cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc)
+    {
+        if (error) *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:path sqliteError:sqlite3_errmsg(db)];
+        sqlite3_close(db);
+        return NO;
+    }
+
+    // Give any lookups which are reading from the database a moment to finish before the compaction commits
+    //
+    sqlite3_busy_timeout(db, 5000);
+
+    NSInteger schemaVersion = MBXOfflineMapDatabaseSchemaVersionLegacy;
+    sqlite3_stmt *versionStmt;
+    if (sqlite3_prepare_v2(db, "SELECT value FROM metadata WHERE name = 'schemaVersion';", -1, &versionStmt, NULL) == SQLITE_OK && sqlite3_step(versionStmt) == SQLITE_ROW)
+    {
+        schemaVersion = sqlite3_column_int(versionStmt, 0);
+    }
+    sqlite3_finalize(versionStmt);
+    if (schemaVersion < MBXOfflineMapDatabaseSchemaVersionTiles)
+    {
+        if (error) *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:path sqliteError:"the database hasn't been converted to the tile schema"];
+        sqlite3_close(db);
+        return NO;
+    }
+
+    // Converting a version 2 database keeps its tiles table around under another name while the tiles are moved out of it
+    //
+    NSMutableString *begin = [NSMutableString stringWithString:@"BEGIN IMMEDIATE TRANSACTION;\n"];
+    if (schemaVersion < MBXOfflineMapDatabaseSchemaVersionDeduplicated)
+    {
+        [begin appendString:@"ALTER TABLE data ADD COLUMN hash BLOB;\n"];
+        [begin appendString:@"CREATE UNIQUE INDEX data_hash ON data (hash);\n"];
+        [begin appendString:@"ALTER TABLE tiles RENAME TO tiles_with_data;\n"];
+        [begin appendString:[self tileTableSchemaForVersion:MBXOfflineMapDatabaseSchemaVersionDeduplicated]];
+    }
+    char *errmsg = NULL;
+    sqlite3_exec(db, [begin UTF8String], NULL, NULL, &errmsg);
+
+    sqlite3_stmt *selectData = NULL;
+    sqlite3_stmt *selectDuplicate = NULL;
+    sqlite3_stmt *updateHash = NULL;
+    sqlite3_stmt *updateResources = NULL;
+    sqlite3_stmt *deleteData = NULL;
+    sqlite3_stmt *insertData = NULL;
+    sqlite3_stmt *insertTile = NULL;
+    if (!errmsg)
+    {
+        sqlite3_prepare_v2(db, "SELECT value FROM data WHERE id = ?1;", -1, &selectData, NULL);
+        sqlite3_prepare_v2(db, "SELECT id FROM data WHERE hash = ?1;", -1, &selectDuplicate, NULL);
+        sqlite3_prepare_v2(db, "UPDATE data SET hash = ?2 WHERE id = ?1;", -1, &updateHash, NULL);
+        sqlite3_prepare_v2(db, "UPDATE resources SET id = ?2 WHERE id = ?1;", -1, &updateResources, NULL);
+        sqlite3_prepare_v2(db, "DELETE FROM data WHERE id = ?1;", -1, &deleteData, NULL);
+        sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO data (value, hash) VALUES (?1, ?2);", -1, &insertData, NULL);
+        sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO tiles VALUES (?1, ?2, ?3, (SELECT id FROM data WHERE hash = ?4));", -1, &insertTile, NULL);
+    }
+    BOOL success = (!errmsg && selectData && selectDuplicate && updateHash && updateResources && deleteData && insertData && insertTile);
+
+    // Gather the ids of the blobs which haven't been hashed before modifying the table
+    //
+    NSMutableArray *ids = [[NSMutableArray alloc] init];
+    if (success)
+    {
+        sqlite3_stmt *ppStmt;
+        if (sqlite3_prepare_v2(db, "SELECT id FROM data WHERE hash IS NULL;", -1, &ppStmt, NULL) == SQLITE_OK)
+        {
+            while (sqlite3_step(ppStmt) == SQLITE_ROW)
+            {
+                [ids addObject:@(sqlite3_column_int64(ppStmt, 0))];
+            }
+        }
+        sqlite3_finalize(ppStmt);
+    }
+
+    for (NSUInteger i = 0; success && i < [ids count]; i++)
+    {
+        sqlite3_int64 dataID = [ids[i] longLongValue];
+        NSData *hash = nil;
+        sqlite3_bind_int64(selectData, 1, dataID);
+        if (sqlite3_step(selectData) == SQLITE_ROW)
+        {
+            hash = [self contentHashForData:[NSData dataWithBytesNoCopy:(void *)sqlite3_column_blob(selectData, 0) length:sqlite3_column_bytes(selectData, 0) freeWhenDone:NO]];
+        }
+        sqlite3_reset(selectData);
+        if (!hash) continue;
+
+        sqlite3_int64 duplicateID = 0;
+        sqlite3_bind_blob(selectDuplicate, 1, [hash bytes], (int)[hash length], SQLITE_STATIC);
+        if (sqlite3_step(selectDuplicate) == SQLITE_ROW)
+        {
+            duplicateID = sqlite3_column_int64(selectDuplicate, 0);
+        }
+        sqlite3_reset(selectDuplicate);
+
+        if (duplicateID)
+        {
+            // This blob is a copy of one which is already kept, so point its resources at that one instead
+            //
+            sqlite3_bind_int64(updateResources, 1, dataID);
+            sqlite3_bind_int64(updateResources, 2, duplicateID);
+            success = (sqlite3_step(updateResources) == SQLITE_DONE);
+            sqlite3_reset(updateResources);
+            if (success)
+            {
+                sqlite3_bind_int64(deleteData, 1, dataID);
+                success = (sqlite3_step(deleteData) == SQLITE_DONE);
+                sqlite3_reset(deleteData);
+            }
+        }
+        else
+        {
+            sqlite3_bind_int64(updateHash, 1, dataID);
+            sqlite3_bind_blob(updateHash, 2, [hash bytes], (int)[hash length], SQLITE_STATIC);
+            success = (sqlite3_step(updateHash) == SQLITE_DONE);
+            sqlite3_reset(updateHash);
+        }
+    }
+
+    if (success && schemaVersion < MBXOfflineMapDatabaseSchemaVersionDeduplicated)
+    {
+        // Move the tiles over to the deduplicated tiles table one at a time, adding each tile's blob to the data table
+        // unless an identical one is already there
+        //
+        sqlite3_stmt *ppStmt;
+        success = (sqlite3_prepare_v2(db, "SELECT zoom_level, tile_column, tile_row, tile_data FROM tiles_with_data;", -1, &ppStmt, NULL) == SQLITE_OK);
+        while (success && (rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+        {
+            NSData *hash = nil;
+            if (sqlite3_column_type(ppStmt, 3) != SQLITE_NULL)
+            {
+                const void *bytes = sqlite3_column_blob(ppStmt, 3);
+                int length = sqlite3_column_bytes(ppStmt, 3);
+                hash = [self contentHashForData:[NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO]];
+
+                sqlite3_bind_blob(insertData, 1, bytes, length, SQLITE_STATIC);
+                sqlite3_bind_blob(insertData, 2, [hash bytes], (int)[hash length], SQLITE_STATIC);
+                success = (sqlite3_step(insertData) == SQLITE_DONE);
+                sqlite3_reset(insertData);
+                sqlite3_clear_bindings(insertData);
+            }
+
+            if (success)
+            {
+                sqlite3_bind_int64(insertTile, 1, sqlite3_column_int64(ppStmt, 0));
+                sqlite3_bind_int64(insertTile, 2, sqlite3_column_int64(ppStmt, 1));
+                sqlite3_bind_int64(insertTile, 3, sqlite3_column_int64(ppStmt, 2));
+                if (hash) sqlite3_bind_blob(insertTile, 4, [hash bytes], (int)[hash length], SQLITE_STATIC);
+                success = (sqlite3_step(insertTile) == SQLITE_DONE);
+                sqlite3_reset(insertTile);
+                sqlite3_clear_bindings(insertTile);
+            }
+        }
+        success = success && (rc == SQLITE_DONE);
+        sqlite3_finalize(ppStmt);
+    }
+    sqlite3_finalize(selectData);
+    sqlite3_finalize(selectDuplicate);
+    sqlite3_finalize(updateHash);
+    sqlite3_finalize(updateResources);
+    sqlite3_finalize(deleteData);
+    sqlite3_finalize(insertData);
+    sqlite3_finalize(insertTile);
+
+    // Blobs which were replaced by a later download of the same resource aren't used by anything anymore
+    //
+    BOOL reclaimedSpace = (schemaVersion < MBXOfflineMapDatabaseSchemaVersionDeduplicated || [ids count] > 0);
+    if (success)
+    {
+        sqlite3_exec(db, "DELETE FROM data WHERE id NOT IN (SELECT tile_id FROM tiles WHERE tile_id IS NOT NULL) AND id NOT IN (SELECT id FROM resources WHERE id IS NOT NULL);", NULL, NULL, &errmsg);
+        success = (errmsg == NULL);
+        reclaimedSpace = reclaimedSpace || (sqlite3_changes(db) > 0);
+    }
+
+    if (success)
+    {
+        NSString *commit = [NSString stringWithFormat:@"%@INSERT OR REPLACE INTO metadata VALUES('schemaVersion','%ld');\nCOMMIT;",
+                               (schemaVersion < MBXOfflineMapDatabaseSchemaVersionDeduplicated ? @"DROP TABLE tiles_with_data;\n" : @""),
+                               (long)MBXOfflineMapDatabaseSchemaVersionDeduplicated];
+        sqlite3_exec(db, [commit UTF8String], NULL, NULL, &errmsg);
+        success = (errmsg == NULL);
+    }
+
+    if (success && reclaimedSpace)
+    {
+        // Give the space which was used by the duplicate blobs back to the file system
+        //
+        sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL);
+    }
+    else if (!success)
+    {
+        if (error) *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:path sqliteError:(errmsg ? errmsg : sqlite3_errmsg(db))];
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+    sqlite3_free(errmsg);
+    sqlite3_close(db);
+
+    return success;
+}
+
+
++ (dispatch_queue_t)migrationQueue
+{
+    // Legacy conversions rewrite the whole file, so they're done one at a time, and never at the same time as a compaction
+    // of the same database
+    //
+    static dispatch_queue_t migrationQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        migrationQueue = dispatch_queue_create("com.mapbox.MBXMapKit.offlineMapDatabaseMigration", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(migrationQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return migrationQueue;
+}
+
+- (void)migrateLegacyDatabaseInBackground
+{
+    // This is a one-time conversion of an offline map which was downloaded by an older version of MBXMapKit. It rewrites
+    // the whole file, so it happens in the background, and lookups keep using the legacy URL keyed queries until it's
+    // done. If it fails for some reason, the database just stays readable that way.
+    //
+    NSString *path = _path;
+    __weak MBXOfflineMapDatabase *weakSelf = self;
+    dispatch_async([MBXOfflineMapDatabase migrationQueue], ^{
+        NSError *error;
+        if ([MBXOfflineMapDatabase migrateLegacyDatabaseAtPath:path withError:&error])
+        {
+            // Picking up the new schema version also retires the connections which have the legacy statements prepared
+            //
+            [weakSelf reloadContents];
+        }
+        else
+        {
+            NSLog(@"Unable to convert offline map database %@ to the tile schema: %@", path, error);
+        }
+    });
+}
+
+- (BOOL)compactWithError:(NSError **)error
+{
+    assert(_initializedProperly);
+
+    if (self.schemaVersion < MBXOfflineMapDatabaseSchemaVersionTiles)
+    {
+        // A legacy database which couldn't be converted on open gets another chance here. Waiting on the migration queue
+        // also means this doesn't race a conversion which is still running in the background.
+        //
+        __block BOOL migrated;
+        __block NSError *migrationError;
+        dispatch_sync([MBXOfflineMapDatabase migrationQueue], ^{
+            migrated = [MBXOfflineMapDatabase migrateLegacyDatabaseAtPath:_path withError:&migrationError];
+        });
+        if (!migrated)
+        {
+            if (error) *error = migrationError;
+            return NO;
+        }
+        self.schemaVersion = MBXOfflineMapDatabaseSchemaVersionTiles;
+        [self sqliteCloseIdleConnections];
+    }
+
+    BOOL success = [MBXOfflineMapDatabase compactDatabaseAtPath:_path withError:error];
+    if (success)
+    {
+        // Idle connections still have statements prepared for the old tiles table
+        //
+        self.schemaVersion = MBXOfflineMapDatabaseSchemaVersionDeduplicated;
+        [self sqliteCloseIdleConnections];
+    }
+
+    return success;
+}
+
+
+#pragma mark - Packed archives
+
+- (NSString *)archivePath
+{
+    return [_path stringByAppendingPathExtension:@"archive"];
+}
+
+
+- (MBXOfflineMapArchive *)openArchive
+{
+    // The archive is mapped on the first lookup after it's written (or after the database is reloaded). If it can't be
+    // read, lookups go back to using the database.
+    //
+    @synchronized(self)
+    {
+        if (_archived && !_archive)
+        {
+            NSError *error;
+            _archive = [[MBXOfflineMapArchive alloc] initWithContentsOfFile:[self archivePath] error:&error];
+            if (!_archive)
+            {
+                NSLog(@"Unable to read the packed archive of offline map database %@: %@", _path, error);
+                _archived = NO;
+            }
+        }
+        return _archive;
+    }
+}
+
+
+- (BOOL)writeArchiveWithError:(NSError **)error
+{
+    assert(_initializedProperly);
+
+    // The archive is written from the deduplicated schema, so that identical tiles are stored once in it too
+    //
+    if (self.schemaVersion < MBXOfflineMapDatabaseSchemaVersionDeduplicated && ! [self compactWithError:error]) return NO;
+
+    if ( ! [MBXOfflineMapDatabase writeArchiveForDatabaseAtPath:_path toPath:[self archivePath] withError:error]) return NO;
+
+    @synchronized(self)
+    {
+        _archived = YES;
+        _archive = nil;
+    }
+    return YES;
+}
+
+
++ (BOOL)writeArchiveForDatabaseAtPath:(NSString *)path toPath:(NSString *)archivePath withError:(NSError **)error
+{
+    // Write a packed archive of a deduplicated database (see the description of the format at the top of this file). The
+    // archive is written to a temporary file which is renamed into place at the end, so anything which already has the old
+    // archive mapped keeps reading it undisturbed.
+    //
+    sqlite3 *db;
+    const char *filename = [path cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL);
+    if (rc)
+    {
+        if (error) *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:path sqliteError:sqlite3_errmsg(db)];
+        sqlite3_close(db);
+        return NO;
+    }
+
+    // Read the metadata table and the non-tile resources for the metadata block
+    //
+    NSMutableDictionary *metadata = [[NSMutableDictionary alloc] init];
+    NSMutableDictionary *resources = [[NSMutableDictionary alloc] init];
+    sqlite3_stmt *ppStmt;
+    BOOL success = (sqlite3_prepare_v2(db, "SELECT name, value FROM metadata;", -1, &ppStmt, NULL) == SQLITE_OK);
+    while (success && (rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+    {
+        const unsigned char *name = sqlite3_column_text(ppStmt, 0);
+        const unsigned char *value = sqlite3_column_text(ppStmt, 1);
+        if (name && value) metadata[[NSString stringWithUTF8String:(const char *)name]] = [NSString stringWithUTF8String:(const char *)value];
+    }
+    success = success && (rc == SQLITE_DONE);
+    sqlite3_finalize(ppStmt);
+
+    if (success && [metadata[@"schemaVersion"] integerValue] < MBXOfflineMapDatabaseSchemaVersionDeduplicated)
+    {
+        if (error) *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:path sqliteError:"the database hasn't been converted to the deduplicated schema"];
+        sqlite3_close(db);
+        return NO;
+    }
+
+    success = success && (sqlite3_prepare_v2(db, "SELECT resources.url, data.value FROM resources JOIN data ON data.id = resources.id;", -1, &ppStmt, NULL) == SQLITE_OK);
+    while (success && (rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+    {
+        const unsigned char *url = sqlite3_column_text(ppStmt, 0);
+        const void *value = sqlite3_column_blob(ppStmt, 1);
+        if (url && value) resources[[NSString stringWithUTF8String:(const char *)url]] = [NSData dataWithBytes:value length:sqlite3_column_bytes(ppStmt, 1)];
+    }
+    success = success && (rc == SQLITE_DONE);
+    sqlite3_finalize(ppStmt);
+
+    // Build the tile directory and sort it along the Hilbert curve
+    //
+    MBXOfflineMapArchiveEntry *entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    success = success && (sqlite3_prepare_v2(db, "SELECT zoom_level, tile_column, tile_row, tile_id FROM tiles WHERE tile_id IS NOT NULL;", -1, &ppStmt, NULL) == SQLITE_OK);
+    while (success && (rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+    {
+        sqlite3_int64 z = sqlite3_column_int64(ppStmt, 0);
+        sqlite3_int64 x = sqlite3_column_int64(ppStmt, 1);
+        sqlite3_int64 row = sqlite3_column_int64(ppStmt, 2);
+        if (z < 0 || z > MBXOfflineMapArchiveMaximumZ || x < 0 || x >= ((sqlite3_int64)1 << z) || row < 0 || row >= ((sqlite3_int64)1 << z)) continue;
+
+        if (count == capacity)
+        {
+            capacity = (capacity ? capacity * 2 : 1024);
+            MBXOfflineMapArchiveEntry *grown = realloc(entries, capacity * sizeof(MBXOfflineMapArchiveEntry));
+            if (!grown)
+            {
+                success = NO;
+                break;
+            }
+            entries = grown;
+        }
+
+        // Flipping the MBTiles row the same way as a y coordinate gives the y coordinate back
+        //
+        MKTileOverlayPath tilePath = { .x = (NSInteger)x, .y = (NSInteger)row, .z = (NSInteger)z };
+        entries[count].key = MBXOfflineMapArchiveTileKey((long)z, (uint64_t)x, (uint64_t)[self tileRowForPath:tilePath]);
+        entries[count].offset = 0;
+        entries[count].length = 0;
+        entries[count].dataID = sqlite3_column_int64(ppStmt, 3);
+        count += 1;
+    }
+    success = success && (rc == SQLITE_DONE || rc == SQLITE_ROW);
+    sqlite3_finalize(ppStmt);
+    if (count > 0) qsort(entries, count, sizeof(MBXOfflineMapArchiveEntry), MBXOfflineMapArchiveCompareEntries);
+
+    // Write the tile data in directory order, after room for the header and directory. Each distinct blob is written
+    // the first time a tile uses it, and later tiles which use it point at the same bytes.
+    //
+    NSString *temporaryPath = [archivePath stringByAppendingPathExtension:@"tmp"];
+    FILE *file = (success ? fopen([temporaryPath fileSystemRepresentation], "wb") : NULL);
+    int fileError = (success && !file ? errno : 0);
+    uint64_t directoryOffset = MBXOfflineMapArchiveHeaderSize;
+    uint64_t dataOffset = directoryOffset + (uint64_t)count * MBXOfflineMapArchiveEntrySize;
+    uint64_t offset = dataOffset;
+    success = success && file && (fseeko(file, (off_t)dataOffset, SEEK_SET) == 0);
+
+    NSMutableDictionary *entryIndexForDataID = [[NSMutableDictionary alloc] init];
+    sqlite3_stmt *selectData = NULL;
+    success = success && (sqlite3_prepare_v2(db, "SELECT value FROM data WHERE id = ?1;", -1, &selectData, NULL) == SQLITE_OK);
+    for (size_t i = 0; success && i < count; i++)
+    {
+        NSNumber *written = entryIndexForDataID[@(entries[i].dataID)];
+        if (written)
+        {
+            entries[i].offset = entries[[written unsignedLongValue]].offset;
+            entries[i].length = entries[[written unsignedLongValue]].length;
+            continue;
+        }
+
+        sqlite3_bind_int64(selectData, 1, entries[i].dataID);
+        if (sqlite3_step(selectData) == SQLITE_ROW && sqlite3_column_type(selectData, 0) != SQLITE_NULL)
+        {
+            const void *value = sqlite3_column_blob(selectData, 0);
+            int length = sqlite3_column_bytes(selectData, 0);
+            success = (length == 0 || fwrite(value, 1, (size_t)length, file) == (size_t)length);
+            entries[i].offset = offset;
+            entries[i].length = (uint32_t)length;
+            offset += (uint64_t)length;
+            entryIndexForDataID[@(entries[i].dataID)] = @(i);
+        }
+        sqlite3_reset(selectData);
+    }
+    sqlite3_finalize(selectData);
+    if (!success && !fileError && file && ferror(file)) fileError = errno;
+    if (!success && error && !fileError) *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:path sqliteError:sqlite3_errmsg(db)];
+    sqlite3_close(db);
+
+    // Finish with the metadata block, the directory, and the header
+    //
+    NSData *metadataBlock = nil;
+    if (success)
+    {
+        metadataBlock = [NSPropertyListSerialization dataWithPropertyList:@{ @"metadata" : metadata, @"resources" : resources }
+                                                                   format:NSPropertyListBinaryFormat_v1_0
+                                                                  options:0
+                                                                    error:error];
+        success = (metadataBlock != nil);
+    }
+    if (success)
+    {
+        success = (fwrite([metadataBlock bytes], 1, [metadataBlock length], file) == [metadataBlock length]);
+
+        uint8_t *directory = (count > 0 ? malloc(count * MBXOfflineMapArchiveEntrySize) : NULL);
+        success = success && (count == 0 || directory);
+        for (size_t i = 0; success && i < count; i++)
+        {
+            uint8_t *entry = directory + i * MBXOfflineMapArchiveEntrySize;
+            MBXOfflineMapArchiveWriteUInt64(entry, entries[i].key);
+            MBXOfflineMapArchiveWriteUInt64(entry + 8, entries[i].offset);
+            MBXOfflineMapArchiveWriteUInt32(entry + 16, entries[i].length);
+            MBXOfflineMapArchiveWriteUInt32(entry + 20, 0);
+        }
+
+        uint8_t header[MBXOfflineMapArchiveHeaderSize];
+        memset(header, 0, sizeof(header));
+        memcpy(header, MBXOfflineMapArchiveMagic, sizeof(MBXOfflineMapArchiveMagic));
+        MBXOfflineMapArchiveWriteUInt32(header + 8, MBXOfflineMapArchiveVersion);
+        MBXOfflineMapArchiveWriteUInt64(header + 16, count);
+        MBXOfflineMapArchiveWriteUInt64(header + 24, directoryOffset);
+        MBXOfflineMapArchiveWriteUInt64(header + 32, dataOffset);
+        MBXOfflineMapArchiveWriteUInt64(header + 40, offset - dataOffset);
+        MBXOfflineMapArchiveWriteUInt64(header + 48, offset);
+        MBXOfflineMapArchiveWriteUInt64(header + 56, [metadataBlock length]);
+
+        success = success
+            && fseeko(file, 0, SEEK_SET) == 0
+            && fwrite(header, 1, sizeof(header), file) == sizeof(header)
+            && (count == 0 || fwrite(directory, MBXOfflineMapArchiveEntrySize, count, file) == count);
+        free(directory);
+        if (!success) fileError = errno;
+    }
+    free(entries);
+
+    if (file && fclose(file) != 0 && success)
+    {
+        success = NO;
+        fileError = errno;
+    }
+    if (success && rename([temporaryPath fileSystemRepresentation], [archivePath fileSystemRepresentation]) != 0)
+    {
+        success = NO;
+        fileError = errno;
+    }
+    if (!success)
+    {
+        if (error && fileError) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:fileError userInfo:nil];
+        unlink([temporaryPath fileSystemRepresentation]);
+    }
+
+    return success;
+}
+
+
+#pragma mark - sqlite stuff
+
+- (NSDictionary *)sqliteMetadata
+{
+    // Read the whole metadata table with a single short-lived connection. This happens once per database, so it isn't
+    // worth keeping a connection in the pool for it.
+    //
+    NSMutableDictionary *metadata = [[NSMutableDictionary alloc] init];
+    MBXOfflineMapDatabaseConnection *connection = [self sqliteOpenConnection];
+    if (!connection) return metadata;
+
+    sqlite3_stmt *ppStmt;
+    int rc = sqlite3_prepare_v2(connection->db, "SELECT name, value FROM metadata;", -1, &ppStmt, NULL);
+    if (rc)
+    {
+        NSLog(@"Problem preparing sql statement: %s", sqlite3_errmsg(connection->db));
+    }
+    else
+    {
+        while ((rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+        {
+            const unsigned char *name = sqlite3_column_text(ppStmt, 0);
+            const void *value = sqlite3_column_blob(ppStmt, 1);
+            int length = sqlite3_column_bytes(ppStmt, 1);
+            if (name && value)
+            {
+                NSString *valueString = [[NSString alloc] initWithBytes:value length:length encoding:NSUTF8StringEncoding];
+                if (valueString) metadata[[NSString stringWithUTF8String:(const char *)name]] = valueString;
+            }
+        }
+        if (rc != SQLITE_DONE)
+        {
+            NSLog(@"sqlite3_step() produced an error: %s", sqlite3_errmsg(connection->db));
+        }
+    }
+    sqlite3_finalize(ppStmt);
+    [self sqliteCloseConnection:connection];
+
+    return metadata;
+}
+
+
+- (NSUInteger)sqliteTileCount
+{
+    NSUInteger count = 0;
+    MBXOfflineMapDatabaseConnection *connection = [self sqliteOpenConnection];
+    if (!connection) return count;
+
+    // Legacy databases which couldn't be converted keep their tiles in the resources table, and don't have a tiles table
+    //
+    sqlite3_stmt *ppStmt;
+    const char *sql = (self.schemaVersion < MBXOfflineMapDatabaseSchemaVersionTiles ? "SELECT COUNT(*) FROM resources;" : "SELECT COUNT(*) FROM tiles;");
+    if (sqlite3_prepare_v2(connection->db, sql, -1, &ppStmt, NULL) == SQLITE_OK && sqlite3_step(ppStmt) == SQLITE_ROW)
+    {
+        count = (NSUInteger)sqlite3_column_int64(ppStmt, 0);
+    }
+    else
+    {
+        NSLog(@"Problem counting the tiles in %@: %s", _path, sqlite3_errmsg(connection->db));
+    }
+    sqlite3_finalize(ppStmt);
+    [self sqliteCloseConnection:connection];
+
+    return count;
+}
+
+
+- (NSData *)sqliteDataForURL:(NSURL *)url usingConnection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    sqlite3_stmt *ppStmt = [self sqliteStatement:MBXOfflineMapDatabaseStatementDataForURL forConnection:connection];
+    NSString *key = (self.schemaVersion >= MBXOfflineMapDatabaseSchemaVersionTiles ? [MBXOfflineMapDatabase resourceKeyForURL:url] : [url absoluteString]);
+    const char *urlString = [key UTF8String];
+    if (!ppStmt || !urlString) return nil;
+
+    sqlite3_bind_text(ppStmt, 1, urlString, -1, SQLITE_TRANSIENT);
+    NSData *data = [self sqliteDataForSingleColumnStatement:ppStmt connection:connection];
+    sqlite3_reset(ppStmt);
+    sqlite3_clear_bindings(ppStmt);
+
+    return data;
+}
+
+
+- (NSData *)sqliteDataForPath:(MKTileOverlayPath)path usingConnection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    NSInteger schemaVersion = self.schemaVersion;
+    if (schemaVersion < MBXOfflineMapDatabaseSchemaVersionTiles)
+    {
+        // A legacy database which couldn't be converted still has its tiles keyed by the URL they were downloaded from
+        //
+        NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"https://a.tiles.mapbox.com/v4/%@/%ld/%ld/%ld%@.%@%@",
+                                              _mapID,
+                                              (long)path.z,
+                                              (long)path.x,
+                                              (long)path.y,
+                                              (path.contentScaleFactor > 1.0 ? @"@2x" : @""),
+                                              [MBXRasterTileOverlay qualityExtensionForImageQuality:_imageQuality],
+                                              [@"?access_token=" stringByAppendingString:[MBXMapKit accessToken]]]];
+        return [self sqliteDataForURL:url usingConnection:connection];
+    }
+
+    MBXOfflineMapDatabaseStatement statement = (schemaVersion >= MBXOfflineMapDatabaseSchemaVersionDeduplicated ? MBXOfflineMapDatabaseStatementDataForDeduplicatedTile : MBXOfflineMapDatabaseStatementDataForTile);
+    sqlite3_stmt *ppStmt = [self sqliteStatement:statement forConnection:connection];
+    if (!ppStmt) return nil;
+
+    sqlite3_bind_int64(ppStmt, 1, path.z);
+    sqlite3_bind_int64(ppStmt, 2, path.x);
+    sqlite3_bind_int64(ppStmt, 3, [MBXOfflineMapDatabase tileRowForPath:path]);
+    NSData *data = [self sqliteDataForSingleColumnStatement:ppStmt connection:connection];
+    sqlite3_reset(ppStmt);
+
+    return data;
+}
+
+
+- (NSData *)sqliteDataForSingleColumnStatement:(sqlite3_stmt *)ppStmt connection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    // Evaluate a prepared statement which already has its parameters bound. The caller is responsible for resetting it.
+    // See http://sqlite.org/c3ref/step.html and http://sqlite.org/c3ref/column_blob.html
+    //
+    NSData *data = nil;
+    int rc = sqlite3_step(ppStmt);
+    if (rc == SQLITE_ROW && sqlite3_column_type(ppStmt, 0) == SQLITE_NULL)
+    {
+        // The row exists, but its data hasn't been downloaded
+    }
+    else if (rc == SQLITE_ROW)
+    {
+        // The query is supposed to be for exactly one column
+        assert(sqlite3_column_count(ppStmt)==1);
+
+        // Success!
+        data = [NSData dataWithBytes:sqlite3_column_blob(ppStmt, 0) length:sqlite3_column_bytes(ppStmt, 0)];
+
+        // Check if any more rows match
+        if(sqlite3_step(ppStmt) != SQLITE_DONE)
+        {
+            // Oops, the query apparently matched more than one row (could also be an error)... not fatal, but not good.
+            NSLog(@"Warning, query may match more than one row: %s", sqlite3_sql(ppStmt));
+        }
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        // The query returned no results.
+    }
+    else if (rc == SQLITE_BUSY)
+    {
+        // This is bad, but theoretically it should never happen
+        NSLog(@"sqlite3_step() returned SQLITE_BUSY. You probably have a concurrency problem.");
+        [[MBXTileMetrics sharedTileMetrics] addValue:1 toCounter:MBXTileMetricsCounterSqliteBusy];
+    }
+    else
+    {
+        NSLog(@"sqlite3_step() produced an error: %s", sqlite3_errmsg(connection->db));
+    }
+
+    return data;
+}
+
+
+#pragma mark - sqlite connection pool
+
+- (MBXOfflineMapDatabaseConnection *)sqliteCheckOutConnection
+{
+    // Take an idle connection if there is one, otherwise open a new one. A connection is only ever used by the thread
+    // which checked it out, which is what sqlite's multi-thread mode requires.
+    //
+    MBXOfflineMapDatabaseConnection *connection = NULL;
+    @synchronized(_idleConnections)
+    {
+        NSUInteger count = [_idleConnections count];
+        if (count > 0)
+        {
+            connection = [_idleConnections pointerAtIndex:count - 1];
+            [_idleConnections removePointerAtIndex:count - 1];
+        }
+    }
+
+    return connection ? connection : [self sqliteOpenConnection];
+}
+
+
+- (void)sqliteCheckInConnection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    @synchronized(_idleConnections)
+    {
+        if ( ! _invalid && connection->generation == _connectionGeneration && [_idleConnections count] < MBXOfflineMapDatabaseMaximumIdleConnections)
+        {
+            [_idleConnections addPointer:connection];
+            return;
+        }
+    }
+
+    [self sqliteCloseConnection:connection];
+}
+
+
+- (void)sqliteCloseIdleConnections
+{
+    NSMutableArray *connections = [[NSMutableArray alloc] init];
+    @synchronized(_idleConnections)
+    {
+        for (NSUInteger i = 0; i < [_idleConnections count]; i++)
+        {
+            [connections addObject:[NSValue valueWithPointer:[_idleConnections pointerAtIndex:i]]];
+        }
+        [_idleConnections setCount:0];
+    }
+
+    for (NSValue *value in connections)
+    {
+        [self sqliteCloseConnection:(MBXOfflineMapDatabaseConnection *)[value pointerValue]];
+    }
+}
+
+
+- (MBXOfflineMapDatabaseConnection *)sqliteOpenConnection
+{
+    // MBXMapKit expects libsqlite to have been compiled with SQLITE_THREADSAFE=2 (multi-thread mode), which means
+    // that it can handle its own thread safety as long as you don't attempt to use a database connection from more
+    // than one thread at the same time. The connection pool takes care of that by handing each connection to only one
+    // thread at a time. Since the queries here are all SELECT's, locking for writes shouldn't be an issue.
+    // Some relevant sqlite documentation:
+    // - http://sqlite.org/faq.html#q5
+    // - http://www.sqlite.org/threadsafe.html
+    // - http://www.sqlite.org/c3ref/threadsafe.html
+    // - http://www.sqlite.org/c3ref/c_config_covering_index_scan.html#sqliteconfigmultithread
+    //
+    assert(sqlite3_threadsafe()==2);
+
+    // Note which version of the file this connection is for before opening it, so that if the file is replaced while it
+    // opens, the connection is treated as being for the old file
+    //
+    NSUInteger generation;
+    @synchronized(_idleConnections)
+    {
+        generation = _connectionGeneration;
+    }
+
+    // Open the database read-only and multi-threaded. The slightly obscure c-style variable names here and below are
+    // used to stay consistent with the sqlite documentaion. See http://sqlite.org/c3ref/open.html
+    sqlite3 *db;
+    int rc;
+    const char *filename = [_path cStringUsingEncoding:NSUTF8StringEncoding];
+    rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc)
+    {
+        NSLog(@"Can't open database %@: %s", _path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    // Apply the optional memory-mapped I/O and page cache tuning. A negative cache_size is interpreted by sqlite as KiB.
+    // See http://sqlite.org/pragma.html#pragma_mmap_size and http://sqlite.org/pragma.html#pragma_cache_size
+    //
+    NSString *pragmas = [NSString stringWithFormat:@"PRAGMA mmap_size=%lu; PRAGMA cache_size=-%lu;",
+                            (unsigned long)_memoryMapSize,
+                            (unsigned long)(_pageCacheSize / 1024)];
+    char *errmsg = NULL;
+    sqlite3_exec(db, [pragmas UTF8String], NULL, NULL, &errmsg);
+    if (errmsg)
+    {
+        NSLog(@"Problem configuring database %@: %s", _path, errmsg);
+        sqlite3_free(errmsg);
+    }
+
+    MBXOfflineMapDatabaseConnection *connection = calloc(1, sizeof(MBXOfflineMapDatabaseConnection));
+    connection->db = db;
+    connection->generation = generation;
+
+    return connection;
+}
+
+
+- (sqlite3_stmt *)sqliteStatement:(MBXOfflineMapDatabaseStatement)statement forConnection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    // Prepare each statement once per connection so that each lookup only needs to bind its parameters,
+    // see http://sqlite.org/c3ref/prepare.html
+    //
+    if (!connection->statements[statement])
+    {
+        int rc = sqlite3_prepare_v2(connection->db, MBXOfflineMapDatabaseStatementSQL[statement], -1, &connection->statements[statement], NULL);
+        if (rc)
+        {
+            NSLog(@"Problem preparing sql statement: %s", sqlite3_errmsg(connection->db));
+            sqlite3_finalize(connection->statements[statement]);
+            connection->statements[statement] = NULL;
+        }
+    }
+
+    return connection->statements[statement];
+}
+
+
+- (void)sqliteCloseConnection:(MBXOfflineMapDatabaseConnection *)connection
+{
+    if (!connection) return;
+
+    for (NSUInteger i = 0; i < MBXOfflineMapDatabaseStatementCount; i++)
+    {
+        sqlite3_finalize(connection->statements[i]);
+    }
+    sqlite3_close(connection->db);
+    free(connection);
 }
 
 @end
@@ -10,7 +10,7 @@
 
 #pragma mark - Task states
 
-/** The possible states of the offline map downloader. */
+/** The possible states of the offline map downloader and of its download jobs. */
 typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
     /** An offline map download job is in progress. */
     MBXOfflineMapDownloaderStateRunning,
@@ -26,7 +26,9 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 #pragma mark - Delegate protocol for progress updates
 
 @class MBXOfflineMapDownloader;
+@class MBXOfflineMapDownloadJob;
 @class MBXOfflineMapDatabase;
+@class MBXTileCoverage;
 
 /** The `MBXOfflineMapDownloaderDelegate` protocol provides notifications of download progress and state machine transitions for the shared offline map downloader. */
 @protocol MBXOfflineMapDownloaderDelegate <NSObject>
@@ -37,9 +39,15 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 
 /** Notifies the delegate that the offline map downloader's state has changed. This is designed to facilitate user interface updates such as enabling and disabling buttons and network activity indicators.
 *   @param offlineMapDownloader The offline map downloader whose state has changed.
-*   @param state The new state of the downloader. */
+*   @param state The new state of the downloader, which combines the states of all of its download jobs. */
 - (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader stateChangedTo:(MBXOfflineMapDownloaderState)state;
 
+/** Notifies the delegate that the state of one of the offline map downloader's download jobs has changed.
+*   @param offlineMapDownloader The offline map downloader which is running the job.
+*   @param job The download job whose state has changed.
+*   @param state The new state of the job. */
+- (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader job:(MBXOfflineMapDownloadJob *)job stateChangedTo:(MBXOfflineMapDownloaderState)state;
+
 /** @name Obtaining Information About Download Jobs */
 
 /** Notifies the delegate of the number of resources which will be requested as part of the current offline map download job. This is designed to facilitate a user interface update to show a progress indicator, as well as to enable sanity checks for whether the number of tiles being requested is reasonable.
@@ -49,12 +57,19 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 *   @warning Since the offline map downloader does not impose any arbitrary upper limit on the number of resources which may be requested from the Mapbox APIs, it is possible to request a very large amount of data. You might want to provide your own checks or accounting mechanisms to manage the number of resources that your apps request from the API. */
 - (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader totalFilesExpectedToWrite:(NSUInteger)totalFilesExpectedToWrite;
 
-/** Notifies the delegate of changes to the percentage completion of an offline map download job. This is designed to facilitate updating a progress indicator.
+/** Notifies the delegate of changes to the percentage completion of the offline map downloader's download jobs. This is designed to facilitate updating a progress indicator.
 *   @param offlineMapDownloader The offline map downloader.
-*   @param totalFilesWritten The number of files which have been downloaded and saved to the database on disk.
-*   @param totalFilesExpectedToWrite An estimated count of the number of resources that will be downloaded. This is primarily determined from the map region and zoom limits which were used to begin a download job, but it also potentially includes JSON and marker icon resources. */
+*   @param totalFilesWritten The number of files which have been downloaded and saved to the database on disk, summed over all of the download jobs.
+*   @param totalFilesExpectedToWrite An estimated count of the number of resources that will be downloaded, summed over all of the download jobs. This is primarily determined from the map regions and zoom limits which were used to begin the download jobs, but it also potentially includes JSON and marker icon resources. */
 - (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader totalFilesWritten:(NSUInteger)totalFilesWritten totalFilesExpectedToWrite:(NSUInteger)totalFilesExpectedToWrite;
 
+/** Notifies the delegate of changes to the percentage completion of one offline map download job.
+*   @param offlineMapDownloader The offline map downloader which is running the job.
+*   @param job The download job which has made progress.
+*   @param totalFilesWritten The number of the job's files which have been downloaded and saved to the database on disk.
+*   @param totalFilesExpectedToWrite An estimated count of the number of resources that the job will download. */
+- (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader job:(MBXOfflineMapDownloadJob *)job totalFilesWritten:(NSUInteger)totalFilesWritten totalFilesExpectedToWrite:(NSUInteger)totalFilesExpectedToWrite;
+
 /** @name Ending Download Jobs */
 
 /** Notifies the delegate that something unexpected, but not necessarily bad, has happened. This is designed to provide an opportunity to recognize potential configuration problems with your map. For example, you might receive an HTTP 404 response for a map tile if you request a map region which extends outside of your map data's coverage area. 
@@ -70,6 +85,70 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 *   @param error The error which stopped the offline map download job. For successful completion, this parameter will be `nil`. */
 - (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader didCompleteOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase withError:(NSError *)error;
 
+/** Notifies the delegate that an offline map download job has finished, identifying which job it was. This is called along with `offlineMapDownloader:didCompleteOfflineMapDatabase:withError:`.
+*   @param offlineMapDownloader The offline map downloader which finished a job.
+*   @param job The download job which finished.
+*   @param offlineMapDatabase An offline map database which you can use to create an `MBXRasterTileOverlay`. This parameter may be `nil` if there was an error.
+*   @param error The error which stopped the offline map download job. For successful completion, this parameter will be `nil`. */
+- (void)offlineMapDownloader:(MBXOfflineMapDownloader *)offlineMapDownloader job:(MBXOfflineMapDownloadJob *)job didCompleteOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase withError:(NSError *)error;
+
+@end
+
+
+#pragma mark -
+
+/** An instance of the `MBXOfflineMapDownloadJob` class represents one offline map which the shared offline map downloader is downloading or updating.
+*
+*   Each job has its own partial database on disk, and can be suspended, resumed, and canceled independently of the others. Running jobs share the downloader's requests in flight in proportion to their priorities. Jobs which haven't finished when the app quits are restored in the suspended state the next time the shared downloader is created.
+*
+*   @warning The `MBXOfflineMapDownloadJob` class is not meant to be instantiated directly. Instead, instances are created and managed by the shared `MBXOfflineMapDownloader` instance. */
+@interface MBXOfflineMapDownloadJob : NSObject
+
+/** @name Getting Attributes */
+
+/** A unique identifier for the offline map being downloaded. When the job finishes, this is the `uniqueID` of the resulting offline map database. */
+@property (readonly, nonatomic) NSString *uniqueID;
+
+/** The job's current state. */
+@property (readonly, nonatomic) MBXOfflineMapDownloaderState state;
+
+/** The map ID which was used to begin the job. */
+@property (readonly, nonatomic) NSString *mapID;
+
+/** Whether the job was specified to include metadata. */
+@property (readonly, nonatomic) BOOL includesMetadata;
+
+/** Whether the job was specified to include markers. */
+@property (readonly, nonatomic) BOOL includesMarkers;
+
+/** The image quality which was specified for downloading the job's map tiles. */
+@property (readonly, nonatomic) MBXRasterImageQuality imageQuality;
+
+/** The map region which was specified to begin the job. */
+@property (readonly, nonatomic) MKCoordinateRegion mapRegion;
+
+/** The minimum zoom which was specified to begin the job. */
+@property (readonly, nonatomic) NSInteger minimumZ;
+
+/** The maximum zoom which was specified to begin the job. */
+@property (readonly, nonatomic) NSInteger maximumZ;
+
+/** If the job is updating an existing offline map, the offline map database which it's updating. Otherwise `nil`. */
+@property (readonly, nonatomic) MBXOfflineMapDatabase *updatingOfflineMapDatabase;
+
+/** The number of files which the job has written so far. */
+@property (readonly,nonatomic) NSUInteger totalFilesWritten;
+
+/** The number of files which the job needs to write in total. */
+@property (readonly,nonatomic) NSUInteger totalFilesExpectedToWrite;
+
+/** @name Sharing the Downloader With Other Jobs */
+
+/** The job's share of the downloader's requests in flight, relative to the other running jobs. A job with a priority of `2` keeps twice as many requests in flight as a job with a priority of `1`, as long as it has resources left to request. The priority is saved with the job, so it persists across app launches. The default value is `1`, which is also the minimum. */
+@property (nonatomic) NSUInteger priority;
+
+- (instancetype)init UNAVAILABLE_ATTRIBUTE;
+
 @end
 
 
@@ -93,34 +172,37 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 
 /** @name Getting and Setting Attributes */
 
-/** The offline map downloader's current state. */
+/** The offline map downloader's current state. This combines the states of all of the download jobs: the downloader is running if any job is running, and otherwise suspended if any job is suspended, canceling if any job is being canceled, or available if there are no jobs. */
 @property (readonly, nonatomic) MBXOfflineMapDownloaderState state;
 
-/** If a download job is running or suspended, the map ID which was used to begin that job. */
+/** If any download jobs are running or suspended, the first job's map ID which was used to begin that job. */
 @property (readonly, nonatomic) NSString *mapID;
 
-/** If a download job is running or suspended, whether the job was specified to include metadata. */
+/** If any download jobs are running or suspended, whether the first job was specified to include metadata. */
 @property (readonly, nonatomic) BOOL includesMetadata;
 
-/** If a download job is running or suspended, whether the job was specified to include markers. */
+/** If any download jobs are running or suspended, whether the first job was specified to include markers. */
 @property (readonly, nonatomic) BOOL includesMarkers;
 
-/** If a download job is running or suspended, the image quality which was specified for downloading the job's map tiles. */
+/** If any download jobs are running or suspended, the image quality which was specified for downloading the first job's map tiles. */
 @property (readonly, nonatomic) MBXRasterImageQuality imageQuality;
 
-/** If a download job is running or suspended, the map region which was specified to begin the job. */
+/** If any download jobs are running or suspended, the map region which was specified to begin the first job. */
 @property (readonly, nonatomic) MKCoordinateRegion mapRegion;
 
-/** If a download job is running or suspended, the minimum zoom which was specified to begin the job. */
+/** If any download jobs are running or suspended, the minimum zoom which was specified to begin the first job. */
 @property (readonly, nonatomic) NSInteger minimumZ;
 
-/** If a download job is running or suspended, the maximum zoom which was specified to begin the job. */
+/** If any download jobs are running or suspended, the maximum zoom which was specified to begin the first job. */
 @property (readonly, nonatomic) NSInteger maximumZ;
 
-/** If a download job is running or suspended, the number of files which have been written so far. */
+/** If the first download job is updating an existing offline map, the offline map database which it's updating. Otherwise `nil`. */
+@property (readonly, nonatomic) MBXOfflineMapDatabase *updatingOfflineMapDatabase;
+
+/** The number of files which the download jobs have written so far, summed over all of the jobs. */
 @property (readonly,nonatomic) NSUInteger totalFilesWritten;
 
-/** If a download job is running or suspended, the number of files which still need to be written to finish the job. */
+/** The number of files which the download jobs need to write in total, summed over all of the jobs. */
 @property (readonly,nonatomic) NSUInteger totalFilesExpectedToWrite;
 
 /** An array of `MBXOfflineMapDatabase` objects representing all completed offline map databases on disk. This is designed, in combination with the properties provided by `MBXOfflineMapDatabase`, to allow enumeration and management of the maps which are available on disk. */
@@ -129,6 +211,19 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 /** Whether offline map databases should be excluded from iCloud and iTunes backups. This defaults to `YES`. If you want to make a change, the value will persist across app launches since it changes the offline map folder's resource value on disk. */
 @property (nonatomic) BOOL offlineMapsAreExcludedFromBackup;
 
+/** @name Tuning Download Scheduling */
+
+/** The maximum number of resource requests which the downloader keeps in flight at once. The downloader adjusts the number of requests it actually keeps in flight between 1 and this value, based on the throughput and errors it observes, and divides them between the running download jobs according to their priorities. The default value is `8`. */
+@property (nonatomic) NSUInteger maximumConcurrentDownloads;
+
+/** Whether map tiles are downloaded in order of increasing zoom level, so that the lower zoom levels of an offline map are complete before the higher ones. When this is `NO`, tiles are downloaded in the order they were queued. The default value is `YES`. */
+@property (nonatomic) BOOL downloadsLowerZoomLevelsFirst;
+
+/** @name Packing Completed Offline Maps */
+
+/** Whether each offline map is also written out as a packed archive when its download completes, and rewritten when it is updated. Map tiles are then read from the archive, which is faster than reading them from the database, at the cost of storing the tiles twice. See `-[MBXOfflineMapDatabase writeArchiveWithError:]`. The default value is `NO`. */
+@property (nonatomic) BOOL writesArchivesForCompletedOfflineMaps;
+
 /** @name Managing the Delegate */
 
 /** The delegate which should receive notifications as the offline map downloader's state and progress change. */
@@ -168,15 +263,69 @@ typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderState) {
 *   @param imageQuality The image quality to when requesting tiles. */
 - (void)beginDownloadingMapID:(NSString *)mapID mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality;
 
-/** Cancels the current offline map download job and discards any associated resources. */
+/** Begins a download job which brings an existing offline map up to date.
+*
+*   The job requests each of the offline map's resources only if it has changed since it was downloaded, using the ETag and Last-Modified validators which were saved with it, and rewrites only the resources which have changed. It works on a copy of the offline map, which replaces the offline map all at once when the job finishes, so the offline map stays usable throughout. When the job finishes, the delegate receives `offlineMapDownloader:didCompleteOfflineMapDatabase:withError:` with the same offline map database object. Canceling the job leaves the offline map as it was.
+*
+*   Offline maps downloaded by older versions of MBXMapKit don't have saved validators, so updating them downloads every resource once.
+*   @param offlineMapDatabase The offline map database to update. It must be one of the databases in `offlineMapDatabases`. */
+- (void)beginUpdatingOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase;
+
+/** Cancels all of the offline map download jobs and discards any associated resources. */
 - (void)cancel;
 
-/** Resumes a previously suspended offline map download job. */
+/** Resumes all of the suspended offline map download jobs. */
 - (void)resume;
 
-/** Suspends a currently running offline map download job. */
+/** Suspends all of the running offline map download jobs. */
 - (void)suspend;
 
+/** @name Managing Multiple Download Jobs */
+
+/** An array of `MBXOfflineMapDownloadJob` objects representing the download jobs which are running, suspended, or being canceled, in the order they were begun. */
+@property (readonly, nonatomic) NSArray *jobs;
+
+/** Begins an offline map download job which runs alongside any other jobs.
+*   @param mapID The map ID from which to download offline map data.
+*   @param mapRegion The region of the map for which to download tiles.
+*   @param minimumZ The minimum zoom level for which to download tiles.
+*   @param maximumZ The maximum zoom level for which to download tiles.
+*   @param includeMetadata Whether to include the map's metadata (for values such as the initial center point and zoom) in the offline map.
+*   @param includeMarkers Whether to include the map's marker image resources in the offline map.
+*   @param imageQuality The image quality to when requesting tiles.
+*   @return The new download job. */
+- (MBXOfflineMapDownloadJob *)beginJobDownloadingMapID:(NSString *)mapID mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality;
+
+/** Begins an offline map download job for an irregular area, such as a park boundary or a route, which runs alongside any other jobs.
+*
+*   Only the tiles in the tile coverage are downloaded, rather than every tile in its bounding box. The job's `mapRegion` is the coverage's `boundingMapRegion`. Use the coverage's `tileCountForMinimumZ:maximumZ:` to find out how large the download will be before beginning it.
+*   @param mapID The map ID from which to download offline map data.
+*   @param coverage The area of the map for which to download tiles.
+*   @param minimumZ The minimum zoom level for which to download tiles.
+*   @param maximumZ The maximum zoom level for which to download tiles.
+*   @param includeMetadata Whether to include the map's metadata (for values such as the initial center point and zoom) in the offline map.
+*   @param includeMarkers Whether to include the map's marker image resources in the offline map.
+*   @param imageQuality The image quality to when requesting tiles.
+*   @return The new download job. */
+- (MBXOfflineMapDownloadJob *)beginJobDownloadingMapID:(NSString *)mapID coverage:(MBXTileCoverage *)coverage minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality;
+
+/** Begins a download job which brings an existing offline map up to date, and runs alongside any other jobs. See `beginUpdatingOfflineMapDatabase:` for how updates work.
+*   @param offlineMapDatabase The offline map database to update. It must be one of the databases in `offlineMapDatabases`, and must not already be updating.
+*   @return The new download job. */
+- (MBXOfflineMapDownloadJob *)beginJobUpdatingOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase;
+
+/** Cancels one download job and discards its associated resources. The other jobs carry on.
+*   @param job The download job to cancel. */
+- (void)cancelJob:(MBXOfflineMapDownloadJob *)job;
+
+/** Resumes one suspended download job.
+*   @param job The download job to resume. */
+- (void)resumeJob:(MBXOfflineMapDownloadJob *)job;
+
+/** Suspends one running download job. Its requests in flight are handed over to the other running jobs.
+*   @param job The download job to suspend. */
+- (void)suspendJob:(MBXOfflineMapDownloadJob *)job;
+
 /** @name Removing Offline Maps */
 
 /** Invalidates a given offline map and removes its associated backing database on disk. This is designed for managing the disk storage consumed by offline maps.
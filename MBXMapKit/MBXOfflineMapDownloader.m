@@ -25,7 +25,29 @@
 @interface MBXRasterTileOverlay ()
 
 + (NSString *)qualityExtensionForImageQuality:(MBXRasterImageQuality)imageQuality;
-+ (NSURL *)markerIconURLForSize:(NSString *)size symbol:(NSString *)symbol color:(NSString *)color;
++ (NSURL *)markerIconURLForSize:(NSString *)size symbol:(NSString *)symbol color:(NSString *)color scale:(CGFloat)scale;
++ (MBXTileURLTemplate *)tileURLTemplateForMapID:(NSString *)mapID imageQuality:(MBXRasterImageQuality)imageQuality;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileFetcher
+
+typedef void (^MBXTileFetcherCompletionBlock)(NSData *data, NSURLResponse *response, NSError *error);
+
+@interface MBXTileFetcher ()
+
+- (id)fetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path cachesResponse:(BOOL)cachesResponse completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (void)cancelLoad:(id)load;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileCoverage
+
+@interface MBXTileCoverage ()
+
+- (BOOL)enumerateTileRangesForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ withError:(NSError **)error usingBlock:(void (^)(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY))block;
 
 @end
 
@@ -35,9 +57,163 @@
 @interface MBXOfflineMapDatabase ()
 
 @property (readonly, nonatomic) NSString *path;
+@property (readonly, nonatomic) BOOL loadedFromCatalogEntry;
+@property (readonly, nonatomic) NSString *archivePath;
 
 - (instancetype)initWithContentsOfFile:(NSString *)path;
+- (instancetype)initWithContentsOfFile:(NSString *)path catalogEntry:(NSDictionary *)catalogEntry;
+- (NSDictionary *)catalogEntry;
 - (void)invalidate;
+- (void)reloadContents;
+
++ (NSString *)resourceKeyForURL:(NSURL *)url;
++ (NSURL *)URLForResourceKey:(NSString *)key;
++ (NSString *)tileTableSchemaForVersion:(NSInteger)schemaVersion;
++ (NSData *)contentHashForData:(NSData *)data;
++ (NSInteger)tileRowForPath:(MKTileOverlayPath)path;
++ (NSInteger)schemaVersionOfDatabaseAtPath:(NSString *)path;
++ (BOOL)migrateLegacyDatabaseAtPath:(NSString *)path withError:(NSError **)error;
++ (BOOL)compactDatabaseAtPath:(NSString *)path withError:(NSError **)error;
++ (BOOL)writeArchiveForDatabaseAtPath:(NSString *)path toPath:(NSString *)archivePath withError:(NSError **)error;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileMetrics
+
+@interface MBXTileMetrics ()
+
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+
+#pragma mark - Schema versions
+
+extern NSInteger const MBXOfflineMapDatabaseSchemaVersionDeduplicated;
+
+
+#pragma mark - Offline map catalog
+
+// The catalog is a small property list in the offline map directory with the metadata, tile count, and file size of
+// every completed offline map, keyed by file name. It lets init recreate the offline map database objects without
+// opening each of their databases. Entries are checked against the modification date and size of their files, so an
+// offline map which was changed behind the catalog's back is simply read from its database again.
+//
+static NSString *const MBXOfflineMapDownloaderCatalogFilename = @"catalog.plist";
+static NSInteger const MBXOfflineMapDownloaderCatalogVersion = 1;
+
+
+#pragma mark - Write pipeline configuration
+
+// Downloaded resources are committed to the partial database in batches. A batch is committed as soon as it reaches
+// either limit, or when the interval has passed since the first resource in it was buffered.
+//
+static NSUInteger const MBXOfflineMapDownloaderCommitBatchCount = 64;
+static NSUInteger const MBXOfflineMapDownloaderCommitBatchBytes = 4 * 1024 * 1024;
+static NSTimeInterval const MBXOfflineMapDownloaderCommitInterval = 1.0;
+
+
+#pragma mark - Download scheduler configuration
+
+// The downloader keeps a window of requests in flight and starts a new request as soon as any of them finishes. The
+// window starts out small and is adjusted each time a sample of requests completes: it grows by one request while
+// throughput keeps up, shrinks by one when throughput drops, and is halved when a connectivity error occurs.
+//
+static NSUInteger const MBXOfflineMapDownloaderInitialWindow = 4;
+static NSUInteger const MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads = 8;
+
+// Failed requests are retried after an exponentially increasing (and slightly randomized) delay. A resource which fails
+// with an HTTP error the maximum number of times, or which fails with a permanent HTTP error like 404, is given up on.
+// Connectivity errors don't count as attempts, since they say nothing about the resource itself.
+//
+static NSTimeInterval const MBXOfflineMapDownloaderRetryBaseDelay = 2.0;
+static NSTimeInterval const MBXOfflineMapDownloaderRetryMaximumDelay = 120.0;
+static NSInteger const MBXOfflineMapDownloaderMaximumAttempts = 5;
+
+// Resources which still need to be downloaded are listed in the queue table of the partial database. Non-tile resources
+// are queued with a zoom level of -1 so they sort ahead of the map tiles.
+//
+static NSString *const MBXOfflineMapDownloaderQueueSchema =
+    @"CREATE TABLE queue (id INTEGER PRIMARY KEY, url TEXT, zoom_level INTEGER NOT NULL, tile_column INTEGER, tile_row INTEGER, attempts INTEGER NOT NULL DEFAULT 0, not_before REAL NOT NULL DEFAULT 0);\n"
+    @"CREATE INDEX queue_order ON queue (zoom_level, id);\n";
+
+// Map tiles aren't queued when a job is created. Instead, the rectangular ranges of tiles which make up the job's tile
+// coverage at each zoom level are stored (with y counted from the top, like tile URLs), along with how many tiles of
+// each range have been queued so far. Whenever the scheduler runs out of queued resources, the next chunk of tiles is
+// enumerated into the queue. Older partial databases have a single range per zoom level, keyed by zoom_level, so ranges
+// are always looked up by rowid, which works with either schema.
+//
+static NSString *const MBXOfflineMapDownloaderTileRangeSchema =
+    @"CREATE TABLE tile_ranges (id INTEGER PRIMARY KEY, zoom_level INTEGER NOT NULL, min_x INTEGER NOT NULL, max_x INTEGER NOT NULL, min_y INTEGER NOT NULL, max_y INTEGER NOT NULL, enumerated INTEGER NOT NULL DEFAULT 0);\n";
+
+static NSInteger const MBXOfflineMapDownloaderEnumerationChunkSize = 1024;
+
+// The ETag and Last-Modified validators of every downloaded resource are kept so that an update job can make conditional
+// requests, and only download the resources which have changed. Rows are keyed the same way as the queue: map tiles by
+// zoom level, column, and row, and non-tile resources by their URL with a zoom level of -1. The table is created when
+// the job database is opened, since offline maps downloaded by older versions of MBXMapKit don't have it.
+//
+static NSString *const MBXOfflineMapDownloaderValidatorSchema =
+    @"CREATE TABLE IF NOT EXISTS validators (zoom_level INTEGER NOT NULL, tile_column INTEGER NOT NULL, tile_row INTEGER NOT NULL, url TEXT NOT NULL, etag TEXT, last_modified TEXT, PRIMARY KEY (zoom_level, tile_column, tile_row, url));\n";
+
+// Statements are prepared once when the job connection is opened and reused with bound parameters. The queue is read in
+// passes, each starting where the previous read left off, so reading the next few resources is an index seek rather
+// than a scan past everything which has already been requested. Downloaded blobs are only inserted into the data table
+// if no blob with the same hash is there already, and tiles and resources are then pointed at whichever row has it.
+//
+typedef NS_ENUM(NSUInteger, MBXOfflineMapDownloaderStatement) {
+    MBXOfflineMapDownloaderStatementInsertData = 0,
+    MBXOfflineMapDownloaderStatementUpdateResource = 1,
+    MBXOfflineMapDownloaderStatementInsertTile = 2,
+    MBXOfflineMapDownloaderStatementDeleteQueued = 3,
+    MBXOfflineMapDownloaderStatementRetryQueued = 4,
+    MBXOfflineMapDownloaderStatementSelectQueuedByZoom = 5,
+    MBXOfflineMapDownloaderStatementSelectQueuedByID = 6,
+    MBXOfflineMapDownloaderStatementSelectTileRange = 7,
+    MBXOfflineMapDownloaderStatementUpdateTileRange = 8,
+    MBXOfflineMapDownloaderStatementInsertQueuedTile = 9,
+    MBXOfflineMapDownloaderStatementSelectValidators = 10,
+    MBXOfflineMapDownloaderStatementInsertValidators = 11,
+    MBXOfflineMapDownloaderStatementCount
+};
+
+static const char *const MBXOfflineMapDownloaderStatementSQL[MBXOfflineMapDownloaderStatementCount] = {
+    "INSERT OR IGNORE INTO data(value, hash) VALUES(?1, ?2);",
+    "UPDATE resources SET status=200,id=(SELECT id FROM data WHERE hash=?2) WHERE url=?1;",
+    "INSERT OR REPLACE INTO tiles VALUES (?1, ?2, ?3, (SELECT id FROM data WHERE hash=?4));",
+    "DELETE FROM queue WHERE id=?1;",
+    "UPDATE queue SET attempts=?2, not_before=?3 WHERE id=?1;",
+    "SELECT * FROM (SELECT id, url, zoom_level, tile_column, tile_row, attempts FROM queue WHERE zoom_level = ?2 AND id > ?3 AND not_before <= ?1 ORDER BY id LIMIT ?4) "
+    "UNION ALL SELECT * FROM (SELECT id, url, zoom_level, tile_column, tile_row, attempts FROM queue WHERE zoom_level > ?2 AND not_before <= ?1 ORDER BY zoom_level, id LIMIT ?4) LIMIT ?4;",
+    "SELECT id, url, zoom_level, tile_column, tile_row, attempts FROM queue WHERE id > ?3 AND not_before <= ?1 ORDER BY id LIMIT ?4;",
+    "SELECT rowid, zoom_level, min_x, max_x, min_y, max_y, enumerated FROM tile_ranges WHERE enumerated < (max_x - min_x + 1) * (max_y - min_y + 1) ORDER BY zoom_level, rowid LIMIT 1;",
+    "UPDATE tile_ranges SET enumerated=?2 WHERE rowid=?1;",
+    "INSERT INTO queue (zoom_level, tile_column, tile_row) VALUES (?1, ?2, ?3);",
+    "SELECT etag, last_modified FROM validators WHERE zoom_level=?1 AND tile_column=?2 AND tile_row=?3 AND url=?4;",
+    "INSERT OR REPLACE INTO validators VALUES (?1, ?2, ?3, ?4, ?5, ?6);"
+};
+
+
+#pragma mark - Queued resources
+
+// A resource which has been read from the download queue. Non-tile resources have a resource key, and map tiles have a path.
+// During an update job, resources also carry the validators from when they were last downloaded.
+//
+@interface MBXOfflineMapDownloadItem : NSObject
+
+@property (nonatomic) sqlite3_int64 queueID;
+@property (nonatomic) NSString *resourceKey;
+@property (nonatomic) MKTileOverlayPath path;
+@property (nonatomic) NSInteger attempts;
+@property (nonatomic) NSString *etag;
+@property (nonatomic) NSString *lastModified;
+
+@end
+
+@implementation MBXOfflineMapDownloadItem
 
 @end
 
@@ -46,7 +222,42 @@
 
 @interface MBXOfflineMapDownloader ()
 
+@property (nonatomic) NSMutableArray *mutableJobs;
+@property (nonatomic) MBXOfflineMapDownloaderState notifiedState;
+
+@property (nonatomic) NSMutableArray *mutableOfflineMapDatabases;
+@property (nonatomic) NSURL *offlineMapDirectory;
+
+@property (nonatomic) NSOperationQueue *backgroundWorkQueue;
+@property (nonatomic) NSOperationQueue *sqliteQueue;
+@property (nonatomic) NSURLSession *dataSession;
+@property (nonatomic) NSInteger activeDataSessionTasks;
+
+@property (nonatomic) NSUInteger downloadWindow;
+@property (nonatomic) NSUInteger sampleCompletions;
+@property (nonatomic) CFAbsoluteTime sampleStartTime;
+@property (nonatomic) double sampleThroughput;
+@property (nonatomic) NSInteger consecutiveConnectivityErrors;
+
+@end
+
+
+#pragma mark - Download jobs
+
+// Everything which belongs to one download job lives here: the properties it was begun with, its partial database and
+// the job connection to it, the writes waiting to be committed, and its place in the download queue. The downloader's
+// shared scheduler hands out slots in the download window to whichever running job is furthest below its share.
+//
+// The generation is bumped whenever the job's requests in flight are canceled, so that responses which were already on
+// their way back can be recognized and ignored.
+//
+@interface MBXOfflineMapDownloadJob ()
+{
+    sqlite3_stmt *_statements[MBXOfflineMapDownloaderStatementCount];
+}
+
 @property (readwrite, nonatomic) NSString *uniqueID;
+@property (readwrite, nonatomic) MBXOfflineMapDownloaderState state;
 @property (readwrite, nonatomic) NSString *mapID;
 @property (readwrite, nonatomic) BOOL includesMetadata;
 @property (readwrite, nonatomic) BOOL includesMarkers;
@@ -54,18 +265,220 @@
 @property (readwrite, nonatomic) MKCoordinateRegion mapRegion;
 @property (readwrite, nonatomic) NSInteger minimumZ;
 @property (readwrite, nonatomic) NSInteger maximumZ;
-@property (readwrite, nonatomic) MBXOfflineMapDownloaderState state;
+@property (readwrite, nonatomic) MBXOfflineMapDatabase *updatingOfflineMapDatabase;
 @property (readwrite,nonatomic) NSUInteger totalFilesWritten;
 @property (readwrite,nonatomic) NSUInteger totalFilesExpectedToWrite;
 
-@property (nonatomic) NSMutableArray *mutableOfflineMapDatabases;
+@property (weak, nonatomic) MBXOfflineMapDownloader *downloader;
 @property (nonatomic) NSString *partialDatabasePath;
-@property (nonatomic) NSURL *offlineMapDirectory;
+@property (nonatomic) NSUInteger generation;
+@property (nonatomic) MBXTileURLTemplate *tileURLTemplate;
+@property (nonatomic) CGFloat contentScaleFactor;
+
+@property (nonatomic) NSInteger activeTasks;
+@property (nonatomic) NSMutableDictionary *activeDataTasks;
+@property (nonatomic) NSMutableDictionary *activeTileLoads;
+
+@property (readonly, nonatomic) sqlite3 *database;
+@property (nonatomic) NSMutableArray *pendingWrites;
+@property (nonatomic) NSUInteger pendingWriteBytes;
+
+@property (nonatomic) NSMutableArray *readyItems;
+@property (nonatomic) NSMutableSet *claimedQueueIDs;
+@property (nonatomic) sqlite3_int64 queueCursorZoom;
+@property (nonatomic) sqlite3_int64 queueCursorID;
+@property (nonatomic) BOOL retryWakeUpScheduled;
+
+- (instancetype)initWithPartialDatabasePath:(NSString *)path;
+- (void)restorePriority:(NSUInteger)priority;
+- (sqlite3_stmt *)statement:(MBXOfflineMapDownloaderStatement)statement;
+- (BOOL)sqliteOpenDatabaseWithError:(NSError **)error;
+- (void)sqliteCloseDatabase;
+- (void)sqliteRemovePartialDatabase;
 
-@property (nonatomic) NSOperationQueue *backgroundWorkQueue;
-@property (nonatomic) NSOperationQueue *sqliteQueue;
-@property (nonatomic) NSURLSession *dataSession;
-@property (nonatomic) NSInteger activeDataSessionTasks;
+@end
+
+
+@implementation MBXOfflineMapDownloadJob
+
+- (instancetype)initWithPartialDatabasePath:(NSString *)path
+{
+    self = [super init];
+
+    if(self)
+    {
+        _partialDatabasePath = path;
+        _priority = 1;
+        _contentScaleFactor = 1.0;
+        _activeDataTasks = [[NSMutableDictionary alloc] init];
+        _activeTileLoads = [[NSMutableDictionary alloc] init];
+        _pendingWrites = [[NSMutableArray alloc] init];
+        _readyItems = [[NSMutableArray alloc] init];
+        _claimedQueueIDs = [[NSMutableSet alloc] init];
+    }
+
+    return self;
+}
+
+
+- (sqlite3_stmt *)statement:(MBXOfflineMapDownloaderStatement)statement
+{
+    return _statements[statement];
+}
+
+
+- (void)setPriority:(NSUInteger)priority
+{
+    _priority = MAX(priority, (NSUInteger)1);
+
+    // Save the priority in the partial database so it still applies after the app is relaunched. Jobs which aren't
+    // attached to a downloader yet have nowhere to save it, and it's written along with their metadata when they are.
+    //
+    MBXOfflineMapDownloader *downloader = _downloader;
+    if(downloader)
+    {
+        NSUInteger savedPriority = _priority;
+        [downloader.sqliteQueue addOperationWithBlock:^{
+            [self sqliteSavePriority:savedPriority];
+        }];
+    }
+}
+
+
+- (void)restorePriority:(NSUInteger)priority
+{
+    // The priority of a restored job came from its partial database, so it's set without saving it back again. The
+    // background work queue which restores jobs is serial, and resuming a job goes through it, so nothing reads the
+    // priority until this is done.
+    //
+    _priority = MAX(priority, (NSUInteger)1);
+}
+
+
+- (void)sqliteSavePriority:(NSUInteger)priority
+{
+    assert(![NSThread isMainThread]);
+
+    // Until the partial database has been created, there's nothing to save to. The priority is written along with the
+    // rest of the job's metadata when it is created.
+    //
+    if( ! [[NSFileManager defaultManager] fileExistsAtPath:_partialDatabasePath] || ! [self sqliteOpenDatabaseWithError:nil])
+    {
+        return;
+    }
+
+    NSString *query = [NSString stringWithFormat:@"INSERT OR REPLACE INTO metadata VALUES('jobPriority','%ld');", (long)priority];
+    char *errmsg;
+    sqlite3_exec(_database, [query UTF8String], NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem saving the priority of the offline map download job: %s", errmsg);
+        sqlite3_free(errmsg);
+    }
+
+    if(_state != MBXOfflineMapDownloaderStateRunning)
+    {
+        [self sqliteCloseDatabase];
+    }
+}
+
+
+- (BOOL)sqliteOpenDatabaseWithError:(NSError **)error
+{
+    assert(![NSThread isMainThread]);
+
+    // The partial database stays open for writing for as long as the job is running, rather than being opened for every
+    // downloaded file. It uses write-ahead logging so that committing a batch doesn't have to rewrite the rollback journal,
+    // and so that the reads of pending resources don't block on the writer.
+    //
+    if(_database)
+    {
+        return YES;
+    }
+
+    sqlite3 *db;
+    const char *filename = [_partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc)
+    {
+        if(error)
+        {
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+        }
+        sqlite3_close(db);
+        return NO;
+    }
+
+    char *errmsg;
+    sqlite3_exec(db, "PRAGMA foreign_keys=ON; PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem configuring the partial offline map database: %s", errmsg);
+        sqlite3_free(errmsg);
+    }
+    sqlite3_exec(db, [MBXOfflineMapDownloaderValidatorSchema UTF8String], NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem adding the validators table to the partial offline map database: %s", errmsg);
+        sqlite3_free(errmsg);
+    }
+
+    _database = db;
+    for(NSUInteger i = 0; i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        if(sqlite3_prepare_v2(db, MBXOfflineMapDownloaderStatementSQL[i], -1, &_statements[i], NULL) != SQLITE_OK)
+        {
+            if(error)
+            {
+                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+            }
+            [self sqliteCloseDatabase];
+            return NO;
+        }
+    }
+    return YES;
+}
+
+
+- (void)sqliteCloseDatabase
+{
+    assert(![NSThread isMainThread]);
+
+    if(!_database)
+    {
+        return;
+    }
+
+    for(NSUInteger i = 0; i < MBXOfflineMapDownloaderStatementCount; i++)
+    {
+        sqlite3_finalize(_statements[i]);
+        _statements[i] = NULL;
+    }
+
+    // Switching back to a rollback journal checkpoints the write-ahead log into the database file and removes it, so the
+    // file can be moved or opened read-only on its own
+    //
+    sqlite3_exec(_database, "PRAGMA journal_mode=DELETE;", NULL, NULL, NULL);
+    sqlite3_close(_database);
+    _database = NULL;
+}
+
+
+- (void)sqliteRemovePartialDatabase
+{
+    assert(![NSThread isMainThread]);
+
+    [_pendingWrites removeAllObjects];
+    _pendingWriteBytes = 0;
+    [_readyItems removeAllObjects];
+    [_claimedQueueIDs removeAllObjects];
+    [self sqliteCloseDatabase];
+
+    NSFileManager *fm = [NSFileManager defaultManager];
+    [fm removeItemAtPath:_partialDatabasePath error:nil];
+    [fm removeItemAtPath:[_partialDatabasePath stringByAppendingString:@"-wal"] error:nil];
+    [fm removeItemAtPath:[_partialDatabasePath stringByAppendingString:@"-shm"] error:nil];
+}
 
 @end
 
@@ -80,11 +493,11 @@
 {
     static id _sharedDownloader = nil;
     static dispatch_once_t onceToken;
-    
+
     dispatch_once(&onceToken, ^{
         _sharedDownloader = [[self alloc] init];
     });
-    
+
     return _sharedDownloader;
 }
 
@@ -141,20 +554,20 @@
         }
 
 
-        // This is where partial offline map databases live (at most 1 at a time!) while their resources are being downloaded
-        //
-        _partialDatabasePath = [[_offlineMapDirectory URLByAppendingPathComponent:@"newdatabase.partial"] path];
-
-
-        // Restore persistent state from disk
+        // Restore persistent state from disk. Each download job has its own partial offline map database, which lives in
+        // the offline map directory until the job finishes or is canceled.
         //
         _mutableOfflineMapDatabases = [[NSMutableArray alloc] init];
+        _mutableJobs = [[NSMutableArray alloc] init];
+        NSMutableArray *partialDatabasePaths = [[NSMutableArray alloc] init];
         error = nil;
         NSArray *files = [fm contentsOfDirectoryAtPath:[_offlineMapDirectory path] error:&error];
         if(error)
         {
             NSLog(@"There was an error with listing the contents of the offline map directory: %@", error);
         }
+        NSDictionary *catalogEntries = [self readCatalogEntries];
+        BOOL catalogIsStale = NO;
         if (files)
         {
             MBXOfflineMapDatabase *db;
@@ -164,47 +577,27 @@
                 //
                 if([path hasSuffix:@".complete"])
                 {
-                    db = [[MBXOfflineMapDatabase alloc] initWithContentsOfFile:[[_offlineMapDirectory URLByAppendingPathComponent:path] path]];
+                    db = [[MBXOfflineMapDatabase alloc] initWithContentsOfFile:[[_offlineMapDirectory URLByAppendingPathComponent:path] path] catalogEntry:catalogEntries[path]];
                     if(db)
                     {
-                        [_mutableOfflineMapDatabases addObject:db];
+                        @synchronized(_mutableOfflineMapDatabases)
+                        {
+                            [_mutableOfflineMapDatabases addObject:db];
+                        }
+                        catalogIsStale = catalogIsStale || !db.loadedFromCatalogEntry;
                     }
                     else
                     {
                         NSLog(@"Error: %@ is not a valid offline map database",path);
                     }
                 }
+                else if([path hasSuffix:@".partial"])
+                {
+                    [partialDatabasePaths addObject:[[_offlineMapDirectory URLByAppendingPathComponent:path] path]];
+                }
             }
         }
 
-        if([fm fileExistsAtPath:_partialDatabasePath])
-        {
-            _state = MBXOfflineMapDownloaderStateSuspended;
-
-            NSError *error;
-            [self sqliteQueryWrittenAndExpectedCountsWithError:&error];
-            if(error)
-            {
-                NSLog(@"Error while querying how many files need to be downloaded %@",error);
-            }
-            else if(_totalFilesWritten >= _totalFilesExpectedToWrite)
-            {
-                // This isn't good... the offline map database is completely downloaded, but it's still in the location for
-                // a download in progress.
-                NSLog(@"Something strange happened. While restoring a supposedly partial offline map download from disk, init found that %ld of %ld urls are complete.",(long)_totalFilesWritten,(long)_totalFilesExpectedToWrite);
-            }
-
-            //
-            // Note that we're not calling offlineMapDownloader:totalFilesExpectedToWrite: because it isn't possible for the
-            // delegate to be set yet. If the object that's invoking init by way of sharedOfflineMapDownloader wants to resume
-            // the download, it needs to poll the values of state, totalFilesExpectedToWrite, and totalFilesWritten on its own.
-            //
-        }
-        else
-        {
-            _state = MBXOfflineMapDownloaderStateAvailable;
-        }
-
         // Configure the background and sqlite operation queues as a serial queues
         //
         _backgroundWorkQueue = [[NSOperationQueue alloc] init];
@@ -212,6 +605,37 @@
         _sqliteQueue = [[NSOperationQueue alloc] init];
         [_sqliteQueue setMaxConcurrentOperationCount:1];
 
+        // Restore the download jobs in the order they were begun. Older versions of MBXMapKit only had one job at a time,
+        // in newdatabase.partial, which is restored like any other job.
+        //
+        [partialDatabasePaths sortUsingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+            NSTimeInterval createdA = [[[fm attributesOfItemAtPath:a error:nil] fileCreationDate] timeIntervalSinceReferenceDate];
+            NSTimeInterval createdB = [[[fm attributesOfItemAtPath:b error:nil] fileCreationDate] timeIntervalSinceReferenceDate];
+            return [@(createdA) compare:@(createdB)];
+        }];
+        for(NSString *path in partialDatabasePaths)
+        {
+            MBXOfflineMapDownloadJob *job = [self restoreJobFromPartialDatabaseAtPath:path];
+            job.downloader = self;
+            [_mutableJobs addObject:job];
+        }
+        _notifiedState = [self state];
+
+        // Bring the catalog up to date if any offline maps were added, changed, or removed without it. That means
+        // counting the tiles of any offline maps which weren't in it, so it's done in the background.
+        //
+        if(catalogIsStale || [catalogEntries count] != [[self offlineMapDatabases] count])
+        {
+            [_backgroundWorkQueue addOperationWithBlock:^{
+                [self writeCatalog];
+            }];
+        }
+
+        // Configure the download scheduler
+        //
+        _maximumConcurrentDownloads = MBXOfflineMapDownloaderDefaultMaximumConcurrentDownloads;
+        _downloadsLowerZoomLevelsFirst = YES;
+
         // Configure the download session
         //
         [self setUpNewDataSession];
@@ -220,6 +644,77 @@
     return self;
 }
 
+
+- (MBXOfflineMapDownloadJob *)restoreJobFromPartialDatabaseAtPath:(NSString *)path
+{
+    // NOTE: This is called on the main thread as part of init. Restored jobs are suspended until they are resumed.
+    //
+    // Reading the job's properties and bringing an old partial database up to date can take a while, so that happens on
+    // the background work queue. Resuming or canceling the job goes through the same serial queue, so it always sees the
+    // restored job.
+    //
+    MBXOfflineMapDownloadJob *job = [[MBXOfflineMapDownloadJob alloc] initWithPartialDatabasePath:path];
+    job.state = MBXOfflineMapDownloaderStateSuspended;
+
+    [_backgroundWorkQueue addOperationWithBlock:^{
+        [self restoreJobFromPartialDatabase:job];
+    }];
+
+    return job;
+}
+
+- (void)restoreJobFromPartialDatabase:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // A download which was suspended by an older version of MBXMapKit needs its pending tiles moved to the tile schema, its
+    // pending resources moved into the download queue, and its blobs deduplicated. Partial databases which are already up
+    // to date are left alone, so this doesn't rewrite anything on every launch.
+    //
+    NSString *path = job.partialDatabasePath;
+    NSError *error;
+    if([MBXOfflineMapDatabase schemaVersionOfDatabaseAtPath:path] < MBXOfflineMapDatabaseSchemaVersionDeduplicated)
+    {
+        if( ! [MBXOfflineMapDatabase migrateLegacyDatabaseAtPath:path withError:&error])
+        {
+            NSLog(@"Error while converting the partial offline map database to the tile schema %@",error);
+            error = nil;
+        }
+        if( ! [self sqliteUpgradeDownloadQueueForJob:job withError:&error])
+        {
+            NSLog(@"Error while moving the pending resources of the partial offline map database into the download queue %@",error);
+            error = nil;
+        }
+        if( ! [MBXOfflineMapDatabase compactDatabaseAtPath:path withError:&error])
+        {
+            NSLog(@"Error while converting the partial offline map database to the deduplicated schema %@",error);
+            error = nil;
+        }
+    }
+    if( ! [self sqliteRestoreMetadataForJob:job withError:&error])
+    {
+        NSLog(@"Error while restoring the properties of the suspended offline map download %@",error);
+        error = nil;
+    }
+    [self sqliteQueryWrittenAndExpectedCountsForJob:job withError:&error];
+    if(error)
+    {
+        NSLog(@"Error while querying how many files need to be downloaded %@",error);
+    }
+    else if(job.totalFilesWritten >= job.totalFilesExpectedToWrite)
+    {
+        // This isn't good... the offline map database is completely downloaded, but it's still in the location for
+        // a download in progress.
+        NSLog(@"Something strange happened. While restoring a supposedly partial offline map download from disk, init found that %ld of %ld urls are complete.",(long)job.totalFilesWritten,(long)job.totalFilesExpectedToWrite);
+    }
+
+    // The delegate may have been set by now, so let it know the restored job's counts. If the object that's invoking init
+    // by way of sharedOfflineMapDownloader sets the delegate later, it needs to poll the values of jobs, state,
+    // totalFilesExpectedToWrite, and totalFilesWritten on its own.
+    //
+    [self notifyDelegateOfInitialCountForJob:job];
+}
+
 - (void)setOfflineMapsAreExcludedFromBackup:(BOOL)offlineMapsAreExcludedFromBackup
 {
     NSError *error;
@@ -237,54 +732,196 @@
 
 - (void)setUpNewDataSession
 {
-    // Create a new NSURLDataSession. This is necessary after a call to invalidateAndCancel
+    // Create a new NSURLDataSession, so that the current value of maximumConcurrentDownloads applies to its connections.
+    // Any requests which are still in flight on the old session are allowed to finish.
     //
     NSURLSessionConfiguration *config = [NSURLSessionConfiguration defaultSessionConfiguration];
     config.allowsCellularAccess = YES;
-    config.HTTPMaximumConnectionsPerHost = 4;
+    config.HTTPMaximumConnectionsPerHost = (NSInteger)_maximumConcurrentDownloads;
     config.URLCache = [NSURLCache sharedURLCache];
     config.HTTPAdditionalHeaders = @{ @"User-Agent" : [MBXMapKit userAgent] };
+    [_dataSession finishTasksAndInvalidate];
     _dataSession = [NSURLSession sessionWithConfiguration:config];
-    _activeDataSessionTasks = 0;
 }
 
 
-#pragma mark - Delegate Notifications
+#pragma mark - API: Properties of the download jobs
 
-- (void)notifyDelegateOfStateChange
+- (NSArray *)jobs
 {
-    assert(![NSThread isMainThread]);
-
-    if([_delegate respondsToSelector:@selector(offlineMapDownloader:stateChangedTo:)])
+    @synchronized(_mutableJobs)
     {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            [_delegate offlineMapDownloader:self stateChangedTo:_state];
-        });
+        return [NSArray arrayWithArray:_mutableJobs];
+    }
+}
+
+
+- (MBXOfflineMapDownloadJob *)firstJob
+{
+    NSArray *jobs = [self jobs];
+    return ([jobs count] > 0 ? jobs[0] : nil);
+}
+
+
+- (MBXOfflineMapDownloaderState)state
+{
+    // The downloader is running if any of its jobs are, and otherwise takes on the state of whichever job is the furthest
+    // from being done with
+    //
+    MBXOfflineMapDownloaderState state = MBXOfflineMapDownloaderStateAvailable;
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        if(job.state == MBXOfflineMapDownloaderStateRunning)
+        {
+            return MBXOfflineMapDownloaderStateRunning;
+        }
+        else if(job.state == MBXOfflineMapDownloaderStateSuspended)
+        {
+            state = MBXOfflineMapDownloaderStateSuspended;
+        }
+        else if(job.state == MBXOfflineMapDownloaderStateCanceling && state == MBXOfflineMapDownloaderStateAvailable)
+        {
+            state = MBXOfflineMapDownloaderStateCanceling;
+        }
+    }
+    return state;
+}
+
+
+- (NSString *)mapID
+{
+    return [self firstJob].mapID;
+}
+
+
+- (BOOL)includesMetadata
+{
+    return [self firstJob].includesMetadata;
+}
+
+
+- (BOOL)includesMarkers
+{
+    return [self firstJob].includesMarkers;
+}
+
+
+- (MBXRasterImageQuality)imageQuality
+{
+    return [self firstJob].imageQuality;
+}
+
+
+- (MKCoordinateRegion)mapRegion
+{
+    MBXOfflineMapDownloadJob *job = [self firstJob];
+    return (job ? job.mapRegion : MKCoordinateRegionMake(CLLocationCoordinate2DMake(0, 0), MKCoordinateSpanMake(0, 0)));
+}
+
+
+- (NSInteger)minimumZ
+{
+    return [self firstJob].minimumZ;
+}
+
+
+- (NSInteger)maximumZ
+{
+    return [self firstJob].maximumZ;
+}
+
+
+- (MBXOfflineMapDatabase *)updatingOfflineMapDatabase
+{
+    return [self firstJob].updatingOfflineMapDatabase;
+}
+
+
+- (NSUInteger)totalFilesWritten
+{
+    NSUInteger totalFilesWritten = 0;
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        totalFilesWritten += job.totalFilesWritten;
+    }
+    return totalFilesWritten;
+}
+
+
+- (NSUInteger)totalFilesExpectedToWrite
+{
+    NSUInteger totalFilesExpectedToWrite = 0;
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        totalFilesExpectedToWrite += job.totalFilesExpectedToWrite;
     }
+    return totalFilesExpectedToWrite;
+}
+
+
+#pragma mark - Delegate Notifications
+
+- (void)notifyDelegateOfStateChangeForJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    MBXOfflineMapDownloaderState jobState = job.state;
+    MBXOfflineMapDownloaderState state = [self state];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if([_delegate respondsToSelector:@selector(offlineMapDownloader:job:stateChangedTo:)])
+        {
+            [_delegate offlineMapDownloader:self job:job stateChangedTo:jobState];
+        }
+
+        // The downloader's own state combines the states of all of its jobs, so many job state changes leave it as it
+        // was. Comparing against the last state sent, on the main thread, keeps the notifications in order.
+        //
+        if(state != _notifiedState)
+        {
+            _notifiedState = state;
+            if([_delegate respondsToSelector:@selector(offlineMapDownloader:stateChangedTo:)])
+            {
+                [_delegate offlineMapDownloader:self stateChangedTo:state];
+            }
+        }
+    });
 }
 
 
-- (void)notifyDelegateOfInitialCount
+- (void)notifyDelegateOfInitialCountForJob:(MBXOfflineMapDownloadJob *)job
 {
+    NSUInteger totalFilesExpectedToWrite = job.totalFilesExpectedToWrite;
     if([_delegate respondsToSelector:@selector(offlineMapDownloader:totalFilesExpectedToWrite:)])
     {
         // Update the delegate with the file count so it can display a progress indicator
         //
         dispatch_async(dispatch_get_main_queue(), ^{
-            [_delegate offlineMapDownloader:self totalFilesExpectedToWrite:_totalFilesExpectedToWrite];
+            [_delegate offlineMapDownloader:self totalFilesExpectedToWrite:totalFilesExpectedToWrite];
         });
     }
+    [self notifyDelegateOfProgressForJob:job];
 }
 
 
-- (void)notifyDelegateOfProgress
+- (void)notifyDelegateOfProgressForJob:(MBXOfflineMapDownloadJob *)job
 {
     assert(![NSThread isMainThread]);
 
+    if([_delegate respondsToSelector:@selector(offlineMapDownloader:job:totalFilesWritten:totalFilesExpectedToWrite:)])
+    {
+        NSUInteger totalFilesWritten = job.totalFilesWritten;
+        NSUInteger totalFilesExpectedToWrite = job.totalFilesExpectedToWrite;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [_delegate offlineMapDownloader:self job:job totalFilesWritten:totalFilesWritten totalFilesExpectedToWrite:totalFilesExpectedToWrite];
+        });
+    }
+
     if([_delegate respondsToSelector:@selector(offlineMapDownloader:totalFilesWritten:totalFilesExpectedToWrite:)])
     {
+        NSUInteger totalFilesWritten = [self totalFilesWritten];
+        NSUInteger totalFilesExpectedToWrite = [self totalFilesExpectedToWrite];
         dispatch_async(dispatch_get_main_queue(), ^{
-            [_delegate offlineMapDownloader:self totalFilesWritten:_totalFilesWritten totalFilesExpectedToWrite:_totalFilesExpectedToWrite];
+            [_delegate offlineMapDownloader:self totalFilesWritten:totalFilesWritten totalFilesExpectedToWrite:totalFilesExpectedToWrite];
         });
     }
 }
@@ -336,15 +973,73 @@
 }
 
 
-- (void)notifyDelegateOfCompletionWithOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMap withError:(NSError *)error
+- (void)notifyDelegateOfCompletionOfJob:(MBXOfflineMapDownloadJob *)job withOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMap withError:(NSError *)error
 {
     assert(![NSThread isMainThread]);
 
-    if([_delegate respondsToSelector:@selector(offlineMapDownloader:didCompleteOfflineMapDatabase:withError:)])
-    {
-        dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if([_delegate respondsToSelector:@selector(offlineMapDownloader:job:didCompleteOfflineMapDatabase:withError:)])
+        {
+            [_delegate offlineMapDownloader:self job:job didCompleteOfflineMapDatabase:offlineMap withError:error];
+        }
+        if([_delegate respondsToSelector:@selector(offlineMapDownloader:didCompleteOfflineMapDatabase:withError:)])
+        {
             [_delegate offlineMapDownloader:self didCompleteOfflineMapDatabase:offlineMap withError:error];
-        });
+        }
+    });
+}
+
+
+#pragma mark - Implementation: offline map catalog
+
+- (NSDictionary *)readCatalogEntries
+{
+    NSURL *catalogURL = [_offlineMapDirectory URLByAppendingPathComponent:MBXOfflineMapDownloaderCatalogFilename];
+    NSData *data = [NSData dataWithContentsOfURL:catalogURL];
+    if(!data)
+    {
+        return nil;
+    }
+
+    NSDictionary *catalog = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil];
+    if(![catalog isKindOfClass:[NSDictionary class]] || [catalog[@"version"] integerValue] != MBXOfflineMapDownloaderCatalogVersion)
+    {
+        return nil;
+    }
+    NSDictionary *entries = catalog[@"databases"];
+    return ([entries isKindOfClass:[NSDictionary class]] ? entries : nil);
+}
+
+
+- (void)writeCatalog
+{
+    // The catalog is written to a temporary file which is then renamed over the old one, so a crash part way through
+    // can't leave a truncated catalog behind
+    //
+    @synchronized(self)
+    {
+        NSMutableDictionary *entries = [[NSMutableDictionary alloc] init];
+        for(MBXOfflineMapDatabase *offlineMap in [self offlineMapDatabases])
+        {
+            NSDictionary *entry = [offlineMap catalogEntry];
+            if(entry && !offlineMap.isInvalid)
+            {
+                entries[[offlineMap.path lastPathComponent]] = entry;
+            }
+        }
+
+        NSDictionary *catalog = @{ @"version" : @(MBXOfflineMapDownloaderCatalogVersion), @"databases" : entries };
+        NSError *error;
+        NSData *data = [NSPropertyListSerialization dataWithPropertyList:catalog format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+        if(data)
+        {
+            NSURL *catalogURL = [_offlineMapDirectory URLByAppendingPathComponent:MBXOfflineMapDownloaderCatalogFilename];
+            [data writeToURL:catalogURL options:NSDataWritingAtomic error:&error];
+        }
+        if(error)
+        {
+            NSLog(@"There was an error while writing the offline map catalog: %@", error);
+        }
     }
 }
 
@@ -352,7 +1047,7 @@
 #pragma mark - Implementation: download urls
 
 
-- (MBXOfflineMapDatabase *)completeDatabaseAndInstantiateOfflineMapWithError:(NSError **)error
+- (MBXOfflineMapDatabase *)completeDatabaseAndInstantiateOfflineMapForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
 {
     assert(![NSThread isMainThread]);
 
@@ -364,7 +1059,7 @@
     NSString *newPath = [[_offlineMapDirectory URLByAppendingPathComponent:newFilename] path];
     CFRelease(uuidString);
     CFRelease(uuid);
-    [[NSFileManager defaultManager] moveItemAtPath:_partialDatabasePath toPath:newPath error:error];
+    [[NSFileManager defaultManager] moveItemAtPath:job.partialDatabasePath toPath:newPath error:error];
 
     // If the move worked, instantiate and return offline map database
     //
@@ -372,219 +1067,1093 @@
     {
         return nil;
     }
-    else
+
+    MBXOfflineMapDatabase *offlineMap = [[MBXOfflineMapDatabase alloc] initWithContentsOfFile:newPath];
+
+    // Packing the offline map is optional, so if it fails the offline map is simply read from its database
+    //
+    NSError *archiveError;
+    if(offlineMap && _writesArchivesForCompletedOfflineMaps && ! [offlineMap writeArchiveWithError:&archiveError])
     {
-        return [[MBXOfflineMapDatabase alloc] initWithContentsOfFile:newPath];
+        NSLog(@"Error while writing the packed archive of the offline map database %@",archiveError);
     }
+    return offlineMap;
 }
 
 
-- (void)startDownloading
+- (MBXOfflineMapDatabase *)completeUpdateOfOfflineMapForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
 {
     assert(![NSThread isMainThread]);
 
-    [_sqliteQueue addOperationWithBlock:^{
-        NSError *error;
-        NSArray *urls = [self sqliteReadArrayOfOfflineMapURLsToBeDownloadLimit:30 withError:&error];
+    MBXOfflineMapDatabase *offlineMap = job.updatingOfflineMapDatabase;
+
+    // If the offline map was removed while it was being updated, the update has nothing to replace
+    //
+    if( ! [[self offlineMapDatabases] containsObject:offlineMap] || offlineMap.isInvalid)
+    {
+        [job sqliteRemovePartialDatabase];
         if(error)
         {
-            NSLog(@"Error while reading offline map urls: %@",error);
+            *error = [NSError mbx_errorWithCode:MBXMapKitErrorCodeDownloadingCanceled reason:@"The offline map was removed while it was being updated" description:@"Download canceled"];
         }
-        else
-        {
-            for(NSURL *url in urls)
-            {
-                NSURLSessionDataTask *task;
-                NSURLRequest *request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestUseProtocolCachePolicy timeoutInterval:60];
-                _activeDataSessionTasks += 1;
-                task = [_dataSession dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
-                {
-                    if(error  && _state == MBXOfflineMapDownloaderStateRunning)
-                    {
-                        // We got a session level error which probably indicates a connectivity problem such as airplane mode.
-                        // Notify the delegate.
-                        //
-                        [self notifyDelegateOfNetworkConnectivityError:error];
-                    }
-                    if(!error  && _state == MBXOfflineMapDownloaderStateRunning)
-                    {
-                        if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200)
-                        {
-                            // This url didn't work. For now, use the primitive error handling method of notifying the delegate and
-                            // continuing to request the url (this will eventually cycle back through the download queue since we're
-                            // not marking the url as done in the database).
-                            //
-                            [self notifyDelegateOfHTTPStatusError:((NSHTTPURLResponse *)response).statusCode url:response.URL];
-                        }
-                        else
-                        {
-                            // Since the URL was successfully retrieved, save the data
-                            //
-                            [self sqliteSaveDownloadedData:data forURL:url];
-                        }
-                    }
-                }];
-                [task resume];
+        return nil;
+    }
 
-                // This is the last line of the for loop
-            }
+    // Get rid of the blobs of resources which changed, then swap the updated copy in for the offline map. rename() replaces
+    // the file atomically, so the offline map is readable the whole time, first from the old file and then from the new one.
+    //
+    NSError *compactError;
+    if( ! [MBXOfflineMapDatabase compactDatabaseAtPath:job.partialDatabasePath withError:&compactError])
+    {
+        NSLog(@"Error while removing unused data from the updated offline map database %@",compactError);
+    }
+
+    // An offline map which is packed gets a new archive of the updated copy. The old archive stays mapped until it has been
+    // replaced, and if the new one can't be written, the old one is removed so it doesn't serve outdated tiles.
+    //
+    if(offlineMap.isArchived || _writesArchivesForCompletedOfflineMaps)
+    {
+        NSError *archiveError;
+        if( ! [MBXOfflineMapDatabase writeArchiveForDatabaseAtPath:job.partialDatabasePath toPath:offlineMap.archivePath withError:&archiveError])
+        {
+            NSLog(@"Error while writing the packed archive of the updated offline map database %@",archiveError);
+            unlink([offlineMap.archivePath fileSystemRepresentation]);
         }
-    }];
+    }
+    if(rename([job.partialDatabasePath fileSystemRepresentation], [offlineMap.path fileSystemRepresentation]) != 0)
+    {
+        if(error)
+        {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        }
+        [job sqliteRemovePartialDatabase];
+        return nil;
+    }
 
+    [offlineMap reloadContents];
+    [self writeCatalog];
+    return offlineMap;
 }
 
 
-#pragma mark - Implementation: sqlite stuff
-
-- (void)sqliteSaveDownloadedData:(NSData *)data forURL:(NSURL *)url
+- (void)startDownloadingJob:(MBXOfflineMapDownloadJob *)job
 {
     assert(![NSThread isMainThread]);
-    assert(_activeDataSessionTasks > 0);
 
     [_sqliteQueue addOperationWithBlock:^{
+        // Start the job's pass through its download queue from scratch. Anything which was requested before a suspension,
+        // but not written, is still in the download queue, so the first pass through the queue will pick it up again.
+        //
+        [job.readyItems removeAllObjects];
+        [job.claimedQueueIDs removeAllObjects];
+        job.queueCursorZoom = -1;
+        job.queueCursorID = 0;
+        job.retryWakeUpScheduled = NO;
 
-        // Bail out if the state has changed to canceling, suspended, or available
+        // The download window is shared by all of the jobs, so it only starts over if nothing else is downloading
         //
-        if(_state != MBXOfflineMapDownloaderStateRunning)
+        if(_activeDataSessionTasks == 0)
         {
-            return;
+            _downloadWindow = MIN(MBXOfflineMapDownloaderInitialWindow, _maximumConcurrentDownloads);
+            _sampleCompletions = 0;
+            _sampleStartTime = CFAbsoluteTimeGetCurrent();
+            _sampleThroughput = 0.0;
+            _consecutiveConnectivityErrors = 0;
         }
 
-        // Open the database read-write and multi-threaded. The slightly obscure c-style variable names here and below are
-        // used to stay consistent with the sqlite documentaion.
-        NSError *error;
-        sqlite3 *db;
-        int rc;
-        const char *filename = [_partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
-        rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
-        if (rc)
+        [self sqliteFillDownloadWindow];
+    }];
+}
+
+
+- (void)sqliteFillDownloadWindow
+{
+    assert(![NSThread isMainThread]);
+
+    // Keep starting requests until the window is full or none of the running jobs has anything which is ready to be
+    // requested. Each free slot goes to the job with the fewest requests in flight relative to its priority, so the
+    // running jobs divide the window, and with it the available bandwidth, in proportion to their priorities.
+    //
+    NSArray *jobs = [self jobs];
+    NSMutableArray *candidates = [[NSMutableArray alloc] init];
+    NSMutableSet *exhaustedJobs = [[NSMutableSet alloc] init];
+    for(MBXOfflineMapDownloadJob *job in jobs)
+    {
+        if(job.state == MBXOfflineMapDownloaderStateRunning)
         {
-            // Opening the database failed... something is very wrong.
-            //
-            error = [NSError mbx_errorCannotOpenOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+            [candidates addObject:job];
         }
-        else
+    }
+
+    while(_activeDataSessionTasks < (NSInteger)MIN(_downloadWindow, _maximumConcurrentDownloads) && [candidates count] > 0)
+    {
+        MBXOfflineMapDownloadJob *next;
+        for(MBXOfflineMapDownloadJob *job in candidates)
         {
-            // Creating the database file worked, so now start an atomic commit
-            //
-            NSMutableString *query = [[NSMutableString alloc] init];
-            [query appendString:@"PRAGMA foreign_keys=ON;\n"];
-            [query appendString:@"BEGIN TRANSACTION;\n"];
-            const char *zSql = [query cStringUsingEncoding:NSUTF8StringEncoding];
-            char *errmsg;
-            sqlite3_exec(db, zSql, NULL, NULL, &errmsg);
-            if(errmsg)
+            if(!next || job.activeTasks * (NSInteger)next.priority < next.activeTasks * (NSInteger)job.priority)
             {
-                error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:errmsg];
-                sqlite3_free(errmsg);
+                next = job;
             }
-            else
-            {
-                // Continue by inserting an image blob into the data table
-                //
-                NSString *query2 = @"INSERT INTO data(value) VALUES(?);";
-                const char *zSql2 = [query2 cStringUsingEncoding:NSUTF8StringEncoding];
-                int nByte2 = (int)[query2 lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
-                sqlite3_stmt *ppStmt2;
-                const char *pzTail2;
-                BOOL successfulBlobInsert = NO;
-                if(sqlite3_prepare_v2(db, zSql2, nByte2, &ppStmt2, &pzTail2) == SQLITE_OK)
-                {
-                    if(sqlite3_bind_blob(ppStmt2, 1, [data bytes], (int)[data length], SQLITE_TRANSIENT) == SQLITE_OK)
-                    {
-                        if(sqlite3_step(ppStmt2) == SQLITE_DONE)
-                        {
-                            successfulBlobInsert = YES;
-                        }
-                    }
-                }
-                if(!successfulBlobInsert)
-                {
-                    error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
-                }
-                sqlite3_finalize(ppStmt2);
-
-                // Finish up by updating the url in the resources table with status and the blob id, then close out the commit
-                //
-                if(!error)
-                {
-                    query  = [[NSMutableString alloc] init];
-                    [query appendFormat:@"UPDATE resources SET status=200,id=last_insert_rowid() WHERE url='%@';\n",[url absoluteString]];
-                    [query appendString:@"COMMIT;"];
-                    const char *zSql3 = [query cStringUsingEncoding:NSUTF8StringEncoding];
-                    sqlite3_exec(db, zSql3, NULL, NULL, &errmsg);
-                    if(errmsg)
-                    {
-                        error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:errmsg];
-                        sqlite3_free(errmsg);
-                    }
-                }
+        }
 
+        if([next.readyItems count] == 0)
+        {
+            NSError *error;
+            if( ! [self sqliteReadDownloadQueueForJob:next withError:&error])
+            {
+                NSLog(@"Error while reading the offline map download queue: %@",error);
+                [self notifyDelegateOfSqliteError:error];
+                [candidates removeObject:next];
+                continue;
+            }
+            if([next.readyItems count] == 0)
+            {
+                [candidates removeObject:next];
+                [exhaustedJobs addObject:next];
+                continue;
             }
         }
-        sqlite3_close(db);
 
-        if(error)
+        MBXOfflineMapDownloadItem *item = next.readyItems[0];
+        [next.readyItems removeObjectAtIndex:0];
+        [self startDownloadingItem:item forJob:next];
+    }
+
+    for(MBXOfflineMapDownloadJob *job in jobs)
+    {
+        if(job.state != MBXOfflineMapDownloaderStateRunning || job.activeTasks > 0 || [job.readyItems count] > 0)
+        {
+            continue;
+        }
+        if(job.totalFilesWritten >= job.totalFilesExpectedToWrite)
         {
-            // Oops, that didn't work. Notify the delegate.
+            // There's nothing left to download. This also covers resuming a job which was suspended right as it finished.
             //
-            [self notifyDelegateOfSqliteError:error];
+            [self sqliteFinishJobIfComplete:job];
         }
-        else
+        else if([exhaustedJobs containsObject:job] && [job.claimedQueueIDs count] == 0)
         {
-            // Update the progress
+            // Everything left in the job's queue is waiting out a retry delay
             //
-            _totalFilesWritten += 1;
-            [self notifyDelegateOfProgress];
+            [self sqliteScheduleRetryWakeUpForJob:job];
+        }
+    }
+}
 
-            // If all the downloads are done, clean up and notify the delegate
-            //
-            if(_totalFilesWritten >= _totalFilesExpectedToWrite)
-            {
-                if(_state == MBXOfflineMapDownloaderStateRunning)
-                {
-                    // This is what to do when we've downloaded all the files
-                    //
-                    MBXOfflineMapDatabase *offlineMap = [self completeDatabaseAndInstantiateOfflineMapWithError:&error];
-                    if(offlineMap && !error) {
-                        [_mutableOfflineMapDatabases addObject:offlineMap];
-                    }
-                    [self notifyDelegateOfCompletionWithOfflineMapDatabase:offlineMap withError:error];
 
-                    _state = MBXOfflineMapDownloaderStateAvailable;
-                    [self notifyDelegateOfStateChange];
-                }
+- (void)startDownloadingItem:(MBXOfflineMapDownloadItem *)item forJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // Map tile URLs are built here at request time, so they always use the current access token
+    //
+    NSURL *url = item.resourceKey ? [MBXOfflineMapDatabase URLForResourceKey:item.resourceKey] : [self tileURLForPath:item.path ofJob:job];
+
+    // Responses are handled on the sqlite queue along with everything else that touches the scheduler's state. Responses
+    // to requests which were canceled because the job was suspended or canceled are ignored.
+    //
+    NSUInteger generation = job.generation;
+    _activeDataSessionTasks += 1;
+    job.activeTasks += 1;
+    MBXTileFetcherCompletionBlock completionHandler = ^(NSData *data, NSURLResponse *response, NSError *error)
+    {
+        [_sqliteQueue addOperationWithBlock:^{
+            if(generation == job.generation && job.state == MBXOfflineMapDownloaderStateRunning)
+            {
+                [job.activeDataTasks removeObjectForKey:@(item.queueID)];
+                [job.activeTileLoads removeObjectForKey:@(item.queueID)];
+                [self sqliteFinishRequestForItem:item job:job data:data response:response error:error];
             }
-        }
+        }];
+    };
 
-        // If this was the last of a batch of urls in the data session's download queue, and there are more urls
-        // to be downloaded, get another batch of urls from the database and keep working.
+    if(job.updatingOfflineMapDatabase)
+    {
+        // An update job asks for each resource only if it has changed since it was downloaded. These requests skip the
+        // shared tile fetcher and the URL cache, since a cached response would hide whether the resource has changed.
+        //
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:60];
+        if(item.etag) [request setValue:item.etag forHTTPHeaderField:@"If-None-Match"];
+        if(item.lastModified) [request setValue:item.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+        NSURLSessionDataTask *task = [_dataSession dataTaskWithRequest:request completionHandler:completionHandler];
+        job.activeDataTasks[@(item.queueID)] = task;
+        [task resume];
+    }
+    else if(item.resourceKey)
+    {
+        NSURLRequest *request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestUseProtocolCachePolicy timeoutInterval:60];
+        NSURLSessionDataTask *task = [_dataSession dataTaskWithRequest:request completionHandler:completionHandler];
+        job.activeDataTasks[@(item.queueID)] = task;
+        [task resume];
+    }
+    else
+    {
+        // Map tiles go through the shared tile fetcher, so a tile which a live map overlay is already loading isn't
+        // requested twice. The job's tiles aren't put in the shared tile cache, since a large job would just push out
+        // all the tiles which the live maps are using.
         //
-        if(_activeDataSessionTasks > 0)
+        id load = [[MBXTileFetcher sharedTileFetcher] fetchTileWithURL:url source:[self tileCacheSourceForJob:job] path:item.path cachesResponse:NO completionHandler:completionHandler];
+        job.activeTileLoads[@(item.queueID)] = load;
+    }
+}
+
+
+- (void)sqliteStopRequestsForJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // Cancel the job's requests in flight and hand their slots in the download window over to the other jobs. The other
+    // jobs' requests are left alone, so the shared data session can't simply be invalidated.
+    //
+    job.generation += 1;
+    job.tileURLTemplate = nil;
+    for(NSURLSessionTask *task in [job.activeDataTasks allValues])
+    {
+        [task cancel];
+    }
+    [job.activeDataTasks removeAllObjects];
+    for(id load in [job.activeTileLoads allValues])
+    {
+        [[MBXTileFetcher sharedTileFetcher] cancelLoad:load];
+    }
+    [job.activeTileLoads removeAllObjects];
+    [job.readyItems removeAllObjects];
+
+    _activeDataSessionTasks = MAX(_activeDataSessionTasks - job.activeTasks, 0);
+    job.activeTasks = 0;
+}
+
+
+- (void)sqliteFinishRequestForItem:(MBXOfflineMapDownloadItem *)item job:(MBXOfflineMapDownloadJob *)job data:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error
+{
+    assert(![NSThread isMainThread]);
+
+    _activeDataSessionTasks = MAX(_activeDataSessionTasks - 1, 0);
+    job.activeTasks = MAX(job.activeTasks - 1, 0);
+
+    NSInteger status = 200;
+    if ([response isKindOfClass:[NSHTTPURLResponse class]])
+    {
+        status = ((NSHTTPURLResponse *)response).statusCode;
+    }
+
+    if(error)
+    {
+        // We got a session level error which probably indicates a connectivity problem such as airplane mode. Notify the
+        // delegate, back off the request rate, and try the resource again later. Timeouts count as an attempt, since a
+        // single resource which never responds shouldn't keep the job from finishing.
+        //
+        [self notifyDelegateOfNetworkConnectivityError:error];
+
+        _downloadWindow = MAX(_downloadWindow / 2, 1);
+        _sampleCompletions = 0;
+        _sampleStartTime = CFAbsoluteTimeGetCurrent();
+        _sampleThroughput = 0.0;
+
+        if([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorTimedOut)
+        {
+            [self sqliteRetryItem:item forJob:job countingAttempt:YES];
+        }
+        else
+        {
+            _consecutiveConnectivityErrors += 1;
+            [self sqliteRetryItem:item forJob:job countingAttempt:NO];
+        }
+    }
+    else if(status == 304 && job.updatingOfflineMapDatabase)
+    {
+        // The resource hasn't changed since the offline map was downloaded, so there's nothing to write but its validators
+        //
+        _consecutiveConnectivityErrors = 0;
+        [self adjustDownloadWindowForCompletion];
+        [self sqliteSaveDownloadedData:nil response:response forItem:item job:job];
+    }
+    else if(status != 200)
+    {
+        // This url didn't work. Client errors other than timeouts and rate limiting won't go away by asking again, so give
+        // up on those right away. Anything else gets retried with backoff.
+        //
+        [self notifyDelegateOfHTTPStatusError:status url:response.URL];
+
+        if(status >= 400 && status < 500 && status != 408 && status != 429)
+        {
+            [self sqliteGiveUpOnItem:item forJob:job];
+        }
+        else
+        {
+            [self sqliteRetryItem:item forJob:job countingAttempt:YES];
+        }
+    }
+    else
+    {
+        // Since the URL was successfully retrieved, save the data
+        //
+        _consecutiveConnectivityErrors = 0;
+        [self adjustDownloadWindowForCompletion];
+        [self sqliteSaveDownloadedData:data response:response forItem:item job:job];
+    }
+
+    [self sqliteFillDownloadWindow];
+}
+
+
+
+- (void)adjustDownloadWindowForCompletion
+{
+    assert(![NSThread isMainThread]);
+
+    // Measure throughput over a sample of a few windows worth of completed requests, then compare it to the previous
+    // sample to decide whether more requests in flight are helping or hurting
+    //
+    _sampleCompletions += 1;
+    if(_sampleCompletions < _downloadWindow * 2)
+    {
+        return;
+    }
+
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    double throughput = _sampleCompletions / MAX(now - _sampleStartTime, 0.001);
+    if(throughput >= _sampleThroughput * 0.95)
+    {
+        if(_downloadWindow < _maximumConcurrentDownloads)
+        {
+            _downloadWindow += 1;
+        }
+    }
+    else if(throughput < _sampleThroughput * 0.8 && _downloadWindow > 1)
+    {
+        _downloadWindow -= 1;
+    }
+    _downloadWindow = MIN(_downloadWindow, _maximumConcurrentDownloads);
+
+    _sampleThroughput = throughput;
+    _sampleCompletions = 0;
+    _sampleStartTime = now;
+}
+
+
+- (void)setMaximumConcurrentDownloads:(NSUInteger)maximumConcurrentDownloads
+{
+    // The new limit applies to the download window right away, and to the session's connection limit when the next
+    // download session is created
+    //
+    _maximumConcurrentDownloads = MAX(maximumConcurrentDownloads, (NSUInteger)1);
+}
+
+
+- (NSString *)tileCacheSourceForJob:(MBXOfflineMapDownloadJob *)job
+{
+    // This has to match the source that MBXRasterTileOverlay uses for the same map, or requests won't be coalesced
+    //
+    return [NSString stringWithFormat:@"%@.%@%@",
+            job.mapID,
+            [MBXRasterTileOverlay qualityExtensionForImageQuality:job.imageQuality],
+            (job.contentScaleFactor > 1.0 ? @"@2x" : @"")];
+}
+
+
+- (NSURL *)tileURLForPath:(MKTileOverlayPath)path ofJob:(MBXOfflineMapDownloadJob *)job
+{
+    // The template is compiled once each time the job starts, and it's the same one that MBXRasterTileOverlay uses, so
+    // both request the same URLs from the same hosts
+    //
+    if( ! job.tileURLTemplate)
+    {
+        job.tileURLTemplate = [MBXRasterTileOverlay tileURLTemplateForMapID:job.mapID imageQuality:job.imageQuality];
+    }
+
+    path.contentScaleFactor = job.contentScaleFactor;
+
+    return [job.tileURLTemplate URLForTilePath:path];
+}
+
+
+#pragma mark - Implementation: sqlite stuff
+
+- (void)sqliteSaveDownloadedData:(NSData *)data response:(NSURLResponse *)response forItem:(MBXOfflineMapDownloadItem *)item job:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // Buffer the download so it can be committed along with others in a single transaction. Nothing counts as written
+    // until its transaction commits, so the progress reported to the delegate always matches what is on disk. A resource
+    // which an update job found to be unchanged has no data, but still gets its validators and queue row written.
+    //
+    [job.pendingWrites addObject:@[ item, (data ? data : [NSNull null]), (response ? response : [NSNull null]) ]];
+    job.pendingWriteBytes += [data length];
+
+    if([job.pendingWrites count] >= MBXOfflineMapDownloaderCommitBatchCount
+       || job.pendingWriteBytes >= MBXOfflineMapDownloaderCommitBatchBytes
+       || job.activeTasks == 0)
+    {
+        // The batch is full, or there's nothing else in flight for the job, so there's no reason to wait any longer
+        //
+        [self sqliteCommitPendingWritesForJob:job];
+    }
+    else if([job.pendingWrites count] == 1)
+    {
+        // Make sure a slow trickle of downloads still gets committed in a timely manner
+        //
+        NSUInteger generation = job.generation;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MBXOfflineMapDownloaderCommitInterval * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [_sqliteQueue addOperationWithBlock:^{
+                if(generation == job.generation && job.state == MBXOfflineMapDownloaderStateRunning)
+                {
+                    [self sqliteCommitPendingWritesForJob:job];
+                    [self sqliteFillDownloadWindow];
+                }
+            }];
+        });
+    }
+}
+
+
+- (void)countSqliteBusyForDatabase:(sqlite3 *)db
+{
+    // Writes to a partial database can only be busy if something else has it open, such as a leftover connection
+    // from an earlier job for the same region
+    //
+    if(sqlite3_errcode(db) == SQLITE_BUSY)
+    {
+        [[MBXTileMetrics sharedTileMetrics] addValue:1 toCounter:MBXTileMetricsCounterSqliteBusy];
+    }
+}
+
+
+- (void)sqliteCommitPendingWritesForJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    NSUInteger count = [job.pendingWrites count];
+    if(count == 0)
+    {
+        return;
+    }
+
+    NSError *error;
+    if([job sqliteOpenDatabaseWithError:&error])
+    {
+        // Write the whole batch in one transaction using the job connection's prepared statements
+        //
+        char *errmsg;
+        sqlite3_exec(job.database, "BEGIN TRANSACTION;", NULL, NULL, &errmsg);
+        if(errmsg)
+        {
+            [self countSqliteBusyForDatabase:job.database];
+            error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+            sqlite3_free(errmsg);
+        }
+        else
+        {
+            for(NSArray *write in job.pendingWrites)
+            {
+                if( ! [self sqliteWriteData:(write[1] == [NSNull null] ? nil : write[1])
+                                     response:(write[2] == [NSNull null] ? nil : write[2])
+                                      forItem:write[0]
+                                          job:job])
+                {
+                    [self countSqliteBusyForDatabase:job.database];
+                    error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(job.database)];
+                    break;
+                }
+            }
+
+            sqlite3_exec(job.database, (error ? "ROLLBACK;" : "COMMIT;"), NULL, NULL, &errmsg);
+            if(errmsg)
+            {
+                [self countSqliteBusyForDatabase:job.database];
+                if(!error) error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+                sqlite3_free(errmsg);
+            }
+        }
+    }
+
+    // Whether or not the batch was written, its resources are no longer claimed by this pass through the queue. If the
+    // batch failed, they're still in the download queue, so they will be requested again on the next pass.
+    //
+    for(NSArray *write in job.pendingWrites)
+    {
+        [job.claimedQueueIDs removeObject:@(((MBXOfflineMapDownloadItem *)write[0]).queueID)];
+    }
+    [job.pendingWrites removeAllObjects];
+    job.pendingWriteBytes = 0;
+
+    if(error)
+    {
+        // Oops, that didn't work. Notify the delegate.
+        //
+        [self notifyDelegateOfSqliteError:error];
+    }
+    else
+    {
+        // Update the progress, and if all the downloads are done, clean up and notify the delegate
+        //
+        job.totalFilesWritten += count;
+        [self notifyDelegateOfProgressForJob:job];
+        [self sqliteFinishJobIfComplete:job];
+    }
+}
+
+
+- (BOOL)sqliteWriteData:(NSData *)data response:(NSURLResponse *)response forItem:(MBXOfflineMapDownloadItem *)item job:(MBXOfflineMapDownloadJob *)job
+{
+    BOOL success = YES;
+    if(data)
+    {
+        // The blob goes into the data table unless an identical one is already there, which is common for map tiles of
+        // open ocean, empty land, and the like
+        //
+        NSData *hash = [MBXOfflineMapDatabase contentHashForData:data];
+        sqlite3_stmt *insertData = [job statement:MBXOfflineMapDownloaderStatementInsertData];
+        sqlite3_bind_blob(insertData, 1, [data bytes], (int)[data length], SQLITE_STATIC);
+        sqlite3_bind_blob(insertData, 2, [hash bytes], (int)[hash length], SQLITE_STATIC);
+        success = (sqlite3_step(insertData) == SQLITE_DONE);
+        sqlite3_reset(insertData);
+        sqlite3_clear_bindings(insertData);
+
+        if(success && item.resourceKey)
+        {
+            // Non-tile resources get their row in the resources table updated with status and the blob id
+            //
+            sqlite3_stmt *updateResource = [job statement:MBXOfflineMapDownloaderStatementUpdateResource];
+            sqlite3_bind_text(updateResource, 1, [item.resourceKey UTF8String], -1, SQLITE_TRANSIENT);
+            sqlite3_bind_blob(updateResource, 2, [hash bytes], (int)[hash length], SQLITE_STATIC);
+            success = (sqlite3_step(updateResource) == SQLITE_DONE);
+            sqlite3_reset(updateResource);
+            sqlite3_clear_bindings(updateResource);
+        }
+        else if(success)
+        {
+            // Map tiles get a row in the tiles table which refers to the blob id
+            //
+            sqlite3_stmt *insertTile = [job statement:MBXOfflineMapDownloaderStatementInsertTile];
+            sqlite3_bind_int64(insertTile, 1, item.path.z);
+            sqlite3_bind_int64(insertTile, 2, item.path.x);
+            sqlite3_bind_int64(insertTile, 3, [MBXOfflineMapDatabase tileRowForPath:item.path]);
+            sqlite3_bind_blob(insertTile, 4, [hash bytes], (int)[hash length], SQLITE_STATIC);
+            success = (sqlite3_step(insertTile) == SQLITE_DONE);
+            sqlite3_reset(insertTile);
+            sqlite3_clear_bindings(insertTile);
+        }
+    }
+
+    // Keep the resource's validators for the next update. A 304 response may come with new ones.
+    //
+    NSDictionary *headers = ([response isKindOfClass:[NSHTTPURLResponse class]] ? [(NSHTTPURLResponse *)response allHeaderFields] : nil);
+    NSString *etag = headers[@"ETag"];
+    NSString *lastModified = headers[@"Last-Modified"];
+    if(success && (etag || lastModified))
+    {
+        sqlite3_stmt *insertValidators = [job statement:MBXOfflineMapDownloaderStatementInsertValidators];
+        [self sqliteBindValidatorKeyForItem:item toStatement:insertValidators];
+        sqlite3_bind_text(insertValidators, 5, [(etag ? etag : item.etag) UTF8String], -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(insertValidators, 6, [(lastModified ? lastModified : item.lastModified) UTF8String], -1, SQLITE_TRANSIENT);
+        success = (sqlite3_step(insertValidators) == SQLITE_DONE);
+        sqlite3_reset(insertValidators);
+        sqlite3_clear_bindings(insertValidators);
+    }
+
+    // Take the resource off of the download queue in the same transaction
+    //
+    return success && [self sqliteDeleteQueuedItem:item forJob:job];
+}
+
+
+- (void)sqliteBindValidatorKeyForItem:(MBXOfflineMapDownloadItem *)item toStatement:(sqlite3_stmt *)ppStmt
+{
+    if(item.resourceKey)
+    {
+        sqlite3_bind_int64(ppStmt, 1, -1);
+        sqlite3_bind_int64(ppStmt, 2, 0);
+        sqlite3_bind_int64(ppStmt, 3, 0);
+        sqlite3_bind_text(ppStmt, 4, [item.resourceKey UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    else
+    {
+        sqlite3_bind_int64(ppStmt, 1, item.path.z);
+        sqlite3_bind_int64(ppStmt, 2, item.path.x);
+        sqlite3_bind_int64(ppStmt, 3, [MBXOfflineMapDatabase tileRowForPath:item.path]);
+        sqlite3_bind_text(ppStmt, 4, "", -1, SQLITE_STATIC);
+    }
+}
+
+
+- (void)sqliteLoadValidatorsForItem:(MBXOfflineMapDownloadItem *)item job:(MBXOfflineMapDownloadJob *)job
+{
+    sqlite3_stmt *selectValidators = [job statement:MBXOfflineMapDownloaderStatementSelectValidators];
+    [self sqliteBindValidatorKeyForItem:item toStatement:selectValidators];
+    if(sqlite3_step(selectValidators) == SQLITE_ROW)
+    {
+        const char *etag = (const char *)sqlite3_column_text(selectValidators, 0);
+        const char *lastModified = (const char *)sqlite3_column_text(selectValidators, 1);
+        item.etag = (etag ? [NSString stringWithUTF8String:etag] : nil);
+        item.lastModified = (lastModified ? [NSString stringWithUTF8String:lastModified] : nil);
+    }
+    sqlite3_reset(selectValidators);
+    sqlite3_clear_bindings(selectValidators);
+}
+
+
+- (BOOL)sqliteDeleteQueuedItem:(MBXOfflineMapDownloadItem *)item forJob:(MBXOfflineMapDownloadJob *)job
+{
+    sqlite3_stmt *deleteQueued = [job statement:MBXOfflineMapDownloaderStatementDeleteQueued];
+    sqlite3_bind_int64(deleteQueued, 1, item.queueID);
+    BOOL success = (sqlite3_step(deleteQueued) == SQLITE_DONE);
+    sqlite3_reset(deleteQueued);
+    sqlite3_clear_bindings(deleteQueued);
+    return success;
+}
+
+
+- (void)sqliteRetryItem:(MBXOfflineMapDownloadItem *)item forJob:(MBXOfflineMapDownloadJob *)job countingAttempt:(BOOL)countingAttempt
+{
+    assert(![NSThread isMainThread]);
+
+    NSInteger attempts = item.attempts + (countingAttempt ? 1 : 0);
+    if(attempts >= MBXOfflineMapDownloaderMaximumAttempts)
+    {
+        [self sqliteGiveUpOnItem:item forJob:job];
+        return;
+    }
+
+    [[MBXTileMetrics sharedTileMetrics] addValue:1 toCounter:MBXTileMetricsCounterRetries];
+
+    // Push the resource's next request back by an exponentially increasing delay, with some jitter so that a burst of
+    // failures doesn't turn into a burst of retries
+    //
+    NSInteger exponent = countingAttempt ? attempts : _consecutiveConnectivityErrors;
+    NSTimeInterval delay = MIN(MBXOfflineMapDownloaderRetryBaseDelay * pow(2.0, MAX(exponent - 1, 0)), MBXOfflineMapDownloaderRetryMaximumDelay);
+    delay *= 0.75 + (arc4random_uniform(1001) / 2000.0);
+
+    NSError *error;
+    if([job sqliteOpenDatabaseWithError:&error])
+    {
+        sqlite3_stmt *retryQueued = [job statement:MBXOfflineMapDownloaderStatementRetryQueued];
+        sqlite3_bind_int64(retryQueued, 1, item.queueID);
+        sqlite3_bind_int64(retryQueued, 2, attempts);
+        sqlite3_bind_double(retryQueued, 3, [[NSDate date] timeIntervalSince1970] + delay);
+        if(sqlite3_step(retryQueued) != SQLITE_DONE)
+        {
+            error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(job.database)];
+        }
+        sqlite3_reset(retryQueued);
+        sqlite3_clear_bindings(retryQueued);
+    }
+    if(error)
+    {
+        // The resource is still in the queue, so it will just be retried without a delay
+        //
+        [self notifyDelegateOfSqliteError:error];
+    }
+
+    [job.claimedQueueIDs removeObject:@(item.queueID)];
+}
+
+
+- (void)sqliteGiveUpOnItem:(MBXOfflineMapDownloadItem *)item forJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // Take the resource off of the download queue without writing anything for it. The delegate has already been told
+    // about the error, and the resource no longer counts toward the files expected to be written.
+    //
+    NSError *error;
+    if([job sqliteOpenDatabaseWithError:&error] && ! [self sqliteDeleteQueuedItem:item forJob:job])
+    {
+        error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(job.database)];
+    }
+    [job.claimedQueueIDs removeObject:@(item.queueID)];
+
+    if(error)
+    {
+        [self notifyDelegateOfSqliteError:error];
+    }
+    else if(job.updatingOfflineMapDatabase)
+    {
+        // An update job keeps the copy of the resource which was downloaded before, so it still counts as written
+        //
+        job.totalFilesWritten += 1;
+        [self notifyDelegateOfProgressForJob:job];
+        [self sqliteFinishJobIfComplete:job];
+    }
+    else
+    {
+        job.totalFilesExpectedToWrite = MAX(job.totalFilesExpectedToWrite, (NSUInteger)1) - 1;
+        [self notifyDelegateOfProgressForJob:job];
+        [self sqliteFinishJobIfComplete:job];
+    }
+}
+
+
+- (void)sqliteFinishJobIfComplete:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    if(job.totalFilesWritten >= job.totalFilesExpectedToWrite && job.state == MBXOfflineMapDownloaderStateRunning)
+    {
+        // This is what to do when we've downloaded all the files. The download queue is empty by now, and completed
+        // offline maps have no use for it, or for the bookkeeping of the job.
+        //
+        NSError *error;
+        if(job.database)
+        {
+            sqlite3_exec(job.database, "DROP TABLE IF EXISTS queue; DELETE FROM metadata WHERE name IN ('updatePath', 'updateFileCount', 'jobPriority');", NULL, NULL, NULL);
+        }
+        [job sqliteCloseDatabase];
+        MBXOfflineMapDatabase *offlineMap;
+        if(job.updatingOfflineMapDatabase)
+        {
+            offlineMap = [self completeUpdateOfOfflineMapForJob:job withError:&error];
+        }
+        else
+        {
+            offlineMap = [self completeDatabaseAndInstantiateOfflineMapForJob:job withError:&error];
+            if(offlineMap && !error) {
+                @synchronized(_mutableOfflineMapDatabases)
+                {
+                    [_mutableOfflineMapDatabases addObject:offlineMap];
+                }
+                [self writeCatalog];
+            }
+        }
+        [self notifyDelegateOfCompletionOfJob:job withOfflineMapDatabase:offlineMap withError:error];
+
+        [self sqliteRemoveJob:job];
+    }
+}
+
+
+- (void)sqliteRemoveJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    // The job is done with, one way or another, so it goes back to being available and stops being one of the jobs
+    //
+    job.state = MBXOfflineMapDownloaderStateAvailable;
+    @synchronized(_mutableJobs)
+    {
+        [_mutableJobs removeObject:job];
+    }
+    [self notifyDelegateOfStateChangeForJob:job];
+}
+
+
+- (void)sqliteScheduleRetryWakeUpForJob:(MBXOfflineMapDownloadJob *)job
+{
+    assert(![NSThread isMainThread]);
+
+    if(job.retryWakeUpScheduled || ! [job sqliteOpenDatabaseWithError:nil])
+    {
+        return;
+    }
+
+    // Find out when the earliest retry delay runs out, and check the queue again then
+    //
+    NSTimeInterval notBefore = 0;
+    sqlite3_stmt *ppStmt;
+    if(sqlite3_prepare_v2(job.database, "SELECT MIN(not_before) FROM queue;", -1, &ppStmt, NULL) == SQLITE_OK && sqlite3_step(ppStmt) == SQLITE_ROW)
+    {
+        notBefore = sqlite3_column_double(ppStmt, 0);
+    }
+    sqlite3_finalize(ppStmt);
+
+    NSTimeInterval delay = MAX(notBefore - [[NSDate date] timeIntervalSince1970], 0.1);
+    NSUInteger generation = job.generation;
+    job.retryWakeUpScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [_sqliteQueue addOperationWithBlock:^{
+            if(generation == job.generation)
+            {
+                job.retryWakeUpScheduled = NO;
+                [self sqliteFillDownloadWindow];
+            }
+        }];
+    });
+}
+
+
+- (BOOL)sqliteReadDownloadQueueForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
+{
+    assert(![NSThread isMainThread]);
+
+    if( ! [job sqliteOpenDatabaseWithError:error])
+    {
+        return NO;
+    }
+
+    // Read enough of the queue to refill the window a couple of times over. When a read comes up short, the cursor has
+    // reached the end of the queue, so enumerate the next chunk of tiles into the queue. Once there are no more tiles to
+    // enumerate, start another pass from the beginning to pick up resources whose retry delay has run out since the last
+    // pass. Resources which are still in flight or waiting to be committed get skipped.
+    //
+    NSInteger limit = (NSInteger)_downloadWindow * 2;
+    BOOL wrapped = NO;
+    while([job.readyItems count] == 0)
+    {
+        NSInteger rows = [self sqliteReadDownloadQueueForJob:job limit:limit withError:error];
+        if(rows < 0)
+        {
+            return NO;
+        }
+        if(rows < limit)
+        {
+            NSInteger enumerated = [self sqliteEnqueueTileChunkForJob:job withError:error];
+            if(enumerated < 0)
+            {
+                return NO;
+            }
+            if(enumerated > 0)
+            {
+                continue;
+            }
+            if(wrapped)
+            {
+                break;
+            }
+            job.queueCursorZoom = -1;
+            job.queueCursorID = 0;
+            wrapped = YES;
+        }
+    }
+    return YES;
+}
+
+
+- (NSInteger)sqliteReadDownloadQueueForJob:(MBXOfflineMapDownloadJob *)job limit:(NSInteger)limit withError:(NSError **)error
+{
+    // Read the next rows of the queue after the cursor, in order of zoom level if low zooms should be finished first, or
+    // in the order they were queued otherwise
+    //
+    sqlite3_stmt *ppStmt = [job statement:(_downloadsLowerZoomLevelsFirst ? MBXOfflineMapDownloaderStatementSelectQueuedByZoom : MBXOfflineMapDownloaderStatementSelectQueuedByID)];
+    sqlite3_bind_double(ppStmt, 1, [[NSDate date] timeIntervalSince1970]);
+    sqlite3_bind_int64(ppStmt, 2, job.queueCursorZoom);
+    sqlite3_bind_int64(ppStmt, 3, job.queueCursorID);
+    sqlite3_bind_int64(ppStmt, 4, limit);
+
+    NSInteger rows = 0;
+    int rc;
+    while((rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
+    {
+        rows += 1;
+        sqlite3_int64 queueID = sqlite3_column_int64(ppStmt, 0);
+        sqlite3_int64 zoom = sqlite3_column_int64(ppStmt, 2);
+        job.queueCursorID = queueID;
+        if(_downloadsLowerZoomLevelsFirst)
+        {
+            job.queueCursorZoom = zoom;
+        }
+        if([job.claimedQueueIDs containsObject:@(queueID)])
+        {
+            continue;
+        }
+
+        MBXOfflineMapDownloadItem *item = [[MBXOfflineMapDownloadItem alloc] init];
+        item.queueID = queueID;
+        item.attempts = (NSInteger)sqlite3_column_int64(ppStmt, 5);
+        const char *url = (const char *)sqlite3_column_text(ppStmt, 1);
+        if(url)
+        {
+            item.resourceKey = [NSString stringWithUTF8String:url];
+        }
+        else
+        {
+            MKTileOverlayPath path;
+            path.z = (NSInteger)zoom;
+            path.x = (NSInteger)sqlite3_column_int64(ppStmt, 3);
+            path.y = ((NSInteger)1 << path.z) - 1 - (NSInteger)sqlite3_column_int64(ppStmt, 4);
+            path.contentScaleFactor = 1.0;
+            item.path = path;
+        }
+        if(job.updatingOfflineMapDatabase)
+        {
+            [self sqliteLoadValidatorsForItem:item job:job];
+        }
+        [job.readyItems addObject:item];
+        [job.claimedQueueIDs addObject:@(queueID)];
+    }
+    if(rc != SQLITE_DONE)
+    {
+        if(error)
+        {
+            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(job.database)];
+        }
+        rows = -1;
+    }
+    sqlite3_reset(ppStmt);
+    sqlite3_clear_bindings(ppStmt);
+
+    return rows;
+}
+
+
+- (NSInteger)sqliteEnqueueTileChunkForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
+{
+    assert(![NSThread isMainThread]);
+
+    // Move the next chunk of tiles from the tile ranges into the download queue, lowest zoom level first, in one
+    // transaction. Tiles within a range are enumerated column by column. This returns the number of tiles queued, which
+    // is zero once every range has been enumerated, or -1 if something went wrong.
+    //
+    char *errmsg;
+    sqlite3_exec(job.database, "BEGIN TRANSACTION;", NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        if(error)
+        {
+            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+        }
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    sqlite3_stmt *selectRange = [job statement:MBXOfflineMapDownloaderStatementSelectTileRange];
+    sqlite3_stmt *updateRange = [job statement:MBXOfflineMapDownloaderStatementUpdateTileRange];
+    sqlite3_stmt *insertTile = [job statement:MBXOfflineMapDownloaderStatementInsertQueuedTile];
+    NSInteger queued = 0;
+    BOOL failed = NO;
+    while(!failed && queued < MBXOfflineMapDownloaderEnumerationChunkSize)
+    {
+        int rc = sqlite3_step(selectRange);
+        if(rc != SQLITE_ROW)
+        {
+            failed = (rc != SQLITE_DONE);
+            sqlite3_reset(selectRange);
+            break;
+        }
+        MKTileOverlayPath path;
+        sqlite3_int64 rangeID = sqlite3_column_int64(selectRange, 0);
+        path.z = (NSInteger)sqlite3_column_int64(selectRange, 1);
+        path.contentScaleFactor = 1.0;
+        sqlite3_int64 minX = sqlite3_column_int64(selectRange, 2);
+        sqlite3_int64 maxX = sqlite3_column_int64(selectRange, 3);
+        sqlite3_int64 minY = sqlite3_column_int64(selectRange, 4);
+        sqlite3_int64 maxY = sqlite3_column_int64(selectRange, 5);
+        sqlite3_int64 enumerated = sqlite3_column_int64(selectRange, 6);
+        sqlite3_reset(selectRange);
+
+        sqlite3_int64 height = maxY - minY + 1;
+        sqlite3_int64 end = MIN((maxX - minX + 1) * height, enumerated + (MBXOfflineMapDownloaderEnumerationChunkSize - queued));
+        for(sqlite3_int64 i = enumerated; i < end && !failed; i++)
+        {
+            path.x = (NSInteger)(minX + i / height);
+            path.y = (NSInteger)(minY + i % height);
+            sqlite3_bind_int64(insertTile, 1, path.z);
+            sqlite3_bind_int64(insertTile, 2, path.x);
+            sqlite3_bind_int64(insertTile, 3, [MBXOfflineMapDatabase tileRowForPath:path]);
+            failed = (sqlite3_step(insertTile) != SQLITE_DONE);
+            sqlite3_reset(insertTile);
+        }
+
+        if(!failed)
+        {
+            sqlite3_bind_int64(updateRange, 1, rangeID);
+            sqlite3_bind_int64(updateRange, 2, end);
+            failed = (sqlite3_step(updateRange) != SQLITE_DONE);
+            sqlite3_reset(updateRange);
+            queued += (NSInteger)(end - enumerated);
+        }
+    }
+
+    if(failed && error)
+    {
+        *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(job.database)];
+    }
+    sqlite3_exec(job.database, (failed ? "ROLLBACK;" : "COMMIT;"), NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        if(!failed && error)
+        {
+            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+        }
+        sqlite3_free(errmsg);
+        failed = YES;
+    }
+
+    return failed ? -1 : queued;
+}
+
+
+
+- (BOOL)sqliteUpgradeDownloadQueueForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
+{
+    // NOTE: This is called on the background work queue while a job is restored, before anything else touches the partial
+    //       database.
+    //
+    // Partial databases created before the download queue existed mark pending resources with a NULL status, and their
+    // pending map tiles are listed in pending_tiles when the legacy schema is converted. Move those into the queue. All of
+    // their tiles are already listed, so they get an empty tile_ranges table.
+    //
+    sqlite3 *db;
+    const char *filename = [job.partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc)
+    {
+        if(error)
         {
-            _activeDataSessionTasks -= 1;
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
         }
-        if(_activeDataSessionTasks == 0 && _totalFilesWritten < _totalFilesExpectedToWrite)
+        sqlite3_close(db);
+        return NO;
+    }
+
+    BOOL hasQueue = NO;
+    sqlite3_stmt *ppStmt;
+    if(sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='queue';", -1, &ppStmt, NULL) == SQLITE_OK && sqlite3_step(ppStmt) == SQLITE_ROW)
+    {
+        hasQueue = (sqlite3_column_int(ppStmt, 0) > 0);
+    }
+    sqlite3_finalize(ppStmt);
+
+    BOOL success = YES;
+    if(!hasQueue)
+    {
+        NSMutableString *query = [[NSMutableString alloc] init];
+        [query appendString:@"BEGIN TRANSACTION;\n"];
+        [query appendString:MBXOfflineMapDownloaderQueueSchema];
+        [query appendString:@"INSERT INTO queue (url, zoom_level) SELECT url, -1 FROM resources WHERE status IS NULL;\n"];
+        [query appendString:@"CREATE TABLE IF NOT EXISTS pending_tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER);\n"];
+        [query appendString:@"INSERT INTO queue (zoom_level, tile_column, tile_row) SELECT zoom_level, tile_column, tile_row FROM pending_tiles ORDER BY zoom_level;\n"];
+        [query appendString:@"DROP TABLE pending_tiles;\n"];
+        [query appendString:MBXOfflineMapDownloaderTileRangeSchema];
+        [query appendString:@"COMMIT;"];
+
+        char *errmsg;
+        sqlite3_exec(db, [query UTF8String], NULL, NULL, &errmsg);
+        if(errmsg)
         {
-            [self startDownloading];
+            if(error)
+            {
+                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+            }
+            sqlite3_free(errmsg);
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            success = NO;
         }
-    }];
+    }
+    sqlite3_close(db);
+
+    return success;
 }
 
 
-- (NSArray *)sqliteReadArrayOfOfflineMapURLsToBeDownloadLimit:(NSInteger)limit withError:(NSError **)error
+- (BOOL)sqliteQueryWrittenAndExpectedCountsForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
 {
-    assert(![NSThread isMainThread]);
+    // NOTE: Unlike most of the sqlite code, this method is written with the expectation that it will be called on the background
+    //       work queue while a job is restored. This is also meant to be used in other contexts throught the normal serial operation queue.
 
-    // Read up to limit undownloaded urls from the offline map database
+    // Calculate how many files have been written already and how many are still either in the download queue or waiting
+    // to be enumerated from the tile ranges. Resources which were given up on are in neither, so they don't count toward
+    // the files expected to be written.
+    //
+    // An update job starts out with everything already written, so it counts its progress as the number of resources it
+    // started with minus the number still queued
     //
-    NSMutableArray *urlArray = [[NSMutableArray alloc] init];
-    NSString *query = [NSString stringWithFormat:@"SELECT url FROM resources WHERE status IS NULL LIMIT %ld;\n",(long)limit];
+    NSString *query = @"SELECT IFNULL((SELECT value FROM metadata WHERE name = 'updateFileCount') - (SELECT COUNT(*) FROM queue), (SELECT COUNT(url) FROM resources WHERE status IS NOT NULL) + (SELECT COUNT(*) FROM tiles)) AS totalFilesWritten, (SELECT COUNT(*) FROM queue) + (SELECT IFNULL(SUM((max_x - min_x + 1) * (max_y - min_y + 1) - enumerated), 0) FROM tile_ranges) AS totalFilesRemaining;\n";
 
+    BOOL success = NO;
     // Open the database
     //
     sqlite3 *db;
-    const char *filename = [_partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    const char *filename = [job.partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
     int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL);
     if (rc)
     {
@@ -592,7 +2161,7 @@
         //
         if(error)
         {
-            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
         }
     }
     else
@@ -610,36 +2179,29 @@
             //
             if(error)
             {
-                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
             }
         }
         else
         {
             // Evaluate the query
             //
-            BOOL keepGoing = YES;
-            while(keepGoing)
+            rc = sqlite3_step(ppStmt);
+            if (rc == SQLITE_ROW && sqlite3_column_count(ppStmt)==2)
             {
-                rc = sqlite3_step(ppStmt);
-                if(rc == SQLITE_ROW && sqlite3_column_count(ppStmt)==1)
-                {
-                    // Success! We got a URL row, so add it to the array
-                    //
-                    [urlArray addObject:[NSURL URLWithString:[NSString stringWithUTF8String:(const char *)sqlite3_column_text(ppStmt, 0)]]];
-                }
-                else if(rc == SQLITE_DONE)
-                {
-                    keepGoing = NO;
-                }
-                else
+                // Success! We got a row with the counts for resource files
+                //
+                job.totalFilesWritten = (NSUInteger)sqlite3_column_int64(ppStmt, 0);
+                job.totalFilesExpectedToWrite = job.totalFilesWritten + (NSUInteger)sqlite3_column_int64(ppStmt, 1);
+                success = YES;
+            }
+            else
+            {
+                // Something unexpected happened.
+                //
+                if(error)
                 {
-                    // Something unexpected happened.
-                    //
-                    keepGoing = NO;
-                    if(error)
-                    {
-                        *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
-                    }
+                    *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
                 }
             }
         }
@@ -647,74 +2209,75 @@
     }
     sqlite3_close(db);
 
-    return [NSArray arrayWithArray:urlArray];
+    return success;
 }
 
 
-- (BOOL)sqliteQueryWrittenAndExpectedCountsWithError:(NSError **)error
+- (BOOL)sqliteRestoreMetadataForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
 {
-    // NOTE: Unlike most of the sqlite code, this method is written with the expectation that it can and will be called on the main
-    //       thread as part of init. This is also meant to be used in other contexts throught the normal serial operation queue.
-
-    // Calculate how many files need to be written in total and how many of them have been written already
+    // NOTE: This is called on the background work queue, to restore the properties of a suspended download job.
+    //       Map tile URLs aren't stored in the database, so the job's map ID and image quality are needed to resume it.
     //
-    NSString *query = @"SELECT COUNT(url) AS totalFilesExpectedToWrite, (SELECT COUNT(url) FROM resources WHERE status IS NOT NULL) AS totalFilesWritten FROM resources;\n";
-
     BOOL success = NO;
-    // Open the database
-    //
     sqlite3 *db;
-    const char *filename = [_partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    const char *filename = [job.partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
     int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL);
     if (rc)
     {
-        // Opening the database failed... something is very wrong.
-        //
         if(error)
         {
-            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
         }
     }
     else
     {
-        // Success! First prepare the query...
-        //
-        const char *zSql = [query cStringUsingEncoding:NSUTF8StringEncoding];
-        int nByte = (int)[query lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
         sqlite3_stmt *ppStmt;
-        const char *pzTail;
-        rc = sqlite3_prepare_v2(db, zSql, nByte, &ppStmt, &pzTail);
-        if (rc)
+        NSMutableDictionary *metadata = [[NSMutableDictionary alloc] init];
+        rc = sqlite3_prepare_v2(db, "SELECT name, value FROM metadata;", -1, &ppStmt, NULL);
+        if (!rc)
         {
-            // Preparing the query didn't work.
-            //
-            if(error)
+            while((rc = sqlite3_step(ppStmt)) == SQLITE_ROW)
             {
-                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+                const char *name = (const char *)sqlite3_column_text(ppStmt, 0);
+                const char *value = (const char *)sqlite3_column_text(ppStmt, 1);
+                if(name && value)
+                {
+                    metadata[[NSString stringWithUTF8String:name]] = [NSString stringWithUTF8String:value];
+                }
             }
         }
-        else
+        if (rc != SQLITE_DONE)
         {
-            // Evaluate the query
-            //
-            rc = sqlite3_step(ppStmt);
-            if (rc == SQLITE_ROW && sqlite3_column_count(ppStmt)==2)
+            if(error)
             {
-                // Success! We got a row with the counts for resource files
-                //
-                _totalFilesExpectedToWrite = [[NSString stringWithUTF8String:(const char *)sqlite3_column_text(ppStmt, 0)] integerValue];
-                _totalFilesWritten = [[NSString stringWithUTF8String:(const char *)sqlite3_column_text(ppStmt, 1)] integerValue];
-                success = YES;
+                *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
             }
-            else
+        }
+        else
+        {
+            job.uniqueID = metadata[@"uniqueID"];
+            job.mapID = metadata[@"mapID"];
+            job.includesMetadata = [metadata[@"includesMetadata"] boolValue];
+            job.includesMarkers = [metadata[@"includesMarkers"] boolValue];
+            job.imageQuality = (MBXRasterImageQuality)[metadata[@"imageQuality"] integerValue];
+            MKCoordinateRegion mapRegion;
+            mapRegion.center.latitude = [metadata[@"region_latitude"] doubleValue];
+            mapRegion.center.longitude = [metadata[@"region_longitude"] doubleValue];
+            mapRegion.span.latitudeDelta = [metadata[@"region_latitude_delta"] doubleValue];
+            mapRegion.span.longitudeDelta = [metadata[@"region_longitude_delta"] doubleValue];
+            job.mapRegion = mapRegion;
+            job.minimumZ = [metadata[@"minimumZ"] integerValue];
+            job.maximumZ = [metadata[@"maximumZ"] integerValue];
+            [job restorePriority:(NSUInteger)MAX([metadata[@"jobPriority"] integerValue], 1)];
+            job.updatingOfflineMapDatabase = nil;
+            for(MBXOfflineMapDatabase *offlineMap in [self offlineMapDatabases])
             {
-                // Something unexpected happened.
-                //
-                if(error)
+                if(metadata[@"updatePath"] && [[offlineMap.path lastPathComponent] isEqualToString:metadata[@"updatePath"]])
                 {
-                    *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+                    job.updatingOfflineMapDatabase = offlineMap;
                 }
             }
+            success = YES;
         }
         sqlite3_finalize(ppStmt);
     }
@@ -724,36 +2287,56 @@
 }
 
 
-- (BOOL)sqliteCreateDatabaseUsingMetadata:(NSDictionary *)metadata urlArray:(NSArray *)urlStrings withError:(NSError **)error
+- (BOOL)sqliteCreateDatabaseForJob:(MBXOfflineMapDownloadJob *)job usingMetadata:(NSDictionary *)metadata urlArray:(NSArray *)urlStrings coverage:(MBXTileCoverage *)coverage withError:(NSError **)error
 {
     assert(![NSThread isMainThread]);
     BOOL success = NO;
 
-    // Build a query to populate the database (map metadata and list of map resource urls)
+    // Build a query to create the tables and populate the database with map metadata, the list of non-tile resource urls
+    // (which are queued for downloading right away), and the ranges of map tiles to download at each zoom level. Tiles
+    // are moved from the ranges into the download queue a chunk at a time as the download progresses, so the cost of
+    // creating the database doesn't depend on how many tiles there are.
     //
     NSMutableString *query = [[NSMutableString alloc] init];
     [query appendString:@"PRAGMA foreign_keys=ON;\n"];
     [query appendString:@"BEGIN TRANSACTION;\n"];
     [query appendString:@"CREATE TABLE metadata (name TEXT UNIQUE, value TEXT);\n"];
-    [query appendString:@"CREATE TABLE data (id INTEGER PRIMARY KEY, value BLOB);\n"];
+    [query appendString:@"CREATE TABLE data (id INTEGER PRIMARY KEY, value BLOB, hash BLOB);\n"];
+    [query appendString:@"CREATE UNIQUE INDEX data_hash ON data (hash);\n"];
     [query appendString:@"CREATE TABLE resources (url TEXT UNIQUE, status TEXT, id INTEGER REFERENCES data);\n"];
+    [query appendString:[MBXOfflineMapDatabase tileTableSchemaForVersion:MBXOfflineMapDatabaseSchemaVersionDeduplicated]];
+    [query appendString:MBXOfflineMapDownloaderQueueSchema];
+    [query appendString:MBXOfflineMapDownloaderTileRangeSchema];
     for(NSString *key in metadata) {
         [query appendFormat:@"INSERT INTO \"metadata\" VALUES('%@','%@');\n", key, [metadata valueForKey:key]];
     }
+    [query appendFormat:@"INSERT INTO \"metadata\" VALUES('jobPriority','%ld');\n", (long)job.priority];
     for(NSString *url in urlStrings)
     {
-        [query appendFormat:@"INSERT INTO \"resources\" VALUES('%@',NULL,NULL);\n",url];
+        [query appendFormat:@"INSERT INTO \"resources\" VALUES('%@',NULL,NULL);\n",[MBXOfflineMapDatabase resourceKeyForURL:[NSURL URLWithString:url]]];
+    }
+    [query appendString:@"INSERT INTO queue (url, zoom_level) SELECT url, -1 FROM resources;\n"];
+    __block NSUInteger tileCount = 0;
+    BOOL covered = [coverage enumerateTileRangesForMinimumZ:job.minimumZ maximumZ:job.maximumZ withError:error usingBlock:^(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY) {
+        [query appendFormat:@"INSERT INTO \"tile_ranges\" VALUES(NULL,%ld,%ld,%ld,%ld,%ld,0);\n", (long)z, (long)minX, (long)maxX, (long)minY, (long)maxY];
+        tileCount += (maxX - minX + 1) * (maxY - minY + 1);
+    }];
+    if(!covered)
+    {
+        // Starting the download with only part of the coverage would leave holes in the offline map
+        //
+        return NO;
     }
     [query appendString:@"COMMIT;"];
-    _totalFilesExpectedToWrite = [urlStrings count];
-    _totalFilesWritten = 0;
+    job.totalFilesExpectedToWrite = [urlStrings count] + tileCount;
+    job.totalFilesWritten = 0;
 
 
     // Open the database read-write and multi-threaded. The slightly obscure c-style variable names here and below are
     // used to stay consistent with the sqlite documentaion.
     sqlite3 *db;
     int rc;
-    const char *filename = [_partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    const char *filename = [job.partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
     rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
     if (rc)
     {
@@ -761,7 +2344,7 @@
         //
         if(error != NULL)
         {
-            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:_partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
         }
         sqlite3_close(db);
     }
@@ -774,9 +2357,9 @@
         sqlite3_exec(db, zSql, NULL, NULL, &errmsg);
         if(error && errmsg != NULL)
         {
-            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:_partialDatabasePath sqliteError:errmsg];
-            sqlite3_free(errmsg);
+            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
         }
+        sqlite3_free(errmsg);
         sqlite3_close(db);
         success = YES;
     }
@@ -784,6 +2367,7 @@
 }
 
 
+
 #pragma mark - API: Begin an offline map download
 
 - (void)beginDownloadingMapID:(NSString *)mapID mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ
@@ -800,28 +2384,92 @@
 
 - (void)beginDownloadingMapID:(NSString *)mapID mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality
 {
-    assert(_state == MBXOfflineMapDownloaderStateAvailable);
+    [self beginJobDownloadingMapID:mapID mapRegion:mapRegion minimumZ:minimumZ maximumZ:maximumZ includeMetadata:includeMetadata includeMarkers:includeMarkers imageQuality:imageQuality];
+}
+
+
+- (void)beginUpdatingOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase
+{
+    [self beginJobUpdatingOfflineMapDatabase:offlineMapDatabase];
+}
+
+
+- (CGFloat)mainScreenScale
+{
+    assert([NSThread isMainThread]);
+
+#if TARGET_OS_IPHONE
+    return [[UIScreen mainScreen] scale];
+#else
+    // Making this smart enough to handle a Retina MacBook with a normal dpi external display is complicated. For now,
+    // just default to @1x images and a 1.0 scale.
+    //
+    return 1.0;
+#endif
+}
+
+
+- (MBXOfflineMapDownloadJob *)addJob
+{
+    // Every job downloads into a partial database of its own, so any number of them can be in progress at once
+    //
+    NSString *filename = [NSString stringWithFormat:@"%@.partial",[[NSUUID UUID] UUIDString]];
+    MBXOfflineMapDownloadJob *job = [[MBXOfflineMapDownloadJob alloc] initWithPartialDatabasePath:[[_offlineMapDirectory URLByAppendingPathComponent:filename] path]];
+    job.downloader = self;
+    job.state = MBXOfflineMapDownloaderStateRunning;
+    job.contentScaleFactor = [self mainScreenScale];
+
+    // A fresh download session picks up any change to maximumConcurrentDownloads, but it's only safe to switch sessions
+    // while nothing else is downloading
+    //
+    if([self state] != MBXOfflineMapDownloaderStateRunning)
+    {
+        [self setUpNewDataSession];
+    }
+
+    @synchronized(_mutableJobs)
+    {
+        [_mutableJobs addObject:job];
+    }
+    return job;
+}
+
+
+- (MBXOfflineMapDownloadJob *)beginJobDownloadingMapID:(NSString *)mapID mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    MBXTileCoverage *coverage = [MBXTileCoverage coverageWithMapRegion:mapRegion];
+    return [self beginJobDownloadingMapID:mapID coverage:coverage mapRegion:mapRegion minimumZ:minimumZ maximumZ:maximumZ includeMetadata:includeMetadata includeMarkers:includeMarkers imageQuality:imageQuality];
+}
+
+
+- (MBXOfflineMapDownloadJob *)beginJobDownloadingMapID:(NSString *)mapID coverage:(MBXTileCoverage *)coverage minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    return [self beginJobDownloadingMapID:mapID coverage:coverage mapRegion:coverage.boundingMapRegion minimumZ:minimumZ maximumZ:maximumZ includeMetadata:includeMetadata includeMarkers:includeMarkers imageQuality:imageQuality];
+}
+
 
-    [self setUpNewDataSession];
+- (MBXOfflineMapDownloadJob *)beginJobDownloadingMapID:(NSString *)mapID coverage:(MBXTileCoverage *)coverage mapRegion:(MKCoordinateRegion)mapRegion minimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    // Start a download job to retrieve all the resources needed for using the specified map offline. The job's properties
+    // are set right away so the caller can inspect the job it gets back.
+    //
+    MBXOfflineMapDownloadJob *job = [self addJob];
+    job.uniqueID = [[NSUUID UUID] UUIDString];
+    job.mapID = mapID;
+    job.includesMetadata = includeMetadata;
+    job.includesMarkers = includeMarkers;
+    job.imageQuality = imageQuality;
+    job.mapRegion = mapRegion;
+    job.minimumZ = minimumZ;
+    job.maximumZ = maximumZ;
 
     [_backgroundWorkQueue addOperationWithBlock:^{
 
-        // Start a download job to retrieve all the resources needed for using the specified map offline
-        //
-        _uniqueID = [[NSUUID UUID] UUIDString];
-        _mapID = mapID;
-        _includesMetadata = includeMetadata;
-        _includesMarkers = includeMarkers;
-        _imageQuality = imageQuality;
-        _mapRegion = mapRegion;
-        _minimumZ = minimumZ;
-        _maximumZ = maximumZ;
-        _state = MBXOfflineMapDownloaderStateRunning;
-        [self notifyDelegateOfStateChange];
+        [self notifyDelegateOfStateChangeForJob:job];
 
         NSDictionary *metadataDictionary =
         @{
-          @"uniqueID": _uniqueID,
+          @"uniqueID": job.uniqueID,
           @"mapID": mapID,
           @"includesMetadata" : includeMetadata?@"YES":@"NO",
           @"includesMarkers" : includeMarkers?@"YES":@"NO",
@@ -831,7 +2479,8 @@
           @"region_latitude_delta" : [NSString stringWithFormat:@"%.8f",mapRegion.span.latitudeDelta],
           @"region_longitude_delta" : [NSString stringWithFormat:@"%.8f",mapRegion.span.longitudeDelta],
           @"minimumZ" : [NSString stringWithFormat:@"%ld",(long)minimumZ],
-          @"maximumZ" : [NSString stringWithFormat:@"%ld",(long)maximumZ]
+          @"maximumZ" : [NSString stringWithFormat:@"%ld",(long)maximumZ],
+          @"schemaVersion" : [NSString stringWithFormat:@"%ld",(long)MBXOfflineMapDatabaseSchemaVersionDeduplicated]
           };
 
 
@@ -852,50 +2501,6 @@
                                 [@"?access_token=" stringByAppendingString:[MBXMapKit accessToken]]]];
         }
 
-        // Loop through the zoom levels and lat/lon bounds to generate a list of urls which should be included in the offline map
-        //
-        CLLocationDegrees minLat = mapRegion.center.latitude - (mapRegion.span.latitudeDelta / 2.0);
-        CLLocationDegrees maxLat = minLat + mapRegion.span.latitudeDelta;
-        CLLocationDegrees minLon = mapRegion.center.longitude - (mapRegion.span.longitudeDelta / 2.0);
-        CLLocationDegrees maxLon = minLon + mapRegion.span.longitudeDelta;
-        NSUInteger minX;
-        NSUInteger maxX;
-        NSUInteger minY;
-        NSUInteger maxY;
-        NSUInteger tilesPerSide;
-        for(NSUInteger zoom = minimumZ; zoom <= maximumZ; zoom++)
-        {
-            tilesPerSide = pow(2.0, zoom);
-            minX = floor(((minLon + 180.0) / 360.0) * tilesPerSide);
-            maxX = floor(((maxLon + 180.0) / 360.0) * tilesPerSide);
-            minY = floor((1.0 - (logf(tanf(maxLat * M_PI / 180.0) + 1.0 / cosf(maxLat * M_PI / 180.0)) / M_PI)) / 2.0 * tilesPerSide);
-            maxY = floor((1.0 - (logf(tanf(minLat * M_PI / 180.0) + 1.0 / cosf(minLat * M_PI / 180.0)) / M_PI)) / 2.0 * tilesPerSide);
-            for(NSUInteger x=minX; x<=maxX; x++)
-            {
-                for(NSUInteger y=minY; y<=maxY; y++)
-                {
-                    [urls addObject:[NSString stringWithFormat:@"https://a.tiles.mapbox.com/v4/%@/%ld/%ld/%ld%@.%@%@",
-                                     mapID,
-                                     (long)zoom,
-                                     (long)x,
-                                     (long)y,
-#if TARGET_OS_IPHONE
-                                     [[UIScreen mainScreen] scale] > 1.0 ? @"@2x" : @"",
-#else
-                                     // Making this smart enough to handle a Retina MacBook with a normal dpi external display
-                                     // is complicated. For now, just default to @1x images and a 1.0 scale.
-                                     //
-                                     @"",
-#endif
-                                     [MBXRasterTileOverlay qualityExtensionForImageQuality:_imageQuality],
-                                     [@"?access_token=" stringByAppendingString:[MBXMapKit accessToken]]
-                                     ]
-                     ];
-                }
-            }
-        }
-
-
         // Determine if we need to add marker icon urls (i.e. parse markers.geojson/features.json), and if so, add them
         //
         if(includeMarkers)
@@ -908,7 +2513,13 @@
             NSURLRequest *request = [NSURLRequest requestWithURL:geojson cachePolicy:NSURLRequestUseProtocolCachePolicy timeoutInterval:60];
             task = [_dataSession dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
             {
-                if(error)
+                if(job.state == MBXOfflineMapDownloaderStateCanceling || job.state == MBXOfflineMapDownloaderStateAvailable)
+                {
+                    // The job was canceled while the marker geojson was loading, so there's nothing left to do
+                    //
+                    return;
+                }
+                else if(error)
                 {
                     // We got a session level error which probably indicates a connectivity problem such as airplane mode.
                     // Since we must fetch and parse markers.geojson/features.json in order to determine which marker icons need to be
@@ -916,7 +2527,7 @@
                     // here.
                     //
                     [self notifyDelegateOfNetworkConnectivityError:error];
-                    [self cancelImmediatelyWithError:error];
+                    [self cancelJob:job immediatelyWithError:error];
                 }
                 else
                 {
@@ -934,7 +2545,7 @@
                         // try to save it here, because it may already be in the download queue and saving it twice will mess
                         // up the count of urls to be downloaded!
                         //
-                        NSArray *markerIconURLStrings = [self parseMarkerIconURLStringsFromGeojsonData:(NSData *)data];
+                        NSArray *markerIconURLStrings = [self parseMarkerIconURLStringsFromGeojsonData:(NSData *)data scale:job.contentScaleFactor];
                         if(markerIconURLStrings)
                         {
                             [urls addObjectsFromArray:markerIconURLStrings];
@@ -951,15 +2562,15 @@
                     // Create the database and start the download
                     //
                     NSError *error;
-                    [self sqliteCreateDatabaseUsingMetadata:metadataDictionary urlArray:urls withError:&error];
+                    [self sqliteCreateDatabaseForJob:job usingMetadata:metadataDictionary urlArray:urls coverage:coverage withError:&error];
                     if(error)
                     {
-                        [self cancelImmediatelyWithError:error];
+                        [self cancelJob:job immediatelyWithError:error];
                     }
                     else
                     {
-                        [self notifyDelegateOfInitialCount];
-                        [self startDownloading];
+                        [self notifyDelegateOfInitialCountForJob:job];
+                        [self startDownloadingJob:job];
                     }
                 }
             }];
@@ -970,26 +2581,135 @@
             // There aren't any marker icons to worry about, so just create database and start downloading
             //
             NSError *error;
-            [self sqliteCreateDatabaseUsingMetadata:metadataDictionary urlArray:urls withError:&error];
+            [self sqliteCreateDatabaseForJob:job usingMetadata:metadataDictionary urlArray:urls coverage:coverage withError:&error];
             if(error)
             {
-                [self cancelImmediatelyWithError:error];
+                [self cancelJob:job immediatelyWithError:error];
             }
             else
             {
-                [self notifyDelegateOfInitialCount];
-                [self startDownloading];
+                [self notifyDelegateOfInitialCountForJob:job];
+                [self startDownloadingJob:job];
             }
         }
     }];
+
+    return job;
+}
+
+
+- (MBXOfflineMapDownloadJob *)beginJobUpdatingOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase
+{
+    assert([[self offlineMapDatabases] containsObject:offlineMapDatabase]);
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        assert(job.updatingOfflineMapDatabase != offlineMapDatabase);
+    }
+
+    // Start a download job which refreshes an existing offline map. The job works on a copy of the offline map, so
+    // the offline map stays usable until the copy is swapped in for it at the end.
+    //
+    MBXOfflineMapDownloadJob *job = [self addJob];
+    job.uniqueID = offlineMapDatabase.uniqueID;
+    job.updatingOfflineMapDatabase = offlineMapDatabase;
+    job.mapID = offlineMapDatabase.mapID;
+    job.includesMetadata = offlineMapDatabase.includesMetadata;
+    job.includesMarkers = offlineMapDatabase.includesMarkers;
+    job.imageQuality = offlineMapDatabase.imageQuality;
+    job.mapRegion = offlineMapDatabase.mapRegion;
+    job.minimumZ = offlineMapDatabase.minimumZ;
+    job.maximumZ = offlineMapDatabase.maximumZ;
+
+    [_backgroundWorkQueue addOperationWithBlock:^{
+
+        [self notifyDelegateOfStateChangeForJob:job];
+
+        NSError *error;
+        [self sqliteCreateUpdateDatabaseForJob:job withError:&error];
+        if(error)
+        {
+            [self cancelJob:job immediatelyWithError:error];
+        }
+        else
+        {
+            [self notifyDelegateOfInitialCountForJob:job];
+            [self startDownloadingJob:job];
+        }
+    }];
+
+    return job;
+}
+
+
+- (BOOL)sqliteCreateUpdateDatabaseForJob:(MBXOfflineMapDownloadJob *)job withError:(NSError **)error
+{
+    assert(![NSThread isMainThread]);
+
+    // Copy the offline map into place as the partial database, and bring it up to the current schema if it was downloaded
+    // by an older version of MBXMapKit
+    //
+    MBXOfflineMapDatabase *offlineMap = job.updatingOfflineMapDatabase;
+    if( ! [[NSFileManager defaultManager] copyItemAtPath:offlineMap.path toPath:job.partialDatabasePath error:error]
+       || ! [MBXOfflineMapDatabase compactDatabaseAtPath:job.partialDatabasePath withError:error])
+    {
+        return NO;
+    }
+
+    // Queue every resource and map tile which the offline map has, in the same order as a new download. Nothing is left
+    // to enumerate, so the tile ranges are emptied.
+    //
+    NSMutableString *query = [[NSMutableString alloc] init];
+    [query appendString:@"BEGIN TRANSACTION;\n"];
+    [query appendString:@"DROP TABLE IF EXISTS queue;\n"];
+    [query appendString:@"DROP TABLE IF EXISTS tile_ranges;\n"];
+    [query appendString:MBXOfflineMapDownloaderQueueSchema];
+    [query appendString:MBXOfflineMapDownloaderTileRangeSchema];
+    [query appendString:MBXOfflineMapDownloaderValidatorSchema];
+    [query appendString:@"INSERT INTO queue (url, zoom_level) SELECT url, -1 FROM resources WHERE id IS NOT NULL;\n"];
+    [query appendString:@"INSERT INTO queue (zoom_level, tile_column, tile_row) SELECT zoom_level, tile_column, tile_row FROM tiles WHERE tile_id IS NOT NULL ORDER BY zoom_level;\n"];
+    [query appendFormat:@"INSERT OR REPLACE INTO metadata VALUES('updatePath','%@');\n", [offlineMap.path lastPathComponent]];
+    [query appendString:@"INSERT OR REPLACE INTO metadata VALUES('updateFileCount',(SELECT COUNT(*) FROM queue));\n"];
+    [query appendFormat:@"INSERT OR REPLACE INTO metadata VALUES('jobPriority','%ld');\n", (long)job.priority];
+    [query appendString:@"COMMIT;"];
+
+    sqlite3 *db;
+    const char *filename = [job.partialDatabasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc)
+    {
+        if(error)
+        {
+            *error = [NSError mbx_errorCannotOpenOfflineMapDatabase:job.partialDatabasePath sqliteError:sqlite3_errmsg(db)];
+        }
+        sqlite3_close(db);
+        return NO;
+    }
+
+    char *errmsg;
+    sqlite3_exec(db, [query UTF8String], NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        if(error)
+        {
+            *error = [NSError mbx_errorQueryFailedForOfflineMapDatabase:job.partialDatabasePath sqliteError:errmsg];
+        }
+        sqlite3_free(errmsg);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        sqlite3_close(db);
+        return NO;
+    }
+    sqlite3_close(db);
+
+    return [self sqliteQueryWrittenAndExpectedCountsForJob:job withError:error];
 }
 
 
-- (NSArray *)parseMarkerIconURLStringsFromGeojsonData:(NSData *)data
+- (NSArray *)parseMarkerIconURLStringsFromGeojsonData:(NSData *)data scale:(CGFloat)scale
 {
     id markers;
     id value;
-    NSMutableArray *iconURLStrings = [[NSMutableArray alloc] init];
+    NSMutableSet *iconURLStrings = [[NSMutableSet alloc] init];
+    NSMutableSet *iconStyles = [[NSMutableSet alloc] init];
     NSError *error;
     NSDictionary *simplestyleJSONDictionary = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
     if(!error)
@@ -1012,9 +2732,13 @@
                         NSString *size        = feature[@"properties"][@"marker-size"];
                         NSString *color       = feature[@"properties"][@"marker-color"];
                         NSString *symbol      = feature[@"properties"][@"marker-symbol"];
-                        if (size && color && symbol)
+                        if (size && color && symbol && ![iconStyles containsObject:@[ size, symbol, color ]])
                         {
-                            NSURL *markerURL = [MBXRasterTileOverlay markerIconURLForSize:size symbol:symbol color:color];
+                            // Only build the URL the first time each combination of icon properties is seen
+                            //
+                            [iconStyles addObject:@[ size, symbol, color ]];
+
+                            NSURL *markerURL = [MBXRasterTileOverlay markerIconURLForSize:size symbol:symbol color:color scale:scale];
                             if(markerURL && iconURLStrings )
                             {
                                 [iconURLStrings addObject:[markerURL absoluteString]];
@@ -1029,72 +2753,90 @@
 
     // Return only the unique icon urls
     //
-    NSSet *uniqueIcons = [NSSet setWithArray:iconURLStrings];
-    return [uniqueIcons allObjects];
+    return [iconURLStrings allObjects];
 }
 
 
-- (void)cancelImmediatelyWithError:(NSError *)error
+- (void)cancelJob:(MBXOfflineMapDownloadJob *)job immediatelyWithError:(NSError *)error
 {
-    // Creating the database failed for some reason, so clean up and change the state back to available
+    // Creating the job's database failed for some reason, so clean up and change the job's state back to available
     //
-    _state = MBXOfflineMapDownloaderStateCanceling;
-    [self notifyDelegateOfStateChange];
+    job.state = MBXOfflineMapDownloaderStateCanceling;
+    [self notifyDelegateOfStateChangeForJob:job];
 
-    if([_delegate respondsToSelector:@selector(offlineMapDownloader:didCompleteOfflineMapDatabase:withError:)])
-    {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            [_delegate offlineMapDownloader:self didCompleteOfflineMapDatabase:nil withError:error];
-        });
-    }
+    [_sqliteQueue addOperationWithBlock:^{
+        [self sqliteStopRequestsForJob:job];
+        [self sqliteDiscardJob:job withError:error];
+        [self sqliteFillDownloadWindow];
+    }];
+}
 
-    [_dataSession invalidateAndCancel];
-    [_sqliteQueue cancelAllOperations];
 
-    [_sqliteQueue addOperationWithBlock:^{
-        [self setUpNewDataSession];
-        _totalFilesWritten = 0;
-        _totalFilesExpectedToWrite = 0;
+- (void)sqliteDiscardJob:(MBXOfflineMapDownloadJob *)job withError:(NSError *)error
+{
+    assert(![NSThread isMainThread]);
 
-        [[NSFileManager defaultManager] removeItemAtPath:_partialDatabasePath error:nil];
+    job.totalFilesWritten = 0;
+    job.totalFilesExpectedToWrite = 0;
+    [job sqliteRemovePartialDatabase];
 
-        _state = MBXOfflineMapDownloaderStateAvailable;
-        [self notifyDelegateOfStateChange];
-    }];
+    [self notifyDelegateOfCompletionOfJob:job withOfflineMapDatabase:nil withError:error];
+    [self sqliteRemoveJob:job];
 }
 
 
-#pragma mark - API: Control an in-progress offline map download
+#pragma mark - API: Control in-progress offline map downloads
 
 - (void)cancel
 {
-    if(_state != MBXOfflineMapDownloaderStateCanceling && _state != MBXOfflineMapDownloaderStateAvailable)
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
     {
-        // Stop a download job and discard the associated files
-        //
-        [_backgroundWorkQueue addOperationWithBlock:^{
-            _state = MBXOfflineMapDownloaderStateCanceling;
-            [self notifyDelegateOfStateChange];
+        [self cancelJob:job];
+    }
+}
 
-            [_dataSession invalidateAndCancel];
-            [_sqliteQueue cancelAllOperations];
 
-            [_sqliteQueue addOperationWithBlock:^{
-                [self setUpNewDataSession];
-                _totalFilesWritten = 0;
-                _totalFilesExpectedToWrite = 0;
-                [[NSFileManager defaultManager] removeItemAtPath:_partialDatabasePath error:nil];
+- (void)resume
+{
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        if(job.state == MBXOfflineMapDownloaderStateSuspended)
+        {
+            [self resumeJob:job];
+        }
+    }
+}
 
-                if([_delegate respondsToSelector:@selector(offlineMapDownloader:didCompleteOfflineMapDatabase:withError:)])
-                {
-                    NSError *canceled = [NSError mbx_errorWithCode:MBXMapKitErrorCodeDownloadingCanceled reason:@"The download job was canceled" description:@"Download canceled"];
-                    dispatch_async(dispatch_get_main_queue(), ^{
-                        [_delegate offlineMapDownloader:self didCompleteOfflineMapDatabase:nil withError:canceled];
-                    });
-                }
 
-                _state = MBXOfflineMapDownloaderStateAvailable;
-                [self notifyDelegateOfStateChange];
+- (void)suspend
+{
+    for(MBXOfflineMapDownloadJob *job in [self jobs])
+    {
+        [self suspendJob:job];
+    }
+}
+
+
+- (void)cancelJob:(MBXOfflineMapDownloadJob *)job
+{
+    if(job.state != MBXOfflineMapDownloaderStateCanceling && job.state != MBXOfflineMapDownloaderStateAvailable)
+    {
+        // Stop a download job and discard the associated files. The other jobs carry on, and take over its share of
+        // the download window.
+        //
+        [_backgroundWorkQueue addOperationWithBlock:^{
+            if(job.state == MBXOfflineMapDownloaderStateCanceling || job.state == MBXOfflineMapDownloaderStateAvailable)
+            {
+                return;
+            }
+            job.state = MBXOfflineMapDownloaderStateCanceling;
+            [self notifyDelegateOfStateChangeForJob:job];
+
+            [_sqliteQueue addOperationWithBlock:^{
+                [self sqliteStopRequestsForJob:job];
+                NSError *canceled = [NSError mbx_errorWithCode:MBXMapKitErrorCodeDownloadingCanceled reason:@"The download job was canceled" description:@"Download canceled"];
+                [self sqliteDiscardJob:job withError:canceled];
+                [self sqliteFillDownloadWindow];
             }];
 
         }];
@@ -1102,31 +2844,46 @@
 }
 
 
-- (void)resume
+- (void)resumeJob:(MBXOfflineMapDownloadJob *)job
 {
-    assert(_state == MBXOfflineMapDownloaderStateSuspended);
+    assert(job.state == MBXOfflineMapDownloaderStateSuspended);
 
-    // Resume a previously suspended download job
+    // Resume a previously suspended download job. The screen may have changed since the job was suspended, and this is
+    // the last chance to look at it before the job goes off the main thread.
     //
+    job.contentScaleFactor = [self mainScreenScale];
     [_backgroundWorkQueue addOperationWithBlock:^{
-        _state = MBXOfflineMapDownloaderStateRunning;
-        [self startDownloading];
-        [self notifyDelegateOfStateChange];
+        job.state = MBXOfflineMapDownloaderStateRunning;
+        [self startDownloadingJob:job];
+        [self notifyDelegateOfStateChangeForJob:job];
     }];
 }
 
 
-- (void)suspend
+- (void)suspendJob:(MBXOfflineMapDownloadJob *)job
 {
-    if(_state == MBXOfflineMapDownloaderStateRunning)
+    if(job.state == MBXOfflineMapDownloaderStateRunning)
     {
         // Stop a download job, preserving the necessary state to resume later
         //
         [_backgroundWorkQueue addOperationWithBlock:^{
-            [_sqliteQueue cancelAllOperations];
-            _state = MBXOfflineMapDownloaderStateSuspended;
-            _activeDataSessionTasks = 0;
-            [self notifyDelegateOfStateChange];
+            if(job.state != MBXOfflineMapDownloaderStateRunning)
+            {
+                return;
+            }
+            job.state = MBXOfflineMapDownloaderStateSuspended;
+
+            // Stop the job's requests in flight, and keep whatever has already been downloaded by committing the buffered
+            // writes before letting go of the database. Everything else is still in the download queue for when the job
+            // resumes. Meanwhile, the other running jobs take over its share of the download window.
+            //
+            [_sqliteQueue addOperationWithBlock:^{
+                [self sqliteStopRequestsForJob:job];
+                [self sqliteCommitPendingWritesForJob:job];
+                [job sqliteCloseDatabase];
+                [self sqliteFillDownloadWindow];
+            }];
+            [self notifyDelegateOfStateChangeForJob:job];
         }];
     }
 }
@@ -1136,9 +2893,14 @@
 
 - (NSArray *)offlineMapDatabases
 {
-    // Return an array with offline map database objects representing each of the *complete* map databases on disk
+    // Return an array with offline map database objects representing each of the *complete* map databases on disk. The
+    // array is changed from the sqlite queue when a download completes and from the main thread when a map is removed, so
+    // every access to it goes through the same lock, and everything else works with a snapshot like this one.
     //
-    return [NSArray arrayWithArray:_mutableOfflineMapDatabases];
+    @synchronized(_mutableOfflineMapDatabases)
+    {
+        return [NSArray arrayWithArray:_mutableOfflineMapDatabases];
+    }
 }
 
 
@@ -1156,7 +2918,10 @@
 
     // Remove the offline map object from the array and delete it's backing database
     //
-    [_mutableOfflineMapDatabases removeObject:offlineMapDatabase];
+    @synchronized(_mutableOfflineMapDatabases)
+    {
+        [_mutableOfflineMapDatabases removeObject:offlineMapDatabase];
+    }
 
     NSError *error;
     [[NSFileManager defaultManager] removeItemAtPath:offlineMapDatabase.path error:&error];
@@ -1164,6 +2929,11 @@
     {
         NSLog(@"There was an error while attempting to delete an offline map database: %@", error);
     }
+    unlink([offlineMapDatabase.archivePath fileSystemRepresentation]);
+
+    [_backgroundWorkQueue addOperationWithBlock:^{
+        [self writeCatalog];
+    }];
 }
 
 - (void)removeOfflineMapDatabaseWithID:(NSString *)uniqueID
@@ -0,0 +1,27 @@
+//
+//  MBXRasterTileDecoder.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import CoreGraphics;
+
+/** Returns whether the data starts with the PNG signature.
+*   @param data The image data to check. */
+bool MBXRasterTileDataIsPNG(CFDataRef data);
+
+/** Returns whether the data starts with a JPEG/JFIF signature.
+*   @param data The image data to check. */
+bool MBXRasterTileDataIsJPEG(CFDataRef data);
+
+/** Decodes PNG or JPEG tile image data into bitmaps which are ready to draw into an `MKOverlayRenderer` context without any further decoding, cropping, or flipping.
+*
+*   The image is decoded exactly once, into a bitmap which is flipped vertically to match the coordinate system of `drawMapRect:zoomScale:inContext:`. A 512px tile is then split into the four 256px quadrants that cover its child tiles. The quadrants share the memory of the decoded bitmap rather than copying it.
+*
+*   This only depends on Core Graphics, so it can be used and measured outside of a renderer.
+*
+*   @param data The PNG or JPEG image data of a map tile.
+*   @param cost On return, the number of bytes of bitmap memory used by the returned images. May be `NULL`.
+*   @return An array of `CGImageRef` objects, which the caller is responsible for releasing, or `NULL` if the data couldn't be decoded. A 512px tile yields four images ordered top left, top right, bottom left, bottom right (index `(y % 2) * 2 + (x % 2)` for a child tile at `x`, `y`), and any other tile yields one image. */
+CFArrayRef MBXRasterTileCreateImagesWithData(CFDataRef data, size_t *cost);
@@ -0,0 +1,89 @@
+//
+//  MBXRasterTileDecoder.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXRasterTileDecoder.h"
+
+bool MBXRasterTileDataIsPNG(CFDataRef data) {
+    const UInt8 *b = CFDataGetBytePtr(data);
+    return (CFDataGetLength(data) > 4 && b[0] == 0x89 && b[1] == 0x50 && b[2] == 0x4e && b[3] == 0x47);
+}
+
+bool MBXRasterTileDataIsJPEG(CFDataRef data) {
+    const UInt8 *b = CFDataGetBytePtr(data);
+    return (CFDataGetLength(data) > 4 && b[0] == 0xff && b[1] == 0xd8 && b[2] == 0xff && b[3] == 0xe0);
+}
+
+CFArrayRef MBXRasterTileCreateImagesWithData(CFDataRef data, size_t *cost) {
+    CGDataProviderRef provider = CGDataProviderCreateWithCFData(data);
+    if (!provider) {
+        return NULL;
+    }
+
+    CGImageRef image = NULL;
+    if (MBXRasterTileDataIsPNG(data)) {
+        image = CGImageCreateWithPNGDataProvider(provider, NULL, false, kCGRenderingIntentDefault);
+    } else if (MBXRasterTileDataIsJPEG(data)) {
+        image = CGImageCreateWithJPEGDataProvider(provider, NULL, false, kCGRenderingIntentDefault);
+    }
+    CGDataProviderRelease(provider);
+
+    if (!image) {
+        return NULL;
+    }
+
+    // Decode the image by drawing it upside down into a bitmap in the native pixel format, so drawing the result later is
+    // a plain copy
+    //
+    size_t width = CGImageGetWidth(image);
+    size_t height = CGImageGetHeight(image);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef bitmap = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst);
+    CGColorSpaceRelease(colorSpace);
+
+    if (!bitmap) {
+        CGImageRelease(image);
+        return NULL;
+    }
+
+    CGContextTranslateCTM(bitmap, 0, height);
+    CGContextScaleCTM(bitmap, 1, -1);
+    CGContextDrawImage(bitmap, CGRectMake(0, 0, width, height), image);
+    CGImageRelease(image);
+
+    CGImageRef decoded = CGBitmapContextCreateImage(bitmap);
+    if (cost) {
+        *cost = CGBitmapContextGetBytesPerRow(bitmap) * height;
+    }
+    CGContextRelease(bitmap);
+
+    if (!decoded) {
+        return NULL;
+    }
+
+    // Split 512px tiles into quadrants. Since the bitmap is upside down, the top row of child tiles is in its bottom half.
+    //
+    CFMutableArrayRef images = CFArrayCreateMutable(kCFAllocatorDefault, 4, &kCFTypeArrayCallBacks);
+    if (width == 512 && height == 512) {
+        for (size_t quadrant = 0; quadrant < 4; quadrant++) {
+            CGRect rect = CGRectMake((quadrant % 2 ? 256 : 0), (quadrant / 2 ? 0 : 256), 256, 256);
+            CGImageRef quadrantImage = CGImageCreateWithImageInRect(decoded, rect);
+            if (quadrantImage) {
+                CFArrayAppendValue(images, quadrantImage);
+                CGImageRelease(quadrantImage);
+            }
+        }
+        if (CFArrayGetCount(images) != 4) {
+            CFRelease(images);
+            images = NULL;
+        }
+    } else {
+        CFArrayAppendValue(images, decoded);
+    }
+    CGImageRelease(decoded);
+
+    return images;
+}
@@ -12,6 +12,8 @@
 
 @class MBXRasterTileOverlay;
 @class MBXOfflineMapDatabase;
+@class MBXMarkerIndex;
+@class MBXTileURLTemplate;
 
 #pragma mark - Constants for the MBXMapKit error domain
 
@@ -49,6 +51,21 @@ extern NSInteger const MBXMapKitErrorCodeDictionaryMissingKeys;
 *   @param fullyRendered This parameter is set to `YES` if the overlay was able to render all tiles completely or `NO` if errors prevented all tiles from being rendered. */
 - (void)tileOverlayDidFinishRendering:(MBXRasterTileOverlay *)overlay fullyRendered:(BOOL)fullyRendered;
 
+/** Notifies the delegate that the map has finished rendering all visible tiles, with the number of tiles which loaded and failed. This is called once, on the main thread, after tile loading has stopped for half a second, so a pan or zoom which requests many tiles is reported as a single generation.
+*   @param overlay The raster tile overlay that was rendering its tiles.
+*   @param generation The number of the rendering generation, which starts at `1` and goes up by one with each notification. This is the new value of `renderGeneration`.
+*   @param renderedTileCount The number of tiles which loaded since the previous generation.
+*   @param failedTileCount The number of tiles which could not be loaded since the previous generation. */
+- (void)tileOverlay:(MBXRasterTileOverlay *)overlay didFinishRenderingGeneration:(NSUInteger)generation renderedTileCount:(NSUInteger)renderedTileCount failedTileCount:(NSUInteger)failedTileCount;
+
+/** @name Observing Tile Loading */
+
+/** Notifies the delegate that a map tile was loaded, and where it came from. This is designed to help with checking how much of a map is being served by offline map databases.
+*   @param overlay The raster tile overlay which loaded the tile.
+*   @param path The path of the tile.
+*   @param source Where the tile came from. */
+- (void)tileOverlay:(MBXRasterTileOverlay *)overlay didLoadTileAtPath:(MKTileOverlayPath)path fromSource:(MBXTileSource)source;
+
 @end
 
 
@@ -102,16 +119,34 @@ extern NSInteger const MBXMapKitErrorCodeDictionaryMissingKeys;
 *   @return An initialized raster tile overlay, or `nil` if an overlay could not be initialized. */
 - (instancetype)initWithOfflineMapDatabase:(MBXOfflineMapDatabase *)offlineMapDatabase;
 
+/** Initialize a map view with a given Mapbox map ID, using several offline map databases where they have tiles and falling back to the network where they don't.
+*
+*   The offline map databases may overlap and cover different ranges of zoom levels. Each tile is looked for in the offline map databases which cover it, newest first, then in the shared tile cache, and then on the network. Metadata and markers are likewise taken from the first offline map database which has them. Offline map databases for other map IDs or image qualities are ignored.
+*
+*   @param mapID The Mapbox map ID.
+*   @param offlineMapDatabases An array of `MBXOfflineMapDatabase` objects obtained from `MBXOfflineMapDownloader`.
+*   @param includeMetadata Whether to load the map's metadata including center coordinate and zoom limits
+*   @param includeMarkers Whether to load the map's markers
+*   @param imageQuality The image quality to use for requesting tiles
+*   @return An initialized raster tile overlay, or `nil` if an overlay could not be initialized. */
+- (instancetype)initWithMapID:(NSString *)mapID offlineMapDatabases:(NSArray *)offlineMapDatabases includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality;
+
 /**
  *  Initialize a URL for retrieving custom tiles and tile size handled by the underlying provider
  *
- *  @param urlString Tile server URL
+ *  @param urlString Tile server URL, either as an `MBXTileURLTemplate` template string or as a format string with three `%ld` conversions for the zoom level, column, and row. Templates which use `{s}` need hosts, so use `initWithTileURLTemplate:tileSize:` for those.
  *  @param tileSize  Tile size
  *
  *  @return  An initialized raster tile overlay, or `nil` if an overlay could not be initialized.
  */
 - (instancetype)initWithTileURL:(NSString *)urlString tileSize:(NSInteger)tileSize;
 
+/** Initialize a raster tile overlay for a custom tile server, with tile URLs made from a template. Use a template with several hosts to spread tile requests across the hosts.
+*   @param tileURLTemplate The template for the tile server's URLs.
+*   @param tileSize The size of the tile server's tiles, in pixels.
+*   @return An initialized raster tile overlay, or `nil` if an overlay could not be initialized. */
+- (instancetype)initWithTileURLTemplate:(MBXTileURLTemplate *)tileURLTemplate tileSize:(NSInteger)tileSize;
+
 /** @name Accessing the Delegate */
 
 /** Delegate to notify of asynchronous resource load completion events. */
@@ -142,8 +177,24 @@ extern NSInteger const MBXMapKitErrorCodeDictionaryMissingKeys;
 @property (readonly,nonatomic) NSInteger centerZoom;
 /** The map's array of `MBXPointAnnotation` marker annotations as parsed from the marker JSON. */
 @property (readonly,nonatomic) NSArray *markers;
+/** A spatial index of the map's markers, for maps with too many markers to add them all to a map view at once. Use `-[MBXMarkerIndex annotationsInMapRect:clusteredAtZoomLevel:]` with the map view's visible map rect to find only the markers which need to be shown. This is `nil` until the markers have loaded. */
+@property (readonly,nonatomic) MBXMarkerIndex *markerIndex;
 /** A default plain text attribution message suitable for displaying in an alert dialog. */
 @property (readonly,nonatomic) NSString *attribution;
+/** The offline map databases which this raster tile overlay loads tiles from before falling back to the network, newest first. This is empty unless the overlay was initialized with `initWithMapID:offlineMapDatabases:includeMetadata:includeMarkers:imageQuality:`. */
+@property (readonly,nonatomic) NSArray *offlineMapDatabases;
+/** The template which the overlay's tile URLs are made from. */
+@property (readonly,nonatomic) MBXTileURLTemplate *tileURLTemplate;
+/** The number of times the delegate has been notified that rendering finished. Tiles which are loading now will be reported in generation `renderGeneration + 1`. */
+@property (readonly,nonatomic) NSUInteger renderGeneration;
+
+
+#pragma mark - Measuring main thread use
+
+/** @name Measuring Main Thread Use */
+
+/** The average time, in seconds, which the overlay has spent on the main thread for each tile it has loaded so far. This includes delivering delegate callbacks, and is meant for checking that scrolling stays smooth while tiles, metadata, and markers are loading. */
+@property (readonly,nonatomic) NSTimeInterval mainThreadTimePerTile;
 
 
 #pragma mark - Methods for invalidating cached metadata and markers
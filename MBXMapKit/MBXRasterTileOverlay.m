@@ -6,15 +6,18 @@
 //
 
 #import "MBXMapKit.h"
+#import "MBXRasterTilePrefetcher.h"
 
-typedef NS_ENUM(NSUInteger, MBXRenderCompletionState) {
-    MBXRenderCompletionStateUnknown = 0,
-    MBXRenderCompletionStatePartial = 1,
-    MBXRenderCompletionStateFull = 2
-};
+#import <stdatomic.h>
+
+// How long tile loading has to stay finished before the delegate is told that rendering is complete, so that a burst of
+// loads which briefly runs dry, such as while the map is being panned, is reported once
+//
+static NSTimeInterval const MBXRasterTileOverlayRenderQuietInterval = 0.5;
 
 typedef void (^MBXRasterTileOverlayWorkerBlock)(NSData *data, NSError **error);
 typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error);
+typedef void (^MBXTileFetcherCompletionBlock)(NSData *data, NSURLResponse *response, NSError *error);
 
 #pragma mark - Private API for creating verbose errors
 
@@ -34,6 +37,170 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 @interface MBXOfflineMapDatabase ()
 
 - (NSData *)dataForURL:(NSURL *)url withError:(NSError **)error;
+- (NSData *)dataForPath:(MKTileOverlayPath)path withError:(NSError **)error;
+- (NSArray *)dataForPaths:(NSArray *)paths;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileFetcher
+
+@interface MBXTileFetcher ()
+
+- (id)loadTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (void)cancelLoad:(id)load;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileMetrics
+
+@interface MBXTileMetrics ()
+
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileCoverage
+
+@interface MBXTileCoverage ()
+
+- (BOOL)enumerateTileRangesForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ withError:(NSError **)error usingBlock:(void (^)(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY))block;
+
+@end
+
+
+#pragma mark - Index of the tiles covered by several offline map databases
+
+// Each offline map database covers a rectangle of tiles at each of its zoom levels, or two rectangles if its region
+// crosses the antimeridian. For each zoom level, the index keeps the rectangles sorted by their first column, along with
+// the furthest column reached by that rectangle or any before it. A lookup binary searches for the rectangles which start
+// at or before the tile's column, then walks back only as long as an earlier rectangle could still reach the tile, so it
+// takes O(log n) time plus the number of rectangles which overlap the tile's column.
+//
+typedef struct {
+    NSInteger minX;
+    NSInteger maxX;
+    NSInteger minY;
+    NSInteger maxY;
+    NSInteger reachX;
+    NSUInteger rank;
+} MBXOfflineMapIndexEntry;
+
+static NSInteger const MBXOfflineMapIndexMaximumZ = 30;
+
+static int MBXOfflineMapIndexCompareEntries(const void *a, const void *b)
+{
+    NSInteger xa = ((const MBXOfflineMapIndexEntry *)a)->minX;
+    NSInteger xb = ((const MBXOfflineMapIndexEntry *)b)->minX;
+    return (xa < xb ? -1 : (xa > xb ? 1 : 0));
+}
+
+@interface MBXOfflineMapIndex : NSObject
+
+@property (readonly, nonatomic) NSArray *offlineMapDatabases;
+
+- (instancetype)initWithOfflineMapDatabases:(NSArray *)offlineMapDatabases;
+- (NSArray *)offlineMapDatabasesForPath:(MKTileOverlayPath)path;
+- (NSData *)dataForURL:(NSURL *)url;
+
+@end
+
+@implementation MBXOfflineMapIndex
+{
+    NSArray *_entriesByZoom;
+}
+
+- (instancetype)initWithOfflineMapDatabases:(NSArray *)offlineMapDatabases
+{
+    self = [super init];
+    if (self)
+    {
+        // Newer offline maps are preferred where they overlap, since they have the more recent tiles
+        //
+        _offlineMapDatabases = [offlineMapDatabases sortedArrayUsingComparator:^NSComparisonResult(MBXOfflineMapDatabase *a, MBXOfflineMapDatabase *b) {
+            NSTimeInterval createdA = [a.creationDate timeIntervalSinceReferenceDate];
+            NSTimeInterval createdB = [b.creationDate timeIntervalSinceReferenceDate];
+            return [@(createdB) compare:@(createdA)];
+        }];
+
+        NSMutableArray *entriesByZoom = [[NSMutableArray alloc] init];
+        for (NSInteger z = 0; z <= MBXOfflineMapIndexMaximumZ; z++)
+        {
+            [entriesByZoom addObject:[NSMutableData data]];
+        }
+        [_offlineMapDatabases enumerateObjectsUsingBlock:^(MBXOfflineMapDatabase *database, NSUInteger rank, BOOL *stop) {
+            MBXTileCoverage *coverage = [MBXTileCoverage coverageWithMapRegion:database.mapRegion];
+            NSError *error;
+            BOOL success = [coverage enumerateTileRangesForMinimumZ:database.minimumZ maximumZ:MIN(database.maximumZ, MBXOfflineMapIndexMaximumZ) withError:&error usingBlock:^(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY) {
+                MBXOfflineMapIndexEntry entry = { minX, maxX, minY, maxY, maxX, rank };
+                [entriesByZoom[z] appendBytes:&entry length:sizeof(entry)];
+            }];
+            if (!success) NSLog(@"Unable to index the tiles of offline map database %@: %@", database.uniqueID, error);
+        }];
+
+        for (NSMutableData *data in entriesByZoom)
+        {
+            MBXOfflineMapIndexEntry *entries = data.mutableBytes;
+            NSUInteger count = data.length / sizeof(MBXOfflineMapIndexEntry);
+            qsort(entries, count, sizeof(MBXOfflineMapIndexEntry), MBXOfflineMapIndexCompareEntries);
+            for (NSUInteger i = 1; i < count; i++)
+            {
+                entries[i].reachX = MAX(entries[i].maxX, entries[i - 1].reachX);
+            }
+        }
+        _entriesByZoom = entriesByZoom;
+    }
+    return self;
+}
+
+- (NSArray *)offlineMapDatabasesForPath:(MKTileOverlayPath)path
+{
+    if (path.z < 0 || path.z > MBXOfflineMapIndexMaximumZ) return @[];
+
+    NSData *data = _entriesByZoom[path.z];
+    const MBXOfflineMapIndexEntry *entries = data.bytes;
+    NSUInteger count = data.length / sizeof(MBXOfflineMapIndexEntry);
+
+    // Find the first rectangle which starts after the tile's column
+    //
+    NSUInteger lo = 0;
+    NSUInteger hi = count;
+    while (lo < hi)
+    {
+        NSUInteger mid = lo + (hi - lo) / 2;
+        if (entries[mid].minX <= path.x) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // The ranks are the databases' positions in offlineMapDatabases, so the index set keeps them newest first
+    //
+    NSMutableIndexSet *ranks = [[NSMutableIndexSet alloc] init];
+    for (NSUInteger i = lo; i > 0 && entries[i - 1].reachX >= path.x; i--)
+    {
+        const MBXOfflineMapIndexEntry *entry = &entries[i - 1];
+        if (entry->maxX >= path.x && entry->minY <= path.y && path.y <= entry->maxY)
+        {
+            [ranks addIndex:entry->rank];
+        }
+    }
+    return [_offlineMapDatabases objectsAtIndexes:ranks];
+}
+
+- (NSData *)dataForURL:(NSURL *)url
+{
+    for (MBXOfflineMapDatabase *database in _offlineMapDatabases)
+    {
+        if (database.isInvalid) continue;
+
+        NSData *data = [database dataForURL:url withError:nil];
+        if (data) return data;
+    }
+    return nil;
+}
 
 @end
 
@@ -45,7 +212,6 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 #pragma mark - Private read-write backing properties for custom tile server
 
 @property (nonatomic, strong) NSString* overlayTileURLString;
-@property (nonatomic, assign) NSInteger overlayTileSize;
 
 #pragma mark - Private read-write backing properties for public read-only properties
 
@@ -54,18 +220,16 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 @property (readwrite,nonatomic) CLLocationCoordinate2D center;
 @property (readwrite,nonatomic) NSInteger centerZoom;
 @property (readwrite,nonatomic) NSArray *markers;
+@property (readwrite,nonatomic) MBXMarkerIndex *markerIndex;
 @property (readwrite,nonatomic) NSString *attribution;
-
-#pragma mark - Private properties for rendering completion notification
-
-@property (nonatomic) NSMutableSet *pendingTileRenders;
-@property (nonatomic) MBXRenderCompletionState renderCompletionState;
+@property (readwrite,nonatomic) MBXTileURLTemplate *tileURLTemplate;
 
 #pragma mark - Properties for asynchronous downloading of metadata and markers
 
 @property (nonatomic) NSDictionary *tileJSONDictionary;
 @property (nonatomic) NSDictionary *simplestyleJSONDictionary;
 @property (nonatomic) BOOL sessionHasBeenInvalidated;
+@property (nonatomic) NSHashTable *activeTileLoads;
 @property (nonatomic) NSURL *metadataURL;
 @property (nonatomic) NSURL *markersURL;
 @property (nonatomic) NSMutableArray *mutableMarkers;
@@ -75,6 +239,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 @property (nonatomic) BOOL didFinishLoadingMarkers;
 
 @property (strong, nonatomic) MBXOfflineMapDatabase *offlineMapDatabase;
+@property (strong, nonatomic) MBXOfflineMapIndex *offlineMapIndex;
 
 @property (nonatomic) NSDictionary *metadataForPendingNotification;
 @property (nonatomic) NSError *metadataErrorForPendingNotification;
@@ -82,12 +247,36 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 @property (nonatomic) NSError *markersErrorForPendingNotification;
 @property (nonatomic) BOOL needToNotifyDelegateThatMetadataAndMarkersAreFinished;
 
+#pragma mark - Properties for batching delegate notifications and measuring main thread use
+
+@property (nonatomic) NSMutableArray *pendingDelegateNotifications;
+
 @end
 
 
 #pragma mark - MBXRasterTileOverlay, a subclass of MKTileOverlay
 
 @implementation MBXRasterTileOverlay
+{
+    // Rendering completion is tracked with counters rather than a set of pending URLs, since tile loads start and
+    // finish on many threads, and the same URL can be loading more than once
+    //
+    _Atomic uint64_t _pendingTileRenders;
+    _Atomic uint64_t _startedTileRenders;
+    _Atomic uint64_t _renderedTileCount;
+    _Atomic uint64_t _failedTileCount;
+    _Atomic uint64_t _renderGeneration;
+    atomic_bool _renderNotificationScheduled;
+
+    // Main thread time is added up in nanoseconds, once for every tile that finishes, so it's counted without a lock
+    //
+    _Atomic uint64_t _mainThreadNanoseconds;
+    _Atomic uint64_t _loadedTileCount;
+
+    // The main screen's scale, read once on the main thread, since marker icons are loaded on the overlay's work queue
+    //
+    CGFloat _screenScale;
+}
 
 
 #pragma mark - URL utility funtions
@@ -131,6 +320,45 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     return [NSURLCache sharedURLCache];
 }
 
++ (NSCache *)markerIconCache
+{
+    // Decoded marker icons are shared by all the markers and overlays which use the same icon URL
+    //
+    static NSCache *iconCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        iconCache = [[NSCache alloc] init];
+        iconCache.name = @"MBXRasterTileOverlay marker icons";
+    });
+    return iconCache;
+}
+
++ (NSOperationQueue *)overlayWorkQueue
+{
+    // Metadata, markers, and marker icons for every overlay are loaded and parsed on this serial queue
+    //
+    static NSOperationQueue *workQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        workQueue = [[NSOperationQueue alloc] init];
+        workQueue.maxConcurrentOperationCount = 1;
+        workQueue.name = @"MBXRasterTileOverlay work queue";
+    });
+    return workQueue;
+}
+
++ (NSURLSession *)overlayDataSession
+{
+    static NSURLSession *dataSession;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSURLSessionConfiguration *config = [NSURLSessionConfiguration defaultSessionConfiguration];
+        config.URLCache = [MBXRasterTileOverlay overlayURLCache];
+        dataSession = [NSURLSession sessionWithConfiguration:config delegate:nil delegateQueue:[MBXRasterTileOverlay overlayWorkQueue]];
+    });
+    return dataSession;
+}
+
 + (NSURLRequest *)overlayURLRequestForURL:(NSURL *)requestURL
 {
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:requestURL];
@@ -142,7 +370,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     return request;
 }
 
-+ (NSURL *)markerIconURLForSize:(NSString *)size symbol:(NSString *)symbol color:(NSString *)color
++ (NSURL *)markerIconURLForSize:(NSString *)size symbol:(NSString *)symbol color:(NSString *)color scale:(CGFloat)scale
 {
     // Make a string which follows the MapBox Core API spec for stand-alone markers. This relies on the MapBox API
     // for error checking.
@@ -173,20 +401,61 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 
     [marker appendString:[color stringByReplacingOccurrencesOfString:@"#" withString:@""]];
 
-#if TARGET_OS_IPHONE
-    [marker appendString:([[UIScreen mainScreen] scale] > 1.0 ? @"@2x.png" : @".png")];
-#else
-    // Making this smart enough to handle a Retina MacBook with a normal dpi external display is complicated.
-    // For now, just default to @1x images and a 1.0 scale.
-    //
-    [marker appendString:@".png"];
-#endif
+    [marker appendString:(scale > 1.0 ? @"@2x.png" : @".png")];
 
     return [NSURL URLWithString:[NSString stringWithFormat:@"https://a.tiles.mapbox.com/v4/marker/%@%@", marker,
                                     [@"?access_token=" stringByAppendingString:[MBXMapKit accessToken]]]];
 }
 
 
++ (MBXTileURLTemplate *)tileURLTemplateForMapID:(NSString *)mapID imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    // This is shared with MBXOfflineMapDownloader, so that overlays and offline map downloads request the same URLs
+    //
+    NSString *templateString = [NSString stringWithFormat:@"https://{s}/v4/%@/{z}/{x}/{y}{r}.{q}?access_token={access_token}", mapID];
+
+    return [MBXTileURLTemplate templateWithString:templateString hosts:[MBXMapKit tileHosts] imageQuality:imageQuality];
+}
+
+
++ (NSString *)tileURLTemplateStringForFormatString:(NSString *)formatString
+{
+    // Tile URLs used to be given as format strings with three %ld conversions for the zoom, column, and row, so those
+    // are still accepted and turned into a template. Strings which already have placeholders are left alone.
+    //
+    if ([formatString rangeOfString:@"{"].location != NSNotFound) return formatString;
+
+    NSArray *placeholders = @[ @"{z}", @"{x}", @"{y}" ];
+    NSMutableString *templateString = [NSMutableString string];
+    NSScanner *scanner = [NSScanner scannerWithString:formatString];
+    scanner.charactersToBeSkipped = nil;
+    NSUInteger conversions = 0;
+
+    while ( ! [scanner isAtEnd])
+    {
+        NSString *text;
+        if ([scanner scanUpToString:@"%" intoString:&text]) [templateString appendString:text];
+        if ([scanner isAtEnd]) break;
+
+        if ([scanner scanString:@"%%" intoString:NULL])
+        {
+            [templateString appendString:@"%"];
+        }
+        else if (conversions < [placeholders count] && ([scanner scanString:@"%ld" intoString:NULL] || [scanner scanString:@"%li" intoString:NULL] || [scanner scanString:@"%d" intoString:NULL]))
+        {
+            [templateString appendString:placeholders[conversions++]];
+        }
+        else
+        {
+            [scanner scanString:@"%" intoString:NULL];
+            [templateString appendString:@"%"];
+        }
+    }
+
+    return templateString;
+}
+
+
 #pragma mark - Initialization
 
 - (instancetype)initWithMapID:(NSString *)mapID;
@@ -233,12 +502,66 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     return self;
 }
 
+- (instancetype)initWithMapID:(NSString *)mapID offlineMapDatabases:(NSArray *)offlineMapDatabases includeMetadata:(BOOL)includeMetadata includeMarkers:(BOOL)includeMarkers imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    self = [super init];
+    if (self)
+    {
+        // Only offline maps of the same map and image quality have the right tiles for this overlay. The index has to be
+        // ready before setupMapID starts loading the metadata and markers.
+        //
+        NSMutableArray *matchingDatabases = [[NSMutableArray alloc] init];
+        for (MBXOfflineMapDatabase *database in offlineMapDatabases)
+        {
+            if ([database.mapID isEqualToString:mapID] && database.imageQuality == imageQuality && !database.isInvalid)
+            {
+                [matchingDatabases addObject:database];
+            }
+        }
+        _offlineMapIndex = [[MBXOfflineMapIndex alloc] initWithOfflineMapDatabases:matchingDatabases];
+        [self setupMapID:mapID includeMetadata:includeMetadata includeMarkers:includeMarkers imageQuality:imageQuality];
+    }
+    return self;
+}
+
 - (instancetype)initWithTileURL:(NSString *)urlString tileSize:(NSInteger)tileSize {
+    // A bare URL string has no hosts to go with {s}, so such templates need -initWithTileURLTemplate:tileSize: instead
+    //
+    MBXTileURLTemplate *tileURLTemplate = [MBXTileURLTemplate templateWithString:[MBXRasterTileOverlay tileURLTemplateStringForFormatString:urlString]
+                                                                           hosts:nil
+                                                                    imageQuality:MBXRasterImageQualityFull];
+    if (!tileURLTemplate)
+    {
+        return nil;
+    }
+
     self = [super init];
     if (self)
     {
         self.overlayTileURLString = urlString;
-        self.overlayTileSize = tileSize;
+        self.tileURLTemplate = tileURLTemplate;
+        self.tileSize = CGSizeMake(tileSize, tileSize);
+        self.activeTileLoads = [NSHashTable weakObjectsHashTable];
+        self.pendingDelegateNotifications = [NSMutableArray new];
+    }
+    return self;
+}
+
+- (instancetype)initWithTileURLTemplate:(MBXTileURLTemplate *)tileURLTemplate tileSize:(NSInteger)tileSize
+{
+    if (!tileURLTemplate)
+    {
+        return nil;
+    }
+
+    self = [super init];
+    if (self)
+    {
+        self.overlayTileURLString = tileURLTemplate.templateString;
+        self.tileURLTemplate = tileURLTemplate;
+        self.tileSize = CGSizeMake(tileSize, tileSize);
+        self.activeTileLoads = [NSHashTable weakObjectsHashTable];
+        self.pendingDelegateNotifications = [NSMutableArray new];
     }
     return self;
 }
@@ -249,6 +572,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     //
     _mapID = mapID;
     _imageQuality = imageQuality;
+    _tileURLTemplate = [MBXRasterTileOverlay tileURLTemplateForMapID:mapID imageQuality:imageQuality];
     _metadataURL = [NSURL URLWithString:[NSString stringWithFormat:@"https://a.tiles.mapbox.com/v4/%@.json?secure%@",
                                             _mapID,
                                             [@"&access_token=" stringByAppendingString:[MBXMapKit accessToken]]]];
@@ -258,7 +582,15 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 
     // Use larger tiles if on retina
     //
-    if ([[UIScreen mainScreen] scale] > 1) self.tileSize = CGSizeMake(512, 512);
+#if TARGET_OS_IPHONE
+    _screenScale = [[UIScreen mainScreen] scale];
+#else
+    // Making this smart enough to handle a Retina MacBook with a normal dpi external display is complicated.
+    // For now, just default to @1x images and a 1.0 scale.
+    //
+    _screenScale = 1.0;
+#endif
+    if (_screenScale > 1) self.tileSize = CGSizeMake(512, 512);
 
     // Default to covering up Apple's map
     //
@@ -267,7 +599,8 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     // Default attribution
     self.attribution = @"© Mapbox\n© OpenStreetMap Contributors";
 
-    self.pendingTileRenders = [NSMutableSet new];
+    self.activeTileLoads = [NSHashTable weakObjectsHashTable];
+    self.pendingDelegateNotifications = [NSMutableArray new];
 
     // Initiate asynchronous metadata and marker loading
     //
@@ -296,6 +629,20 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 {
     _delegate = nil;
     _sessionHasBeenInvalidated = YES;
+
+    // Give up on the tiles this overlay is still waiting for. The shared tile fetcher cancels each request once no other
+    // overlay is waiting for it either.
+    //
+    NSArray *loads;
+    @synchronized(_activeTileLoads)
+    {
+        loads = [_activeTileLoads allObjects];
+        [_activeTileLoads removeAllObjects];
+    }
+    for (id load in loads)
+    {
+        [[MBXTileFetcher sharedTileFetcher] cancelLoad:load];
+    }
 }
 
 
@@ -319,50 +666,87 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
         return;
     }
 
-    NSURL *url = nil;
-    if(self.overlayTileURLString == nil) {
-        
-        url = [NSURL URLWithString:[NSString stringWithFormat:@"https://a.tiles.mapbox.com/v4/%@/%ld/%ld/%ld%@.%@%@",
-                                    _mapID,
-                                    (long)path.z,
-                                    (long)path.x,
-                                    (long)path.y,
-                                    (path.contentScaleFactor > 1.0 ? @"@2x" : @""),
-                                    [MBXRasterTileOverlay qualityExtensionForImageQuality:_imageQuality],
-                                    [@"?access_token=" stringByAppendingString:[MBXMapKit accessToken]]
-                                    ]];
-    } else {
-        self.tileSize = CGSizeMake(self.overlayTileSize, self.overlayTileSize);
-        NSString *urlString = [NSString stringWithFormat:self.overlayTileURLString,
-                               (long)path.z,
-                               (long)path.x,
-                               (long)path.y
-                               ];
-        
-        url = [NSURL URLWithString:urlString];
-    }
-
     MBXRasterTileOverlayCompletionBlock completionHandler = ^(NSData *data, NSError *error) {
-        // Invoke the loadTileAtPath's completion handler
+        // Invoke the loadTileAtPath's completion handler on whichever thread the tile was loaded. MapKit and
+        // MBXRasterTileRenderer both accept results on any thread, so there's no need to wait for the main thread.
         //
         if ([NSThread isMainThread])
         {
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
             result(data, error);
+            [self addMainThreadTime:CFAbsoluteTimeGetCurrent() - start tiles:1];
         }
         else
         {
-            dispatch_sync(dispatch_get_main_queue(), ^{
-                result(data, error);
-            });
+            result(data, error);
+            [self addMainThreadTime:0 tiles:1];
         }
+
+        // Every way of loading a tile calls this exactly once, so this is the one place where its render finishes
+        //
+        [self finishTileRenderWithError:error];
     };
 
-    [self setRenderCompletionState:MBXRenderCompletionStateFull
-                  ifCurrentStateIs:MBXRenderCompletionStateUnknown];
+    [self startTileRender];
+
+    if (_offlineMapDatabase)
+    {
+        // Offline map databases store tiles by their zoom, column, and row, so there's no need to build a URL
+        //
+        [self asyncLoadPath:path completionHandler:completionHandler];
+        return;
+    }
+
+    NSURL *url = [self URLForTilePath:path];
+
+    if (_offlineMapIndex)
+    {
+        // Look in the offline map databases which cover the tile first
+        //
+        if ([self loadTileFromOfflineMapDatabasesAtPath:path completionHandler:completionHandler]) return;
+    }
+
+    [self asyncLoadTileURL:url path:path cacheSource:[self networkTileCacheSourceForPath:path] completionHandler:completionHandler];
+}
+
+
+- (NSURL *)URLForTilePath:(MKTileOverlayPath)path
+{
+    // The template was compiled when the overlay was initialized, so this doesn't parse any format strings
+    //
+    return [_tileURLTemplate URLForTilePath:path];
+}
+
+
+- (NSArray *)offlineMapDatabases
+{
+    return (_offlineMapIndex ? _offlineMapIndex.offlineMapDatabases : @[]);
+}
+
+
+- (NSString *)tileCacheSourceForPath:(MKTileOverlayPath)path
+{
+    // Offline maps don't use the cache at all. Tiles which are covered by this overlay's offline map databases aren't
+    // worth prefetching from the network either, since they will most likely be found offline.
+    //
+    if (_offlineMapDatabase) return nil;
 
-    [self addPendingRender:url removePendingRender:nil];
+    if ([[_offlineMapIndex offlineMapDatabasesForPath:path] count] > 0) return nil;
 
-    [self asyncLoadURL:url workerBlock:nil completionHandler:completionHandler];
+    return [self networkTileCacheSourceForPath:path];
+}
+
+
+- (NSString *)networkTileCacheSourceForPath:(MKTileOverlayPath)path
+{
+    // Tiles are cached by map ID and image quality rather than by URL, so the cache doesn't depend on the access token
+    //
+    if (self.overlayTileURLString != nil) return self.overlayTileURLString;
+
+    return [NSString stringWithFormat:@"%@.%@%@",
+            _mapID,
+            [MBXRasterTileOverlay qualityExtensionForImageQuality:_imageQuality],
+            (path.contentScaleFactor > 1.0 ? @"@2x" : @"")];
 }
 
 #pragma mark - Delegate Notifications
@@ -391,53 +775,104 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 
 - (void)notifyDelegateDidLoadMetadata:(NSDictionary *)metadata withError:(NSError *)error
 {
-    if([_delegate respondsToSelector:@selector(tileOverlay:didLoadMetadata:withError:)])
-    {
-        _metadataForPendingNotification = nil;
-        _metadataErrorForPendingNotification = nil;
-        dispatch_async(dispatch_get_main_queue(), ^{
+    [self enqueueDelegateNotification:^{
+        if([_delegate respondsToSelector:@selector(tileOverlay:didLoadMetadata:withError:)])
+        {
+            _metadataForPendingNotification = nil;
+            _metadataErrorForPendingNotification = nil;
             [_delegate tileOverlay:self didLoadMetadata:metadata withError:error];
-        });
-    }
-    else
-    {
-        _metadataForPendingNotification = metadata;
-        _metadataErrorForPendingNotification = error;
-    }
+        }
+        else
+        {
+            _metadataForPendingNotification = metadata;
+            _metadataErrorForPendingNotification = error;
+        }
+    }];
 }
 
 
 - (void)notifyDelegateDidLoadMarkers:(NSArray *)markers withError:(NSError *)error
 {
-    if([_delegate respondsToSelector:@selector(tileOverlay:didLoadMarkers:withError:)])
-    {
-        _markersForPendingNotification = nil;
-        _markersErrorForPendingNotification = nil;
-        dispatch_async(dispatch_get_main_queue(), ^{
+    [self enqueueDelegateNotification:^{
+        if([_delegate respondsToSelector:@selector(tileOverlay:didLoadMarkers:withError:)])
+        {
+            _markersForPendingNotification = nil;
+            _markersErrorForPendingNotification = nil;
             [_delegate tileOverlay:self didLoadMarkers:markers withError:error];
-        });
-    }
-    else
+        }
+        else
+        {
+            _markersForPendingNotification = markers;
+            _markersErrorForPendingNotification = error;
+        }
+    }];
+}
+
+
+- (void)notifyDelegateDidLoadTileAtPath:(MKTileOverlayPath)path fromSource:(MBXTileSource)source
+{
+    if([_delegate respondsToSelector:@selector(tileOverlay:didLoadTileAtPath:fromSource:)])
     {
-        _markersForPendingNotification = markers;
-        _markersErrorForPendingNotification = error;
+        [self enqueueDelegateNotification:^{
+            [_delegate tileOverlay:self didLoadTileAtPath:path fromSource:source];
+        }];
     }
 }
 
 
 - (void)notifyDelegateDidFinishLoadingMetadataAndMarkersForOverlay
 {
-    if([_delegate respondsToSelector:@selector(tileOverlayDidFinishLoadingMetadataAndMarkers:)])
+    [self enqueueDelegateNotification:^{
+        if([_delegate respondsToSelector:@selector(tileOverlayDidFinishLoadingMetadataAndMarkers:)])
+        {
+            _needToNotifyDelegateThatMetadataAndMarkersAreFinished = NO;
+            [_delegate tileOverlayDidFinishLoadingMetadataAndMarkers:self];
+        }
+        else
+        {
+            _needToNotifyDelegateThatMetadataAndMarkersAreFinished = YES;
+        }
+    }];
+}
+
+
+- (void)enqueueDelegateNotification:(dispatch_block_t)notification
+{
+    // Notifications are collected from whichever threads they happen on and delivered on the main thread in batches, so
+    // a burst of them (like a screenful of tiles) costs a single trip to the main thread rather than one each. They are
+    // also what keeps the saved notifications for setDelegate: on the main thread.
+    //
+    BOOL needsDelivery;
+    @synchronized(_pendingDelegateNotifications)
+    {
+        needsDelivery = ([_pendingDelegateNotifications count] == 0);
+        [_pendingDelegateNotifications addObject:[notification copy]];
+    }
+    if (needsDelivery)
     {
-        _needToNotifyDelegateThatMetadataAndMarkersAreFinished = NO;
         dispatch_async(dispatch_get_main_queue(), ^{
-            [_delegate tileOverlayDidFinishLoadingMetadataAndMarkers:self];
+            [self deliverDelegateNotifications];
         });
     }
-    else
+}
+
+
+- (void)deliverDelegateNotifications
+{
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+
+    NSArray *notifications;
+    @synchronized(_pendingDelegateNotifications)
+    {
+        notifications = [_pendingDelegateNotifications copy];
+        [_pendingDelegateNotifications removeAllObjects];
+    }
+    for (dispatch_block_t notification in notifications)
     {
-        _needToNotifyDelegateThatMetadataAndMarkersAreFinished = YES;
+        notification();
     }
+
+    [self addMainThreadTime:CFAbsoluteTimeGetCurrent() - start tiles:0];
 }
 
 
@@ -451,6 +886,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     MBXRasterTileOverlayWorkerBlock workerBlock = ^(NSData *data, NSError **error) {
         id markers;
         id value;
+        NSMutableDictionary *pointsForMarkerIconURL = [NSMutableDictionary new];
         NSDictionary *simplestyleJSONDictionary = [NSJSONSerialization JSONObjectWithData:data options:0 error:error];
         if(!*error)
         {
@@ -481,17 +917,21 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 
                             if (longitude && latitude && size && color && symbol)
                             {
-                                // Keep track of how many marker icons are submitted to the download queue
-                                //
-                                _activeMarkerIconRequests += 1;
-
                                 MBXPointAnnotation *point = [MBXPointAnnotation new];
                                 point.title      = title;
                                 point.subtitle   = description;
                                 point.coordinate = CLLocationCoordinate2DMake([latitude doubleValue], [longitude doubleValue]);
 
-                                NSURL *markerURL = [MBXRasterTileOverlay markerIconURLForSize:size symbol:symbol color:color];
-                                [self asyncLoadMarkerIconURL:(NSURL *)markerURL point:point];
+                                // Group the markers by icon URL, since many markers usually share a few icons
+                                //
+                                NSURL *markerURL = [MBXRasterTileOverlay markerIconURLForSize:size symbol:symbol color:color scale:_screenScale];
+                                NSMutableArray *points = pointsForMarkerIconURL[markerURL];
+                                if (!points)
+                                {
+                                    points = [NSMutableArray new];
+                                    pointsForMarkerIconURL[markerURL] = points;
+                                }
+                                [points addObject:point];
                             }
                             else
                             {
@@ -503,6 +943,28 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
                 }
             }
         }
+
+        // Load each distinct marker icon only once, and skip the ones which have already been decoded
+        //
+        [pointsForMarkerIconURL enumerateKeysAndObjectsUsingBlock:^(NSURL *markerURL, NSArray *points, BOOL *stop) {
+#if TARGET_OS_IPHONE
+            UIImage *image = [[MBXRasterTileOverlay markerIconCache] objectForKey:markerURL];
+#else
+            NSImage *image = [[MBXRasterTileOverlay markerIconCache] objectForKey:markerURL];
+#endif
+            if (image)
+            {
+                for (MBXPointAnnotation *point in points) point.image = image;
+                [_mutableMarkers addObjectsFromArray:points];
+            }
+            else
+            {
+                // Keep track of how many marker icons are submitted to the download queue
+                //
+                _activeMarkerIconRequests += 1;
+                [self asyncLoadMarkerIconURL:markerURL points:points];
+            }
+        }];
     };
 
     // This block runs at the end of all error handling and data processing associated with the URL
@@ -531,6 +993,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
                 // Handle the case where all the marker icons URLs finished loading before the markers.geojson/features.json finished parsing
                 //
                 _markers = [NSArray arrayWithArray:_mutableMarkers];
+                [self publishMarkerIndex:[[MBXMarkerIndex alloc] initWithAnnotations:_markers]];
                 [self notifyDelegateDidLoadMarkers:_markers withError:error];
 
                 _didFinishLoadingMarkers = YES;
@@ -552,21 +1015,36 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
 }
 
 
-- (void)asyncLoadMarkerIconURL:(NSURL *)url point:(MBXPointAnnotation *)point
+- (void)publishMarkerIndex:(MBXMarkerIndex *)markerIndex
+{
+    // The index is built on the overlay work queue, but markerIndex is read on the main thread, so it's set there. Going
+    // through the delegate notifications means it's already set when the delegate hears that the markers have loaded.
+    //
+    [self enqueueDelegateNotification:^{
+        self.markerIndex = markerIndex;
+    }];
+}
+
+
+- (void)asyncLoadMarkerIconURL:(NSURL *)url points:(NSArray *)points
 {
     // This block is run only if data for the URL is successfully retrieved
     //
     MBXRasterTileOverlayWorkerBlock workerBlock = ^(NSData *data, NSError **error) {
+        // Decode the icon once and share the image among all the markers which use it
+        //
 #if TARGET_OS_IPHONE
-        point.image = [[UIImage alloc] initWithData:data scale:[[UIScreen mainScreen] scale]];
+        UIImage *image = [[UIImage alloc] initWithData:data scale:_screenScale];
 #else
-        point.image = [[NSImage alloc] initWithData:data];
+        NSImage *image = [[NSImage alloc] initWithData:data];
 #endif
+        if (image) [[MBXRasterTileOverlay markerIconCache] setObject:image forKey:url];
 
-        // Add the annotation for this marker icon to the collection of point annotations
+        // Add the annotations for this marker icon to the collection of point annotations
         // and update the count of marker icons in the download queue
         //
-        [_mutableMarkers addObject:point];
+        for (MBXPointAnnotation *point in points) point.image = image;
+        [_mutableMarkers addObjectsFromArray:points];
         _activeMarkerIconRequests -= 1;
     };
 
@@ -576,6 +1054,7 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
         if(_markerIconLoaderMayInitiateDelegateCallback && _activeMarkerIconRequests <= 0)
         {
             _markers = [NSArray arrayWithArray:_mutableMarkers];
+            [self publishMarkerIndex:[[MBXMarkerIndex alloc] initWithAnnotations:_markers]];
             [self notifyDelegateDidLoadMarkers:_markers withError:error];
 
             _didFinishLoadingMarkers = YES;
@@ -640,102 +1119,332 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     // 2. Provide a single configuration point where it is possible to set breakpoints and adjust the caching policy for all HTTP requests
     // 3. Provide a hook point for implementing alternate methods (i.e. offline map database) of fetching data for a URL
     //
+    // The worker and completion blocks always run on the overlay work queue, whichever way the data is fetched, so the
+    // JSON parsing they do stays off the main thread, and they never run at the same time as each other.
+    //
+    [[MBXRasterTileOverlay overlayWorkQueue] addOperationWithBlock:^{
+        NSData *offlineData = [_offlineMapIndex dataForURL:url];
 
-    if (_offlineMapDatabase)
+        if (_offlineMapDatabase)
+        {
+            // If this assert fails, it's probably because MBXOfflineMapDownloader's removeOfflineMapDatabase: method has been invoked
+            // for this offline map database object while the database is still associated with a map overlay. That's a serious logic
+            // error which should be checked for and avoided.
+            //
+            assert(_offlineMapDatabase.isInvalid == NO);
+
+            // If an offline map database is configured for this overlay, use the database to fetch data for URLs
+            //
+            NSError *error;
+            NSData *data = [_offlineMapDatabase dataForURL:url withError:&error];
+            if(!error)
+            {
+                // Since the URL was successfully retrieved, invoke the block to process its data
+                //
+                if (workerBlock) workerBlock(data, &error);
+            }
+            completionHandler(data,error);
+        }
+        else if (offlineData)
+        {
+            // The metadata, markers, or marker icon was found in one of the overlay's offline map databases
+            //
+            NSError *error;
+            if (workerBlock) workerBlock(offlineData, &error);
+            completionHandler(offlineData, error);
+        }
+        else
+        {
+            // In the normal case, use HTTP network requests to fetch data for URLs. The session delivers its completion
+            // handlers on the overlay work queue.
+            //
+            MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+            uint64_t fetchStartTime = [metrics startTime];
+
+            NSURLSessionDataTask *task;
+            task = [[MBXRasterTileOverlay overlayDataSession] dataTaskWithRequest:[[self class] overlayURLRequestForURL:url]
+                                                                completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
+            {
+                [metrics recordStage:MBXTileMetricsStageResourceFetch startTime:fetchStartTime];
+                if (fetchStartTime)
+                {
+                    if (error) [metrics addValue:1 toCounter:MBXTileMetricsCounterFetchErrors];
+                    else [metrics addValue:data.length toCounter:MBXTileMetricsCounterBytesReceived];
+                }
+
+                NSError *outError = nil;
+
+                if (!error)
+                {
+                    if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200)
+                    {
+                        outError = [self statusErrorFromHTTPResponse:response];
+                    }
+                    else
+                    {
+                        // Since the URL was successfully retrieved, invoke the block to process its data
+                        //
+                        if (workerBlock) workerBlock(data, &outError);
+                    }
+                }
+                else
+                {
+                    outError = [error copy];
+                }
+
+                completionHandler(data, outError);
+            }];
+            [task resume];
+        }
+    }];
+}
+
+- (void)asyncLoadTileURL:(NSURL *)url path:(MKTileOverlayPath)path cacheSource:(NSString *)cacheSource completionHandler:(MBXRasterTileOverlayCompletionBlock)completionHandler
+{
+    // Tiles go through the shared tile fetcher rather than NSURLConnection and NSURLCache. It looks in the shared tile cache
+    // first, and it shares one request among all the overlays and renderers waiting for the same tile.
+    //
+    id load = [[MBXTileFetcher sharedTileFetcher] loadTileWithURL:url source:cacheSource path:path completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
     {
-        // If this assert fails, it's probably because MBXOfflineMapDownloader's removeOfflineMapDatabase: method has been invoked
-        // for this offline map database object while the database is still associated with a map overlay. That's a serious logic
-        // error which should be checked for and avoided.
-        //
-        assert(_offlineMapDatabase.isInvalid == NO);
+        NSError *outError = nil;
 
-        // If an offline map database is configured for this overlay, use the database to fetch data for URLs
-        //
-        NSError *error;
-        NSData *data = [_offlineMapDatabase dataForURL:url withError:&error];
-        if(!error)
+        if (!error)
+        {
+            if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200)
+            {
+                outError = [self statusErrorFromHTTPResponse:response];
+            }
+        }
+        else
+        {
+            outError = [error copy];
+        }
+
+        completionHandler(data, outError);
+
+        if (!outError && data)
         {
-            // Since the URL was successfully retrieved, invoke the block to process its data
+            // Tiles which came from the shared tile cache don't have a response
             //
-            if (workerBlock) workerBlock(data, &error);
+            [self notifyDelegateDidLoadTileAtPath:path fromSource:(response ? MBXTileSourceNetwork : MBXTileSourceTileCache)];
         }
-        completionHandler(data,error);
+    }];
+
+    // The table only holds loads weakly, so finished loads drop out of it on their own once the fetcher lets go of them
+    //
+    @synchronized(_activeTileLoads)
+    {
+        [_activeTileLoads addObject:load];
+    }
+}
+
+- (void)asyncLoadPath:(MKTileOverlayPath)path completionHandler:(MBXRasterTileOverlayCompletionBlock)completionHandler
+{
+    // If this assert fails, it's probably because MBXOfflineMapDownloader's removeOfflineMapDatabase: method has been invoked
+    // for this offline map database object while the database is still associated with a map overlay.
+    //
+    assert(_offlineMapDatabase.isInvalid == NO);
+
+    NSError *error;
+    NSData *data = [_offlineMapDatabase dataForPath:path withError:&error];
+    completionHandler(data, error);
+
+    if (!error)
+    {
+        [self notifyDelegateDidLoadTileAtPath:path fromSource:MBXTileSourceOfflineMapDatabase];
+    }
+}
 
-        if (error)
+- (BOOL)loadTileFromOfflineMapDatabasesAtPath:(MKTileOverlayPath)path completionHandler:(MBXRasterTileOverlayCompletionBlock)completionHandler
+{
+    // Try each offline map database which covers the tile, newest first. A database whose region covers the tile might
+    // still not have it, for instance if it was downloaded for a polygon rather than a whole region, so a miss just moves
+    // on to the next one.
+    //
+    for (MBXOfflineMapDatabase *database in [_offlineMapIndex offlineMapDatabasesForPath:path])
+    {
+        if (database.isInvalid) continue;
+
+        NSData *data = [database dataForPath:path withError:nil];
+        if (data)
         {
-            [self setRenderCompletionState:MBXRenderCompletionStatePartial
-                          ifCurrentStateIs:MBXRenderCompletionStateFull];
+            completionHandler(data, nil);
+            [self notifyDelegateDidLoadTileAtPath:path fromSource:MBXTileSourceOfflineMapDatabase];
+            return YES;
         }
+    }
+    return NO;
+}
 
-        [self addPendingRender:nil removePendingRender:url];
+- (NSDictionary *)offlineDataForPaths:(NSArray *)paths
+{
+    // Look up a batch of tiles, like the ones around a viewport, with one pass over each offline map database instead of
+    // one lookup per tile. The paths are NSValues holding MKTileOverlayPaths, and the result maps the tile key of each
+    // tile which was found to its data.
+    //
+    NSMutableDictionary *dataForKeys = [NSMutableDictionary dictionary];
+    if (_offlineMapDatabase)
+    {
+        if (_offlineMapDatabase.isInvalid) return dataForKeys;
+
+        NSArray *results = [_offlineMapDatabase dataForPaths:paths];
+        [results enumerateObjectsUsingBlock:^(id data, NSUInteger i, BOOL *stop) {
+            if (data == [NSNull null]) return;
+
+            MKTileOverlayPath path;
+            [(NSValue *)paths[i] getValue:&path];
+            dataForKeys[@(MBXRasterTileKeyForPath(path))] = data;
+        }];
+        return dataForKeys;
     }
-    else
+
+    // With several offline map databases, each tile comes from the newest one which has it, as in
+    // loadTileFromOfflineMapDatabasesAtPath:completionHandler:. Each round asks every database for the tiles it's next in
+    // line for, so a database is only visited once per round however many tiles it's asked for.
+    //
+    NSMutableArray *remaining = [NSMutableArray array];
+    for (NSValue *value in paths)
     {
-        // In the normal case, use HTTP network requests to fetch data for URLs
-        //
-        [NSURLConnection sendAsynchronousRequest:[[self class] overlayURLRequestForURL:url]
-                                           queue:[NSOperationQueue mainQueue]
-                               completionHandler:^(NSURLResponse *response, NSData *data, NSError *error)
-                               {
-                                   NSError *outError = nil;
-
-                                   if (!error)
-                                   {
-                                       if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200)
-                                       {
-                                           outError = [self statusErrorFromHTTPResponse:response];
-                                       }
-                                       else
-                                       {
-                                           // Since the URL was successfully retrieved, invoke the block to process its data
-                                           //
-                                           if (workerBlock) workerBlock(data, &outError);
-                                       }
-                                   }
-                                   else
-                                   {
-                                       outError = [error copy];
-                                   }
-
-                                   completionHandler(data, outError);
-
-                                   if (outError)
-                                   {
-                                       [self setRenderCompletionState:MBXRenderCompletionStatePartial
-                                                     ifCurrentStateIs:MBXRenderCompletionStateFull];
-                                   }
-
-                                   [self addPendingRender:nil removePendingRender:url];
-                               }];
-    }
-}
-
-- (void)addPendingRender:(NSURL *)addURL removePendingRender:(NSURL *)removeURL
-{
-    dispatch_async(dispatch_get_main_queue(), ^{
-        if (addURL) [self.pendingTileRenders addObject:addURL];
-
-        if ([self.pendingTileRenders containsObject:removeURL]) [self.pendingTileRenders removeObject:removeURL];
-
-        if ([self.pendingTileRenders count] == 0)
+        MKTileOverlayPath path;
+        [value getValue:&path];
+        NSArray *databases = [_offlineMapIndex offlineMapDatabasesForPath:path];
+        if ([databases count] > 0) [remaining addObject:@[ value, databases ]];
+    }
+
+    for (NSUInteger round = 0; [remaining count] > 0; round++)
+    {
+        NSMapTable *batches = [NSMapTable strongToStrongObjectsMapTable];
+        NSMutableArray *next = [NSMutableArray array];
+        for (NSArray *entry in remaining)
         {
-            [NSObject cancelPreviousPerformRequestsWithTarget:self];
+            NSArray *databases = entry[1];
+            if (round >= [databases count]) continue;
 
-            [self performSelector:@selector(notifyRenderDelegateWithSuccess:)
-                       withObject:@(self.renderCompletionState == MBXRenderCompletionStateFull)
-                       afterDelay:0.5];
+            MBXOfflineMapDatabase *database = databases[round];
+            if (database.isInvalid)
+            {
+                [next addObject:entry];
+                continue;
+            }
+
+            NSMutableArray *batch = [batches objectForKey:database];
+            if (!batch)
+            {
+                batch = [NSMutableArray array];
+                [batches setObject:batch forKey:database];
+            }
+            [batch addObject:entry];
         }
+
+        for (MBXOfflineMapDatabase *database in batches)
+        {
+            NSArray *batch = [batches objectForKey:database];
+            NSMutableArray *batchPaths = [NSMutableArray arrayWithCapacity:[batch count]];
+            for (NSArray *entry in batch) [batchPaths addObject:entry[0]];
+
+            NSArray *results = [database dataForPaths:batchPaths];
+            [results enumerateObjectsUsingBlock:^(id data, NSUInteger i, BOOL *stop) {
+                if (data == [NSNull null])
+                {
+                    [next addObject:batch[i]];
+                    return;
+                }
+
+                MKTileOverlayPath path;
+                [(NSValue *)batch[i][0] getValue:&path];
+                dataForKeys[@(MBXRasterTileKeyForPath(path))] = data;
+            }];
+        }
+        remaining = next;
+    }
+
+    return dataForKeys;
+}
+
+#pragma mark - Tracking rendering completion
+
+- (void)startTileRender
+{
+    atomic_fetch_add_explicit(&_startedTileRenders, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_pendingTileRenders, 1, memory_order_acq_rel);
+}
+
+- (void)finishTileRenderWithError:(NSError *)error
+{
+    atomic_fetch_add_explicit((error ? &_failedTileCount : &_renderedTileCount), 1, memory_order_relaxed);
+
+    // Whichever load finishes last schedules the notification
+    //
+    if (atomic_fetch_sub_explicit(&_pendingTileRenders, 1, memory_order_acq_rel) == 1)
+    {
+        [self scheduleRenderNotification];
+    }
+}
+
+- (void)scheduleRenderNotification
+{
+    // At most one notification is scheduled at a time, no matter how many times loading runs dry before it's delivered
+    //
+    bool expected = false;
+    if ( ! atomic_compare_exchange_strong(&_renderNotificationScheduled, &expected, true)) return;
+
+    uint64_t started = atomic_load_explicit(&_startedTileRenders, memory_order_relaxed);
+    __weak MBXRasterTileOverlay *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MBXRasterTileOverlayRenderQuietInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [weakSelf deliverRenderNotificationIfQuietSince:started];
     });
 }
 
-- (void)notifyRenderDelegateWithSuccess:(NSNumber *)flag
+- (void)deliverRenderNotificationIfQuietSince:(uint64_t)started
 {
-    if (self.delegate && [self.delegate respondsToSelector:@selector(tileOverlayDidFinishRendering:fullyRendered:)])
+    atomic_store(&_renderNotificationScheduled, false);
+
+    // If loads are still running, the last of them to finish will schedule another notification. If some started and
+    // finished in the meantime, loading hasn't been quiet for long enough yet, so wait again.
+    //
+    if (atomic_load(&_pendingTileRenders) > 0) return;
+
+    if (atomic_load(&_startedTileRenders) != started)
+    {
+        [self scheduleRenderNotification];
+        return;
+    }
+
+    NSUInteger renderedTileCount = (NSUInteger)atomic_exchange(&_renderedTileCount, 0);
+    NSUInteger failedTileCount = (NSUInteger)atomic_exchange(&_failedTileCount, 0);
+    if (renderedTileCount + failedTileCount == 0) return;
+
+    NSUInteger generation = (NSUInteger)atomic_fetch_add(&_renderGeneration, 1) + 1;
+
+    if ([self.delegate respondsToSelector:@selector(tileOverlay:didFinishRenderingGeneration:renderedTileCount:failedTileCount:)])
     {
-        [self.delegate tileOverlayDidFinishRendering:self fullyRendered:[flag boolValue]];
+        [self.delegate tileOverlay:self didFinishRenderingGeneration:generation renderedTileCount:renderedTileCount failedTileCount:failedTileCount];
     }
 
-    [self setRenderCompletionState:MBXRenderCompletionStateUnknown];
+    if ([self.delegate respondsToSelector:@selector(tileOverlayDidFinishRendering:fullyRendered:)])
+    {
+        [self.delegate tileOverlayDidFinishRendering:self fullyRendered:(failedTileCount == 0)];
+    }
+}
+
+- (NSUInteger)renderGeneration
+{
+    return (NSUInteger)atomic_load(&_renderGeneration);
+}
+
+#pragma mark - Measuring main thread use
+
+- (void)addMainThreadTime:(NSTimeInterval)time tiles:(NSUInteger)tiles
+{
+    if (time > 0) atomic_fetch_add_explicit(&_mainThreadNanoseconds, (uint64_t)(time * NSEC_PER_SEC), memory_order_relaxed);
+    if (tiles > 0) atomic_fetch_add_explicit(&_loadedTileCount, tiles, memory_order_relaxed);
+}
+
+- (NSTimeInterval)mainThreadTimePerTile
+{
+    uint64_t loadedTileCount = atomic_load_explicit(&_loadedTileCount, memory_order_relaxed);
+    uint64_t nanoseconds = atomic_load_explicit(&_mainThreadNanoseconds, memory_order_relaxed);
+    return (loadedTileCount > 0 ? (NSTimeInterval)nanoseconds / NSEC_PER_SEC / loadedTileCount : 0.0);
 }
 
 #pragma mark - Helper methods
@@ -759,32 +1468,6 @@ typedef void (^MBXRasterTileOverlayCompletionBlock)(NSData *data, NSError *error
     return [NSError mbx_errorWithCode:MBXMapKitErrorCodeDictionaryMissingKeys reason:reason description:@"Dictionary missing keys error"];
 }
 
-- (void)setRenderCompletionState:(MBXRenderCompletionState)newState
-{
-    if ( ! [NSThread mainThread]) {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            _renderCompletionState = newState;
-        });
-    } else {
-        _renderCompletionState = newState;
-    }
-}
-
-- (void)setRenderCompletionState:(MBXRenderCompletionState)newState ifCurrentStateIs:(MBXRenderCompletionState)checkState
-{
-    if ( ! [NSThread isMainThread]) {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            if (_renderCompletionState == checkState) {
-                _renderCompletionState = newState;
-            }
-        });
-    } else {
-        if (_renderCompletionState == checkState) {
-            _renderCompletionState = newState;
-        }
-    }
-}
-
 #pragma mark - Methods for clearing cached metadata and markers
 
 - (void)clearCachedMetadata
@@ -0,0 +1,75 @@
+//
+//  MBXRasterTilePrefetcher.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import MapKit;
+
+// Tiles are identified by a 64 bit key which packs the zoom level (6 bits) with x and y (29 bits each), so looking up a
+// tile doesn't involve any string formatting or parsing.
+//
+static inline uint64_t MBXRasterTileKeyForPath(MKTileOverlayPath path) {
+    return ((uint64_t)path.z << 58) | (((uint64_t)path.x & 0x1fffffff) << 29) | ((uint64_t)path.y & 0x1fffffff);
+}
+
+/** Starts loading a tile for the prefetcher, and returns an object which can be passed to `cancelLoad` to cancel it, or `nil` if the tile can't be prefetched. The completion handler is called with the tile's data if it was downloaded, or with `nil` if it was already cached or couldn't be loaded. */
+typedef id (^MBXRasterTilePrefetchLoadBlock)(MKTileOverlayPath path, void (^completionHandler)(NSData *data));
+
+/** Cancels a load started by an `MBXRasterTilePrefetchLoadBlock`. */
+typedef void (^MBXRasterTilePrefetchCancelBlock)(id load);
+
+/** Loads a batch of tiles at once, before any of them are loaded one at a time, for tiles which don't need to be downloaded, such as tiles in offline map databases. It's called on the prefetcher's own queue and returns when it's done. The paths are `NSValue` objects holding `MKTileOverlayPath`s, and the block returns a dictionary from the tile key of each tile it loaded to the tile's size in bytes. */
+typedef NSDictionary *(^MBXRasterTilePrefetchBatchLoadBlock)(NSArray *paths);
+
+/** Returns whether visible tiles are being loaded, in which case the prefetcher holds off. */
+typedef BOOL (^MBXRasterTilePrefetchBusyBlock)(void);
+
+/** `MBXRasterTilePrefetcher` predicts which tiles a renderer is about to draw and loads them ahead of time.
+*
+*   The renderer reports each tile it's asked to draw. The prefetcher gathers those tiles into the visible map rect, and from successive visible map rects it works out how the map is moving. It then loads the tiles the map is moving toward, the tiles one zoom level out, and the tiles one zoom level in around the center.
+*
+*   Prefetches only start while no visible tiles are loading, a few at a time, and they stop while the bytes prefetched but not yet drawn exceed a budget. When a new prediction no longer includes a tile which is still loading, that load is canceled. */
+@interface MBXRasterTilePrefetcher : NSObject
+
+/** Initializes a prefetcher.
+*   @param load The block which starts loading a tile.
+*   @param cancel The block which cancels a load.
+*   @param busy The block which reports whether visible tiles are loading. */
+- (instancetype)initWithLoadBlock:(MBXRasterTilePrefetchLoadBlock)load cancelBlock:(MBXRasterTilePrefetchCancelBlock)cancel busyBlock:(MBXRasterTilePrefetchBusyBlock)busy;
+
+/** The block which loads a batch of tiles at once, or `nil` if every tile is loaded on its own. Set this before enabling the prefetcher. */
+@property (copy, nonatomic) MBXRasterTilePrefetchBatchLoadBlock batchLoadBlock;
+
+/** Whether the prefetcher loads tiles. Setting this to `NO` cancels any prefetches in progress. The default value is `NO`. */
+@property (nonatomic) BOOL enabled;
+
+/** The zoom levels outside of which no tiles are prefetched. */
+@property (nonatomic) NSInteger minimumZ;
+@property (nonatomic) NSInteger maximumZ;
+
+/** The number of prefetches which may be loading at once. The default value is `2`. */
+@property (nonatomic) NSUInteger maximumConcurrentPrefetches;
+
+/** The number of bytes of prefetched tiles which may be waiting to be drawn before prefetching stops. The default value is 2 MB. */
+@property (nonatomic) NSUInteger byteBudget;
+
+/** The number of tiles which were downloaded by prefetching. */
+@property (readonly, nonatomic) NSUInteger prefetchCount;
+
+/** The number of prefetched tiles which were later drawn. */
+@property (readonly, nonatomic) NSUInteger hitCount;
+
+/** The number of prefetches which were canceled because the map didn't move the way it was predicted to. */
+@property (readonly, nonatomic) NSUInteger canceledCount;
+
+/** Notes that a tile is being drawn.
+*   @param mapRect The map rect covered by the tile.
+*   @param path The path by which the tile is loaded. */
+- (void)noteVisibleTileRect:(MKMapRect)mapRect path:(MKTileOverlayPath)path;
+
+/** Cancels all prefetches in progress. */
+- (void)cancelAll;
+
+@end
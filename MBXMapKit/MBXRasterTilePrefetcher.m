@@ -0,0 +1,343 @@
+//
+//  MBXRasterTilePrefetcher.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXRasterTilePrefetcher.h"
+
+#import <stdatomic.h>
+
+// The tiles a renderer is asked to draw within this interval make up one visible map rect
+//
+static NSTimeInterval const MBXRasterTilePrefetcherSampleInterval = 0.15;
+
+// Successive visible map rects further apart than this don't give a usable velocity
+//
+static NSTimeInterval const MBXRasterTilePrefetcherMaximumSampleGap = 1.0;
+
+// How far ahead, in seconds of the current velocity, to prefetch tiles
+//
+static NSTimeInterval const MBXRasterTilePrefetcherLookahead = 0.75;
+
+// While visible tiles are loading, check back this often to see whether prefetching can continue
+//
+static NSTimeInterval const MBXRasterTilePrefetcherBusyRetryInterval = 0.1;
+
+static NSUInteger const MBXRasterTilePrefetcherMaximumPredictedTiles = 48;
+static NSUInteger const MBXRasterTilePrefetcherDefaultMaximumConcurrentPrefetches = 2;
+static NSUInteger const MBXRasterTilePrefetcherDefaultByteBudget = 2 * 1024 * 1024;
+
+@implementation MBXRasterTilePrefetcher {
+    MBXRasterTilePrefetchLoadBlock _load;
+    MBXRasterTilePrefetchCancelBlock _cancel;
+    MBXRasterTilePrefetchBusyBlock _busy;
+    dispatch_queue_t _queue;
+
+    // Everything from here down is only touched on _queue
+    MKMapRect _sampleRect;
+    NSInteger _sampleZoom;
+    CGFloat _sampleScale;
+    BOOL _sampleScheduled;
+    MKMapRect _lastVisibleRect;
+    NSInteger _lastVisibleZoom;
+    CFAbsoluteTime _lastVisibleTime;
+
+    NSMutableArray *_pending;
+    NSMutableDictionary *_inFlight;
+    NSMutableDictionary *_prefetched;
+    NSUInteger _prefetchedBytes;
+    BOOL _retryScheduled;
+
+    _Atomic uint64_t _prefetches;
+    _Atomic uint64_t _hits;
+    _Atomic uint64_t _canceled;
+}
+
+- (instancetype)initWithLoadBlock:(MBXRasterTilePrefetchLoadBlock)load cancelBlock:(MBXRasterTilePrefetchCancelBlock)cancel busyBlock:(MBXRasterTilePrefetchBusyBlock)busy {
+    self = [super init];
+
+    if (self) {
+        _load = [load copy];
+        _cancel = [cancel copy];
+        _busy = [busy copy];
+        _queue = dispatch_queue_create("com.mapbox.MBXRasterTilePrefetcher", DISPATCH_QUEUE_SERIAL);
+
+        _enabled = NO;
+        _minimumZ = 0;
+        _maximumZ = 21;
+        _maximumConcurrentPrefetches = MBXRasterTilePrefetcherDefaultMaximumConcurrentPrefetches;
+        _byteBudget = MBXRasterTilePrefetcherDefaultByteBudget;
+
+        _sampleRect = MKMapRectNull;
+        _lastVisibleRect = MKMapRectNull;
+        _pending = [NSMutableArray array];
+        _inFlight = [NSMutableDictionary dictionary];
+        _prefetched = [NSMutableDictionary dictionary];
+    }
+
+    return self;
+}
+
+#pragma mark - Settings and statistics
+
+- (void)setEnabled:(BOOL)enabled {
+    _enabled = enabled;
+    if (!enabled) {
+        [self cancelAll];
+    }
+}
+
+- (NSUInteger)prefetchCount {
+    return (NSUInteger)atomic_load(&_prefetches);
+}
+
+- (NSUInteger)hitCount {
+    return (NSUInteger)atomic_load(&_hits);
+}
+
+- (NSUInteger)canceledCount {
+    return (NSUInteger)atomic_load(&_canceled);
+}
+
+#pragma mark - Tracking the visible map rect
+
+- (void)noteVisibleTileRect:(MKMapRect)mapRect path:(MKTileOverlayPath)path {
+    dispatch_async(_queue, ^{
+        // A prefetched tile which is now being drawn is a hit, and no longer counts against the byte budget
+        NSNumber *key = @(MBXRasterTileKeyForPath(path));
+        NSNumber *bytes = _prefetched[key];
+        if (bytes) {
+            atomic_fetch_add(&_hits, 1);
+            _prefetchedBytes -= MIN(_prefetchedBytes, [bytes unsignedIntegerValue]);
+            [_prefetched removeObjectForKey:key];
+        }
+
+        if (!_enabled) {
+            return;
+        }
+
+        // Gather the tiles drawn within a short interval into one visible map rect, starting over if the zoom changes
+        if (MKMapRectIsNull(_sampleRect) || path.z != _sampleZoom) {
+            _sampleRect = mapRect;
+            _sampleZoom = path.z;
+        } else {
+            _sampleRect = MKMapRectUnion(_sampleRect, mapRect);
+        }
+        _sampleScale = path.contentScaleFactor;
+
+        if (!_sampleScheduled) {
+            _sampleScheduled = YES;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MBXRasterTilePrefetcherSampleInterval * NSEC_PER_SEC)), _queue, ^{
+                [self predict];
+            });
+        }
+    });
+}
+
+#pragma mark - Prediction
+
+- (void)addPathsCoveringMapRect:(MKMapRect)mapRect zoom:(NSInteger)z excluding:(MKMapRect)excludedRect toArray:(NSMutableArray *)paths keys:(NSMutableSet *)keys {
+    if (z < _minimumZ || z > _maximumZ || MKMapRectIsNull(mapRect)) {
+        return;
+    }
+
+    mapRect = MKMapRectIntersection(mapRect, MKMapRectWorld);
+    double tileSize = MKMapSizeWorld.width / (double)(1 << z);
+    NSInteger maxIndex = (1 << z) - 1;
+    NSInteger minX = MAX(0, (NSInteger)floor(MKMapRectGetMinX(mapRect) / tileSize));
+    NSInteger maxX = MIN(maxIndex, (NSInteger)ceil(MKMapRectGetMaxX(mapRect) / tileSize) - 1);
+    NSInteger minY = MAX(0, (NSInteger)floor(MKMapRectGetMinY(mapRect) / tileSize));
+    NSInteger maxY = MIN(maxIndex, (NSInteger)ceil(MKMapRectGetMaxY(mapRect) / tileSize) - 1);
+
+    for (NSInteger y = minY; y <= maxY; y++) {
+        for (NSInteger x = minX; x <= maxX; x++) {
+            if ([paths count] >= MBXRasterTilePrefetcherMaximumPredictedTiles) {
+                return;
+            }
+
+            MKMapRect tileRect = MKMapRectMake(x * tileSize, y * tileSize, tileSize, tileSize);
+            if (!MKMapRectIsNull(excludedRect) && MKMapRectContainsRect(excludedRect, tileRect)) {
+                continue;
+            }
+
+            MKTileOverlayPath path = { .x = x, .y = y, .z = z, .contentScaleFactor = _sampleScale };
+            NSNumber *key = @(MBXRasterTileKeyForPath(path));
+            if (![keys containsObject:key]) {
+                [keys addObject:key];
+                [paths addObject:[NSValue valueWithBytes:&path objCType:@encode(MKTileOverlayPath)]];
+            }
+        }
+    }
+}
+
+- (void)predict {
+    _sampleScheduled = NO;
+
+    MKMapRect visibleRect = _sampleRect;
+    NSInteger z = _sampleZoom;
+    _sampleRect = MKMapRectNull;
+
+    if (!_enabled || MKMapRectIsNull(visibleRect)) {
+        return;
+    }
+
+    // Work out how fast the center of the visible map rect is moving
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    double vx = 0, vy = 0;
+    if (!MKMapRectIsNull(_lastVisibleRect) && _lastVisibleZoom == z && now - _lastVisibleTime < MBXRasterTilePrefetcherMaximumSampleGap) {
+        double dt = now - _lastVisibleTime;
+        vx = (MKMapRectGetMidX(visibleRect) - MKMapRectGetMidX(_lastVisibleRect)) / dt;
+        vy = (MKMapRectGetMidY(visibleRect) - MKMapRectGetMidY(_lastVisibleRect)) / dt;
+    }
+    _lastVisibleRect = visibleRect;
+    _lastVisibleZoom = z;
+    _lastVisibleTime = now;
+
+    // In order of priority: the tiles the map is moving toward, the tiles one zoom level out, and the tiles one zoom level
+    // in around the center. The visible tiles themselves are already being loaded for the renderer.
+    NSMutableArray *paths = [NSMutableArray array];
+    NSMutableSet *keys = [NSMutableSet set];
+
+    if (vx != 0 || vy != 0) {
+        MKMapRect aheadRect = MKMapRectOffset(visibleRect, vx * MBXRasterTilePrefetcherLookahead, vy * MBXRasterTilePrefetcherLookahead);
+        [self addPathsCoveringMapRect:MKMapRectUnion(visibleRect, aheadRect) zoom:z excluding:visibleRect toArray:paths keys:keys];
+    }
+
+    [self addPathsCoveringMapRect:visibleRect zoom:z - 1 excluding:MKMapRectNull toArray:paths keys:keys];
+
+    MKMapRect centerRect = MKMapRectInset(visibleRect, visibleRect.size.width / 4, visibleRect.size.height / 4);
+    [self addPathsCoveringMapRect:centerRect zoom:z + 1 excluding:MKMapRectNull toArray:paths keys:keys];
+
+    // Loads for tiles which are no longer predicted were a wrong guess, so cancel them
+    for (NSNumber *key in [_inFlight allKeys]) {
+        if (![keys containsObject:key]) {
+            _cancel(_inFlight[key]);
+            [_inFlight removeObjectForKey:key];
+            atomic_fetch_add(&_canceled, 1);
+        }
+    }
+
+    // Prefetched tiles which haven't been drawn and are no longer predicted stay in the tile cache, but they stop counting
+    // against the byte budget
+    for (NSNumber *key in [_prefetched allKeys]) {
+        if (![keys containsObject:key]) {
+            _prefetchedBytes -= MIN(_prefetchedBytes, [_prefetched[key] unsignedIntegerValue]);
+            [_prefetched removeObjectForKey:key];
+        }
+    }
+
+    [_pending removeAllObjects];
+    for (NSValue *value in paths) {
+        MKTileOverlayPath path;
+        [value getValue:&path];
+        NSNumber *key = @(MBXRasterTileKeyForPath(path));
+        if (!_inFlight[key] && !_prefetched[key]) {
+            [_pending addObject:value];
+        }
+    }
+
+    [self batchLoadPending];
+    [self startPrefetches];
+}
+
+#pragma mark - Loading
+
+- (void)batchLoadPending {
+    // Whatever can be loaded without a download, like tiles from offline map databases, is loaded in one go, and only the
+    // rest is left for loading one tile at a time
+    MBXRasterTilePrefetchBatchLoadBlock batchLoad = self.batchLoadBlock;
+    if (!batchLoad || [_pending count] == 0 || _prefetchedBytes >= _byteBudget) {
+        return;
+    }
+
+    NSDictionary *loaded = batchLoad([_pending copy]);
+    if ([loaded count] == 0) {
+        return;
+    }
+
+    NSMutableArray *pending = [NSMutableArray arrayWithCapacity:[_pending count]];
+    for (NSValue *value in _pending) {
+        MKTileOverlayPath path;
+        [value getValue:&path];
+        NSNumber *key = @(MBXRasterTileKeyForPath(path));
+        NSNumber *bytes = loaded[key];
+        if (bytes) {
+            atomic_fetch_add(&_prefetches, 1);
+            _prefetched[key] = bytes;
+            _prefetchedBytes += [bytes unsignedIntegerValue];
+        } else {
+            [pending addObject:value];
+        }
+    }
+    _pending = pending;
+}
+
+- (void)startPrefetches {
+    while ([_inFlight count] < _maximumConcurrentPrefetches && [_pending count] > 0 && _prefetchedBytes < _byteBudget) {
+        // Visible tiles always come first, so hold off until they're done
+        if (_busy()) {
+            if (!_retryScheduled) {
+                _retryScheduled = YES;
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MBXRasterTilePrefetcherBusyRetryInterval * NSEC_PER_SEC)), _queue, ^{
+                    _retryScheduled = NO;
+                    [self startPrefetches];
+                });
+            }
+            return;
+        }
+
+        MKTileOverlayPath path;
+        [(NSValue *)_pending[0] getValue:&path];
+        [_pending removeObjectAtIndex:0];
+        NSNumber *key = @(MBXRasterTileKeyForPath(path));
+
+        __weak typeof(self) weakSelf = self;
+        id load = _load(path, ^(NSData *data) {
+            typeof(self) strongSelf = weakSelf;
+            if (strongSelf) {
+                dispatch_async(strongSelf->_queue, ^{
+                    [strongSelf finishPrefetchForKey:key data:data];
+                });
+            }
+        });
+
+        if (!load) {
+            // This overlay's tiles can't be prefetched
+            [_pending removeAllObjects];
+            return;
+        }
+        _inFlight[key] = load;
+    }
+}
+
+- (void)finishPrefetchForKey:(NSNumber *)key data:(NSData *)data {
+    if (!_inFlight[key]) {
+        // The prefetch was canceled
+        return;
+    }
+    [_inFlight removeObjectForKey:key];
+
+    if (data) {
+        atomic_fetch_add(&_prefetches, 1);
+        _prefetched[key] = @([data length]);
+        _prefetchedBytes += [data length];
+    }
+
+    [self startPrefetches];
+}
+
+- (void)cancelAll {
+    dispatch_async(_queue, ^{
+        for (id load in [_inFlight allValues]) {
+            _cancel(load);
+        }
+        [_inFlight removeAllObjects];
+        [_pending removeAllObjects];
+        [_prefetched removeAllObjects];
+        _prefetchedBytes = 0;
+    });
+}
+
+@end
@@ -23,4 +23,40 @@
 *   Use this method to remove the overlay’s existing tile images and reload them from the original source. This method automatically causes the renderer to redraw the new tiles as soon as they are loaded into memory. */
 - (void)reloadData;
 
+/** @name Managing the Tile Cache */
+
+/** The approximate number of bytes of tile data the renderer keeps in memory. When the limit is exceeded, the least recently used tiles are evicted. The default value is 16 MB. */
+@property (nonatomic) NSUInteger tileCacheSizeLimit;
+
+/** The number of tile cache lookups which found a tile. */
+@property (readonly, nonatomic) NSUInteger tileCacheHitCount;
+
+/** The number of tile cache lookups which didn't find a tile. */
+@property (readonly, nonatomic) NSUInteger tileCacheMissCount;
+
+/** The number of tiles which have been evicted from the tile cache to stay within its size limit. */
+@property (readonly, nonatomic) NSUInteger tileCacheEvictionCount;
+
+/** @name Drawing Tiles Which Haven't Loaded */
+
+/** How many zoom levels out the renderer looks for a cached tile to scale up in place of a tile which hasn't loaded yet. Any cached tiles from one zoom level in are scaled down and drawn over it, which covers zooming out. This also sets how far past the overlay's `maximumZ` the map keeps drawing tiles, by scaling up the tiles at `maximumZ`. Set this to `0` to leave tiles blank until they load. The default value is `4`. */
+@property (nonatomic) NSUInteger maximumFallbackZoomLevels;
+
+/** @name Prefetching Tiles */
+
+/** Whether the renderer loads tiles ahead of time, based on which tiles it has been drawing and how the map is moving. Prefetched tiles are loaded into the shared `MBXTileCache`, at a low priority and only while no visible tiles are loading. Tiles from an `MBXRasterTileOverlay`'s offline map databases are read for the whole predicted area in one pass and decoded into the renderer's own cache, without any downloads. Prefetching downloads tiles which may never be drawn, so it's off by default; turn it on where that data is cheap, such as on Wi-Fi, or for overlays which are served from offline map databases. The default value is `NO`. */
+@property (nonatomic) BOOL prefetchesTiles;
+
+/** The number of tiles which were downloaded or read from offline map databases by prefetching. */
+@property (readonly, nonatomic) NSUInteger tilePrefetchCount;
+
+/** The number of prefetched tiles which were later drawn. */
+@property (readonly, nonatomic) NSUInteger tilePrefetchHitCount;
+
+/** The number of prefetches which were canceled because the map didn't move the way it was predicted to. */
+@property (readonly, nonatomic) NSUInteger tilePrefetchCancelCount;
+
+/** The fraction of prefetched tiles which were later drawn, from `0.0` to `1.0`. */
+@property (readonly, nonatomic) double tilePrefetchHitRatio;
+
 @end
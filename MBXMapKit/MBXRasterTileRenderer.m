@@ -5,14 +5,271 @@
 //  Copyright (c) 2014 Mapbox. All rights reserved.
 //
 
-#import "MBXRasterTileRenderer.h"
+#import "MBXMapKit.h"
+#import "MBXRasterTileDecoder.h"
+#import "MBXRasterTilePrefetcher.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+typedef void (^MBXTileFetcherCompletionBlock)(NSData *data, NSURLResponse *response, NSError *error);
+
+#pragma mark - Private API for cooperating with MBXTileFetcher
+
+@interface MBXTileFetcher ()
+
+- (id)loadTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (id)prefetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (void)cancelLoad:(id)load;
+- (NSUInteger)foregroundFetchCount;
+
+@end
+
+#pragma mark - Private API for cooperating with MBXRasterTileOverlay
+
+@interface MBXRasterTileOverlay ()
+
+- (NSString *)tileCacheSourceForPath:(MKTileOverlayPath)path;
+- (NSDictionary *)offlineDataForPaths:(NSArray *)paths;
+
+@end
+
+#pragma mark - Private API for cooperating with MBXTileMetrics
+
+@interface MBXTileMetrics ()
+
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+#pragma mark - Tile cache
+
+// The cache holds decoded bitmaps, which take 256 KB for a 256px tile and 1 MB for a 512px one
+//
+static NSUInteger const MBXRasterTileRendererDefaultCacheSizeLimit = 16 * 1024 * 1024;
+
+// A tile scaled up from more than a few zoom levels out is too blurry to be worth drawing
+//
+static NSUInteger const MBXRasterTileRendererDefaultMaximumFallbackZoomLevels = 4;
+
+// Each cached tile is an entry in a hash set (keyed by the entry's tile key) and in a doubly linked list running from the
+// least to the most recently used entry. Lookups only take the read lock, so they can't relink entries. Instead, each
+// lookup stamps the entry with the time of access, and eviction promotes entries which have been used since they were
+// last linked rather than evicting them.
+//
+typedef struct MBXRasterTileCacheEntry {
+    uint64_t key;
+    CFTypeRef object;
+    NSUInteger cost;
+    _Atomic uint64_t lastAccess;
+    uint64_t linkedAccess;
+    struct MBXRasterTileCacheEntry *older;
+    struct MBXRasterTileCacheEntry *newer;
+} MBXRasterTileCacheEntry;
+
+static Boolean MBXRasterTileCacheEntryEqual(const void *a, const void *b) {
+    return ((const MBXRasterTileCacheEntry *)a)->key == ((const MBXRasterTileCacheEntry *)b)->key;
+}
+
+static CFHashCode MBXRasterTileCacheEntryHash(const void *value) {
+    uint64_t key = ((const MBXRasterTileCacheEntry *)value)->key;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (CFHashCode)key;
+}
+
+@interface MBXRasterTileCache : NSObject
+
+@property (nonatomic) NSUInteger totalCostLimit;
+@property (readonly, nonatomic) NSUInteger hitCount;
+@property (readonly, nonatomic) NSUInteger missCount;
+@property (readonly, nonatomic) NSUInteger evictionCount;
+
+- (id)objectForKey:(uint64_t)key;
+- (id)objectForKey:(uint64_t)key countingLookup:(BOOL)countingLookup;
+- (void)setObject:(id)object forKey:(uint64_t)key cost:(NSUInteger)cost;
+- (void)removeAllObjects;
+
+@end
+
+@implementation MBXRasterTileCache {
+    pthread_rwlock_t _lock;
+    CFMutableSetRef _entries;
+    MBXRasterTileCacheEntry *_oldest;
+    MBXRasterTileCacheEntry *_newest;
+    NSUInteger _totalCost;
+    _Atomic uint64_t _clock;
+    _Atomic uint64_t _hits;
+    _Atomic uint64_t _misses;
+    _Atomic uint64_t _evictions;
+}
+
+- (instancetype)init {
+    self = [super init];
+
+    if (self) {
+        CFSetCallBacks callbacks = {
+            .version = 0,
+            .equal = MBXRasterTileCacheEntryEqual,
+            .hash = MBXRasterTileCacheEntryHash
+        };
+        _entries = CFSetCreateMutable(kCFAllocatorDefault, 0, &callbacks);
+        pthread_rwlock_init(&_lock, NULL);
+        _totalCostLimit = MBXRasterTileRendererDefaultCacheSizeLimit;
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    [self removeAllObjects];
+    CFRelease(_entries);
+    pthread_rwlock_destroy(&_lock);
+}
+
+- (NSUInteger)hitCount {
+    return (NSUInteger)atomic_load(&_hits);
+}
+
+- (NSUInteger)missCount {
+    return (NSUInteger)atomic_load(&_misses);
+}
+
+- (NSUInteger)evictionCount {
+    return (NSUInteger)atomic_load(&_evictions);
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    pthread_rwlock_wrlock(&_lock);
+    _totalCostLimit = totalCostLimit;
+    [self evictEntriesKeeping:NULL];
+    pthread_rwlock_unlock(&_lock);
+}
+
+- (id)objectForKey:(uint64_t)key {
+    return [self objectForKey:key countingLookup:YES];
+}
+
+- (id)objectForKey:(uint64_t)key countingLookup:(BOOL)countingLookup {
+    id object = nil;
+    MBXRasterTileCacheEntry probe = { .key = key };
+
+    pthread_rwlock_rdlock(&_lock);
+    MBXRasterTileCacheEntry *entry = (MBXRasterTileCacheEntry *)CFSetGetValue(_entries, &probe);
+    if (entry) {
+        atomic_store(&entry->lastAccess, atomic_fetch_add(&_clock, 1) + 1);
+        object = (__bridge id)entry->object;
+    }
+    pthread_rwlock_unlock(&_lock);
+
+    if (countingLookup) {
+        atomic_fetch_add((object ? &_hits : &_misses), 1);
+    }
+
+    return object;
+}
+
+- (void)setObject:(id)object forKey:(uint64_t)key cost:(NSUInteger)cost {
+    MBXRasterTileCacheEntry probe = { .key = key };
+
+    pthread_rwlock_wrlock(&_lock);
+    MBXRasterTileCacheEntry *entry = (MBXRasterTileCacheEntry *)CFSetGetValue(_entries, &probe);
+    if (entry) {
+        CFRelease(entry->object);
+        _totalCost -= entry->cost;
+        [self unlinkEntry:entry];
+    } else {
+        entry = calloc(1, sizeof(MBXRasterTileCacheEntry));
+        entry->key = key;
+        CFSetAddValue(_entries, entry);
+    }
+    entry->object = CFBridgingRetain(object);
+    entry->cost = cost;
+    _totalCost += cost;
+    [self linkNewestEntry:entry];
+
+    [self evictEntriesKeeping:entry];
+    pthread_rwlock_unlock(&_lock);
+}
+
+- (void)removeAllObjects {
+    pthread_rwlock_wrlock(&_lock);
+    MBXRasterTileCacheEntry *entry = _oldest;
+    while (entry) {
+        MBXRasterTileCacheEntry *newer = entry->newer;
+        CFRelease(entry->object);
+        free(entry);
+        entry = newer;
+    }
+    CFSetRemoveAllValues(_entries);
+    _oldest = NULL;
+    _newest = NULL;
+    _totalCost = 0;
+    pthread_rwlock_unlock(&_lock);
+}
+
+// The following methods must be called with the write lock held.
+
+- (void)linkNewestEntry:(MBXRasterTileCacheEntry *)entry {
+    entry->linkedAccess = atomic_load(&entry->lastAccess);
+    entry->older = _newest;
+    entry->newer = NULL;
+    if (_newest) {
+        _newest->newer = entry;
+    } else {
+        _oldest = entry;
+    }
+    _newest = entry;
+}
+
+- (void)unlinkEntry:(MBXRasterTileCacheEntry *)entry {
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        _oldest = entry->newer;
+    }
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        _newest = entry->older;
+    }
+    entry->older = NULL;
+    entry->newer = NULL;
+}
+
+- (void)evictEntriesKeeping:(MBXRasterTileCacheEntry *)keep {
+    while (_totalCost > _totalCostLimit && _oldest && _oldest != keep) {
+        MBXRasterTileCacheEntry *entry = _oldest;
+        [self unlinkEntry:entry];
+
+        if (atomic_load(&entry->lastAccess) != entry->linkedAccess) {
+            // This entry has been used since it was linked, so give it another trip through the list
+            [self linkNewestEntry:entry];
+            continue;
+        }
+
+        CFSetRemoveValue(_entries, entry);
+        _totalCost -= entry->cost;
+        CFRelease(entry->object);
+        free(entry);
+        atomic_fetch_add(&_evictions, 1);
+    }
+}
+
+@end
 
 #pragma mark - Private API
 
 @interface MBXRasterTileRenderer ()
 
-@property (nonatomic) NSMutableArray *tiles;
+@property (nonatomic) MBXRasterTileCache *tileCache;
 @property (nonatomic) NSMutableSet *activeDownloads;
+@property (nonatomic) NSHashTable *activeLoads;
+@property (nonatomic) MBXRasterTilePrefetcher *prefetcher;
+@property (nonatomic) id memoryWarningObserver;
 
 @end
 
@@ -26,18 +283,31 @@
     self = [super initWithOverlay:overlay];
 
     if (self) {
-        _tiles = [NSMutableArray new];
+        _tileCache = [MBXRasterTileCache new];
 
         _activeDownloads = [NSMutableSet set];
+        _maximumFallbackZoomLevels = MBXRasterTileRendererDefaultMaximumFallbackZoomLevels;
+        _activeLoads = [NSHashTable weakObjectsHashTable];
 
-        [[NSNotificationCenter defaultCenter] addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
-                                                          object:[UIApplication sharedApplication]
-                                                           queue:nil
-                                                      usingBlock:^(NSNotification *note) {
-                                                          @synchronized(self) {
-                                                              [self.tiles removeAllObjects];
-                                                          }
-                                                      }];
+        __weak typeof(self) weakSelf = self;
+        _prefetcher = [[MBXRasterTilePrefetcher alloc] initWithLoadBlock:^id(MKTileOverlayPath path, void (^completionHandler)(NSData *data)) {
+            return [weakSelf prefetchTileAtPath:path completionHandler:completionHandler];
+        } cancelBlock:^(id load) {
+            [[MBXTileFetcher sharedTileFetcher] cancelLoad:load];
+        } busyBlock:^BOOL{
+            return ([[MBXTileFetcher sharedTileFetcher] foregroundFetchCount] > 0);
+        }];
+        _prefetcher.batchLoadBlock = ^NSDictionary *(NSArray *paths) {
+            return [weakSelf prefetchOfflineTilesAtPaths:paths];
+        };
+
+        // The notification center keeps the block alive until the observer is removed, so it mustn't retain the renderer
+        _memoryWarningObserver = [[NSNotificationCenter defaultCenter] addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                                                                                   object:[UIApplication sharedApplication]
+                                                                                    queue:nil
+                                                                               usingBlock:^(NSNotification *note) {
+                                                                                   [weakSelf.tileCache removeAllObjects];
+                                                                               }];
     }
 
     return self;
@@ -48,131 +318,184 @@
 }
 
 - (void)dealloc {
-    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [[NSNotificationCenter defaultCenter] removeObserver:_memoryWarningObserver];
+
+    // Nothing is going to draw the tiles this renderer is still waiting for
+    NSArray *loads;
+    @synchronized(_activeLoads) {
+        loads = [_activeLoads allObjects];
+    }
+    for (id load in loads) {
+        [[MBXTileFetcher sharedTileFetcher] cancelLoad:load];
+    }
+    [_prefetcher cancelAll];
 }
 
-#pragma mark - Utility
+#pragma mark - Tile cache
 
-- (NSUInteger)cacheMaxSize {
-    if (((MKTileOverlay *)self.overlay).tileSize.width == 512) {
-        return 12;
-    } else {
-        return 48;
-    }
+- (NSUInteger)tileCacheSizeLimit {
+    return self.tileCache.totalCostLimit;
 }
 
-- (MKTileOverlayPath)pathForMapRect:(MKMapRect)mapRect zoomScale:(MKZoomScale)zoomScale {
-    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
-    CGFloat factor = tileOverlay.tileSize.width / 256;
+- (void)setTileCacheSizeLimit:(NSUInteger)tileCacheSizeLimit {
+    self.tileCache.totalCostLimit = tileCacheSizeLimit;
+}
 
-    NSInteger x = round(mapRect.origin.x * zoomScale / (tileOverlay.tileSize.width / factor));
-    NSInteger y = round(mapRect.origin.y * zoomScale / (tileOverlay.tileSize.width / factor));
-    NSInteger z = log2(zoomScale) + 20;
+- (NSUInteger)tileCacheHitCount {
+    return self.tileCache.hitCount;
+}
 
-    MKTileOverlayPath path = {
-        .x = x,
-        .y = y,
-        .z = z,
-        .contentScaleFactor = self.contentScaleFactor
-    };
+- (NSUInteger)tileCacheMissCount {
+    return self.tileCache.missCount;
+}
 
-    return path;
+- (NSUInteger)tileCacheEvictionCount {
+    return self.tileCache.evictionCount;
 }
 
-+ (NSString *)xyzForPath:(MKTileOverlayPath)path {
-    NSString *xyz = [NSString stringWithFormat:@"%li-%li-%li",
-        (long)path.x,
-        (long)path.y,
-        (long)path.z];
+#pragma mark - Tile prefetching
 
-    return xyz;
+- (BOOL)prefetchesTiles {
+    return self.prefetcher.enabled;
 }
 
-+ (MKTileOverlayPath)pathForXYZ:(NSString *)xyz scaleFactor:(CGFloat)scaleFactor {
-    MKTileOverlayPath path = {
-        .x = [[xyz componentsSeparatedByString:@"-"][0] integerValue],
-        .y = [[xyz componentsSeparatedByString:@"-"][1] integerValue],
-        .z = [[xyz componentsSeparatedByString:@"-"][2] integerValue],
-        .contentScaleFactor = scaleFactor
-    };
+- (void)setPrefetchesTiles:(BOOL)prefetchesTiles {
+    self.prefetcher.enabled = prefetchesTiles;
+}
 
-    return path;
+- (NSUInteger)tilePrefetchCount {
+    return self.prefetcher.prefetchCount;
 }
 
-+ (void)addImageData:(NSData *)data toRenderer:(MBXRasterTileRenderer *)renderer forXYZ:(NSString *)xyz usingBigTiles:(BOOL)usingBigTiles {
-    while (renderer.tiles.count >= [renderer cacheMaxSize]) {
-        [renderer.tiles removeObjectAtIndex:0];
+- (NSUInteger)tilePrefetchHitCount {
+    return self.prefetcher.hitCount;
+}
+
+- (NSUInteger)tilePrefetchCancelCount {
+    return self.prefetcher.canceledCount;
+}
+
+- (double)tilePrefetchHitRatio {
+    NSUInteger prefetches = self.prefetcher.prefetchCount;
+    return (prefetches > 0 ? (double)self.prefetcher.hitCount / prefetches : 0.0);
+}
+
+- (id)prefetchTileAtPath:(MKTileOverlayPath)path completionHandler:(void (^)(NSData *data))completionHandler {
+    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
+    NSString *source = [self tileCacheSourceForPath:path];
+    if (!source) {
+        return nil;
     }
 
-    if (usingBigTiles) {
-        MKTileOverlayPath parentPath = [[renderer class] pathForXYZ:xyz scaleFactor:renderer.contentScaleFactor];
-        parentPath.x /= 2;
-        parentPath.y /= 2;
-        parentPath.z--;
+    return [[MBXTileFetcher sharedTileFetcher] prefetchTileWithURL:[tileOverlay URLForTilePath:path] source:source path:path completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        BOOL downloaded = (!error && [response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode == 200);
+        completionHandler(downloaded ? data : nil);
+    }];
+}
 
-        NSString *parentXYZ = [[renderer class] xyzForPath:parentPath];
+- (NSDictionary *)prefetchOfflineTilesAtPaths:(NSArray *)paths {
+    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
+    if (![tileOverlay isKindOfClass:[MBXRasterTileOverlay class]]) {
+        return nil;
+    }
 
-        if (![[renderer.tiles valueForKeyPath:@"xyz"] containsObject:parentXYZ]) {
-            [renderer.tiles addObject:@{
-                @"xyz": parentXYZ,
-                @"data": data
-            }];
-        }
-    } else {
-        if (![[renderer.tiles valueForKeyPath:@"xyz"] containsObject:xyz]) {
-            [renderer.tiles addObject:@{
-                @"xyz": xyz,
-                @"data": data
-            }];
+    // Offline tiles are read for the whole batch at once and decoded straight into the tile cache, since there's no
+    // download for the tile fetcher to hold on to. The prefetcher's paths are already the paths of the tiles as loaded,
+    // so their tile keys are the cache keys.
+    NSMutableArray *uncached = [NSMutableArray arrayWithCapacity:[paths count]];
+    for (NSValue *value in paths) {
+        MKTileOverlayPath path;
+        [value getValue:&path];
+        if (![self.tileCache objectForKey:MBXRasterTileKeyForPath(path) countingLookup:NO]) {
+            [uncached addObject:value];
         }
     }
+    if ([uncached count] == 0) {
+        return nil;
+    }
+
+    NSMutableDictionary *loaded = [NSMutableDictionary dictionary];
+    NSDictionary *dataForKeys = [(MBXRasterTileOverlay *)tileOverlay offlineDataForPaths:uncached];
+    [dataForKeys enumerateKeysAndObjectsUsingBlock:^(NSNumber *key, NSData *data, BOOL *stop) {
+        size_t cost = 0;
+        CFArrayRef images = MBXRasterTileCreateImagesWithData((__bridge CFDataRef)data, &cost);
+        if (images) {
+            [self.tileCache setObject:(__bridge_transfer NSArray *)images forKey:[key unsignedLongLongValue] cost:cost];
+            loaded[key] = @([data length]);
+        }
+    }];
+
+    return loaded;
+}
+
+#pragma mark - Utility
+
+- (MKTileOverlayPath)pathForMapRect:(MKMapRect)mapRect zoomScale:(MKZoomScale)zoomScale {
+    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
+    CGFloat factor = tileOverlay.tileSize.width / 256;
+
+    NSInteger x = round(mapRect.origin.x * zoomScale / (tileOverlay.tileSize.width / factor));
+    NSInteger y = round(mapRect.origin.y * zoomScale / (tileOverlay.tileSize.width / factor));
+    NSInteger z = log2(zoomScale) + 20;
+
+    MKTileOverlayPath path = {
+        .x = x,
+        .y = y,
+        .z = z,
+        .contentScaleFactor = self.contentScaleFactor
+    };
+
+    return path;
 }
 
-+ (NSData *)imageDataFromRenderer:(MBXRasterTileRenderer *)renderer forXYZ:(NSString *)xyz usingBigTiles:(BOOL)usingBigTiles {
-    NSString *searchXYZ;
+- (uint64_t)cacheKeyForPath:(MKTileOverlayPath)path usingBigTiles:(BOOL)usingBigTiles {
+    // A 512px tile covers four 256px tiles, so it's cached once under its own path rather than under each of theirs
     if (usingBigTiles) {
-        MKTileOverlayPath path = [[renderer class] pathForXYZ:xyz scaleFactor:renderer.contentScaleFactor];
         path.x /= 2;
         path.y /= 2;
         path.z--;
-        searchXYZ = [[renderer class] xyzForPath:path];
-    } else {
-        searchXYZ = xyz;
     }
 
-    NSDictionary *tile = nil;
+    return MBXRasterTileKeyForPath(path);
+}
 
-    for (tile in renderer.tiles) {
-        if ([tile[@"xyz"] isEqualToString:searchXYZ]) {
-            break;
-        }
+- (NSString *)tileCacheSourceForPath:(MKTileOverlayPath)path {
+    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
+
+    if ([tileOverlay isKindOfClass:[MBXRasterTileOverlay class]]) {
+        return [(MBXRasterTileOverlay *)tileOverlay tileCacheSourceForPath:path];
     }
 
-    if (!tile) {
+    // Other overlays which load tiles their own way are left to it, and so are overlays without a URL template to
+    // identify their tiles by
+    IMP loader = [tileOverlay methodForSelector:@selector(loadTileAtPath:result:)];
+    if (loader != [MKTileOverlay instanceMethodForSelector:@selector(loadTileAtPath:result:)] || !tileOverlay.URLTemplate) {
         return nil;
     }
 
-    [renderer.tiles removeObject:tile];
-    [renderer.tiles addObject:tile];
-
-    return tile[@"data"];
+    return [tileOverlay.URLTemplate stringByAppendingString:(path.contentScaleFactor > 1.0 ? @"@2x" : @"")];
 }
 
-+ (BOOL)dataIsPNG:(NSData *)data {
-    unsigned char *b = (unsigned char *)data.bytes;
-    if (data.length > 4 && b[0] == 0x89 && b[1] == 0x50 && b[2] == 0x4e && b[3] == 0x47) {
-        return YES;
-    } else {
-        return NO;
+- (void)loadTileAtPath:(MKTileOverlayPath)path result:(void (^)(NSData *tileData, NSError *error))result {
+    MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
+
+    // MBXRasterTileOverlay already goes through the shared tile fetcher, and overlays without a cache source can't
+    NSString *source = [self tileCacheSourceForPath:path];
+    if ([tileOverlay isKindOfClass:[MBXRasterTileOverlay class]] || !source) {
+        return [tileOverlay loadTileAtPath:path result:result];
     }
-}
 
-+ (BOOL)dataIsJPEG:(NSData *)data {
-    unsigned char *b = (unsigned char *)data.bytes;
-    if (data.length > 4 && b[0] == 0xff && b[1] == 0xd8 && b[2] == 0xff && b[3] == 0xe0) {
-        return YES;
-    } else {
-        return NO;
+    // Otherwise load the overlay's tile URL through the shared tile fetcher, so it's cached and shared with any other
+    // renderer drawing the same tiles
+    id load = [[MBXTileFetcher sharedTileFetcher] loadTileWithURL:[tileOverlay URLForTilePath:path] source:source path:path completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        if (!error && [response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200) {
+            data = nil;
+        }
+        result(data, error);
+    }];
+
+    @synchronized(_activeLoads) {
+        [_activeLoads addObject:load];
     }
 }
 
@@ -182,7 +505,18 @@
     MKTileOverlay *tileOverlay = (MKTileOverlay *)self.overlay;
     MKTileOverlayPath path = [self pathForMapRect:mapRect zoomScale:zoomScale];
     BOOL usingBigTiles = (tileOverlay.tileSize.width == 512);
-    MKTileOverlayPath childPath = path;
+
+    // Past the overlay's maximum zoom there are no tiles to load, so load the tile at the maximum zoom which covers this
+    // one, and draw it scaled up
+    NSInteger overzoom = path.z - (tileOverlay.maximumZ + (usingBigTiles ? 1 : 0));
+    if (overzoom > 0 && overzoom <= (NSInteger)self.maximumFallbackZoomLevels) {
+        path.x >>= overzoom;
+        path.y >>= overzoom;
+        path.z -= overzoom;
+    }
+
+    uint64_t key = [self cacheKeyForPath:path usingBigTiles:usingBigTiles];
+    NSNumber *queueKey = @(key);
 
     if (usingBigTiles) {
         path.x /= 2;
@@ -190,26 +524,18 @@
         path.z -= 1;
     }
 
-    NSString *xyz = [[self class] xyzForPath:childPath];
-    NSString *xyzQueue = [[self class] xyzForPath:path];
-    BOOL tileReady = NO;
+    // The map rect covered by the tile being loaded, which is bigger than mapRect for a 512px or overzoomed tile
+    double tileSize = MKMapSizeWorld.width / (double)(1 << path.z);
+    MKMapRect tileRect = MKMapRectMake(path.x * tileSize, path.y * tileSize, tileSize, tileSize);
 
-    // introduce a new tileRect that covers the entire region of a 512px tile
-    MKMapRect tileRect;
+    // The prefetcher gets the paths of the tiles being loaded, which for 512px tiles are already a zoom level up from the
+    // paths MapKit asks to draw. The overlay's zoom bounds count tiles of its own size (which is why the overzoom check
+    // above adds one for 512px tiles), so they're the bounds of the loaded paths as they are.
+    self.prefetcher.minimumZ = tileOverlay.minimumZ;
+    self.prefetcher.maximumZ = tileOverlay.maximumZ;
+    [self.prefetcher noteVisibleTileRect:tileRect path:path];
 
-    if (usingBigTiles) {
-        double xTile = 256.0 * path.x / (0.5 * zoomScale);
-        double yTile = 256.0 * path.y / (0.5 * zoomScale);
-        double wTile = 2.0 * mapRect.size.width;
-
-        tileRect = MKMapRectMake(xTile, yTile, wTile, wTile);
-    } else {
-        tileRect=mapRect;
-    }
-
-    @synchronized(self) {
-        tileReady = ([[self class] imageDataFromRenderer:self forXYZ:xyz usingBigTiles:usingBigTiles] != nil);
-    }
+    BOOL tileReady = ([self.tileCache objectForKey:key] != nil);
 
     if (tileReady) {
         return YES;
@@ -217,100 +543,131 @@
         __weak typeof(self) weakSelf = self;
         BOOL tileActive = NO;
         @synchronized(weakSelf) {
-            tileActive = ([weakSelf.activeDownloads containsObject:xyzQueue]);
+            tileActive = ([weakSelf.activeDownloads containsObject:queueKey]);
             if ( ! tileActive) {
-                [weakSelf.activeDownloads addObject:xyzQueue];
+                [weakSelf.activeDownloads addObject:queueKey];
             }
         }
         if ( ! tileActive) {
-            [(MKTileOverlay *)weakSelf.overlay loadTileAtPath:path result:^(NSData *tileData, NSError *error) {
+            MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+            uint64_t requestStartTime = [metrics startTime];
+            [weakSelf loadTileAtPath:path result:^(NSData *tileData, NSError *error) {
 
                 @synchronized(weakSelf) {
-                    [weakSelf.activeDownloads removeObject:xyzQueue];
+                    [weakSelf.activeDownloads removeObject:queueKey];
                 }
                 if (tileData) {
                     NSData *tileDataCopy = [[NSData alloc] initWithBytes:tileData.bytes length:tileData.length];
 
                     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-                        CGDataProviderRef provider = CGDataProviderCreateWithCFData((CFDataRef)tileDataCopy);
-                        CGImageRef imageRef = nil;
-
-                        if ([[weakSelf class] dataIsPNG:tileDataCopy]) {
-                            imageRef = CGImageCreateWithPNGDataProvider(provider, nil, NO, kCGRenderingIntentDefault);
-                        } else if ([[weakSelf class] dataIsJPEG:tileDataCopy]) {
-                            imageRef = CGImageCreateWithJPEGDataProvider(provider, nil, NO, kCGRenderingIntentDefault);
+                        // Decode the tile here, once, into bitmaps which drawMapRect:zoomScale:inContext: can draw as is
+                        size_t cost = 0;
+                        uint64_t decodeStartTime = [metrics startTime];
+                        CFArrayRef images = MBXRasterTileCreateImagesWithData((__bridge CFDataRef)tileDataCopy, &cost);
+                        [metrics recordStage:MBXTileMetricsStageDecode startTime:decodeStartTime];
+
+                        if (images) {
+                            [weakSelf.tileCache setObject:(__bridge_transfer NSArray *)images forKey:key cost:cost];
+                            [metrics recordStage:MBXTileMetricsStageTotal startTime:requestStartTime];
                         }
 
-                        if (imageRef) {
-                            @synchronized(weakSelf) {
-                                [[weakSelf class] addImageData:tileDataCopy
-                                                    toRenderer:weakSelf
-                                                        forXYZ:xyz
-                                                 usingBigTiles:usingBigTiles];
-                            }
-                        }
-
-                        CGImageRelease(imageRef);
-                        CGDataProviderRelease(provider);
-
+                        // This also replaces any fallback which was drawn while the tile was loading
                         [weakSelf setNeedsDisplayInMapRect:tileRect zoomScale:zoomScale];
                     });
                 }
             }];
         }
-        return NO;
+
+        // While the tile loads, draw whatever can stand in for it from the cache
+        return [self drawFallbackForMapRect:mapRect zoomScale:zoomScale inContext:NULL];
     }
 }
 
 - (void)drawMapRect:(MKMapRect)mapRect zoomScale:(MKZoomScale)zoomScale inContext:(CGContextRef)context {
     MKTileOverlayPath path = [self pathForMapRect:mapRect zoomScale:zoomScale];
-    NSString *xyz = [[self class] xyzForPath:path];
-    NSData *tileData = nil;
-
-    @synchronized(self) {
-        tileData = [[self class] imageDataFromRenderer:self
-                                                forXYZ:xyz
-                                         usingBigTiles:(((MKTileOverlay *)self.overlay).tileSize.width == 512)];
+    uint64_t key = [self cacheKeyForPath:path usingBigTiles:(((MKTileOverlay *)self.overlay).tileSize.width == 512)];
+    NSArray *images = [self.tileCache objectForKey:key];
 
-        if (!tileData) {
-            return [self setNeedsDisplayInMapRect:mapRect zoomScale:zoomScale];
+    if (!images) {
+        if (![self drawFallbackForMapRect:mapRect zoomScale:zoomScale inContext:context]) {
+            [self setNeedsDisplayInMapRect:mapRect zoomScale:zoomScale];
         }
+        return;
     }
 
-    CGImageRef imageRef = nil;
+    // The cached images are already decoded, split into quadrants, and flipped for this context, so just draw
+    NSUInteger index = (images.count == 4 ? (path.y % 2) * 2 + (path.x % 2) : 0);
+    MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+    uint64_t drawStartTime = [metrics startTime];
+    CGContextDrawImage(context, [self rectForMapRect:mapRect], (__bridge CGImageRef)images[index]);
+    [metrics recordStage:MBXTileMetricsStageDraw startTime:drawStartTime];
+}
+
+#pragma mark - Fallback Drawing
+
+- (id)cachedImageForPath:(MKTileOverlayPath)path usingBigTiles:(BOOL)usingBigTiles {
+    // Looking for stand-in tiles doesn't count toward the cache statistics
+    NSArray *images = [self.tileCache objectForKey:[self cacheKeyForPath:path usingBigTiles:usingBigTiles] countingLookup:NO];
 
-    CGDataProviderRef provider = CGDataProviderCreateWithCFData((CFDataRef)tileData);
-    if (provider) {
-        if ([[self class] dataIsPNG:tileData]) {
-            imageRef = CGImageCreateWithPNGDataProvider(provider, nil, NO, kCGRenderingIntentDefault);
-        } else if ([[self class] dataIsJPEG:tileData]) {
-            imageRef = CGImageCreateWithJPEGDataProvider(provider, nil, NO, kCGRenderingIntentDefault);
+    return (images ? images[(images.count == 4 ? (path.y % 2) * 2 + (path.x % 2) : 0)] : nil);
+}
+
+- (BOOL)drawFallbackForMapRect:(MKMapRect)mapRect zoomScale:(MKZoomScale)zoomScale inContext:(CGContextRef)context {
+    // Stand in for a tile which isn't cached by scaling up the nearest cached ancestor, clipped to the tile, and then by
+    // scaling down whichever of the tile's children are cached on top of that. With a NULL context, this only checks
+    // whether there is anything to draw.
+    MKTileOverlayPath path = [self pathForMapRect:mapRect zoomScale:zoomScale];
+    BOOL usingBigTiles = (((MKTileOverlay *)self.overlay).tileSize.width == 512);
+    BOOL found = NO;
+
+    for (NSInteger levels = 1; levels <= (NSInteger)self.maximumFallbackZoomLevels && path.z - levels >= (usingBigTiles ? 1 : 0); levels++) {
+        MKTileOverlayPath ancestor = path;
+        ancestor.x >>= levels;
+        ancestor.y >>= levels;
+        ancestor.z -= levels;
+
+        id image = [self cachedImageForPath:ancestor usingBigTiles:usingBigTiles];
+        if (image) {
+            if (!context) {
+                return YES;
+            }
+
+            double size = mapRect.size.width * (double)(1 << levels);
+            MKMapRect ancestorRect = MKMapRectMake(ancestor.x * size, ancestor.y * size, size, size);
+
+            CGContextSaveGState(context);
+            CGContextClipToRect(context, [self rectForMapRect:mapRect]);
+            CGContextDrawImage(context, [self rectForMapRect:ancestorRect], (__bridge CGImageRef)image);
+            CGContextRestoreGState(context);
+
+            found = YES;
+            break;
         }
-        CGDataProviderRelease(provider);
     }
 
-    if (!imageRef) {
-        return [self setNeedsDisplayInMapRect:mapRect zoomScale:zoomScale];
-    }
+    if (self.maximumFallbackZoomLevels > 0) {
+        double size = mapRect.size.width / 2;
+        for (NSUInteger i = 0; i < 4; i++) {
+            MKTileOverlayPath child = path;
+            child.x = path.x * 2 + i % 2;
+            child.y = path.y * 2 + i / 2;
+            child.z = path.z + 1;
+
+            id image = [self cachedImageForPath:child usingBigTiles:usingBigTiles];
+            if (image) {
+                if (!context) {
+                    return YES;
+                }
 
-    CGImageRef croppedImageRef = nil;
+                MKMapRect childRect = MKMapRectMake(child.x * size, child.y * size, size, size);
+                CGContextDrawImage(context, [self rectForMapRect:childRect], (__bridge CGImageRef)image);
 
-    if (CGImageGetWidth(imageRef) == 512) {
-        CGRect cropRect = CGRectMake(0, 0, 256, 256);
-        cropRect.origin.x += (path.x % 2 ? 256 : 0);
-        cropRect.origin.y += (path.y % 2 ? 256 : 0);
-        croppedImageRef = CGImageCreateWithImageInRect(imageRef, cropRect);
+                found = YES;
+            }
+        }
     }
 
-    CGRect tileRect = CGRectMake(0, 0, 256, 256);
-    UIGraphicsBeginImageContext(tileRect.size);
-    CGContextDrawImage(UIGraphicsGetCurrentContext(), tileRect, (croppedImageRef ? croppedImageRef : imageRef));
-    CGImageRelease(croppedImageRef);
-    CGImageRelease(imageRef);
-    CGImageRef flippedImageRef = UIGraphicsGetImageFromCurrentImageContext().CGImage;
-    UIGraphicsEndImageContext();
-
-    CGContextDrawImage(context, [self rectForMapRect:mapRect], flippedImageRef);
+    return found;
 }
 
 #pragma mark - MKTileOverlayRenderer Compatibility
@@ -0,0 +1,69 @@
+//
+//  MBXTileCache.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+
+/** `MBXTileCache` is a cache of map tile images which is shared by every `MBXRasterTileOverlay` and `MBXRasterTileRenderer` in the process.
+*
+*   Tiles are kept in memory and in a database in the app's Caches directory. They are identified by their map ID, image quality, and tile path rather than by their URLs, so cached tiles don't depend on the access token and don't compete with other HTTP responses in the shared `NSURLCache`.
+*
+*   Each tile expires after the lifetime given in its HTTP response, or after `defaultTimeToLive` if the response didn't give one. An expired tile is still drawn right away, while it is revalidated with the server in the background using its ETag.
+*
+*   A single, shared instance of `MBXTileCache` exists and should be accessed with the `sharedTileCache` class method. */
+@interface MBXTileCache : NSObject
+
+
+#pragma mark -
+
+/** @name Accessing the Shared Tile Cache */
+
+/** Returns the shared tile cache. */
++ (MBXTileCache *)sharedTileCache;
+
+
+#pragma mark -
+
+/** @name Getting and Setting Cache Limits */
+
+/** The approximate number of bytes of tile data kept in memory. The default value is 8 MB. */
+@property (nonatomic) NSUInteger memoryCapacity;
+
+/** The approximate number of bytes of tile data kept on disk. When the limit is exceeded, the least recently used tiles are removed. The default value is 64 MB. */
+@property (nonatomic) NSUInteger diskCapacity;
+
+/** How long a tile stays fresh when its HTTP response doesn't include a `Cache-Control` max-age. The default value is one day. */
+@property (nonatomic) NSTimeInterval defaultTimeToLive;
+
+
+#pragma mark -
+
+/** @name Measuring Cache Performance */
+
+/** The number of tile lookups which were answered from memory. */
+@property (readonly, nonatomic) NSUInteger memoryHitCount;
+
+/** The number of tile lookups which were answered from disk. */
+@property (readonly, nonatomic) NSUInteger diskHitCount;
+
+/** The number of tile lookups, counted in either `memoryHitCount` or `diskHitCount`, which found an expired tile that needed to be revalidated. */
+@property (readonly, nonatomic) NSUInteger staleHitCount;
+
+/** The number of tile lookups which didn't find a tile. */
+@property (readonly, nonatomic) NSUInteger missCount;
+
+/** The fraction of tile lookups which found a tile in either memory or on disk, from `0.0` to `1.0`. */
+@property (readonly, nonatomic) double hitRate;
+
+
+#pragma mark -
+
+/** @name Removing Cached Tiles */
+
+/** Removes all tiles from memory and from disk. */
+- (void)removeAllTiles;
+
+@end
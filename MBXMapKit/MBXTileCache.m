@@ -0,0 +1,608 @@
+//
+//  MBXTileCache.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMapKit.h"
+
+#import <sqlite3.h>
+#import <stdatomic.h>
+
+typedef void (^MBXTileCacheLookupBlock)(NSData *data, NSString *etag, BOOL stale);
+
+
+#pragma mark - Cache configuration
+
+// The memory tier is split into shards, each with its own lock, so that the renderers of several overlays drawing at
+// once don't all contend for a single lock
+//
+static NSUInteger const MBXTileCacheMemoryShardCount = 8;
+
+static NSUInteger const MBXTileCacheDefaultMemoryCapacity = 8 * 1024 * 1024;
+static NSUInteger const MBXTileCacheDefaultDiskCapacity = 64 * 1024 * 1024;
+static NSTimeInterval const MBXTileCacheDefaultTimeToLive = 24 * 60 * 60;
+
+// Accessed times on disk are only updated when they're at least this old, so that panning back and forth over the same
+// tiles doesn't turn every disk read into a write
+//
+static NSTimeInterval const MBXTileCacheAccessResolution = 60 * 60;
+
+// When the disk tier is over capacity, the least recently used tiles are removed until it's down to this fraction of
+// its capacity, so that eviction doesn't happen again on the very next write
+//
+static double const MBXTileCacheDiskEvictionTarget = 0.75;
+
+
+#pragma mark - Disk tier schema and statements
+
+// tile_row is the XYZ row of the tile (counted from the top), not the TMS row used by MBTiles. tile_size comes before
+// tile_data so that summing the sizes doesn't have to read the tile data's overflow pages.
+//
+static const char *MBXTileCacheSchema =
+    "CREATE TABLE IF NOT EXISTS tiles (\n"
+    "    source TEXT NOT NULL,\n"
+    "    zoom_level INTEGER NOT NULL,\n"
+    "    tile_column INTEGER NOT NULL,\n"
+    "    tile_row INTEGER NOT NULL,\n"
+    "    tile_size INTEGER NOT NULL,\n"
+    "    tile_data BLOB NOT NULL,\n"
+    "    etag TEXT,\n"
+    "    expires REAL NOT NULL,\n"
+    "    accessed REAL NOT NULL,\n"
+    "    PRIMARY KEY (source, zoom_level, tile_column, tile_row)\n"
+    ");\n"
+    "CREATE INDEX IF NOT EXISTS tiles_accessed ON tiles (accessed);\n";
+
+typedef NS_ENUM(NSUInteger, MBXTileCacheStatement) {
+    MBXTileCacheStatementSelect,
+    MBXTileCacheStatementTouch,
+    MBXTileCacheStatementInsert,
+    MBXTileCacheStatementRefresh,
+    MBXTileCacheStatementSelectOldest,
+    MBXTileCacheStatementDelete,
+    MBXTileCacheStatementTotalSize,
+    MBXTileCacheStatementCount
+};
+
+static const char *MBXTileCacheStatementSQL[MBXTileCacheStatementCount] = {
+    [MBXTileCacheStatementSelect] = "SELECT tile_data, etag, expires, accessed FROM tiles WHERE source = ?1 AND zoom_level = ?2 AND tile_column = ?3 AND tile_row = ?4;",
+    [MBXTileCacheStatementTouch] = "UPDATE tiles SET accessed = ?5 WHERE source = ?1 AND zoom_level = ?2 AND tile_column = ?3 AND tile_row = ?4;",
+    [MBXTileCacheStatementInsert] = "INSERT OR REPLACE INTO tiles (source, zoom_level, tile_column, tile_row, tile_size, tile_data, etag, expires, accessed) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);",
+    [MBXTileCacheStatementRefresh] = "UPDATE tiles SET etag = COALESCE(?5, etag), expires = ?6, accessed = ?7 WHERE source = ?1 AND zoom_level = ?2 AND tile_column = ?3 AND tile_row = ?4;",
+    [MBXTileCacheStatementSelectOldest] = "SELECT rowid, tile_size FROM tiles ORDER BY accessed;",
+    [MBXTileCacheStatementDelete] = "DELETE FROM tiles WHERE rowid = ?1;",
+    [MBXTileCacheStatementTotalSize] = "SELECT COALESCE(SUM(tile_size), 0) FROM tiles;"
+};
+
+
+#pragma mark - Cached tile entries
+
+@interface MBXTileCacheEntry : NSObject
+
+@property (nonatomic) NSData *data;
+@property (nonatomic) NSString *etag;
+@property (nonatomic) NSTimeInterval expires;
+
+@end
+
+@implementation MBXTileCacheEntry
+
+@end
+
+
+#pragma mark -
+
+@interface MBXTileCache ()
+
+@property (nonatomic) NSArray *memoryShards;
+@property (nonatomic) NSOperationQueue *sqliteQueue;
+@property (nonatomic) NSString *databasePath;
+
+// These are used by MBXTileFetcher, which declares them in its own class extension
+//
+- (void)fetchTileForSource:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileCacheLookupBlock)completionHandler;
+- (void)storeTileData:(NSData *)data response:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path;
+- (void)refreshTileWithResponse:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path;
+
+@end
+
+
+@implementation MBXTileCache
+{
+    sqlite3 *_database;
+    sqlite3_stmt *_statements[MBXTileCacheStatementCount];
+    NSUInteger _diskSize;
+    _Atomic uint64_t _memoryHits;
+    _Atomic uint64_t _diskHits;
+    _Atomic uint64_t _staleHits;
+    _Atomic uint64_t _misses;
+}
+
+
+#pragma mark - Shared cache instance
+
++ (MBXTileCache *)sharedTileCache
+{
+    static id _sharedTileCache = nil;
+    static dispatch_once_t onceToken;
+
+    dispatch_once(&onceToken, ^{
+        _sharedTileCache = [[self alloc] init];
+    });
+
+    return _sharedTileCache;
+}
+
+
+#pragma mark - Initialization
+
+- (instancetype)init
+{
+    // NOTE: MBXTileCache is designed with the intention that init should be used _only_ by +sharedTileCache, since the
+    // whole point is for every overlay and renderer in the process to share one cache.
+    //
+    self = [super init];
+
+    if(self)
+    {
+        // Keep the disk tier in Caches, since everything in it can be downloaded again
+        //
+        NSFileManager *fm = [NSFileManager defaultManager];
+        NSURL *caches = [fm URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:NO error:nil];
+        NSURL *cacheDirectory = [caches URLByAppendingPathComponent:@"MBXMapKit"];
+        NSError *error;
+        if(![fm createDirectoryAtURL:cacheDirectory withIntermediateDirectories:YES attributes:nil error:&error])
+        {
+            NSLog(@"There was an error creating the tile cache directory: %@",error);
+        }
+        _databasePath = [[cacheDirectory URLByAppendingPathComponent:@"TileCache.sqlite"] path];
+
+        NSMutableArray *shards = [NSMutableArray arrayWithCapacity:MBXTileCacheMemoryShardCount];
+        for(NSUInteger i = 0; i < MBXTileCacheMemoryShardCount; i++)
+        {
+            [shards addObject:[NSCache new]];
+        }
+        _memoryShards = [NSArray arrayWithArray:shards];
+        self.memoryCapacity = MBXTileCacheDefaultMemoryCapacity;
+
+        _diskCapacity = MBXTileCacheDefaultDiskCapacity;
+        _defaultTimeToLive = MBXTileCacheDefaultTimeToLive;
+
+        // All the disk tier's sqlite calls are made from this queue, so they share one connection and its prepared
+        // statements without any locking
+        //
+        _sqliteQueue = [[NSOperationQueue alloc] init];
+        [_sqliteQueue setMaxConcurrentOperationCount:1];
+        [_sqliteQueue setName:@"com.mapbox.MBXTileCache.sqlite"];
+    }
+
+    return self;
+}
+
+
+#pragma mark - Cache limits and statistics
+
+- (void)setMemoryCapacity:(NSUInteger)memoryCapacity
+{
+    _memoryCapacity = memoryCapacity;
+    for(NSCache *shard in _memoryShards)
+    {
+        shard.totalCostLimit = memoryCapacity / MBXTileCacheMemoryShardCount;
+    }
+}
+
+- (void)setDiskCapacity:(NSUInteger)diskCapacity
+{
+    _diskCapacity = diskCapacity;
+    [_sqliteQueue addOperationWithBlock:^{
+        [self sqliteEvictTilesIfNeeded];
+    }];
+}
+
+- (NSUInteger)memoryHitCount
+{
+    return (NSUInteger)atomic_load(&_memoryHits);
+}
+
+- (NSUInteger)diskHitCount
+{
+    return (NSUInteger)atomic_load(&_diskHits);
+}
+
+- (NSUInteger)staleHitCount
+{
+    return (NSUInteger)atomic_load(&_staleHits);
+}
+
+- (NSUInteger)missCount
+{
+    return (NSUInteger)atomic_load(&_misses);
+}
+
+- (double)hitRate
+{
+    double hits = (double)(atomic_load(&_memoryHits) + atomic_load(&_diskHits));
+    double lookups = hits + (double)atomic_load(&_misses);
+    return (lookups > 0 ? hits / lookups : 0.0);
+}
+
+
+#pragma mark - Looking up and storing tiles
+
++ (NSString *)keyForSource:(NSString *)source path:(MKTileOverlayPath)path
+{
+    return [NSString stringWithFormat:@"%@/%ld/%ld/%ld", source, (long)path.z, (long)path.x, (long)path.y];
+}
+
+- (NSCache *)memoryShardForKey:(NSString *)key
+{
+    return _memoryShards[[key hash] % MBXTileCacheMemoryShardCount];
+}
+
+- (void)fetchTileForSource:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileCacheLookupBlock)completionHandler
+{
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+
+    // Tiles in memory are returned right away on the calling thread
+    //
+    NSString *key = [MBXTileCache keyForSource:source path:path];
+    MBXTileCacheEntry *entry = [[self memoryShardForKey:key] objectForKey:key];
+    if(entry)
+    {
+        BOOL stale = (entry.expires <= now);
+        atomic_fetch_add(&_memoryHits, 1);
+        if(stale) atomic_fetch_add(&_staleHits, 1);
+        completionHandler(entry.data, entry.etag, stale);
+        return;
+    }
+
+    // Otherwise check the disk tier. The completion handler is called off of the sqlite queue, so that whatever the
+    // caller does with the tile doesn't hold up the next lookup.
+    //
+    [_sqliteQueue addOperationWithBlock:^{
+        MBXTileCacheEntry *diskEntry = [self sqliteEntryForSource:source path:path];
+        if(diskEntry)
+        {
+            [[self memoryShardForKey:key] setObject:diskEntry forKey:key cost:[diskEntry.data length]];
+            atomic_fetch_add(&_diskHits, 1);
+            if(diskEntry.expires <= now) atomic_fetch_add(&_staleHits, 1);
+        }
+        else
+        {
+            atomic_fetch_add(&_misses, 1);
+        }
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            completionHandler(diskEntry.data, diskEntry.etag, (diskEntry && diskEntry.expires <= now));
+        });
+    }];
+}
+
+- (void)storeTileData:(NSData *)data response:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path
+{
+    if(!data) return;
+
+    MBXTileCacheEntry *entry = [MBXTileCacheEntry new];
+    entry.data = data;
+    entry.etag = [self etagForResponse:response];
+    entry.expires = [self expirationForResponse:response];
+
+    NSString *key = [MBXTileCache keyForSource:source path:path];
+    [[self memoryShardForKey:key] setObject:entry forKey:key cost:[data length]];
+
+    [_sqliteQueue addOperationWithBlock:^{
+        [self sqliteInsertEntry:entry forSource:source path:path];
+    }];
+}
+
+- (void)refreshTileWithResponse:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path
+{
+    // The server confirmed (with a 304) that the cached tile is still current, so just give it a new expiration time
+    //
+    NSString *etag = [self etagForResponse:response];
+    NSTimeInterval expires = [self expirationForResponse:response];
+
+    NSString *key = [MBXTileCache keyForSource:source path:path];
+    MBXTileCacheEntry *entry = [[self memoryShardForKey:key] objectForKey:key];
+    if(entry)
+    {
+        MBXTileCacheEntry *refreshed = [MBXTileCacheEntry new];
+        refreshed.data = entry.data;
+        refreshed.etag = (etag ? etag : entry.etag);
+        refreshed.expires = expires;
+        [[self memoryShardForKey:key] setObject:refreshed forKey:key cost:[refreshed.data length]];
+    }
+
+    [_sqliteQueue addOperationWithBlock:^{
+        [self sqliteRefreshEntryForSource:source path:path etag:etag expires:expires];
+    }];
+}
+
+- (void)removeAllTiles
+{
+    for(NSCache *shard in _memoryShards)
+    {
+        [shard removeAllObjects];
+    }
+
+    [_sqliteQueue addOperationWithBlock:^{
+        if([self sqliteOpenDatabase])
+        {
+            char *errmsg;
+            sqlite3_exec(_database, "DELETE FROM tiles;", NULL, NULL, &errmsg);
+            if(errmsg)
+            {
+                NSLog(@"Problem clearing the tile cache: %s", errmsg);
+                sqlite3_free(errmsg);
+            }
+            _diskSize = 0;
+        }
+    }];
+}
+
+
+#pragma mark - Interpreting HTTP responses
+
+- (NSString *)etagForResponse:(NSURLResponse *)response
+{
+    if(![response isKindOfClass:[NSHTTPURLResponse class]]) return nil;
+
+    return ((NSHTTPURLResponse *)response).allHeaderFields[@"ETag"];
+}
+
+- (NSTimeInterval)expirationForResponse:(NSURLResponse *)response
+{
+    // Tiles stay fresh for the Cache-Control max-age given by the server, or for the default time to live if there
+    // isn't one. A no-cache response is stored, but has to be revalidated every time it's used.
+    //
+    NSTimeInterval timeToLive = _defaultTimeToLive;
+    if([response isKindOfClass:[NSHTTPURLResponse class]])
+    {
+        NSString *cacheControl = ((NSHTTPURLResponse *)response).allHeaderFields[@"Cache-Control"];
+        for(NSString *directive in [[cacheControl lowercaseString] componentsSeparatedByString:@","])
+        {
+            NSString *trimmed = [directive stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+            if([trimmed hasPrefix:@"max-age="])
+            {
+                timeToLive = [[trimmed substringFromIndex:[@"max-age=" length]] doubleValue];
+            }
+            else if([trimmed isEqualToString:@"no-cache"])
+            {
+                timeToLive = 0;
+                break;
+            }
+        }
+    }
+
+    return [[NSDate date] timeIntervalSince1970] + timeToLive;
+}
+
+
+#pragma mark - sqlite stuff
+
+- (BOOL)sqliteOpenDatabase
+{
+    assert(![NSThread isMainThread]);
+
+    // The cache database is opened the first time it's needed and then stays open
+    //
+    if(_database)
+    {
+        return YES;
+    }
+
+    sqlite3 *db;
+    const char *filename = [_databasePath cStringUsingEncoding:NSUTF8StringEncoding];
+    int rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if (rc)
+    {
+        NSLog(@"Can't open the tile cache database: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NO;
+    }
+
+    // This is only a cache, so it trades durability for speed. If the app is killed in the middle of a write, the worst
+    // case is that some recently downloaded tiles have to be downloaded again.
+    //
+    char *errmsg;
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem configuring the tile cache database: %s", errmsg);
+        sqlite3_free(errmsg);
+        errmsg = NULL;
+    }
+
+    sqlite3_exec(db, MBXTileCacheSchema, NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem creating the tile cache schema: %s", errmsg);
+        sqlite3_free(errmsg);
+        sqlite3_close(db);
+        return NO;
+    }
+
+    for(NSUInteger i = 0; i < MBXTileCacheStatementCount; i++)
+    {
+        if(sqlite3_prepare_v2(db, MBXTileCacheStatementSQL[i], -1, &_statements[i], NULL) != SQLITE_OK)
+        {
+            NSLog(@"Problem preparing a tile cache query: %s", sqlite3_errmsg(db));
+            for(NSUInteger j = 0; j < i; j++)
+            {
+                sqlite3_finalize(_statements[j]);
+                _statements[j] = NULL;
+            }
+            sqlite3_close(db);
+            return NO;
+        }
+    }
+    _database = db;
+    _diskSize = [self sqliteTotalSize];
+
+    return YES;
+}
+
+
+- (void)sqliteBindSource:(NSString *)source path:(MKTileOverlayPath)path toStatement:(sqlite3_stmt *)statement
+{
+    sqlite3_bind_text(statement, 1, [source UTF8String], -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(statement, 2, path.z);
+    sqlite3_bind_int64(statement, 3, path.x);
+    sqlite3_bind_int64(statement, 4, path.y);
+}
+
+
+- (MBXTileCacheEntry *)sqliteEntryForSource:(NSString *)source path:(MKTileOverlayPath)path
+{
+    assert(![NSThread isMainThread]);
+
+    if(![self sqliteOpenDatabase]) return nil;
+
+    MBXTileCacheEntry *entry;
+    NSTimeInterval accessed = 0;
+    sqlite3_stmt *select = _statements[MBXTileCacheStatementSelect];
+    [self sqliteBindSource:source path:path toStatement:select];
+    if(sqlite3_step(select) == SQLITE_ROW)
+    {
+        entry = [MBXTileCacheEntry new];
+        entry.data = [NSData dataWithBytes:sqlite3_column_blob(select, 0) length:(NSUInteger)sqlite3_column_bytes(select, 0)];
+        if(sqlite3_column_type(select, 1) != SQLITE_NULL)
+        {
+            entry.etag = [NSString stringWithUTF8String:(const char *)sqlite3_column_text(select, 1)];
+        }
+        entry.expires = sqlite3_column_double(select, 2);
+        accessed = sqlite3_column_double(select, 3);
+    }
+    sqlite3_reset(select);
+    sqlite3_clear_bindings(select);
+
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+    if(entry && now - accessed > MBXTileCacheAccessResolution)
+    {
+        sqlite3_stmt *touch = _statements[MBXTileCacheStatementTouch];
+        [self sqliteBindSource:source path:path toStatement:touch];
+        sqlite3_bind_double(touch, 5, now);
+        sqlite3_step(touch);
+        sqlite3_reset(touch);
+        sqlite3_clear_bindings(touch);
+    }
+
+    return entry;
+}
+
+
+- (void)sqliteInsertEntry:(MBXTileCacheEntry *)entry forSource:(NSString *)source path:(MKTileOverlayPath)path
+{
+    assert(![NSThread isMainThread]);
+
+    if(![self sqliteOpenDatabase]) return;
+
+    sqlite3_stmt *insert = _statements[MBXTileCacheStatementInsert];
+    [self sqliteBindSource:source path:path toStatement:insert];
+    sqlite3_bind_int64(insert, 5, (sqlite3_int64)[entry.data length]);
+    sqlite3_bind_blob(insert, 6, [entry.data bytes], (int)[entry.data length], SQLITE_STATIC);
+    if(entry.etag)
+    {
+        sqlite3_bind_text(insert, 7, [entry.etag UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    sqlite3_bind_double(insert, 8, entry.expires);
+    sqlite3_bind_double(insert, 9, [[NSDate date] timeIntervalSince1970]);
+    if(sqlite3_step(insert) == SQLITE_DONE)
+    {
+        // A replaced tile's old size is still counted here, so the running total can drift upward. It's recounted
+        // before anything is evicted.
+        //
+        _diskSize += [entry.data length];
+    }
+    else
+    {
+        NSLog(@"Problem writing to the tile cache: %s", sqlite3_errmsg(_database));
+    }
+    sqlite3_reset(insert);
+    sqlite3_clear_bindings(insert);
+
+    [self sqliteEvictTilesIfNeeded];
+}
+
+
+- (void)sqliteRefreshEntryForSource:(NSString *)source path:(MKTileOverlayPath)path etag:(NSString *)etag expires:(NSTimeInterval)expires
+{
+    assert(![NSThread isMainThread]);
+
+    if(![self sqliteOpenDatabase]) return;
+
+    sqlite3_stmt *refresh = _statements[MBXTileCacheStatementRefresh];
+    [self sqliteBindSource:source path:path toStatement:refresh];
+    if(etag)
+    {
+        sqlite3_bind_text(refresh, 5, [etag UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    sqlite3_bind_double(refresh, 6, expires);
+    sqlite3_bind_double(refresh, 7, [[NSDate date] timeIntervalSince1970]);
+    if(sqlite3_step(refresh) != SQLITE_DONE)
+    {
+        NSLog(@"Problem writing to the tile cache: %s", sqlite3_errmsg(_database));
+    }
+    sqlite3_reset(refresh);
+    sqlite3_clear_bindings(refresh);
+}
+
+
+- (NSUInteger)sqliteTotalSize
+{
+    sqlite3_stmt *totalSize = _statements[MBXTileCacheStatementTotalSize];
+    NSUInteger size = 0;
+    if(sqlite3_step(totalSize) == SQLITE_ROW)
+    {
+        size = (NSUInteger)sqlite3_column_int64(totalSize, 0);
+    }
+    sqlite3_reset(totalSize);
+    return size;
+}
+
+
+- (void)sqliteEvictTilesIfNeeded
+{
+    assert(![NSThread isMainThread]);
+
+    if(!_database || _diskSize <= _diskCapacity) return;
+
+    _diskSize = [self sqliteTotalSize];
+    if(_diskSize <= _diskCapacity) return;
+
+    // Remove the least recently used tiles in one transaction until the disk tier is comfortably under its capacity
+    //
+    NSUInteger target = (NSUInteger)(_diskCapacity * MBXTileCacheDiskEvictionTarget);
+    sqlite3_exec(_database, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+
+    sqlite3_stmt *selectOldest = _statements[MBXTileCacheStatementSelectOldest];
+    sqlite3_stmt *deleteRow = _statements[MBXTileCacheStatementDelete];
+    NSMutableArray *rowids = [NSMutableArray array];
+    while(_diskSize > target && sqlite3_step(selectOldest) == SQLITE_ROW)
+    {
+        [rowids addObject:@(sqlite3_column_int64(selectOldest, 0))];
+        _diskSize -= MIN(_diskSize, (NSUInteger)sqlite3_column_int64(selectOldest, 1));
+    }
+    sqlite3_reset(selectOldest);
+
+    for(NSNumber *rowid in rowids)
+    {
+        sqlite3_bind_int64(deleteRow, 1, [rowid longLongValue]);
+        sqlite3_step(deleteRow);
+        sqlite3_reset(deleteRow);
+    }
+    sqlite3_clear_bindings(deleteRow);
+
+    char *errmsg;
+    sqlite3_exec(_database, "COMMIT;", NULL, NULL, &errmsg);
+    if(errmsg)
+    {
+        NSLog(@"Problem evicting tiles from the tile cache: %s", errmsg);
+        sqlite3_free(errmsg);
+        _diskSize = [self sqliteTotalSize];
+    }
+}
+
+@end
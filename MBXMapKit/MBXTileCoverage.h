@@ -0,0 +1,68 @@
+//
+//  MBXTileCoverage.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+@import MapKit;
+
+#import "MBXConstantsAndTypes.h"
+
+/** An `MBXTileCoverage` object describes an area of the map as the set of tiles which cover it at each zoom level. It is used with `MBXOfflineMapDownloader` to download only the tiles which are actually needed for irregular areas, such as a park boundary or a route, rather than every tile in their bounding box.
+*
+*   A coverage is made from a region, from polygons, or from a polyline with a buffer distance around it. Coverages can be combined with `coverageByAddingCoverage:`. Areas which cross the antimeridian are handled, and latitudes beyond the limits of the spherical mercator projection (about ±85.05°) are clamped.
+*
+*   Tiles are counted exactly, so the number of tiles and the approximate size of a download can be checked before it is begun. Coverage objects are immutable and can be used from any thread. */
+@interface MBXTileCoverage : NSObject
+
+
+#pragma mark -
+
+/** @name Creating a Tile Coverage */
+
+/** Returns a coverage of the tiles which overlap a rectangular region of the map.
+*   @param mapRegion The region of the map to cover. Its longitude span may cross the antimeridian. */
++ (instancetype)coverageWithMapRegion:(MKCoordinateRegion)mapRegion;
+
+/** Returns a coverage of the tiles which overlap any of several polygons.
+*
+*   The interior polygons of each polygon are treated as holes. Tiles which fall entirely within a hole aren't covered. A multipolygon can be given as an array with one `MKPolygon` for each of its parts.
+*   @param polygons An array of `MKPolygon` objects. */
++ (instancetype)coverageWithPolygons:(NSArray *)polygons;
+
+/** Returns a coverage of the tiles which lie within a distance of a polyline, such as a road route or a river.
+*   @param polyline The polyline to cover.
+*   @param bufferDistance How far from the polyline to cover, in meters. */
++ (instancetype)coverageWithPolyline:(MKPolyline *)polyline bufferDistance:(CLLocationDistance)bufferDistance;
+
+/** Returns a coverage of the tiles which are in either the receiver or another coverage.
+*   @param coverage The coverage to combine with the receiver. */
+- (MBXTileCoverage *)coverageByAddingCoverage:(MBXTileCoverage *)coverage;
+
+
+#pragma mark -
+
+/** @name Inspecting a Tile Coverage */
+
+/** The smallest region of the map which contains the whole coverage. */
+@property (readonly, nonatomic) MKCoordinateRegion boundingMapRegion;
+
+/** Returns the number of tiles in the coverage over a range of zoom levels.
+*   @param minimumZ The minimum zoom level.
+*   @param maximumZ The maximum zoom level.
+*   @return The number of tiles, counting each zoom level separately, or `NSNotFound` if there isn't enough memory to work out the coverage of an irregular area at such high zoom levels. */
+- (NSUInteger)tileCountForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ;
+
+/** Returns a rough estimate of how many bytes of tile images an offline map of the coverage would take.
+*
+*   The estimate is based on typical tile sizes for each image quality, and on the scale factor of the tiles, since tiles for retina screens are about three times as large. Actual tile sizes vary a lot from map to map, so the estimate is only good for giving users an idea of the size of a download.
+*   @param minimumZ The minimum zoom level.
+*   @param maximumZ The maximum zoom level.
+*   @param imageQuality The image quality which the tiles would be requested with.
+*   @param scaleFactor The scale factor of the screen which the tiles would be downloaded for, such as `[[UIScreen mainScreen] scale]`. The screen isn't checked here, so that the estimate can be made from any thread.
+*   @return The estimated number of bytes, or `0` if the number of tiles can't be worked out. */
+- (unsigned long long)estimatedByteCountForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ imageQuality:(MBXRasterImageQuality)imageQuality scaleFactor:(CGFloat)scaleFactor;
+
+@end
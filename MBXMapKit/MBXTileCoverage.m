@@ -0,0 +1,749 @@
+//
+//  MBXTileCoverage.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMapKit.h"
+
+
+#pragma mark - Private API for creating verbose errors
+
+@interface NSError (MBXError)
+
++ (NSError *)mbx_errorWithCode:(NSInteger)code reason:(NSString *)reason description:(NSString *)description;
+
+@end
+
+
+#pragma mark - Rasterizer
+
+// The tile coverage of each shape is worked out by a scanline rasterizer written in plain C, so that it doesn't depend
+// on MapKit and can be used elsewhere. Shapes are given in normalized spherical mercator coordinates, where the world
+// runs from 0 to 1 in x (west to east) and y (north to south), so the tile containing a point at zoom z is simply
+// floor(x * 2^z), floor(y * 2^z). Longitudes are unwrapped rather than kept within the world, so x may be less than 0 or
+// greater than 1 for shapes which cross the antimeridian, and tile columns are wrapped around at the end.
+//
+typedef struct {
+    double x;
+    double y;
+} MBXTileCoveragePoint;
+
+typedef struct {
+    long minX;
+    long maxX;
+} MBXTileCoverageSpan;
+
+typedef struct {
+    MBXTileCoverageSpan *spans;
+    size_t count;
+    size_t capacity;
+} MBXTileCoverageRow;
+
+// Edges are stored with y0 <= y1, since the even-odd rule doesn't depend on their direction
+//
+typedef struct {
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+} MBXTileCoverageEdge;
+
+static double const MBXTileCoverageMaximumLatitude = 85.0511287798;
+static double const MBXTileCoverageEarthCircumference = 40075016.686;
+static long const MBXTileCoverageMaximumZ = 30;
+
+
+static int MBXTileCoverageCompareEdges(const void *a, const void *b)
+{
+    double ya = ((const MBXTileCoverageEdge *)a)->y0;
+    double yb = ((const MBXTileCoverageEdge *)b)->y0;
+    return (ya < yb ? -1 : (ya > yb ? 1 : 0));
+}
+
+
+static int MBXTileCoverageCompareDoubles(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da < db ? -1 : (da > db ? 1 : 0));
+}
+
+
+static int MBXTileCoverageCompareSpans(const void *a, const void *b)
+{
+    long la = ((const MBXTileCoverageSpan *)a)->minX;
+    long lb = ((const MBXTileCoverageSpan *)b)->minX;
+    return (la < lb ? -1 : (la > lb ? 1 : 0));
+}
+
+
+static bool MBXTileCoverageRowAddSpan(MBXTileCoverageRow *row, long minX, long maxX)
+{
+    if(row->count == row->capacity)
+    {
+        size_t capacity = (row->capacity ? row->capacity * 2 : 4);
+        MBXTileCoverageSpan *spans = realloc(row->spans, capacity * sizeof(MBXTileCoverageSpan));
+        if(!spans)
+        {
+            return false;
+        }
+        row->spans = spans;
+        row->capacity = capacity;
+    }
+    row->spans[row->count].minX = minX;
+    row->spans[row->count].maxX = maxX;
+    row->count++;
+    return true;
+}
+
+
+// Adds the tiles touched by the open interval between xa and xb. An interval which ends exactly on a tile boundary
+// doesn't include the tile beyond it. A zero-width interval, from a vertical edge, counts the tile it's in, unless it
+// lies exactly on a tile boundary, where the tiles on either side are counted by the parts of the shape next to it.
+//
+static bool MBXTileCoverageRowAddInterval(MBXTileCoverageRow *row, double xa, double xb)
+{
+    double lo = floor(MIN(xa, xb));
+    if(xa == xb && lo == xa)
+    {
+        return true;
+    }
+    double hi = MAX(lo, ceil(MAX(xa, xb)) - 1.0);
+    return MBXTileCoverageRowAddSpan(row, (long)lo, (long)hi);
+}
+
+
+static double MBXTileCoverageEdgeXAtY(const MBXTileCoverageEdge *edge, double y)
+{
+    return edge->x0 + (edge->x1 - edge->x0) * (y - edge->y0) / (edge->y1 - edge->y0);
+}
+
+
+static void MBXTileCoverageSortAndMergeSpans(MBXTileCoverageRow *row)
+{
+    if(row->count < 2)
+    {
+        return;
+    }
+    qsort(row->spans, row->count, sizeof(MBXTileCoverageSpan), MBXTileCoverageCompareSpans);
+    size_t merged = 0;
+    for(size_t i = 1; i < row->count; i++)
+    {
+        if(row->spans[i].minX <= row->spans[merged].maxX + 1)
+        {
+            row->spans[merged].maxX = MAX(row->spans[merged].maxX, row->spans[i].maxX);
+        }
+        else
+        {
+            row->spans[++merged] = row->spans[i];
+        }
+    }
+    row->count = merged + 1;
+}
+
+
+// Merges a row's spans and wraps them into the world's columns, splitting any span which crosses the antimeridian
+//
+static bool MBXTileCoverageNormalizeRow(MBXTileCoverageRow *row, long tilesPerSide)
+{
+    MBXTileCoverageSortAndMergeSpans(row);
+    if(row->count == 0 || (row->spans[0].minX >= 0 && row->spans[row->count - 1].maxX < tilesPerSide))
+    {
+        return true;
+    }
+
+    MBXTileCoverageRow wrapped = { NULL, 0, 0 };
+    bool success = true;
+    for(size_t i = 0; i < row->count && success; i++)
+    {
+        long width = row->spans[i].maxX - row->spans[i].minX + 1;
+        if(width >= tilesPerSide)
+        {
+            success = MBXTileCoverageRowAddSpan(&wrapped, 0, tilesPerSide - 1);
+            continue;
+        }
+        long lo = ((row->spans[i].minX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+        long hi = lo + width - 1;
+        if(hi < tilesPerSide)
+        {
+            success = MBXTileCoverageRowAddSpan(&wrapped, lo, hi);
+        }
+        else
+        {
+            success = (MBXTileCoverageRowAddSpan(&wrapped, lo, tilesPerSide - 1) &&
+                       MBXTileCoverageRowAddSpan(&wrapped, 0, hi - tilesPerSide));
+        }
+    }
+    free(row->spans);
+    *row = wrapped;
+    MBXTileCoverageSortAndMergeSpans(row);
+    return success;
+}
+
+
+// Adds the tiles covered by one shape (an outer ring and any holes, filled with the even-odd rule) to the rows from
+// firstRow onward. The tiles covered in each row are the union of the spans of the edges crossing the row, and of the
+// inside of the shape along the top and bottom of the row. Any point of the shape within the row lies on a vertical
+// line between an edge and another edge or the top or bottom of the row, so nothing is missed, and since only the parts
+// of the edges within the row are counted, no tiles are added which the shape doesn't actually overlap.
+//
+static bool MBXTileCoverageRasterizeShape(const MBXTileCoveragePoint *const *rings, const size_t *ringCounts, size_t ringCount, long tilesPerSide, MBXTileCoverageRow *rows, long firstRow, long lastRow)
+{
+    size_t edgeCapacity = 0;
+    for(size_t i = 0; i < ringCount; i++)
+    {
+        edgeCapacity += ringCounts[i];
+    }
+    if(edgeCapacity == 0)
+    {
+        return true;
+    }
+
+    MBXTileCoverageEdge *edges = malloc(edgeCapacity * sizeof(MBXTileCoverageEdge));
+    size_t *active = malloc(edgeCapacity * sizeof(size_t));
+    double *crossings = malloc(edgeCapacity * sizeof(double));
+    if(!edges || !active || !crossings)
+    {
+        free(edges);
+        free(active);
+        free(crossings);
+        return false;
+    }
+
+    size_t edgeCount = 0;
+    double minY = INFINITY;
+    double maxY = -INFINITY;
+    double scale = (double)tilesPerSide;
+    for(size_t i = 0; i < ringCount; i++)
+    {
+        const MBXTileCoveragePoint *ring = rings[i];
+        size_t count = ringCounts[i];
+        for(size_t j = 0; j < count && count > 1; j++)
+        {
+            MBXTileCoveragePoint a = ring[j];
+            MBXTileCoveragePoint b = ring[(j + 1) % count];
+            if(a.y > b.y)
+            {
+                MBXTileCoveragePoint swap = a;
+                a = b;
+                b = swap;
+            }
+            edges[edgeCount].x0 = a.x * scale;
+            edges[edgeCount].y0 = a.y * scale;
+            edges[edgeCount].x1 = b.x * scale;
+            edges[edgeCount].y1 = b.y * scale;
+            minY = MIN(minY, edges[edgeCount].y0);
+            maxY = MAX(maxY, edges[edgeCount].y1);
+            edgeCount++;
+        }
+    }
+    qsort(edges, edgeCount, sizeof(MBXTileCoverageEdge), MBXTileCoverageCompareEdges);
+
+    bool success = true;
+    size_t next = 0;
+    size_t activeCount = 0;
+    long startRow = MAX(firstRow, (long)floor(minY));
+    long endRow = MIN(lastRow, (long)ceil(maxY) - 1);
+    for(long r = startRow; r <= endRow && success && edgeCount > 0; r++)
+    {
+        MBXTileCoverageRow *row = &rows[r - firstRow];
+        double top = (double)r;
+        double bottom = (double)(r + 1);
+
+        // Update the active edge table to hold the edges which overlap this row
+        //
+        while(next < edgeCount && edges[next].y0 < bottom)
+        {
+            active[activeCount++] = next++;
+        }
+        size_t kept = 0;
+        for(size_t i = 0; i < activeCount; i++)
+        {
+            if(edges[active[i]].y1 > top)
+            {
+                active[kept++] = active[i];
+            }
+        }
+        activeCount = kept;
+
+        // Add the span of each edge within the row. Horizontal edges lying exactly on the top or bottom of the row
+        // were dropped above or haven't been added yet, since they don't overlap the row's inside.
+        //
+        for(size_t i = 0; i < activeCount && success; i++)
+        {
+            const MBXTileCoverageEdge *edge = &edges[active[i]];
+            if(edge->y1 > edge->y0)
+            {
+                double ya = MAX(edge->y0, top);
+                double yb = MIN(edge->y1, bottom);
+                success = MBXTileCoverageRowAddInterval(row, MBXTileCoverageEdgeXAtY(edge, ya), MBXTileCoverageEdgeXAtY(edge, yb));
+            }
+            else if(edge->y0 > top && edge->y0 < bottom)
+            {
+                success = MBXTileCoverageRowAddInterval(row, edge->x0, edge->x1);
+            }
+        }
+
+        // Add the inside of the shape just below the top of the row and just above the bottom of the row. Which edges
+        // count as crossing a line is decided with half-open intervals, so that vertices on the line aren't counted
+        // twice, and are counted on the side of the line which is inside the row.
+        //
+        for(int line = 0; line < 2 && success; line++)
+        {
+            double y = (line == 0 ? top : bottom);
+            size_t crossingCount = 0;
+            for(size_t i = 0; i < activeCount; i++)
+            {
+                const MBXTileCoverageEdge *edge = &edges[active[i]];
+                bool crosses = (line == 0 ? (edge->y0 <= y && y < edge->y1) : (edge->y0 < y && y <= edge->y1));
+                if(crosses)
+                {
+                    crossings[crossingCount++] = MBXTileCoverageEdgeXAtY(edge, y);
+                }
+            }
+            qsort(crossings, crossingCount, sizeof(double), MBXTileCoverageCompareDoubles);
+            for(size_t i = 0; i + 1 < crossingCount && success; i += 2)
+            {
+                success = MBXTileCoverageRowAddInterval(row, crossings[i], crossings[i + 1]);
+            }
+        }
+    }
+
+    free(edges);
+    free(active);
+    free(crossings);
+    return success;
+}
+
+
+static double MBXTileCoverageYForLatitude(CLLocationDegrees latitude)
+{
+    double radians = MAX(MIN(latitude, MBXTileCoverageMaximumLatitude), -MBXTileCoverageMaximumLatitude) * M_PI / 180.0;
+    return (1.0 - log(tan(radians) + 1.0 / cos(radians)) / M_PI) / 2.0;
+}
+
+
+static CLLocationDegrees MBXTileCoverageLatitudeForY(double y)
+{
+    return atan(sinh(M_PI * (1.0 - 2.0 * y))) * 180.0 / M_PI;
+}
+
+
+// Converts map points to normalized coordinates, clamping them to the limits of the projection and unwrapping their
+// longitudes so that no two consecutive points are more than half the world apart
+//
+static void MBXTileCoverageNormalizeMapPoints(const MKMapPoint *mapPoints, NSUInteger count, MBXTileCoveragePoint *points)
+{
+    for(NSUInteger i = 0; i < count; i++)
+    {
+        points[i].x = mapPoints[i].x / MKMapSizeWorld.width;
+        points[i].y = MAX(MIN(mapPoints[i].y / MKMapSizeWorld.height, 1.0), 0.0);
+        if(i > 0)
+        {
+            points[i].x -= round(points[i].x - points[i - 1].x);
+        }
+    }
+}
+
+
+#pragma mark - Typical tile sizes
+
+// These are rough averages of the sizes of 256 pixel tiles at each image quality, taken from a mix of street and
+// satellite maps. Retina tiles are 512 pixels and about three times as large.
+//
+static unsigned long long MBXTileCoverageTypicalTileSize(MBXRasterImageQuality imageQuality)
+{
+    switch(imageQuality)
+    {
+        case MBXRasterImageQualityPNG32: return 8 * 1024;
+        case MBXRasterImageQualityPNG64: return 10 * 1024;
+        case MBXRasterImageQualityPNG128: return 12 * 1024;
+        case MBXRasterImageQualityPNG256: return 14 * 1024;
+        case MBXRasterImageQualityJPEG70: return 12 * 1024;
+        case MBXRasterImageQualityJPEG80: return 15 * 1024;
+        case MBXRasterImageQualityJPEG90: return 20 * 1024;
+        case MBXRasterImageQualityFull:
+        default: return 18 * 1024;
+    }
+}
+
+
+#pragma mark -
+
+@interface MBXTileCoverage ()
+
+// Each shape is an array of rings, and each ring is an NSData holding an array of MBXTileCoveragePoint. The first ring
+// of a shape is its outside, and any others are holes. The coverage is the union of the shapes.
+//
+@property (nonatomic) NSArray *shapes;
+@property (nonatomic) BOOL rectangular;
+@property (nonatomic) double minX;
+@property (nonatomic) double maxX;
+@property (nonatomic) double minY;
+@property (nonatomic) double maxY;
+
+@end
+
+
+@implementation MBXTileCoverage
+
+
+#pragma mark - Creating tile coverages
+
+- (instancetype)initWithShapes:(NSArray *)shapes
+{
+    self = [super init];
+
+    if (self)
+    {
+        _shapes = shapes;
+        _minX = INFINITY;
+        _maxX = -INFINITY;
+        _minY = INFINITY;
+        _maxY = -INFINITY;
+        for(NSArray *shape in shapes)
+        {
+            NSData *outside = [shape firstObject];
+            const MBXTileCoveragePoint *points = outside.bytes;
+            NSUInteger count = outside.length / sizeof(MBXTileCoveragePoint);
+            for(NSUInteger i = 0; i < count; i++)
+            {
+                _minX = MIN(_minX, points[i].x);
+                _maxX = MAX(_maxX, points[i].x);
+                _minY = MIN(_minY, points[i].y);
+                _maxY = MAX(_maxY, points[i].y);
+            }
+        }
+    }
+
+    return self;
+}
+
+
++ (instancetype)coverageWithMapRegion:(MKCoordinateRegion)mapRegion
+{
+    double minX = (mapRegion.center.longitude - mapRegion.span.longitudeDelta / 2.0 + 180.0) / 360.0;
+    double maxX = minX + MIN(MAX(mapRegion.span.longitudeDelta, 0.0), 360.0) / 360.0;
+    double minY = MBXTileCoverageYForLatitude(mapRegion.center.latitude + mapRegion.span.latitudeDelta / 2.0);
+    double maxY = MBXTileCoverageYForLatitude(mapRegion.center.latitude - mapRegion.span.latitudeDelta / 2.0);
+
+    MBXTileCoveragePoint ring[4] = { { minX, minY }, { maxX, minY }, { maxX, maxY }, { minX, maxY } };
+    NSArray *shape = @[ [NSData dataWithBytes:ring length:sizeof(ring)] ];
+    MBXTileCoverage *coverage = [[self alloc] initWithShapes:@[ shape ]];
+    coverage.rectangular = YES;
+    return coverage;
+}
+
+
++ (instancetype)coverageWithPolygons:(NSArray *)polygons
+{
+    NSMutableArray *shapes = [[NSMutableArray alloc] init];
+    for(MKPolygon *polygon in polygons)
+    {
+        NSMutableArray *shape = [[NSMutableArray alloc] init];
+        NSMutableArray *ringPolygons = [NSMutableArray arrayWithObject:polygon];
+        if(polygon.interiorPolygons)
+        {
+            [ringPolygons addObjectsFromArray:polygon.interiorPolygons];
+        }
+        for(MKPolygon *ringPolygon in ringPolygons)
+        {
+            NSMutableData *ring = [NSMutableData dataWithLength:ringPolygon.pointCount * sizeof(MBXTileCoveragePoint)];
+            MBXTileCoverageNormalizeMapPoints(ringPolygon.points, ringPolygon.pointCount, ring.mutableBytes);
+            [shape addObject:ring];
+        }
+
+        // Holes are unwrapped separately, so move each one next to the outside of the polygon if it ended up a world
+        // away from it
+        //
+        const MBXTileCoveragePoint *outside = [[shape firstObject] bytes];
+        for(NSUInteger i = 1; i < [shape count] && polygon.pointCount > 0; i++)
+        {
+            NSMutableData *hole = shape[i];
+            MBXTileCoveragePoint *points = hole.mutableBytes;
+            NSUInteger count = hole.length / sizeof(MBXTileCoveragePoint);
+            double shift = (count > 0 ? round(points[0].x - outside[0].x) : 0.0);
+            for(NSUInteger j = 0; j < count; j++)
+            {
+                points[j].x -= shift;
+            }
+        }
+
+        if(polygon.pointCount > 0)
+        {
+            [shapes addObject:shape];
+        }
+    }
+    return [[self alloc] initWithShapes:shapes];
+}
+
+
++ (instancetype)coverageWithPolyline:(MKPolyline *)polyline bufferDistance:(CLLocationDistance)bufferDistance
+{
+    // The buffer is built as the union of a rectangle around each segment and an octagon around each vertex, which
+    // rounds the joins and ends without missing any tiles. Spherical mercator is conformal, so a distance on the ground
+    // is the same length in x and y at any point, and only needs to be scaled for the latitude. Each segment uses the
+    // larger scale of its two ends, so the buffer is never narrower than asked for.
+    //
+    NSUInteger count = polyline.pointCount;
+    NSMutableData *pointData = [NSMutableData dataWithLength:count * sizeof(MBXTileCoveragePoint)];
+    MBXTileCoveragePoint *points = pointData.mutableBytes;
+    MBXTileCoverageNormalizeMapPoints(polyline.points, count, points);
+
+    double meters = MAX(bufferDistance, 1.0);
+    double octagonRadiusFactor = 1.0 / cos(M_PI / 8.0);
+    NSMutableArray *shapes = [[NSMutableArray alloc] init];
+    for(NSUInteger i = 0; i < count; i++)
+    {
+        double latitude = MBXTileCoverageLatitudeForY(points[i].y);
+        double distance = meters / (MBXTileCoverageEarthCircumference * cos(latitude * M_PI / 180.0));
+
+        MBXTileCoveragePoint octagon[8];
+        for(int k = 0; k < 8; k++)
+        {
+            double angle = M_PI / 8.0 + k * M_PI / 4.0;
+            octagon[k].x = points[i].x + distance * octagonRadiusFactor * cos(angle);
+            octagon[k].y = MAX(MIN(points[i].y + distance * octagonRadiusFactor * sin(angle), 1.0), 0.0);
+        }
+        [shapes addObject:@[ [NSData dataWithBytes:octagon length:sizeof(octagon)] ]];
+
+        if(i + 1 < count)
+        {
+            MBXTileCoveragePoint a = points[i];
+            MBXTileCoveragePoint b = points[i + 1];
+            double length = hypot(b.x - a.x, b.y - a.y);
+            if(length > 0.0)
+            {
+                double nextLatitude = MBXTileCoverageLatitudeForY(b.y);
+                double segmentDistance = MAX(distance, meters / (MBXTileCoverageEarthCircumference * cos(nextLatitude * M_PI / 180.0)));
+                double nx = -(b.y - a.y) / length * segmentDistance;
+                double ny = (b.x - a.x) / length * segmentDistance;
+                MBXTileCoveragePoint quad[4] = {
+                    { a.x + nx, a.y + ny }, { b.x + nx, b.y + ny }, { b.x - nx, b.y - ny }, { a.x - nx, a.y - ny }
+                };
+                for(int k = 0; k < 4; k++)
+                {
+                    quad[k].y = MAX(MIN(quad[k].y, 1.0), 0.0);
+                }
+                [shapes addObject:@[ [NSData dataWithBytes:quad length:sizeof(quad)] ]];
+            }
+        }
+    }
+    return [[self alloc] initWithShapes:shapes];
+}
+
+
+- (MBXTileCoverage *)coverageByAddingCoverage:(MBXTileCoverage *)coverage
+{
+    return [[MBXTileCoverage alloc] initWithShapes:[_shapes arrayByAddingObjectsFromArray:coverage.shapes]];
+}
+
+
+#pragma mark - Inspecting tile coverages
+
+- (MKCoordinateRegion)boundingMapRegion
+{
+    if([_shapes count] == 0)
+    {
+        return MKCoordinateRegionMake(CLLocationCoordinate2DMake(0, 0), MKCoordinateSpanMake(0, 0));
+    }
+
+    CLLocationDegrees north = MBXTileCoverageLatitudeForY(_minY);
+    CLLocationDegrees south = MBXTileCoverageLatitudeForY(_maxY);
+    CLLocationDegrees longitudeDelta = MIN((_maxX - _minX) * 360.0, 360.0);
+    CLLocationDegrees longitude = (_minX + _maxX) / 2.0 * 360.0 - 180.0;
+    longitude -= 360.0 * floor((longitude + 180.0) / 360.0);
+    return MKCoordinateRegionMake(CLLocationCoordinate2DMake((north + south) / 2.0, longitude), MKCoordinateSpanMake(north - south, longitudeDelta));
+}
+
+
+- (NSUInteger)tileCountForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ
+{
+    __block NSUInteger tileCount = 0;
+    NSError *error;
+    BOOL success = [self enumerateTileRangesForMinimumZ:minimumZ maximumZ:maximumZ withError:&error usingBlock:^(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY) {
+        tileCount += (NSUInteger)((maxX - minX + 1) * (maxY - minY + 1));
+    }];
+    if(!success)
+    {
+        NSLog(@"Unable to count the tiles in a tile coverage: %@",error);
+        return NSNotFound;
+    }
+    return tileCount;
+}
+
+
+- (unsigned long long)estimatedByteCountForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ imageQuality:(MBXRasterImageQuality)imageQuality scaleFactor:(CGFloat)scaleFactor
+{
+    NSUInteger tileCount = [self tileCountForMinimumZ:minimumZ maximumZ:maximumZ];
+    if(tileCount == NSNotFound)
+    {
+        return 0;
+    }
+
+    unsigned long long tileSize = MBXTileCoverageTypicalTileSize(imageQuality);
+    if(scaleFactor > 1.0)
+    {
+        tileSize *= 3;
+    }
+    return tileCount * tileSize;
+}
+
+
+#pragma mark - Enumerating covered tiles
+
+- (BOOL)enumerateRowsAtZoom:(NSInteger)z usingBlock:(void (^)(long y, const MBXTileCoverageSpan *spans, size_t count))block
+{
+    if([_shapes count] == 0)
+    {
+        return YES;
+    }
+
+    // Rasterize each shape into a shared table of rows, so that overlapping shapes are merged into their union
+    //
+    long tilesPerSide = 1L << z;
+    long firstRow = MIN(MAX((long)floor(_minY * tilesPerSide), 0), tilesPerSide - 1);
+    long lastRow = MAX(MIN((long)ceil(_maxY * tilesPerSide) - 1, tilesPerSide - 1), firstRow);
+    MBXTileCoverageRow *rows = calloc((size_t)(lastRow - firstRow + 1), sizeof(MBXTileCoverageRow));
+    if(!rows)
+    {
+        return NO;
+    }
+
+    bool success = true;
+    for(NSArray *shape in _shapes)
+    {
+        size_t ringCount = [shape count];
+        const MBXTileCoveragePoint *rings[ringCount];
+        size_t ringCounts[ringCount];
+        for(size_t i = 0; i < ringCount; i++)
+        {
+            NSData *ring = shape[i];
+            rings[i] = ring.bytes;
+            ringCounts[i] = ring.length / sizeof(MBXTileCoveragePoint);
+        }
+        success = MBXTileCoverageRasterizeShape(rings, ringCounts, ringCount, tilesPerSide, rows, firstRow, lastRow);
+        if(!success)
+        {
+            break;
+        }
+    }
+
+    for(long y = firstRow; y <= lastRow; y++)
+    {
+        MBXTileCoverageRow *row = &rows[y - firstRow];
+        if(success)
+        {
+            success = MBXTileCoverageNormalizeRow(row, tilesPerSide);
+        }
+        if(success)
+        {
+            block(y, row->spans, row->count);
+        }
+        free(row->spans);
+    }
+    free(rows);
+
+    return success;
+}
+
+
+- (void)enumerateRectangularTileRangesAtZoom:(NSInteger)z usingBlock:(void (^)(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY))block
+{
+    // A coverage made from a region is one rectangle, so its tiles at each zoom level can be worked out directly, with
+    // the same rules for tile boundaries as the rasterizer, and without allocating anything for its rows. A region which
+    // crosses the antimeridian comes out as two ranges.
+    //
+    long tilesPerSide = 1L << z;
+    double scale = (double)tilesPerSide;
+    long minY = MIN(MAX((long)floor(_minY * scale), 0), tilesPerSide - 1);
+    long maxY = MAX(MIN((long)ceil(_maxY * scale) - 1, tilesPerSide - 1), minY);
+    long minX = (long)floor(_minX * scale);
+    long width = MAX(minX, (long)ceil(_maxX * scale) - 1) - minX + 1;
+    if(width >= tilesPerSide)
+    {
+        block(z, 0, tilesPerSide - 1, minY, maxY);
+        return;
+    }
+    minX = ((minX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+    long maxX = minX + width - 1;
+    if(maxX < tilesPerSide)
+    {
+        block(z, minX, maxX, minY, maxY);
+    }
+    else
+    {
+        block(z, 0, maxX - tilesPerSide, minY, maxY);
+        block(z, minX, tilesPerSide - 1, minY, maxY);
+    }
+}
+
+
+- (BOOL)enumerateTileRangesForMinimumZ:(NSInteger)minimumZ maximumZ:(NSInteger)maximumZ withError:(NSError **)error usingBlock:(void (^)(NSInteger z, NSInteger minX, NSInteger maxX, NSInteger minY, NSInteger maxY))block
+{
+    // Rows with the same spans as the row above them are merged into rectangular ranges, so an irregular shape comes out
+    // as a range for each run of matching rows. Regions don't need to be rasterized at all.
+    //
+    for(NSInteger z = MAX(minimumZ, 0); z <= MIN(maximumZ, MBXTileCoverageMaximumZ); z++)
+    {
+        if(_rectangular)
+        {
+            [self enumerateRectangularTileRangesAtZoom:z usingBlock:block];
+            continue;
+        }
+
+        __block MBXTileCoverageRow open = { NULL, 0, 0 };
+        __block long openMinY = 0;
+        __block long openMaxY = -1;
+        __block BOOL success = YES;
+        void (^closeRanges)(void) = ^{
+            for(size_t i = 0; i < open.count; i++)
+            {
+                block(z, open.spans[i].minX, open.spans[i].maxX, openMinY, openMaxY);
+            }
+            open.count = 0;
+        };
+
+        success = [self enumerateRowsAtZoom:z usingBlock:^(long y, const MBXTileCoverageSpan *spans, size_t count) {
+            if(!success)
+            {
+                return;
+            }
+            if(count == open.count && y == openMaxY + 1 && (count == 0 || memcmp(spans, open.spans, count * sizeof(MBXTileCoverageSpan)) == 0))
+            {
+                openMaxY = y;
+                return;
+            }
+            closeRanges();
+            for(size_t i = 0; i < count && success; i++)
+            {
+                success = MBXTileCoverageRowAddSpan(&open, spans[i].minX, spans[i].maxX);
+            }
+            openMinY = y;
+            openMaxY = y;
+        }] && success;
+        if(success)
+        {
+            closeRanges();
+        }
+        free(open.spans);
+
+        if(!success)
+        {
+            // Ranges which were already passed to the block are complete, but the rest of this zoom level is missing, so
+            // the caller has to give up on the coverage rather than use part of it
+            //
+            if(error)
+            {
+                NSString *reason = [NSString stringWithFormat:@"Not enough memory to work out the tile coverage at zoom level %ld", (long)z];
+                *error = [NSError mbx_errorWithCode:MBXMapKitErrorCodeTileCoverageOutOfMemory reason:reason description:@"Tile coverage too large"];
+            }
+            return NO;
+        }
+    }
+    return YES;
+}
+
+@end
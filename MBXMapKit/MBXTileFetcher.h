@@ -0,0 +1,39 @@
+//
+//  MBXTileFetcher.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+
+/** `MBXTileFetcher` makes the network requests for map tiles on behalf of every `MBXRasterTileOverlay`, `MBXRasterTileRenderer`, and the `MBXOfflineMapDownloader` in the process.
+*
+*   Requests are coalesced by tile. While a tile is being fetched, any other request for the same tile waits for that fetch instead of starting its own, and every waiter gets the same response. A fetch is canceled once everything waiting for it has given up, for example because its overlay was sent `invalidateAndCancel`.
+*
+*   A single, shared instance of `MBXTileFetcher` exists and should be accessed with the `sharedTileFetcher` class method. */
+@interface MBXTileFetcher : NSObject
+
+
+#pragma mark -
+
+/** @name Accessing the Shared Tile Fetcher */
+
+/** Returns the shared tile fetcher. */
++ (MBXTileFetcher *)sharedTileFetcher;
+
+
+#pragma mark -
+
+/** @name Measuring Request Coalescing */
+
+/** The number of tile requests which were sent to the network. */
+@property (readonly, nonatomic) NSUInteger networkRequestCount;
+
+/** The number of tile requests which were saved by waiting for a fetch of the same tile which was already in flight. */
+@property (readonly, nonatomic) NSUInteger coalescedRequestCount;
+
+/** The number of tile requests which were canceled because nothing was waiting for them anymore. */
+@property (readonly, nonatomic) NSUInteger canceledRequestCount;
+
+@end
@@ -0,0 +1,453 @@
+//
+//  MBXTileFetcher.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMapKit.h"
+
+#import <stdatomic.h>
+
+typedef void (^MBXTileCacheLookupBlock)(NSData *data, NSString *etag, BOOL stale);
+typedef void (^MBXTileFetcherCompletionBlock)(NSData *data, NSURLResponse *response, NSError *error);
+
+
+#pragma mark - Private API for cooperating with MBXTileCache
+
+@interface MBXTileCache ()
+
+- (void)fetchTileForSource:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileCacheLookupBlock)completionHandler;
+- (void)storeTileData:(NSData *)data response:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path;
+- (void)refreshTileWithResponse:(NSURLResponse *)response forSource:(NSString *)source path:(MKTileOverlayPath)path;
+
+@end
+
+
+#pragma mark - Private API for cooperating with MBXTileMetrics
+
+@interface MBXTileMetrics ()
+
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+
+#pragma mark - Fetches and the requests waiting on them
+
+@class MBXTileFetch;
+
+@interface MBXTileFetchWaiter : NSObject
+
+@property (nonatomic, copy) MBXTileFetcherCompletionBlock completionHandler;
+@property (nonatomic, weak) MBXTileFetch *fetch;
+@property (nonatomic) BOOL prefetch;
+@property BOOL canceled;
+
+@end
+
+@implementation MBXTileFetchWaiter
+
+@end
+
+
+@interface MBXTileFetch : NSObject
+
+@property (nonatomic) NSString *key;
+@property (nonatomic) NSString *source;
+@property (nonatomic) MKTileOverlayPath path;
+@property (nonatomic) NSURLSessionDataTask *task;
+@property (nonatomic) NSMutableArray *waiters;
+@property (nonatomic) BOOL cachesResponse;
+@property (nonatomic) BOOL revalidatesCachedTile;
+@property (nonatomic) BOOL prefetch;
+@property (nonatomic) BOOL active;
+@property (nonatomic) uint64_t startTime;
+
+@end
+
+@implementation MBXTileFetch
+
+@end
+
+
+#pragma mark -
+
+@interface MBXTileFetcher ()
+
+@property (nonatomic) NSURLSession *dataSession;
+@property (nonatomic) NSMutableDictionary *fetches;
+
+// These are used by MBXRasterTileOverlay, MBXRasterTileRenderer, and MBXOfflineMapDownloader, which declare them in
+// their own class extensions
+//
+- (id)loadTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (id)fetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path cachesResponse:(BOOL)cachesResponse completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (id)prefetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler;
+- (void)cancelLoad:(id)load;
+- (NSUInteger)foregroundFetchCount;
+
+@end
+
+
+@implementation MBXTileFetcher
+{
+    NSUInteger _foregroundFetches;
+    _Atomic uint64_t _networkRequests;
+    _Atomic uint64_t _coalescedRequests;
+    _Atomic uint64_t _canceledRequests;
+}
+
+
+#pragma mark - Shared fetcher instance
+
++ (MBXTileFetcher *)sharedTileFetcher
+{
+    static id _sharedTileFetcher = nil;
+    static dispatch_once_t onceToken;
+
+    dispatch_once(&onceToken, ^{
+        _sharedTileFetcher = [[self alloc] init];
+    });
+
+    return _sharedTileFetcher;
+}
+
+
+#pragma mark - Initialization
+
+- (instancetype)init
+{
+    // NOTE: MBXTileFetcher is designed with the intention that init should be used _only_ by +sharedTileFetcher, since
+    // requests can only be coalesced if everything goes through the same fetcher.
+    //
+    self = [super init];
+
+    if(self)
+    {
+        // Tiles are cached by MBXTileCache, so the session doesn't need a URL cache of its own
+        //
+        NSURLSessionConfiguration *config = [NSURLSessionConfiguration defaultSessionConfiguration];
+        config.allowsCellularAccess = YES;
+        config.URLCache = nil;
+        config.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        config.HTTPAdditionalHeaders = @{ @"User-Agent" : [MBXMapKit userAgent] };
+        _dataSession = [NSURLSession sessionWithConfiguration:config];
+
+        _fetches = [[NSMutableDictionary alloc] init];
+    }
+
+    return self;
+}
+
+
+#pragma mark - Statistics
+
+- (NSUInteger)networkRequestCount
+{
+    return (NSUInteger)atomic_load(&_networkRequests);
+}
+
+- (NSUInteger)coalescedRequestCount
+{
+    return (NSUInteger)atomic_load(&_coalescedRequests);
+}
+
+- (NSUInteger)canceledRequestCount
+{
+    return (NSUInteger)atomic_load(&_canceledRequests);
+}
+
+
+#pragma mark - Loading tiles
+
+- (id)loadTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler
+{
+    // Look in the shared tile cache before going to the network. A fresh cached tile is used as is. A stale one is used
+    // right away too, but it's also revalidated with its ETag so that the next request for it gets a current copy. The
+    // revalidation doesn't belong to this request, so it carries on even if this request is canceled.
+    //
+    // Tiles which come from the cache have a nil response.
+    //
+    MBXTileFetchWaiter *waiter = [MBXTileFetchWaiter new];
+    waiter.completionHandler = completionHandler;
+
+    MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+    uint64_t lookupStartTime = [metrics startTime];
+
+    [[MBXTileCache sharedTileCache] fetchTileForSource:source path:path completionHandler:^(NSData *cachedData, NSString *etag, BOOL stale)
+    {
+        [metrics recordStage:MBXTileMetricsStageCacheLookup startTime:lookupStartTime];
+        if(lookupStartTime) [metrics addValue:1 toCounter:(cachedData ? MBXTileMetricsCounterCacheHits : MBXTileMetricsCounterCacheMisses)];
+
+        if(cachedData)
+        {
+            if(stale)
+            {
+                [self joinFetchForURL:url source:source path:path etag:etag cachesResponse:YES waiter:nil];
+            }
+            [self completeWaiter:waiter data:cachedData response:nil error:nil];
+        }
+        else
+        {
+            [self joinFetchForURL:url source:source path:path etag:nil cachesResponse:YES waiter:waiter];
+        }
+    }];
+
+    return waiter;
+}
+
+- (id)fetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path cachesResponse:(BOOL)cachesResponse completionHandler:(MBXTileFetcherCompletionBlock)completionHandler
+{
+    // Go straight to the network, but share a fetch of the same tile if one is already in flight
+    //
+    MBXTileFetchWaiter *waiter = [MBXTileFetchWaiter new];
+    waiter.completionHandler = completionHandler;
+
+    [self joinFetchForURL:url source:source path:path etag:nil cachesResponse:cachesResponse waiter:waiter];
+
+    return waiter;
+}
+
+- (id)prefetchTileWithURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path completionHandler:(MBXTileFetcherCompletionBlock)completionHandler
+{
+    // Speculatively fetch a tile into the shared tile cache. Tiles which are already cached, even stale ones, are left
+    // alone, and the completion handler gets nil data for them. Prefetches are sent at a low priority, and they're
+    // promoted if something which actually needs the tile joins them.
+    //
+    MBXTileFetchWaiter *waiter = [MBXTileFetchWaiter new];
+    waiter.completionHandler = completionHandler;
+    waiter.prefetch = YES;
+
+    [[MBXTileCache sharedTileCache] fetchTileForSource:source path:path completionHandler:^(NSData *cachedData, NSString *etag, BOOL stale)
+    {
+        if(cachedData)
+        {
+            [self completeWaiter:waiter data:nil response:nil error:nil];
+        }
+        else
+        {
+            [self joinFetchForURL:url source:source path:path etag:nil cachesResponse:YES waiter:waiter];
+        }
+    }];
+
+    return waiter;
+}
+
+- (NSUInteger)foregroundFetchCount
+{
+    // The number of fetches in flight which something other than a prefetch is waiting for
+    //
+    @synchronized(self)
+    {
+        return _foregroundFetches;
+    }
+}
+
+- (void)cancelLoad:(id)load
+{
+    MBXTileFetchWaiter *waiter = (MBXTileFetchWaiter *)load;
+    NSURLSessionDataTask *task;
+
+    @synchronized(self)
+    {
+        if(waiter.canceled) return;
+        waiter.canceled = YES;
+
+        MBXTileFetch *fetch = waiter.fetch;
+        if(fetch)
+        {
+            [fetch.waiters removeObject:waiter];
+            waiter.fetch = nil;
+
+            // When nothing is waiting for a fetch anymore, cancel its request, unless it's revalidating a cached tile
+            //
+            if([fetch.waiters count] == 0 && !fetch.revalidatesCachedTile)
+            {
+                if(_fetches[fetch.key] == fetch) [_fetches removeObjectForKey:fetch.key];
+                [self deactivateFetch:fetch];
+                task = fetch.task;
+                atomic_fetch_add(&_canceledRequests, 1);
+            }
+        }
+    }
+
+    [task cancel];
+
+    // Whoever is waiting still hears back, so that anything counting loads in progress sees this one finish
+    //
+    [self completeWaiter:waiter data:nil response:nil error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+}
+
+- (void)completeWaiter:(MBXTileFetchWaiter *)waiter data:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error
+{
+    // A waiter's completion handler is called exactly once, with either the tile or the cancellation, whichever comes first
+    //
+    MBXTileFetcherCompletionBlock completionHandler;
+    @synchronized(waiter)
+    {
+        completionHandler = waiter.completionHandler;
+        waiter.completionHandler = nil;
+    }
+    if(completionHandler) completionHandler(data, response, error);
+}
+
+- (void)joinFetchForURL:(NSURL *)url source:(NSString *)source path:(MKTileOverlayPath)path etag:(NSString *)etag cachesResponse:(BOOL)cachesResponse waiter:(MBXTileFetchWaiter *)waiter
+{
+    // Fetches are keyed by the tile, and also by the ETag of a revalidation, since a 304 response is only useful to
+    // requests which already have the cached tile
+    //
+    NSString *key = [NSString stringWithFormat:@"%@/%ld/%ld/%ld%@", source, (long)path.z, (long)path.x, (long)path.y, (etag ? [@"#" stringByAppendingString:etag] : @"")];
+    MBXTileFetch *fetch;
+    BOOL started = NO;
+
+    @synchronized(self)
+    {
+        if(waiter.canceled) return;
+
+        fetch = _fetches[key];
+        if(fetch)
+        {
+            if(waiter) atomic_fetch_add(&_coalescedRequests, 1);
+
+            // A tile which was only being prefetched is now actually needed, so stop treating its request as speculative
+            //
+            if(fetch.prefetch && !waiter.prefetch)
+            {
+                fetch.prefetch = NO;
+                _foregroundFetches += 1;
+                [self setPriority:0.5 forTask:fetch.task];
+            }
+        }
+        else
+        {
+            fetch = [MBXTileFetch new];
+            fetch.key = key;
+            fetch.source = source;
+            fetch.path = path;
+            fetch.waiters = [[NSMutableArray alloc] init];
+            fetch.prefetch = waiter.prefetch;
+            fetch.active = YES;
+            fetch.startTime = [[MBXTileMetrics sharedTileMetrics] startTime];
+
+            NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:60];
+            if(etag) [request setValue:etag forHTTPHeaderField:@"If-None-Match"];
+
+            // The task and the fetch refer to each other until the request finishes, which keeps the fetch alive even
+            // if it has no waiters
+            //
+            fetch.task = [_dataSession dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
+            {
+                [self finishFetch:fetch data:data response:response error:error];
+            }];
+
+            _fetches[key] = fetch;
+            started = YES;
+            atomic_fetch_add(&_networkRequests, 1);
+
+            if(fetch.prefetch)
+            {
+                [self setPriority:0.25 forTask:fetch.task];
+            }
+            else
+            {
+                _foregroundFetches += 1;
+            }
+        }
+
+        if(waiter)
+        {
+            [fetch.waiters addObject:waiter];
+            waiter.fetch = fetch;
+        }
+        else
+        {
+            fetch.revalidatesCachedTile = YES;
+        }
+        fetch.cachesResponse = fetch.cachesResponse || cachesResponse;
+    }
+
+    if(started) [fetch.task resume];
+}
+
+- (void)deactivateFetch:(MBXTileFetch *)fetch
+{
+    // This must be called while synchronized on self
+    //
+    if(fetch.active && !fetch.prefetch)
+    {
+        _foregroundFetches -= 1;
+    }
+    fetch.active = NO;
+}
+
+- (void)setPriority:(float)priority forTask:(NSURLSessionDataTask *)task
+{
+    // Task priorities are only available starting with iOS 8. The values are those of NSURLSessionTaskPriorityLow and
+    // NSURLSessionTaskPriorityDefault, which can't be referred to directly on iOS 7.
+    //
+    if([task respondsToSelector:@selector(setPriority:)])
+    {
+        task.priority = priority;
+    }
+}
+
+- (void)finishFetch:(MBXTileFetch *)fetch data:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error
+{
+    NSArray *waiters;
+    BOOL cachesResponse;
+
+    @synchronized(self)
+    {
+        if(_fetches[fetch.key] == fetch) [_fetches removeObjectForKey:fetch.key];
+        [self deactivateFetch:fetch];
+        waiters = [NSArray arrayWithArray:fetch.waiters];
+        [fetch.waiters removeAllObjects];
+        for(MBXTileFetchWaiter *waiter in waiters)
+        {
+            waiter.fetch = nil;
+        }
+        cachesResponse = fetch.cachesResponse;
+        fetch.task = nil;
+    }
+
+    // Canceled requests aren't measured, since they say nothing about how long the network takes
+    //
+    if(fetch.startTime && !(error && [error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled))
+    {
+        MBXTileMetrics *metrics = [MBXTileMetrics sharedTileMetrics];
+        [metrics recordStage:MBXTileMetricsStageFetch startTime:fetch.startTime];
+        if(error)
+        {
+            [metrics addValue:1 toCounter:MBXTileMetricsCounterFetchErrors];
+        }
+        else
+        {
+            [metrics addValue:data.length toCounter:MBXTileMetricsCounterBytesReceived];
+        }
+    }
+
+    // The cache is updated once per request, no matter how many waiters there were
+    //
+    if(!error && cachesResponse && [response isKindOfClass:[NSHTTPURLResponse class]])
+    {
+        NSInteger statusCode = ((NSHTTPURLResponse *)response).statusCode;
+        if(statusCode == 304)
+        {
+            [[MBXTileCache sharedTileCache] refreshTileWithResponse:response forSource:fetch.source path:fetch.path];
+        }
+        else if(statusCode == 200)
+        {
+            [[MBXTileCache sharedTileCache] storeTileData:data response:response forSource:fetch.source path:fetch.path];
+        }
+    }
+
+    for(MBXTileFetchWaiter *waiter in waiters)
+    {
+        [self completeWaiter:waiter data:data response:response error:error];
+    }
+}
+
+@end
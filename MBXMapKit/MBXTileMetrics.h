@@ -0,0 +1,151 @@
+//
+//  MBXTileMetrics.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+
+@class MBXTileMetrics;
+@class MBXTileMetricsSnapshot;
+
+
+#pragma mark - Stages and counters
+
+/** The stages of loading and drawing a map tile which `MBXTileMetrics` measures. */
+typedef NS_ENUM(NSUInteger, MBXTileMetricsStage) {
+    /** From when `MBXRasterTileRenderer` asks for a tile which it doesn't have, to when the tile is decoded and ready to draw. */
+    MBXTileMetricsStageTotal = 0,
+    /** Looking up a tile in the shared `MBXTileCache`. */
+    MBXTileMetricsStageCacheLookup = 1,
+    /** Looking up a tile in an offline map database. */
+    MBXTileMetricsStageDatabaseLookup = 2,
+    /** Fetching a tile from the network, from sending the request to receiving the whole response. */
+    MBXTileMetricsStageFetch = 3,
+    /** Fetching metadata, markers, or a marker icon for an `MBXRasterTileOverlay` from the network. */
+    MBXTileMetricsStageResourceFetch = 4,
+    /** Decoding a tile image into bitmaps. */
+    MBXTileMetricsStageDecode = 5,
+    /** Drawing a decoded tile in `-[MBXRasterTileRenderer drawMapRect:zoomScale:inContext:]`. */
+    MBXTileMetricsStageDraw = 6,
+    MBXTileMetricsStageCount
+};
+
+/** The events which `MBXTileMetrics` counts. */
+typedef NS_ENUM(NSUInteger, MBXTileMetricsCounter) {
+    /** The number of bytes received from the network for map tiles and other resources. */
+    MBXTileMetricsCounterBytesReceived = 0,
+    /** The number of tiles found in the shared `MBXTileCache`. */
+    MBXTileMetricsCounterCacheHits = 1,
+    /** The number of tiles not found in the shared `MBXTileCache`. */
+    MBXTileMetricsCounterCacheMisses = 2,
+    /** The number of tiles found in an offline map database. */
+    MBXTileMetricsCounterDatabaseHits = 3,
+    /** The number of tiles not found in an offline map database. */
+    MBXTileMetricsCounterDatabaseMisses = 4,
+    /** The number of network requests which failed. */
+    MBXTileMetricsCounterFetchErrors = 5,
+    /** The number of offline map download requests which were retried. */
+    MBXTileMetricsCounterRetries = 6,
+    /** The number of times an sqlite database was busy when it was read or written. */
+    MBXTileMetricsCounterSqliteBusy = 7,
+    MBXTileMetricsCounterCount
+};
+
+
+#pragma mark - Delegate protocol for periodic snapshots
+
+/** The `MBXTileMetricsDelegate` protocol is for receiving snapshots of the tile metrics at regular intervals, for example to log them or to report them to an analytics service. */
+@protocol MBXTileMetricsDelegate <NSObject>
+
+/** Delivers a snapshot of the tile metrics. This is called on the main thread every `snapshotInterval` seconds while the metrics are enabled.
+*   @param metrics The tile metrics.
+*   @param snapshot A snapshot of all the values collected since the metrics were enabled or last reset. */
+- (void)tileMetrics:(MBXTileMetrics *)metrics didTakeSnapshot:(MBXTileMetricsSnapshot *)snapshot;
+
+@end
+
+
+#pragma mark - Snapshots
+
+/** An `MBXTileMetricsSnapshot` holds the values of the tile metrics at one point in time. Snapshots are immutable. */
+@interface MBXTileMetricsSnapshot : NSObject
+
+/** @name Getting Snapshot Values */
+
+/** When the snapshot was taken. */
+@property (readonly, nonatomic) NSDate *date;
+
+/** Returns how many times a stage was measured.
+*   @param stage The stage. */
+- (NSUInteger)sampleCountForStage:(MBXTileMetricsStage)stage;
+
+/** Returns the average duration of a stage, in seconds.
+*   @param stage The stage. */
+- (NSTimeInterval)averageDurationForStage:(MBXTileMetricsStage)stage;
+
+/** Returns a percentile of the durations of a stage, in seconds.
+*
+*   Durations are collected in a histogram with a bucket for each power of two microseconds, so the result is the upper bound of the bucket which contains the percentile, and may be up to twice the actual value.
+*   @param stage The stage.
+*   @param percentile The percentile, from `0.0` to `1.0`. For example, `0.99` for the 99th percentile. */
+- (NSTimeInterval)durationForStage:(MBXTileMetricsStage)stage percentile:(double)percentile;
+
+/** Returns the value of a counter.
+*   @param counter The counter. */
+- (uint64_t)valueForCounter:(MBXTileMetricsCounter)counter;
+
+/** Returns a snapshot of the changes from an earlier snapshot to the receiver, for measuring an interval of time.
+*   @param snapshot An earlier snapshot. */
+- (MBXTileMetricsSnapshot *)snapshotBySubtractingSnapshot:(MBXTileMetricsSnapshot *)snapshot;
+
+/** Returns the snapshot's values as a dictionary of strings and numbers, which can be serialized with `NSJSONSerialization`. */
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+
+#pragma mark - Tile metrics
+
+/** `MBXTileMetrics` measures how long map tiles spend in each stage of loading and drawing across every `MBXRasterTileOverlay`, `MBXRasterTileRenderer`, and the `MBXOfflineMapDownloader` in the process, and counts the events which affect it, such as cache hits and network errors. It is meant for setting latency budgets and catching slowdowns in production builds.
+*
+*   The metrics are disabled by default, and cost next to nothing while they're disabled. While enabled, each measurement is a few atomic additions to a histogram, without any locking. The values can be read at any time with `snapshot`, or delivered periodically to a delegate.
+*
+*   A single, shared instance of `MBXTileMetrics` exists and should be accessed with the `sharedTileMetrics` class method. */
+@interface MBXTileMetrics : NSObject
+
+
+#pragma mark -
+
+/** @name Accessing the Shared Tile Metrics */
+
+/** Returns the shared tile metrics. */
++ (MBXTileMetrics *)sharedTileMetrics;
+
+
+#pragma mark -
+
+/** @name Collecting Metrics */
+
+/** Whether tile metrics are being collected. The default value is `NO`. */
+@property (nonatomic, getter=isEnabled) BOOL enabled;
+
+/** Returns a snapshot of the values collected since the metrics were enabled or last reset. */
+- (MBXTileMetricsSnapshot *)snapshot;
+
+/** Sets all the collected values back to zero. */
+- (void)reset;
+
+
+#pragma mark -
+
+/** @name Receiving Periodic Snapshots */
+
+/** The delegate which receives periodic snapshots. */
+@property (weak, nonatomic) id<MBXTileMetricsDelegate> delegate;
+
+/** How often the delegate receives a snapshot, in seconds. The default value is `60`. */
+@property (nonatomic) NSTimeInterval snapshotInterval;
+
+@end
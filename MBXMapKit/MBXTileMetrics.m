@@ -0,0 +1,392 @@
+//
+//  MBXTileMetrics.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMapKit.h"
+
+#import <mach/mach_time.h>
+#import <stdatomic.h>
+
+
+#pragma mark - Histogram configuration
+
+// Durations are kept in microseconds, in a histogram with one bucket for each power of two. Bucket 0 holds durations
+// under 1 µs, bucket b holds durations from 2^(b-1) µs up to 2^b µs, and the last bucket holds everything longer.
+//
+#define MBXTileMetricsBucketCount 32
+
+static NSTimeInterval const MBXTileMetricsDefaultSnapshotInterval = 60.0;
+
+typedef struct {
+    uint64_t buckets[MBXTileMetricsStageCount][MBXTileMetricsBucketCount];
+    uint64_t samples[MBXTileMetricsStageCount];
+    uint64_t microseconds[MBXTileMetricsStageCount];
+    uint64_t counters[MBXTileMetricsCounterCount];
+} MBXTileMetricsValues;
+
+
+static NSUInteger MBXTileMetricsBucketForMicroseconds(uint64_t microseconds)
+{
+    if (microseconds == 0) return 0;
+    NSUInteger bucket = (NSUInteger)(64 - __builtin_clzll(microseconds));
+    return MIN(bucket, (NSUInteger)MBXTileMetricsBucketCount - 1);
+}
+
+
+static uint64_t MBXTileMetricsDifference(uint64_t later, uint64_t earlier)
+{
+    return (later > earlier ? later - earlier : 0);
+}
+
+
+static NSString *MBXTileMetricsStageName(MBXTileMetricsStage stage)
+{
+    switch (stage)
+    {
+        case MBXTileMetricsStageTotal:          return @"total";
+        case MBXTileMetricsStageCacheLookup:    return @"cacheLookup";
+        case MBXTileMetricsStageDatabaseLookup: return @"databaseLookup";
+        case MBXTileMetricsStageFetch:          return @"fetch";
+        case MBXTileMetricsStageResourceFetch:  return @"resourceFetch";
+        case MBXTileMetricsStageDecode:         return @"decode";
+        case MBXTileMetricsStageDraw:           return @"draw";
+        default:                                return @"unknown";
+    }
+}
+
+
+static NSString *MBXTileMetricsCounterName(MBXTileMetricsCounter counter)
+{
+    switch (counter)
+    {
+        case MBXTileMetricsCounterBytesReceived:  return @"bytesReceived";
+        case MBXTileMetricsCounterCacheHits:      return @"cacheHits";
+        case MBXTileMetricsCounterCacheMisses:    return @"cacheMisses";
+        case MBXTileMetricsCounterDatabaseHits:   return @"databaseHits";
+        case MBXTileMetricsCounterDatabaseMisses: return @"databaseMisses";
+        case MBXTileMetricsCounterFetchErrors:    return @"fetchErrors";
+        case MBXTileMetricsCounterRetries:        return @"retries";
+        case MBXTileMetricsCounterSqliteBusy:     return @"sqliteBusy";
+        default:                                  return @"unknown";
+    }
+}
+
+
+#pragma mark - Snapshots
+
+@interface MBXTileMetricsSnapshot ()
+
+@property (readwrite, nonatomic) NSDate *date;
+@property (nonatomic) MBXTileMetricsValues values;
+
+@end
+
+
+@implementation MBXTileMetricsSnapshot
+
+- (instancetype)initWithDate:(NSDate *)date values:(const MBXTileMetricsValues *)values
+{
+    self = [super init];
+
+    if (self)
+    {
+        _date = date;
+        _values = *values;
+    }
+
+    return self;
+}
+
+
+- (NSUInteger)sampleCountForStage:(MBXTileMetricsStage)stage
+{
+    if (stage >= MBXTileMetricsStageCount) return 0;
+
+    return (NSUInteger)_values.samples[stage];
+}
+
+
+- (NSTimeInterval)averageDurationForStage:(MBXTileMetricsStage)stage
+{
+    if (stage >= MBXTileMetricsStageCount || _values.samples[stage] == 0) return 0.0;
+
+    return (double)_values.microseconds[stage] / (double)_values.samples[stage] / 1000000.0;
+}
+
+
+- (NSTimeInterval)durationForStage:(MBXTileMetricsStage)stage percentile:(double)percentile
+{
+    if (stage >= MBXTileMetricsStageCount || _values.samples[stage] == 0) return 0.0;
+
+    // Walk the buckets until they hold the requested fraction of the samples
+    //
+    uint64_t target = (uint64_t)ceil(MAX(0.0, MIN(percentile, 1.0)) * (double)_values.samples[stage]);
+    uint64_t seen = 0;
+    for (NSUInteger bucket = 0; bucket < MBXTileMetricsBucketCount; bucket++)
+    {
+        seen += _values.buckets[stage][bucket];
+        if (seen >= target && seen > 0) return (double)((uint64_t)1 << bucket) / 1000000.0;
+    }
+    return (double)((uint64_t)1 << (MBXTileMetricsBucketCount - 1)) / 1000000.0;
+}
+
+
+- (uint64_t)valueForCounter:(MBXTileMetricsCounter)counter
+{
+    if (counter >= MBXTileMetricsCounterCount) return 0;
+
+    return _values.counters[counter];
+}
+
+
+- (MBXTileMetricsSnapshot *)snapshotBySubtractingSnapshot:(MBXTileMetricsSnapshot *)snapshot
+{
+    // A reset between the two snapshots can make some values go down, so differences are clamped at zero
+    //
+    const MBXTileMetricsValues *later = &_values;
+    MBXTileMetricsValues earlier = snapshot.values;
+    MBXTileMetricsValues difference;
+    for (NSUInteger stage = 0; stage < MBXTileMetricsStageCount; stage++)
+    {
+        for (NSUInteger bucket = 0; bucket < MBXTileMetricsBucketCount; bucket++)
+        {
+            difference.buckets[stage][bucket] = MBXTileMetricsDifference(later->buckets[stage][bucket], earlier.buckets[stage][bucket]);
+        }
+        difference.samples[stage] = MBXTileMetricsDifference(later->samples[stage], earlier.samples[stage]);
+        difference.microseconds[stage] = MBXTileMetricsDifference(later->microseconds[stage], earlier.microseconds[stage]);
+    }
+    for (NSUInteger counter = 0; counter < MBXTileMetricsCounterCount; counter++)
+    {
+        difference.counters[counter] = MBXTileMetricsDifference(later->counters[counter], earlier.counters[counter]);
+    }
+    return [[MBXTileMetricsSnapshot alloc] initWithDate:_date values:&difference];
+}
+
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    NSMutableDictionary *stages = [[NSMutableDictionary alloc] init];
+    for (NSUInteger stage = 0; stage < MBXTileMetricsStageCount; stage++)
+    {
+        stages[MBXTileMetricsStageName(stage)] = @{ @"count" : @([self sampleCountForStage:stage]),
+                                                    @"average" : @([self averageDurationForStage:stage]),
+                                                    @"p50" : @([self durationForStage:stage percentile:0.50]),
+                                                    @"p90" : @([self durationForStage:stage percentile:0.90]),
+                                                    @"p99" : @([self durationForStage:stage percentile:0.99]) };
+    }
+
+    NSMutableDictionary *counters = [[NSMutableDictionary alloc] init];
+    for (NSUInteger counter = 0; counter < MBXTileMetricsCounterCount; counter++)
+    {
+        counters[MBXTileMetricsCounterName(counter)] = @([self valueForCounter:counter]);
+    }
+
+    return @{ @"date" : @([_date timeIntervalSince1970]), @"stages" : stages, @"counters" : counters };
+}
+
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; %@>", [self class], self, [self dictionaryRepresentation]];
+}
+
+@end
+
+
+#pragma mark - Private API for recording measurements
+
+@interface MBXTileMetrics ()
+
+@property (nonatomic) dispatch_source_t snapshotTimer;
+
+// These are used by MBXRasterTileOverlay, MBXRasterTileRenderer, MBXTileFetcher, MBXOfflineMapDatabase, and
+// MBXOfflineMapDownloader, which declare them in their own class extensions
+//
+- (uint64_t)startTime;
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime;
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter;
+
+@end
+
+
+@implementation MBXTileMetrics
+{
+    atomic_bool _collecting;
+    double _microsecondsPerTick;
+    _Atomic uint64_t _buckets[MBXTileMetricsStageCount][MBXTileMetricsBucketCount];
+    _Atomic uint64_t _samples[MBXTileMetricsStageCount];
+    _Atomic uint64_t _microseconds[MBXTileMetricsStageCount];
+    _Atomic uint64_t _counters[MBXTileMetricsCounterCount];
+}
+
+
+#pragma mark - Shared metrics instance
+
++ (MBXTileMetrics *)sharedTileMetrics
+{
+    static id _sharedTileMetrics = nil;
+    static dispatch_once_t onceToken;
+
+    dispatch_once(&onceToken, ^{
+        _sharedTileMetrics = [[self alloc] init];
+    });
+
+    return _sharedTileMetrics;
+}
+
+
+- (instancetype)init
+{
+    self = [super init];
+
+    if (self)
+    {
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        _microsecondsPerTick = (double)timebase.numer / (double)timebase.denom / 1000.0;
+        _snapshotInterval = MBXTileMetricsDefaultSnapshotInterval;
+        atomic_init(&_collecting, false);
+    }
+
+    return self;
+}
+
+
+#pragma mark - Recording measurements
+
+- (uint64_t)startTime
+{
+    // A start time of 0 means the measurement isn't being taken, which is what makes the metrics close to free while
+    // they're disabled: the caller does no more than this check, and recordStage:startTime: returns right away
+    //
+    if (!atomic_load_explicit(&_collecting, memory_order_relaxed)) return 0;
+
+    return MAX(mach_absolute_time(), (uint64_t)1);
+}
+
+
+- (void)recordStage:(MBXTileMetricsStage)stage startTime:(uint64_t)startTime
+{
+    if (startTime == 0 || stage >= MBXTileMetricsStageCount || !atomic_load_explicit(&_collecting, memory_order_relaxed)) return;
+
+    uint64_t now = mach_absolute_time();
+    uint64_t microseconds = (now > startTime ? (uint64_t)((double)(now - startTime) * _microsecondsPerTick) : 0);
+
+    atomic_fetch_add_explicit(&_buckets[stage][MBXTileMetricsBucketForMicroseconds(microseconds)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_samples[stage], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_microseconds[stage], microseconds, memory_order_relaxed);
+}
+
+
+- (void)addValue:(uint64_t)value toCounter:(MBXTileMetricsCounter)counter
+{
+    if (counter >= MBXTileMetricsCounterCount || !atomic_load_explicit(&_collecting, memory_order_relaxed)) return;
+
+    atomic_fetch_add_explicit(&_counters[counter], value, memory_order_relaxed);
+}
+
+
+#pragma mark - Reading measurements
+
+- (BOOL)isEnabled
+{
+    return atomic_load(&_collecting);
+}
+
+
+- (void)setEnabled:(BOOL)enabled
+{
+    atomic_store(&_collecting, (bool)enabled);
+    [self updateSnapshotTimer];
+}
+
+
+- (MBXTileMetricsSnapshot *)snapshot
+{
+    // The values are read one at a time while measurements may still be arriving, so a snapshot can be a few
+    // measurements out of step with itself, which doesn't matter for histograms of thousands of samples
+    //
+    MBXTileMetricsValues values;
+    for (NSUInteger stage = 0; stage < MBXTileMetricsStageCount; stage++)
+    {
+        for (NSUInteger bucket = 0; bucket < MBXTileMetricsBucketCount; bucket++)
+        {
+            values.buckets[stage][bucket] = atomic_load_explicit(&_buckets[stage][bucket], memory_order_relaxed);
+        }
+        values.samples[stage] = atomic_load_explicit(&_samples[stage], memory_order_relaxed);
+        values.microseconds[stage] = atomic_load_explicit(&_microseconds[stage], memory_order_relaxed);
+    }
+    for (NSUInteger counter = 0; counter < MBXTileMetricsCounterCount; counter++)
+    {
+        values.counters[counter] = atomic_load_explicit(&_counters[counter], memory_order_relaxed);
+    }
+    return [[MBXTileMetricsSnapshot alloc] initWithDate:[NSDate date] values:&values];
+}
+
+
+- (void)reset
+{
+    for (NSUInteger stage = 0; stage < MBXTileMetricsStageCount; stage++)
+    {
+        for (NSUInteger bucket = 0; bucket < MBXTileMetricsBucketCount; bucket++)
+        {
+            atomic_store_explicit(&_buckets[stage][bucket], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&_samples[stage], 0, memory_order_relaxed);
+        atomic_store_explicit(&_microseconds[stage], 0, memory_order_relaxed);
+    }
+    for (NSUInteger counter = 0; counter < MBXTileMetricsCounterCount; counter++)
+    {
+        atomic_store_explicit(&_counters[counter], 0, memory_order_relaxed);
+    }
+}
+
+
+#pragma mark - Periodic snapshots
+
+- (void)setDelegate:(id<MBXTileMetricsDelegate>)delegate
+{
+    _delegate = delegate;
+    [self updateSnapshotTimer];
+}
+
+
+- (void)setSnapshotInterval:(NSTimeInterval)snapshotInterval
+{
+    _snapshotInterval = snapshotInterval;
+    [self updateSnapshotTimer];
+}
+
+
+- (void)updateSnapshotTimer
+{
+    // The timer only runs while there is something for it to do
+    //
+    @synchronized(self)
+    {
+        if (_snapshotTimer)
+        {
+            dispatch_source_cancel(_snapshotTimer);
+            _snapshotTimer = nil;
+        }
+
+        if ([self isEnabled] && _delegate && _snapshotInterval > 0)
+        {
+            uint64_t interval = (uint64_t)(_snapshotInterval * NSEC_PER_SEC);
+            _snapshotTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+            dispatch_source_set_timer(_snapshotTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+
+            __weak MBXTileMetrics *weakSelf = self;
+            dispatch_source_set_event_handler(_snapshotTimer, ^{
+                MBXTileMetrics *metrics = weakSelf;
+                [metrics.delegate tileMetrics:metrics didTakeSnapshot:[metrics snapshot]];
+            });
+            dispatch_resume(_snapshotTimer);
+        }
+    }
+}
+
+@end
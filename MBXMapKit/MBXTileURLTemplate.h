@@ -0,0 +1,71 @@
+//
+//  MBXTileURLTemplate.h
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+@import Foundation;
+@import MapKit;
+
+#import "MBXConstantsAndTypes.h"
+
+/** An `MBXTileURLTemplate` turns tile paths into tile URLs. The template is parsed once when it's created, so making a URL for each tile is just a matter of copying its pieces and writing out the numbers, without any format string parsing.
+*
+*   Templates are strings with placeholders in curly braces:
+*
+*   - `{z}`, `{x}`, and `{y}` are the tile's zoom level, column, and row.
+*   - `{-y}` is the tile's row counted from the bottom of the map, as used by TMS servers.
+*   - `{quadkey}` is the tile's quadkey, as used by Bing Maps.
+*   - `{s}` is one of the template's hosts, so that tiles can be spread across several hosts or subdomains and more of them can load at once. Each tile always gets the same host, so caches along the way still work.
+*   - `{r}` is `@2x` for tiles on retina screens, and empty otherwise.
+*   - `{q}` is the file extension for the template's image quality, such as `png` or `jpg80`.
+*   - `{access_token}` is the current value of `+[MBXMapKit accessToken]`.
+*
+*   Anything else in curly braces is left as it is. For example, `https://{s}.tile.example.com/{z}/{x}/{y}{r}.png` with the hosts `a`, `b`, and `c`. Templates are immutable and can be used from any thread. */
+@interface MBXTileURLTemplate : NSObject
+
+
+#pragma mark -
+
+/** @name Creating a Tile URL Template */
+
+/** Returns a tile URL template for a template string.
+*   @param templateString The template string.
+*   @param hosts An array of strings to substitute for `{s}`. This may be `nil` or empty if the template doesn't use `{s}`.
+*   @param imageQuality The image quality to substitute for `{q}`.
+*   @return A tile URL template, or `nil` if the template uses `{s}` but no hosts were given. */
++ (instancetype)templateWithString:(NSString *)templateString hosts:(NSArray *)hosts imageQuality:(MBXRasterImageQuality)imageQuality;
+
+/** Initializes a tile URL template with a template string.
+*   @param templateString The template string.
+*   @param hosts An array of strings to substitute for `{s}`. This may be `nil` or empty if the template doesn't use `{s}`.
+*   @param imageQuality The image quality to substitute for `{q}`.
+*   @return An initialized tile URL template, or `nil` if the template uses `{s}` but no hosts were given. */
+- (instancetype)initWithString:(NSString *)templateString hosts:(NSArray *)hosts imageQuality:(MBXRasterImageQuality)imageQuality;
+
+
+#pragma mark -
+
+/** @name Getting Template Properties */
+
+/** The template string which the template was created with. */
+@property (readonly, nonatomic) NSString *templateString;
+
+/** The hosts which are substituted for `{s}`. */
+@property (readonly, nonatomic) NSArray *hosts;
+
+/** The image quality which is substituted for `{q}`. */
+@property (readonly, nonatomic) MBXRasterImageQuality imageQuality;
+
+
+#pragma mark -
+
+/** @name Making Tile URLs */
+
+/** Returns the URL of a tile.
+*   @param path The path of the tile. Its `contentScaleFactor` decides whether `{r}` is `@2x`.
+*   @return The tile's URL, or `nil` if the result isn't a valid URL. */
+- (NSURL *)URLForTilePath:(MKTileOverlayPath)path;
+
+@end
@@ -0,0 +1,376 @@
+//
+//  MBXTileURLTemplate.m
+//  MBXMapKit
+//
+//  Copyright (c) 2014 Mapbox. All rights reserved.
+//
+
+#import "MBXMapKit.h"
+
+
+#pragma mark - Private API for cooperating with MBXRasterTileOverlay
+
+@interface MBXRasterTileOverlay ()
+
++ (NSString *)qualityExtensionForImageQuality:(MBXRasterImageQuality)imageQuality;
+
+@end
+
+
+#pragma mark - Compiled templates
+
+// A compiled template is a list of segments. Literal text, the quality extension, and the hosts are all copied into one
+// buffer of UTF-8 bytes when the template is compiled, so making a URL only copies bytes out of it and writes numbers.
+//
+typedef enum {
+    MBXTileURLTemplateSegmentLiteral,
+    MBXTileURLTemplateSegmentZ,
+    MBXTileURLTemplateSegmentX,
+    MBXTileURLTemplateSegmentY,
+    MBXTileURLTemplateSegmentFlippedY,
+    MBXTileURLTemplateSegmentQuadkey,
+    MBXTileURLTemplateSegmentHost,
+    MBXTileURLTemplateSegmentRetina,
+    MBXTileURLTemplateSegmentAccessToken
+} MBXTileURLTemplateSegmentKind;
+
+typedef struct {
+    MBXTileURLTemplateSegmentKind kind;
+    size_t offset;
+    size_t length;
+} MBXTileURLTemplateSegment;
+
+// URLs which fit are written into a buffer on the stack, which covers any reasonable tile URL
+//
+#define MBXTileURLTemplateStackBufferSize 1024
+
+// The most characters that a decimal number of a tile coordinate can take
+//
+#define MBXTileURLTemplateMaximumNumberLength 20
+
+
+static size_t MBXTileURLTemplateWriteNumber(char *out, uint64_t value)
+{
+    char digits[MBXTileURLTemplateMaximumNumberLength];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    while (value > 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+
+static size_t MBXTileURLTemplateWriteQuadkey(char *out, uint64_t x, uint64_t y, uint64_t z)
+{
+    // Each digit picks one of the four children of the tile above, from the top of the tile pyramid down
+    //
+    for (uint64_t level = z; level > 0; level--)
+    {
+        uint64_t mask = (uint64_t)1 << (level - 1);
+        out[z - level] = (char)('0' + ((x & mask) ? 1 : 0) + ((y & mask) ? 2 : 0));
+    }
+    return (size_t)z;
+}
+
+
+static size_t MBXTileURLTemplateHostIndex(uint64_t x, uint64_t y, uint64_t z, size_t hostCount)
+{
+    // This needs to be stable across launches, so that a tile always goes to the same host and can be found in HTTP
+    // caches, and well mixed, so that the tiles in view are spread evenly across the hosts
+    //
+    uint64_t hash = (x * 73856093ULL) ^ (y * 19349663ULL) ^ (z * 83492791ULL);
+    hash ^= hash >> 17;
+    hash *= 0xed5ad4bbULL;
+    hash ^= hash >> 11;
+    return (size_t)(hash % hostCount);
+}
+
+
+#pragma mark -
+
+@implementation MBXTileURLTemplate
+{
+    NSMutableData *_bytes;
+    MBXTileURLTemplateSegment *_segments;
+    size_t _segmentCount;
+    MBXTileURLTemplateSegment *_hostSegments;
+    size_t _hostCount;
+    size_t _hostPlaceholderCount;
+    size_t _maximumFixedLength;
+    size_t _quadkeyCount;
+    size_t _accessTokenCount;
+}
+
+
+#pragma mark - Creating templates
+
++ (instancetype)templateWithString:(NSString *)templateString hosts:(NSArray *)hosts imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    return [[self alloc] initWithString:templateString hosts:hosts imageQuality:imageQuality];
+}
+
+
+- (instancetype)initWithString:(NSString *)templateString hosts:(NSArray *)hosts imageQuality:(MBXRasterImageQuality)imageQuality
+{
+    self = [super init];
+
+    if (self)
+    {
+        _templateString = [templateString copy];
+        _hosts = [hosts copy] ?: @[];
+        _imageQuality = imageQuality;
+        _bytes = [[NSMutableData alloc] init];
+
+        [self compileHosts];
+        [self compileTemplate];
+
+        // There's no sensible host to write for {s} without any hosts, and an empty one would make URLs like
+        // https://.tile.example.com/ which quietly fail for every tile
+        //
+        if (_hostPlaceholderCount > 0 && _hostCount == 0)
+        {
+            NSLog(@"Tile URL template %@ uses {s} but has no hosts", _templateString);
+            return nil;
+        }
+    }
+
+    return self;
+}
+
+
+- (void)dealloc
+{
+    free(_segments);
+    free(_hostSegments);
+}
+
+
+- (size_t)appendBytes:(const void *)bytes length:(size_t)length
+{
+    size_t offset = [_bytes length];
+    [_bytes appendBytes:bytes length:length];
+    return offset;
+}
+
+
+- (size_t)appendString:(NSString *)string
+{
+    const char *utf8 = [string UTF8String];
+    return [self appendBytes:utf8 length:strlen(utf8)];
+}
+
+
+- (void)compileHosts
+{
+    _hostCount = [_hosts count];
+    _hostSegments = calloc(MAX(_hostCount, (size_t)1), sizeof(MBXTileURLTemplateSegment));
+
+    for (size_t i = 0; i < _hostCount; i++)
+    {
+        NSString *host = [_hosts[i] description];
+        _hostSegments[i].kind = MBXTileURLTemplateSegmentLiteral;
+        _hostSegments[i].length = strlen([host UTF8String]);
+        _hostSegments[i].offset = [self appendString:host];
+    }
+}
+
+
+- (void)compileTemplate
+{
+    // Split the template into literal text and placeholders. Next to each other, {q} and literal text are merged into a
+    // single literal, since the quality extension never changes.
+    //
+    static const struct { const char *name; MBXTileURLTemplateSegmentKind kind; } placeholders[] = {
+        { "z", MBXTileURLTemplateSegmentZ },
+        { "x", MBXTileURLTemplateSegmentX },
+        { "y", MBXTileURLTemplateSegmentY },
+        { "-y", MBXTileURLTemplateSegmentFlippedY },
+        { "quadkey", MBXTileURLTemplateSegmentQuadkey },
+        { "s", MBXTileURLTemplateSegmentHost },
+        { "r", MBXTileURLTemplateSegmentRetina },
+        { "access_token", MBXTileURLTemplateSegmentAccessToken },
+    };
+    const char *quality = [[MBXRasterTileOverlay qualityExtensionForImageQuality:_imageQuality] UTF8String];
+
+    const char *template = [_templateString UTF8String] ?: "";
+    size_t templateLength = strlen(template);
+    size_t capacity = 8;
+    _segments = malloc(capacity * sizeof(MBXTileURLTemplateSegment));
+    _segmentCount = 0;
+
+    size_t maximumHostLength = 0;
+    for (size_t i = 0; i < _hostCount; i++)
+    {
+        maximumHostLength = MAX(maximumHostLength, _hostSegments[i].length);
+    }
+
+    size_t i = 0;
+    while (i < templateLength)
+    {
+        MBXTileURLTemplateSegment segment = { MBXTileURLTemplateSegmentLiteral, 0, 0 };
+        const char *close = (template[i] == '{' ? strchr(template + i, '}') : NULL);
+        size_t nameLength = (close ? (size_t)(close - (template + i + 1)) : 0);
+        BOOL matched = NO;
+
+        if (close)
+        {
+            if (nameLength == 1 && template[i + 1] == 'q')
+            {
+                segment.offset = [self appendBytes:quality length:strlen(quality)];
+                segment.length = strlen(quality);
+                matched = YES;
+            }
+            for (size_t p = 0; !matched && p < sizeof(placeholders) / sizeof(placeholders[0]); p++)
+            {
+                if (strlen(placeholders[p].name) == nameLength && strncmp(placeholders[p].name, template + i + 1, nameLength) == 0)
+                {
+                    segment.kind = placeholders[p].kind;
+                    matched = YES;
+                }
+            }
+        }
+
+        if (matched)
+        {
+            i += nameLength + 2;
+        }
+        else
+        {
+            // Copy literal text up to the next opening brace, including this one if it didn't start a placeholder
+            //
+            const char *open = strchr(template + i + 1, '{');
+            size_t length = (open ? (size_t)(open - (template + i)) : templateLength - i);
+            segment.offset = [self appendBytes:template + i length:length];
+            segment.length = length;
+            i += length;
+        }
+
+        switch (segment.kind)
+        {
+            case MBXTileURLTemplateSegmentLiteral:
+                _maximumFixedLength += segment.length;
+                break;
+            case MBXTileURLTemplateSegmentHost:
+                _maximumFixedLength += maximumHostLength;
+                _hostPlaceholderCount += 1;
+                break;
+            case MBXTileURLTemplateSegmentRetina:
+                _maximumFixedLength += 3;
+                break;
+            case MBXTileURLTemplateSegmentQuadkey:
+                _quadkeyCount += 1;
+                break;
+            case MBXTileURLTemplateSegmentAccessToken:
+                _accessTokenCount += 1;
+                break;
+            default:
+                _maximumFixedLength += MBXTileURLTemplateMaximumNumberLength;
+                break;
+        }
+
+        // Literals which follow each other were copied next to each other, so they can be joined
+        //
+        MBXTileURLTemplateSegment *last = (_segmentCount > 0 ? &_segments[_segmentCount - 1] : NULL);
+        if (last && last->kind == MBXTileURLTemplateSegmentLiteral && segment.kind == MBXTileURLTemplateSegmentLiteral && last->offset + last->length == segment.offset)
+        {
+            last->length += segment.length;
+            continue;
+        }
+
+        if (_segmentCount == capacity)
+        {
+            capacity *= 2;
+            _segments = realloc(_segments, capacity * sizeof(MBXTileURLTemplateSegment));
+        }
+        _segments[_segmentCount++] = segment;
+    }
+}
+
+
+#pragma mark - Making tile URLs
+
+- (NSURL *)URLForTilePath:(MKTileOverlayPath)path
+{
+    uint64_t x = (uint64_t)MAX(path.x, 0);
+    uint64_t y = (uint64_t)MAX(path.y, 0);
+    uint64_t z = (uint64_t)MIN(MAX(path.z, 0), 62);
+
+    const char *accessToken = "";
+    if (_accessTokenCount > 0) accessToken = [[MBXMapKit accessToken] UTF8String] ?: "";
+    size_t accessTokenLength = strlen(accessToken);
+
+    // Write into the stack buffer unless the URL might not fit
+    //
+    size_t maximumLength = _maximumFixedLength + _quadkeyCount * (size_t)z + _accessTokenCount * accessTokenLength;
+    char stackBuffer[MBXTileURLTemplateStackBufferSize];
+    char *buffer = (maximumLength <= sizeof(stackBuffer) ? stackBuffer : malloc(maximumLength));
+    const char *bytes = [_bytes bytes];
+    size_t length = 0;
+
+    for (size_t s = 0; s < _segmentCount; s++)
+    {
+        const MBXTileURLTemplateSegment *segment = &_segments[s];
+        switch (segment->kind)
+        {
+            case MBXTileURLTemplateSegmentLiteral:
+                memcpy(buffer + length, bytes + segment->offset, segment->length);
+                length += segment->length;
+                break;
+            case MBXTileURLTemplateSegmentZ:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, z);
+                break;
+            case MBXTileURLTemplateSegmentX:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, x);
+                break;
+            case MBXTileURLTemplateSegmentY:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, y);
+                break;
+            case MBXTileURLTemplateSegmentFlippedY:
+                length += MBXTileURLTemplateWriteNumber(buffer + length, (((uint64_t)1 << z) - 1) - MIN(y, ((uint64_t)1 << z) - 1));
+                break;
+            case MBXTileURLTemplateSegmentQuadkey:
+                length += MBXTileURLTemplateWriteQuadkey(buffer + length, x, y, z);
+                break;
+            case MBXTileURLTemplateSegmentHost:
+                if (_hostCount > 0)
+                {
+                    const MBXTileURLTemplateSegment *host = &_hostSegments[MBXTileURLTemplateHostIndex(x, y, z, _hostCount)];
+                    memcpy(buffer + length, bytes + host->offset, host->length);
+                    length += host->length;
+                }
+                break;
+            case MBXTileURLTemplateSegmentRetina:
+                if (path.contentScaleFactor > 1.0)
+                {
+                    memcpy(buffer + length, "@2x", 3);
+                    length += 3;
+                }
+                break;
+            case MBXTileURLTemplateSegmentAccessToken:
+                memcpy(buffer + length, accessToken, accessTokenLength);
+                length += accessTokenLength;
+                break;
+        }
+    }
+
+    CFURLRef url = CFURLCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)buffer, (CFIndex)length, kCFStringEncodingUTF8, NULL);
+    if (buffer != stackBuffer) free(buffer);
+
+    return (__bridge_transfer NSURL *)url;
+}
+
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; template = %@; hosts = %@>", [self class], self, _templateString, _hosts];
+}
+
+@end